@@ -2,6 +2,9 @@ uniform float normal_scale = 1.0;
 uniform float water_depth = 0.0;
 uniform vec4 color_scale = vec4(1.0);
 uniform vec3 world_space_offset = vec3(0.0);
+uniform vec3 instance_rot_scale = vec3(1.0, 0.0, 1.0); // {cos(angle), sin(angle), scale} of the shared tree data instance
+
+vec3 rotate_instance(in vec3 v) {return vec3((instance_rot_scale.x*v.x - instance_rot_scale.y*v.y), (instance_rot_scale.y*v.x + instance_rot_scale.x*v.y), v.z);}
 
 void calc_leaf_lighting() {
 	// transform the normal into eye space, but don't normalize because it may be scaled for shadows
@@ -11,8 +14,8 @@ void calc_leaf_lighting() {
 	float nscale = ((dot(normal, epos.xyz) > 0.0) ? -1.0 : 1.0); // facing away from the eye, so reverse (could use faceforward())
 	normal *= nscale;
 
-	vec3 vpos      = fg_Vertex.xyz + world_space_offset;
-	vec3 ws_normal = nscale*normalize(fg_Normal);
+	vec3 vpos      = instance_rot_scale.z*rotate_instance(fg_Vertex.xyz) + world_space_offset;
+	vec3 ws_normal = nscale*normalize(rotate_instance(fg_Normal));
 	vec3 color     = get_tree_leaf_lighting(epos, normal, vpos, ws_normal);
 	fg_Color_vf    = vec4(min(2.0*fg_Color.rgb, clamp(color*color_scale.rgb, 0.0, 1.0)), 1.0); // limit lightning color
 
@@ -1,4 +1,5 @@
 uniform vec3 world_space_offset = vec3(0.0);
+uniform vec3 instance_rot_scale = vec3(1.0, 0.0, 1.0); // {cos(angle), sin(angle), scale} of the shared tree data instance
 
 out vec4 epos;
 out vec3 normal; // eye space
@@ -6,11 +7,13 @@ out vec2 tc;
 out vec3 ws_pos;
 out vec3 ws_normal;
 
+vec3 rotate_instance(in vec3 v) {return vec3((instance_rot_scale.x*v.x - instance_rot_scale.y*v.y), (instance_rot_scale.y*v.x + instance_rot_scale.x*v.y), v.z);}
+
 void main() {
 	tc          = fg_TexCoord;
-	ws_pos      = fg_Vertex.xyz + world_space_offset;
+	ws_pos      = instance_rot_scale.z*rotate_instance(fg_Vertex.xyz) + world_space_offset;
 	epos        = fg_ModelViewMatrix * fg_Vertex;
-	ws_normal   = normalize(fg_Normal);
+	ws_normal   = normalize(rotate_instance(fg_Normal));
 	normal      = normalize(fg_NormalMatrix * fg_Normal);
 	epos        = fg_ModelViewMatrix * fg_Vertex;
 	gl_Position = fg_ProjectionMatrix * epos;
@@ -1,12 +1,15 @@
 uniform float normal_scale = 1.0;
 uniform float water_depth = 0.0;
 uniform vec3 world_space_offset = vec3(0.0);
+uniform vec3 instance_rot_scale = vec3(1.0, 0.0, 1.0); // {cos(angle), sin(angle), scale} of the shared tree data instance
 
 out vec4 epos;
 out vec3 normal; // eye space
 out vec3 ws_pos;
 out vec3 ws_normal;
 
+vec3 rotate_instance(in vec3 v) {return vec3((instance_rot_scale.x*v.x - instance_rot_scale.y*v.y), (instance_rot_scale.y*v.x + instance_rot_scale.x*v.y), v.z);}
+
 void main() {
 	set_tc0_blend_from_tc_vert_id();
 	vec4 vpos   = fg_Vertex;
@@ -14,10 +17,10 @@ void main() {
 	gl_Position = fg_ProjectionMatrix * (fg_ModelViewMatrix * vpos); // Note: faster than using fg_ModelViewProjectionMatrix (avoids CPU mult+upload)
 	fg_Color_vf = fg_Color;
 
-	ws_pos    = fg_Vertex.xyz + world_space_offset;
+	ws_pos    = instance_rot_scale.z*rotate_instance(fg_Vertex.xyz) + world_space_offset;
 	epos      = fg_ModelViewMatrix * fg_Vertex;
-	ws_normal = normalize(fg_Normal);
-	normal    = normalize(fg_NormalMatrix * ws_normal * normal_scale); // eye space
+	ws_normal = normalize(rotate_instance(fg_Normal));
+	normal    = normalize(fg_NormalMatrix * fg_Normal * normal_scale); // eye space
 
 	if (underwater) {
 		vec3 eye        = fg_ModelViewMatrixInverse[3].xyz;
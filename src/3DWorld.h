@@ -1612,6 +1612,7 @@ colorRGBA const BACKGROUND_NIGHT(BLACK);
 
 void register_timing_value(const char *str, int delta_time);
 void toggle_timing_profiler();
+bool timing_profiler_enabled();
 void timing_profiler_stats();
 
 // macros
@@ -701,8 +701,96 @@ float dwobject::get_true_mass() const {
 }
 
 
+// applies gravity, wind, and friction to an airborne object and moves it by timestep; doesn't do any collision detection
+void dwobject::integrate_airborne(int iter, float timestep, float air_factor, bool coll_last_frame) {
+
+	obj_type const &otype(object_types[type]);
+	float const friction(otype.friction_factor);
+	bool const collided(coll_last_frame || fabs(velocity.z) < 1.0E-6);
+	vector3d v_flow(enable_fsource ? get_flow_velocity(pos) : velocity), vtot(v_flow);
+	vector3d const local_wind(get_local_wind(pos));
+	
+	if (iter == 0) {
+		if (collided) {vtot.z += local_wind.z;} else {vtot += local_wind;}
+	}
+	if (!(flags & Z_STOPPED)) {
+		double gscale((type == PLASMA && init_dir.x != 0.0) ? 1.0/sqrt(init_dir.x) : 1.0);
+		float const density(get_true_density());
+		if ((flags & IN_WATER) && density > WATER_DENSITY) {gscale *= (density - WATER_DENSITY)/density;}
+
+		if (enable_fsource) {
+			double const grav_well(min(1.0f, 0.1f*v_flow.mag()));
+
+			if (-velocity.z < otype.terminal_vel) {
+				velocity.z -= (1.0 - grav_well)*base_gravity*gscale*GRAVITY*timestep*otype.gravity;
+				velocity.z  = grav_well*velocity.z - (1.0 - grav_well)*min(-velocity.z, otype.terminal_vel);
+			}
+			if (fabs(air_factor*vtot.z) > fabs(velocity.z) || ((vtot.z < 0) != (velocity.z < 0))) {
+				velocity.z = (1.0 - grav_well*air_factor)*velocity.z + air_factor*vtot.z; // wind?
+			}
+		}
+		else {
+			if (-velocity.z < otype.terminal_vel) {
+				velocity.z -= base_gravity*gscale*GRAVITY*timestep*otype.gravity;
+				velocity.z  = -min(-velocity.z, otype.terminal_vel);
+			}
+			if (fabs(air_factor*local_wind.z) > fabs(velocity.z) || ((local_wind.z < 0) != (velocity.z < 0))) {
+				velocity.z += air_factor*local_wind.z;
+			}
+		}
+	}
+	if (!(flags & XY_STOPPED)) {
+		for (unsigned d = 0; d < 2; ++d) {
+			if (fabs(air_factor*vtot[d]) > fabs(velocity[d]) || ((vtot[d] < 0) != (velocity[d] < 0))) {
+				velocity[d] = (1.0 - air_factor)*velocity[d] + air_factor*vtot[d];
+			}
+			if (collided && iter == 0 && !(flags | IN_WATER)) { // apply static friction
+				bool const stopped(friction >= 2.0*STICK_THRESHOLD || fabs(velocity[d]) <= friction);
+				velocity[d] = (stopped ? 0.0 : max(0.0f, (velocity[d] + ((velocity[d] > 0.0) ? -friction : friction))));
+			}
+			pos[d] += timestep*velocity[d]; // move object
+		}
+		if (flags & FLOATING) {float_downstream(pos, get_true_radius());}
+	}
+	assert(!is_nan(timestep));
+	pos.z += timestep*velocity.z;
+	verify_data();
+}
+
+
+// advances an airborne object that can't hit the mesh, water, or any cobj this step; returns false if advance_object() must be used instead;
+// has the same result as advance_object() in that case, but only modifies this object and reads shared state, so it can be run in parallel on copies
+bool dwobject::advance_free_flight(int iter, float timestep) {
+
+	if (world_mode != WMODE_GROUND || temperature <= ABSOLUTE_ZERO || enable_fsource) return 0;
+	if (status != 1 || type == SMILEY || type == ROCKET) return 0; // only simple airborne objects; rapid fire rockets use rand()
+	if (flags & (Z_STOPPED | FLOATING | IN_WATER | IS_ON_ICE)) return 0;
+	obj_type const &otype(object_types[type]);
+	if (pos.z < zmin || time > otype.lifetime || (type == PARTICLE && is_underwater(pos))) return 0; // will be destroyed
+	bool const coll_last_frame((flags & OBJ_COLLIDED) != 0);
+	dwobject next(*this);
+	next.flags &= ~OBJ_COLLIDED;
+	if (iter == 0) {next.time += iticks;}
+	next.integrate_airborne(iter, timestep, ((flags & UNDERWATER) ? 0.0 : otype.air_factor), coll_last_frame);
+	float const radius(get_true_radius()), wr(otype.radius); // check_water_collision() uses the unscaled radius
+	point zpos(next.pos);
+	float dz(0.0);
+	if (get_obj_zval(zpos, dz, ((otype.flags & COLL_DESTROYS) ? 0.25*radius : radius)) != 1) return 0; // out of bounds or hits the mesh
+
+	if ((next.pos.z - wr) <= max_water_height) { // may hit the water
+		int const xpos(get_xpos(next.pos.x)), ypos(get_ypos(next.pos.y));
+		if (!point_outside_mesh(xpos, ypos) && has_water(xpos, ypos) && (next.pos.z - wr) <= water_matrix[ypos][xpos]) return 0;
+	}
+	if (vert_coll_detector(next, -1, 0, iter, NULL, timestep).has_coll_candidates()) return 0; // may hit a cobj
+	next.status = 1; // still airborne
+	*this = next;
+	return 1;
+}
+
+
 // 0 = out of range/expired, 1 = airborne, 2 = collision, 3 = moving on ground, 4 = motionless
-void dwobject::advance_object(bool disable_motionless_objects, int iter, int obj_index) { // returns collision status
+// timestep is the per-substep tstep for multistep objects; the global TIMESTEP and tstep are not modified here
+void dwobject::advance_object(bool disable_motionless_objects, int iter, int obj_index, float timestep) {
 
 	assert(!disabled());
 	if (temperature <= ABSOLUTE_ZERO) return;
@@ -726,11 +814,11 @@ void dwobject::advance_object(bool disable_motionless_objects, int iter, int obj
 		status  = 1;
 	}
 	if (disable_motionless_objects && status == 4 && ground_mode) {
-		if ((flags & IS_ON_ICE) || (!(flags & (FLOATING | STATIC_COBJ_COLL)) && object_still_stopped(obj_index))) {
+		if ((flags & IS_ON_ICE) || (!(flags & (FLOATING | STATIC_COBJ_COLL)) && object_still_stopped(obj_index, timestep))) {
 			point const old_pos(pos);
-			check_vert_collision(obj_index, 1, iter); // needed for gameplay (already tested in object_still_stopped()?)
+			check_vert_collision(obj_index, 1, iter, timestep); // needed for gameplay (already tested in object_still_stopped()?)
 			pos = old_pos;
-			if (disabled() || check_water_collision(velocity.z)) return;
+			if (disabled() || check_water_collision(velocity.z, timestep)) return;
 			if (pos.z < zmin || !is_over_mesh(pos)) status = 0;
 			flags &= ~Z_STOPPED;
 			return;
@@ -772,56 +860,8 @@ void dwobject::advance_object(bool disable_motionless_objects, int iter, int obj
 			}
 		}
 		point const old_pos(pos);
-		bool const collided(coll_last_frame || fabs(velocity.z) < 1.0E-6);
-		vector3d v_flow(enable_fsource ? get_flow_velocity(pos) : velocity), vtot(v_flow);
 		float const vz_old(velocity.z);
-		vector3d const local_wind(get_local_wind(pos));
-		
-		if (iter == 0) {
-			if (collided) {vtot.z += local_wind.z;} else {vtot += local_wind;}
-		}
-		if (!(flags & Z_STOPPED)) {
-			double gscale((type == PLASMA && init_dir.x != 0.0) ? 1.0/sqrt(init_dir.x) : 1.0);
-			float const density(get_true_density());
-			if ((flags & IN_WATER) && density > WATER_DENSITY) {gscale *= (density - WATER_DENSITY)/density;}
-
-			if (enable_fsource) {
-				double const grav_well(min(1.0f, 0.1f*v_flow.mag()));
-
-				if (-velocity.z < otype.terminal_vel) {
-					velocity.z -= (1.0 - grav_well)*base_gravity*gscale*GRAVITY*tstep*otype.gravity;
-					velocity.z  = grav_well*velocity.z - (1.0 - grav_well)*min(-velocity.z, otype.terminal_vel);
-				}
-				if (fabs(air_factor*vtot.z) > fabs(velocity.z) || ((vtot.z < 0) != (velocity.z < 0))) {
-					velocity.z = (1.0 - grav_well*air_factor)*velocity.z + air_factor*vtot.z; // wind?
-				}
-			}
-			else {
-				if (-velocity.z < otype.terminal_vel) {
-					velocity.z -= base_gravity*gscale*GRAVITY*tstep*otype.gravity;
-					velocity.z  = -min(-velocity.z, otype.terminal_vel);
-				}
-				if (fabs(air_factor*local_wind.z) > fabs(velocity.z) || ((local_wind.z < 0) != (velocity.z < 0))) {
-					velocity.z += air_factor*local_wind.z;
-				}
-			}
-		}
-		if (!(flags & XY_STOPPED)) {
-			for (unsigned d = 0; d < 2; ++d) {
-				if (fabs(air_factor*vtot[d]) > fabs(velocity[d]) || ((vtot[d] < 0) != (velocity[d] < 0))) {
-					velocity[d] = (1.0 - air_factor)*velocity[d] + air_factor*vtot[d];
-				}
-				if (collided && iter == 0 && !(flags | IN_WATER)) { // apply static friction
-					bool const stopped(friction >= 2.0*STICK_THRESHOLD || fabs(velocity[d]) <= friction);
-					velocity[d] = (stopped ? 0.0 : max(0.0f, (velocity[d] + ((velocity[d] > 0.0) ? -friction : friction))));
-				}
-				pos[d] += tstep*velocity[d]; // move object
-			}
-			if (flags & FLOATING) {float_downstream(pos, radius);}
-		}
-		assert(!is_nan(tstep));
-		pos.z += tstep*velocity.z;
-		verify_data();
+		integrate_airborne(iter, timestep, air_factor, coll_last_frame);
 
 		// check collisions
 		float dz;
@@ -835,10 +875,10 @@ void dwobject::advance_object(bool disable_motionless_objects, int iter, int obj
 			if ((ground_mode && pos.z < zmin) || (flags & Z_STOPPED)) {status = 0;} // out of simulation region and underwater
 			return;
 		}
-		int const wcoll(check_water_collision(vz_old));
+		int const wcoll(check_water_collision(vz_old, timestep));
 		vector3d cnorm;
 		bool const last_stat_coll((flags & STATIC_COBJ_COLL) != 0);
-		int coll(check_vert_collision(obj_index, 1, iter, &cnorm));
+		int coll(check_vert_collision(obj_index, 1, iter, timestep, &cnorm));
 		if (disabled()) return;
 
 		if (!ground_mode) { // tiled terrain
@@ -892,16 +932,16 @@ void dwobject::advance_object(bool disable_motionless_objects, int iter, int obj
 		}
 		if (otype.flags & COLL_DESTROYS) {assert(type != SMILEY); status = 0; return;}
 		if (flags & STATIC_COBJ_COLL) return; // stuck on vertical collision surface
-		if (check_water_collision(velocity.z) && (frozen || get_true_density() < WATER_DENSITY)) return;
+		if (check_water_collision(velocity.z, timestep) && (frozen || get_true_density() < WATER_DENSITY)) return;
 		if (flags & IS_CUBE_FLAG) return;
 		if (is_flat() || (otype.flags & OBJ_IS_CYLIN)) {set_orient_for_coll(NULL);}
 		point const old_pos(pos);
-		int const val(surface_advance()); // move along ground
+		int const val(surface_advance(timestep)); // move along ground
 
 		if (val == 2) { // moved, recalculate velocity from position change
 			status = 3;
-			if (radius >= LARGE_OBJ_RAD) {check_vert_collision(obj_index, 1, iter);} // adds instability though
-			assert(tstep > 0.0);
+			if (radius >= LARGE_OBJ_RAD) {check_vert_collision(obj_index, 1, iter, timestep);} // adds instability though
+			assert(timestep > 0.0);
 			if (radius >= LARGE_OBJ_RAD && velocity != zero_vector) {modify_grass_at(pos, radius, 1);} // crush grass
 		}
 		else if (val == 1) { // stopped
@@ -914,7 +954,7 @@ void dwobject::advance_object(bool disable_motionless_objects, int iter, int obj
 				}
 			}
 			if (status != 4) {
-				check_vert_collision(obj_index, 0, iter); // one last time before the object is "stopped"???
+				check_vert_collision(obj_index, 0, iter, timestep); // one last time before the object is "stopped"???
 				velocity = zero_vector;
 				if (!disabled()) {status = 4;}
 			}
@@ -944,7 +984,7 @@ int get_obj_zval(point &pt, float &dz, float z_offset) { // 0 = out of bounds/er
 }
 
 
-int dwobject::object_still_stopped(int obj_index) {
+int dwobject::object_still_stopped(int obj_index, float timestep) {
 
 	float const zval(pos.z - get_true_radius());
 	float const mh(interpolate_mesh_zval(pos.x, pos.y, 0.0, 0, 0));
@@ -956,7 +996,7 @@ int dwobject::object_still_stopped(int obj_index) {
 	}
 	point const old_pos(pos);
 	pos.z = zval;
-	int const coll(check_vert_collision(obj_index, 0, 0)); // apply coll functions?
+	int const coll(check_vert_collision(obj_index, 0, 0, timestep)); // apply coll functions?
 	pos   = old_pos;
 	if (!disabled() && !coll) status = 1;
 	return coll;
@@ -964,7 +1004,7 @@ int dwobject::object_still_stopped(int obj_index) {
 
 
 // 0 = error (bad position), 1 = stopped, 2 = moved
-int dwobject::surface_advance() {
+int dwobject::surface_advance(float timestep) {
 
 	obj_type const &otype(object_types[type]);
 	
@@ -1017,8 +1057,8 @@ int dwobject::surface_advance() {
 	}
 	float const vmult((otype.flags & OBJ_IS_DROP) ? 0.0 : pow(max((1.0f - friction), 0.0f), fticks)); // droplets stick - no momentum
 	velocity = (mesh_vel*(1.0 - vmult) + velocity*vmult);
-	pos.x   += velocity.x*tstep;
-	pos.y   += velocity.y*tstep;
+	pos.x   += velocity.x*timestep;
+	pos.y   += velocity.y*timestep;
 	pos.z    = mh + radius;
 	return val+1;
 }
@@ -1066,7 +1106,7 @@ void dwobject::set_orient_for_coll(vector3d const *const forced_norm) {
 }
 
 
-int dwobject::check_water_collision(float vz_old) {
+int dwobject::check_water_collision(float vz_old, float timestep) {
 
 	if (world_mode != WMODE_GROUND) return 0;
 	obj_type const &otype(object_types[type]);
@@ -1106,7 +1146,7 @@ int dwobject::check_water_collision(float vz_old) {
 
 					if ((zpos - pos.z) > 2.0*radius) { // under the surface
 						velocity.z  = vz_old;
-						velocity.z -= ((density - WATER_DENSITY)/density)*base_gravity*GRAVITY*tstep;
+						velocity.z -= ((density - WATER_DENSITY)/density)*base_gravity*GRAVITY*timestep;
 						flags      |= Z_STOPPED;
 						if ((pos.z - radius) > water_height) splash = 1;
 					}
@@ -1416,7 +1456,7 @@ void particle_cloud::apply_physics(unsigned i) {
 		obj.pos += (vel + init_vel)*(tstep/(double)num_smoke_advance);
 		vector3d cnorm;
 		
-		if (obj.check_vert_collision(0, 0, j, &cnorm, all_zeros, 1, 1)) { // skip dynamic, only_drawn
+		if (obj.check_vert_collision(0, 0, j, tstep, &cnorm, all_zeros, 1, 1)) { // skip dynamic, only_drawn
 			// destroy the smoke if it's not damaging and hits the bottom of a static drawn object (excludes trees and scenery)
 			if (cnorm.z < 0.0 && damage == 0.0) { // <= 0.0?
 				if (acc_smoke && time > 0) add_smoke(pos, 1.0);
@@ -1496,7 +1536,7 @@ void fire::apply_physics(unsigned i) {
 				dwobject obj(FIRE, pos, zero_vector, 1, 10000.0); // make a FIRE object for collision detection
 				obj.source = source;
 
-				if (!obj.check_vert_collision(source, 1, 0)) { // Note: source is passed in as obj_index, and represents the player/smiley responisble for the fire
+				if (!obj.check_vert_collision(source, 1, 0, tstep)) { // Note: source is passed in as obj_index, and represents the player/smiley responisble for the fire
 					pos.z -= radius;
 					status = 1; // re-animate
 				}
@@ -12,6 +12,8 @@
 #include "sinf.h"
 #include "cobj_bsp_tree.h"
 #include "draw_utils.h"
+#include "binary_file_io.h"
+#include <omp.h>
 
 float const BURN_RADIUS      = 0.2;
 float const BURN_DAMAGE      = 80.0;
@@ -31,8 +33,11 @@ int const DISABLE_LEAVES     = 0;
 int const ENABLE_CLIP_LEAVES = 1;
 int const TLEAF_START_TUID   = 8; // trees use texture units 8-12
 bool const FORCE_TREE_TYPE   = 1;
+float const ARCHETYPE_SCALE_VAR = 0.12; // max relative scale variation of instanced shared trees
+unsigned const TREE_ARCHETYPE_MAGIC = 0x54524131; // "TRA1"; change when the archetype cache file format changes
 unsigned const CYLINS_PER_ROOT     = 3;
 unsigned const TREE_BILLBOARD_SIZE = 256;
+bool const VERIFY_TREE_GEN_DETERMINISM = 0; // debugging: regenerate each batch of trees serially and compare against the multithreaded result
 
 
 // bark_tex, leaf_tex, branch_size, branch_radius, leaf_size, leaf_x_ar, height_scale, branch_break_off, branch_tscale, branch_color_var, bush_prob, barkc, leafc
@@ -44,9 +49,6 @@ tree_type tree_types[NUM_TREE_TYPES] = { // not const - config file can override
 	tree_type(BARK6_TEX, PAPAYA_TEX,   1.0, 1.0, 1.0, 1.00, 2.0, 2.0, 0.5, 0.1,  0.0, colorRGBA(0.7, 0.6,  0.5,  1.0), WHITE)
 };
 
-vector<tree_cylin >   tree_builder_t::cylin_cache;
-vector<tree_branch>   tree_builder_t::branch_cache;
-vector<tree_branch *> tree_builder_t::branch_ptr_cache;
 
 
 // tree_mode: 0 = no trees, 1 = large only, 2 = small only, 3 = both large and small
@@ -68,6 +70,7 @@ extern int xoff2, yoff2, rand_gen_index, game_mode, leaf_color_changed, scrollin
 extern unsigned smoke_tid;
 extern float zmin, zmax_est, zbottom, water_plane_z, tree_scale, temperature, fticks, vegetation, tree_density_thresh;
 extern double sim_ticks;
+extern string tile_cache_dir;
 extern vector3d wind;
 extern lightning l_strike;
 extern coll_obj_group coll_objects;
@@ -201,7 +204,7 @@ void tree_lod_render_t::render_billboards(shader_t &s, bool render_branches) con
 			draw_and_clear_verts(pts, GL_POINTS);
 			(render_branches ? i->td->get_render_branch_texture() : i->td->get_render_leaf_texture()).bind_texture();
 		}
-		pts.emplace_back(i->pos, (render_branches ? i->td->br_x : i->td->lr_x), (render_branches ? i->td->br_z : i->td->lr_z), i->cw.c);
+		pts.emplace_back(i->pos, i->scale*(render_branches ? i->td->br_x : i->td->lr_x), i->scale*(render_branches ? i->td->br_z : i->td->lr_z), i->cw.c);
 	} // for i
 	assert(!pts.empty());
 	draw_and_clear_verts(pts, GL_POINTS);
@@ -217,7 +220,7 @@ float get_tree_z_bottom(float z, point const &pos) {
 bool tree::is_over_mesh() const {
 
 	//if (world_mode != WMODE_GROUND) return 1; // ???
-	float const r(tdata().sphere_radius);
+	float const r(get_radius());
 	int const x1(get_xpos(tree_center.x - r)), y1(get_ypos(tree_center.y - r));
 	int const x2(get_xpos(tree_center.x + r)), y2(get_ypos(tree_center.y + r));
 	return (x1 < MESH_X_SIZE && y1 < MESH_Y_SIZE && x2 >= 0 && y2 >= 0); // completely off the mesh
@@ -278,6 +281,46 @@ void tree::remove_collision_objects() {
 }
 
 
+unsigned tree::get_gen_hash() const { // hash of generated tree data and cobj geometry, but not cobj indices; used to check for deterministic generation
+
+	vector<float> vals;
+	for (unsigned d = 0; d < 3; ++d) {vals.push_back(tree_center[d]);}
+	for (unsigned d = 0; d < 4; ++d) {vals.push_back(tree_color[d]);}
+	vals.push_back(type);
+	vals.push_back(inst_angle);
+	vals.push_back(inst_scale);
+	vector<draw_cylin> const &cylins(tdata().get_all_cylins());
+	vector<tree_leaf>  const &leaves(tdata().get_leaves());
+
+	for (auto i = cylins.begin(); i != cylins.end(); ++i) {
+		for (unsigned d = 0; d < 3; ++d) {vals.push_back(i->p1[d]); vals.push_back(i->p2[d]);}
+		vals.push_back(i->r1);
+		vals.push_back(i->r2);
+		vals.push_back(i->level);
+	}
+	for (auto i = leaves.begin(); i != leaves.end(); ++i) {
+		for (unsigned n = 0; n < 4; ++n) {UNROLL_3X(vals.push_back(i->pts[n][i_]);)}
+		UNROLL_3X(vals.push_back(i->norm[i_]);)
+		vals.push_back(i->lcolor);
+		vals.push_back(i->lred);
+		vals.push_back(i->lgreen);
+	}
+	for (unsigned n = 0; n < 2; ++n) {
+		vector<int> const &cixs(n ? leaf_cobjs : branch_cobjs);
+		vals.push_back(cixs.size());
+
+		for (auto i = cixs.begin(); i != cixs.end(); ++i) {
+			coll_obj const &c(coll_objects.get_cobj(*i));
+			vals.push_back(c.type);
+			vals.push_back(c.radius);
+			vals.push_back(c.radius2);
+			for (unsigned d = 0; d < 6; ++d) {vals.push_back(c.d[d>>1][d&1]);}
+		}
+	}
+	return jenkins_one_at_a_time_hash((uint8_t const *)vals.data(), vals.size()*sizeof(float));
+}
+
+
 void tree_cont_t::remove_cobjs() {
 
 	for (iterator i = begin(); i != end(); ++i) {
@@ -288,8 +331,8 @@ void tree_cont_t::remove_cobjs() {
 
 bool tree::check_sphere_coll(point &center, float radius) const {
 
-	float const trunk_radius(0.9*tdata().br_scale*tdata().base_radius);
-	float const trunk_height(max(tdata().sphere_radius, tdata().sphere_center_zoff)); // very approximate
+	float const trunk_radius(0.9*inst_scale*tdata().br_scale*tdata().base_radius);
+	float const trunk_height(inst_scale*max(tdata().sphere_radius, tdata().sphere_center_zoff)); // very approximate
 	cylinder_3dw const cylin(tree_center, tree_center+vector3d(0.0, 0.0, trunk_height), trunk_radius, trunk_radius);
 	return sphere_vert_cylin_intersect(center, radius, cylin);
 }
@@ -307,11 +350,11 @@ void tree_cont_t::draw_branches_and_leaves(shader_t &s, tree_lod_render_t &lod_r
 	bool draw_branches, bool draw_leaves, bool shadow_only, bool reflection_pass, vector3d const &xlate)
 {
 	assert(draw_branches != draw_leaves); // must enable only one
-	int const wsoff_loc(s.get_uniform_loc("world_space_offset")), tex0_loc(s.get_uniform_loc("tex0"));
+	int const wsoff_loc(s.get_uniform_loc("world_space_offset")), inst_loc(s.get_uniform_loc("instance_rot_scale")), tex0_loc(s.get_uniform_loc("tex0"));
 
 	if (draw_branches) {
 		tree_data_t::pre_branch_draw(s, shadow_only);
-		for (iterator i = begin(); i != end(); ++i) {i->draw_branches_top(s, lod_renderer, shadow_only, reflection_pass, xlate, wsoff_loc);}
+		for (iterator i = begin(); i != end(); ++i) {i->draw_branches_top(s, lod_renderer, shadow_only, reflection_pass, xlate, wsoff_loc, inst_loc);}
 		tree_data_t::post_branch_draw(shadow_only);
 	}
 	else { // draw_leaves
@@ -329,7 +372,7 @@ void tree_cont_t::draw_branches_and_leaves(shader_t &s, tree_lod_render_t &lod_r
 		to_update_leaves.clear();
 
 		for (auto i = sorted.begin(); i != sorted.end(); ++i) {
-			operator[](i->second).draw_leaves_top(s, lod_renderer, shadow_only, reflection_pass, xlate, wsoff_loc, tex0_loc, to_update_leaves);
+			operator[](i->second).draw_leaves_top(s, lod_renderer, shadow_only, reflection_pass, xlate, wsoff_loc, inst_loc, tex0_loc, to_update_leaves);
 		}
 		tree_data_t::post_leaf_draw();
 		int const num_to_update(to_update_leaves.size());
@@ -405,6 +448,7 @@ void set_leaf_shader(shader_t &s, float min_alpha, unsigned tc_start_ix, bool en
 	s.add_uniform_int("tex0", 0);
 	s.add_uniform_int("tc_start_ix", tc_start_ix);
 	s.add_uniform_vector3d("world_space_offset", zero_vector); // reset
+	s.add_uniform_vector3d("instance_rot_scale", vector3d(1.0, 0.0, 1.0)); // reset
 
 	if (use_indir) {
 		set_3d_texture_as_current(smoke_tid, 1);
@@ -464,6 +508,7 @@ void tree_cont_t::draw(bool shadow_only, bool reflection_pass) {
 	set_tree_branch_shader(bs, !shadow_only, !shadow_only, branch_smap);
 	draw_branches_and_leaves(bs, lod_renderer, 1, 0, shadow_only, reflection_pass, zero_vector);
 	bs.add_uniform_vector3d("world_space_offset", zero_vector); // reset
+	bs.add_uniform_vector3d("instance_rot_scale", vector3d(1.0, 0.0, 1.0)); // reset
 	bs.end_shader();
 }
 
@@ -713,7 +758,7 @@ void tree::blast_damage(blastr const *const blast_radius) {
 	float const bradius(blast_radius->cur_size), bdamage(LEAF_DAM_SCALE*blast_radius->damage);
 	if (bdamage == 0.0) return;
 	point const &bpos(blast_radius->pos);
-	float const radius(bradius + tdata().sphere_radius);
+	float const radius(bradius + get_radius());
 	if (p2p_dist_sq(bpos, sphere_center()) > radius*radius) return;
 	burn_leaves_within_radius(bpos, bradius, bdamage);
 	add_fire(bpos, 0.25*bradius, blast_radius->damage);
@@ -832,11 +877,34 @@ unsigned tree_data_t::get_gpu_mem() const {
 
 bool tree::is_visible_to_camera(vector3d const &xlate) const {
 	int const level((get_camera_pos().z > max(ztop, czmax)) ? 0 : 2); // test cobjs and mesh unless camera is in the air
-	return sphere_in_camera_view((sphere_center() + xlate), 1.1*tdata().sphere_radius, level);
+	return sphere_in_camera_view((sphere_center() + xlate), 1.1*get_radius(), level);
 }
 void tree::add_bounds_to_bcube(cube_t &bcube) const {
-	bcube.assign_or_union_with_cube(tdata().branches_bcube + tree_center);
-	bcube.union_with_cube(tdata().leaves_bcube + tree_center);
+	bcube.assign_or_union_with_cube(get_inst_bcube(tdata().branches_bcube));
+	bcube.union_with_cube(get_inst_bcube(tdata().leaves_bcube));
+}
+cube_t tree::get_inst_bcube(cube_t const &c) const { // c is relative to tree_center; returns a world space cube that contains the rotated and scaled c
+
+	if (!has_inst_xform()) return (c + tree_center);
+	float const angle(TO_RADIANS*inst_angle), ca(cosf(angle)), sa(sinf(angle));
+	cube_t bc;
+
+	for (unsigned i = 0; i < 4; ++i) {
+		float const x(c.d[0][i&1]), y(c.d[1][i>>1]);
+		point const pt((ca*x - sa*y), (sa*x + ca*y), c.d[2][0]);
+		if (i == 0) {bc.set_from_point(pt);} else {bc.union_with_pt(pt);}
+	}
+	bc.d[2][1] = c.d[2][1];
+	UNROLL_3X(bc.d[i_][0] *= inst_scale; bc.d[i_][1] *= inst_scale;)
+	return (bc + tree_center);
+}
+void tree::apply_inst_xform() const { // rotate and scale the shared tree data about the tree base; called after translate_to(tree_center)
+	if (inst_angle != 0.0) {fgRotate(inst_angle, 0.0, 0.0, 1.0);}
+	if (inst_scale != 1.0) {fgScale(inst_scale);}
+}
+void tree::set_inst_xform_uniform(int inst_loc) const { // same transform for world space lighting in the vertex shader
+	float const angle(TO_RADIANS*inst_angle);
+	shader_t::set_uniform_vector3d(inst_loc, vector3d(cosf(angle), sinf(angle), inst_scale));
 }
 
 void tree::shift_tree(vector3d const &vd) {
@@ -900,23 +968,24 @@ void tree_data_t::draw_leaves_shadow_only(float size_scale) {
 float tree::calc_size_scale(point const &draw_pos) const {
 
 	if (world_mode == WMODE_INF_TERRAIN && distance_to_camera_xy(draw_pos) > get_draw_tile_dist()) return 0.0; // to far away to draw
-	return (do_zoom ? ZOOM_FACTOR : 1.0)*tdata().base_radius/(distance_to_camera(draw_pos)*DIST_C_SCALE);
+	return (do_zoom ? ZOOM_FACTOR : 1.0)*inst_scale*tdata().base_radius/(distance_to_camera(draw_pos)*DIST_C_SCALE);
 }
 
 float tree_data_t::get_size_scale_mult() const {return (has_4th_branches ? LEAF_4TH_SCALE : 1.0);}
 
 
-void tree::draw_branches_top(shader_t &s, tree_lod_render_t &lod_renderer, bool shadow_only, bool reflection_pass, vector3d const &xlate, int wsoff_loc) {
+void tree::draw_branches_top(shader_t &s, tree_lod_render_t &lod_renderer, bool shadow_only, bool reflection_pass, vector3d const &xlate, int wsoff_loc, int inst_loc) {
 
 	if (!created || not_visible) return;
 	tree_data_t &td(tdata());
-	if (!camera_pdu.cube_visible(td.branches_bcube + tree_center + xlate)) return;
+	if (!camera_pdu.cube_visible(get_inst_bcube(td.branches_bcube) + xlate)) return;
 	bool const ground_mode(world_mode == WMODE_GROUND), wind_enabled(ground_mode && (display_mode & 0x0100) != 0);
 
 	if (shadow_only) {
 		if (ground_mode && !is_over_mesh()) return;
 		fgPushMatrix();
 		translate_to(tree_center + xlate);
+		apply_inst_xform();
 		td.draw_branches(s, (ground_mode ? (wind_enabled ? last_size_scale : 0.0) : 1.0), 1); // draw branches (untextured), low_detail=1
 		fgPopMatrix();
 		return;
@@ -936,7 +1005,7 @@ void tree::draw_branches_top(shader_t &s, tree_lod_render_t &lod_renderer, bool
 
 		if (td.get_render_branch_texture().is_valid() && size_scale < lod_start) {
 			geom_opacity = ((lod_denom == 0.0) ? 0.0 : CLIP_TO_01((size_scale - lod_end)/lod_denom));
-			lod_renderer.add_branches(&td, draw_pos, (1.0 - geom_opacity), bcolor);
+			lod_renderer.add_branches(&td, draw_pos, (1.0 - geom_opacity), bcolor, inst_scale);
 		}
 		if (geom_opacity == 0.0) return;
 		s.set_uniform_float(lod_renderer.branch_opacity_loc, geom_opacity);
@@ -944,15 +1013,17 @@ void tree::draw_branches_top(shader_t &s, tree_lod_render_t &lod_renderer, bool
 	select_texture(tree_types[type].bark_tex);
 	s.set_cur_color(bcolor);
 	s.set_uniform_vector3d(wsoff_loc, (tree_center + xlate - get_camera_coord_space_xlate()));
+	set_inst_xform_uniform(inst_loc);
 	fgPushMatrix();
 	translate_to(tree_center + xlate);
+	apply_inst_xform();
 	td.draw_branches(s, size_scale, reflection_pass);
 	fgPopMatrix();
 }
 
 
 void tree::draw_leaves_top(shader_t &s, tree_lod_render_t &lod_renderer, bool shadow_only, bool reflection_pass, vector3d const &xlate,
-	int wsoff_loc, int tex0_off, vector<tree *> &to_update_leaves)
+	int wsoff_loc, int inst_loc, int tex0_off, vector<tree *> &to_update_leaves)
 {
 	if (!created) return;
 	tree_data_t &td(tdata());
@@ -963,6 +1034,7 @@ void tree::draw_leaves_top(shader_t &s, tree_lod_render_t &lod_renderer, bool sh
 		if (ground_mode && !is_over_mesh()) return;
 		fgPushMatrix();
 		translate_to(tree_center + xlate);
+		apply_inst_xform();
 		td.leaf_draw_setup(1);
 		// Note: since the shadow map is updated every frame when wind is enabled, we can use dynamic LOD without locking in a low-LOD static shadow map
 		td.draw_leaves_shadow_only((ground_mode ? (wind_enabled ? last_size_scale : 0.0) : 0.5));
@@ -979,7 +1051,7 @@ void tree::draw_leaves_top(shader_t &s, tree_lod_render_t &lod_renderer, bool sh
 	not_visible = !is_visible_to_camera(xlate); // first pass only
 	if (not_visible && !leaf_color_changed) return; // if leaf_color_changed=1, we always draw the leaves as that forces the leaf color update
 	if (!has_leaves) return; // only after not_visible is calculated
-	if (!leaf_color_changed && !camera_pdu.cube_visible(td.leaves_bcube + tree_center + xlate)) return;
+	if (!leaf_color_changed && !camera_pdu.cube_visible(get_inst_bcube(td.leaves_bcube) + xlate)) return;
 	point const draw_pos(sphere_center() + xlate);
 	float const size_scale(calc_size_scale(draw_pos));
 	last_size_scale = size_scale;
@@ -991,7 +1063,7 @@ void tree::draw_leaves_top(shader_t &s, tree_lod_render_t &lod_renderer, bool sh
 
 		if (td.get_render_leaf_texture().is_valid() && size_scale < lod_start) {
 			geom_opacity = ((lod_denom == 0.0) ? 0.0 : CLIP_TO_01((size_scale - lod_end)/lod_denom));
-			lod_renderer.add_leaves(&td, (draw_pos + vector3d(0.0, 0.0, (td.lr_z_cent - td.sphere_center_zoff))), (1.0 - geom_opacity));
+			lod_renderer.add_leaves(&td, (draw_pos + vector3d(0.0, 0.0, inst_scale*(td.lr_z_cent - td.sphere_center_zoff))), (1.0 - geom_opacity), inst_scale);
 		}
 		if (geom_opacity == 0.0) return;
 		s.set_uniform_float(lod_renderer.leaf_opacity_loc, geom_opacity);
@@ -1006,8 +1078,10 @@ void tree::draw_leaves_top(shader_t &s, tree_lod_render_t &lod_renderer, bool sh
 		s.set_uniform_vector3d(wsoff_loc, (tree_center + xlate - get_camera_coord_space_xlate()));
 	}
 	s.set_uniform_int(tex0_off, TLEAF_START_TUID+type); // what about texture color mod?
+	set_inst_xform_uniform(inst_loc);
 	fgPushMatrix();
 	translate_to(tree_center + xlate);
+	apply_inst_xform();
 	td.draw_leaves(size_scale);
 	fgPopMatrix();
 }
@@ -1299,6 +1373,43 @@ void tree_data_t::clear_data() {
 	clear_cont(leaves); // Note: not present in original delete_trees()
 }
 
+template<typename T> bool read_tree_vector(binary_file_reader &reader, vector<T> &v) {
+	unsigned num(0);
+	if (!reader.read(&num, sizeof(unsigned), 1)) return 0;
+	v.resize(num);
+	return (num == 0 || reader.read(v.data(), sizeof(T), num));
+}
+template<typename T> bool write_tree_vector(binary_file_writer &writer, vector<T> const &v) {
+	unsigned const num(v.size());
+	return (writer.write(&num, sizeof(unsigned), 1) && (num == 0 || writer.write(v.data(), sizeof(T), num)));
+}
+
+bool tree_data_t::read(binary_file_reader &reader) { // generated data only; leaf colors, VBOs, and textures are recreated on first draw
+
+	unsigned char has_4th(0);
+	float vals[12];
+	if (!reader.read(&tree_type, sizeof(int), 1) || tree_type < 0 || tree_type >= NUM_TREE_TYPES) return 0;
+	if (!reader.read(&has_4th, sizeof(unsigned char), 1) || !reader.read(&base_color, sizeof(colorRGBA), 1)) return 0;
+	if (!reader.read(vals, sizeof(float), 12) || !reader.read(&leaves_bcube, sizeof(cube_t), 1) || !reader.read(&branches_bcube, sizeof(cube_t), 1)) return 0;
+	if (!read_tree_vector(reader, all_cylins) || all_cylins.empty() || !read_tree_vector(reader, leaves)) return 0;
+	has_4th_branches = (has_4th != 0);
+	base_radius = vals[0]; sphere_radius = vals[1]; sphere_center_zoff = vals[2]; br_scale = vals[3]; b_tex_scale = vals[4];
+	lr_z_cent   = vals[5]; lr_x = vals[6]; lr_y = vals[7]; lr_z = vals[8]; br_x = vals[9]; br_y = vals[10]; br_z = vals[11];
+	leaf_data.clear();
+	clear_vbo_ixs();
+	return 1;
+}
+
+bool tree_data_t::write(binary_file_writer &writer) const {
+
+	assert(is_created());
+	unsigned char const has_4th(has_4th_branches);
+	float const vals[12] = {base_radius, sphere_radius, sphere_center_zoff, br_scale, b_tex_scale, lr_z_cent, lr_x, lr_y, lr_z, br_x, br_y, br_z};
+	if (!writer.write(&tree_type, sizeof(int), 1) || !writer.write(&has_4th, sizeof(unsigned char), 1) || !writer.write(&base_color, sizeof(colorRGBA), 1)) return 0;
+	if (!writer.write(vals, sizeof(float), 12) || !writer.write(&leaves_bcube, sizeof(cube_t), 1) || !writer.write(&branches_bcube, sizeof(cube_t), 1)) return 0;
+	return (write_tree_vector(writer, all_cylins) && write_tree_vector(writer, leaves));
+}
+
 
 void copy_cylins(tree_cylin *start_cylin, int num, tree_cylin *&cur_cylin) {
 	for (int i = 0; i < num; ++i) {*cur_cylin = *(start_cylin+i); ++cur_cylin;}
@@ -1455,6 +1566,11 @@ void tree::gen_tree(point const &pos, int size, int ttype, int calc_z, bool add_
 			assert(type == td_type); // up to the caller to ensure this
 		}
 		UNROLL_3X(tree_color[i_] = 1.0 + tree_types[type].branch_color_var*color_var[i_];)
+
+		if (world_mode == WMODE_INF_TERRAIN) { // vary the archetype per instance; not in ground mode, where cobjs and leaf interactions use untransformed tree data
+			inst_angle = 360.0*rgen.rand_float();
+			inst_scale = 1.0 + ARCHETYPE_SCALE_VAR*rgen.signed_rand_float();
+		}
 	}
 	else {
 		type = ((ttype < 0) ? rgen.rand() : ttype) % NUM_TREE_TYPES; // maybe should be an error if > NUM_TREE_TYPES
@@ -1537,6 +1653,12 @@ void tree_data_t::gen_tree_data(int tree_type_, int size, float tree_depth, floa
 }
 
 
+tree_builder_arena_t &tree_builder_t::get_thread_arena() {
+	static thread_local tree_builder_arena_t arena; // per-thread, so the vectors keep their capacity across trees without being shared between threads
+	return arena;
+}
+
+
 float tree_builder_t::create_tree_branches(int tree_type, int size, float tree_depth, colorRGBA &base_color, float height_scale,
 	float br_scale, float nl_scale, float bbo_scale, bool has_4th_branches, bool create_bush)
 {
@@ -2098,7 +2220,7 @@ void tree_cont_t::add_new_tree(rand_gen_t &rgen, int &ttype) {
 	int tree_id(-1);
 
 	if (ttype >= 0) {
-		unsigned const num_per_type(max(1U, (unsigned)shared_tree_data.size()/NUM_TREE_TYPES));
+		unsigned const num_per_type(shared_tree_data.get_num_per_type());
 		tree_id = min(unsigned((((rgen.rseed1 >> 7) + rgen.rseed2) % num_per_type) + ttype*num_per_type), (unsigned)shared_tree_data.size()-1);
 	}
 	else {
@@ -2149,9 +2271,10 @@ void tree_cont_t::gen_trees_tt_within_radius(int x1, int y1, int x2, int y2, poi
 	unsigned const skip_val(max(1, int(1.0/tree_scale))); // similar to deterministic gen in scenery.cpp
 	shared_tree_data.ensure_init();
 	mesh_xy_grid_cache_t density_gen[NUM_TREE_TYPES+1];
+	vector<pending_tree_t> to_gen;
 
 	if (NONUNIFORM_TREE_DEN) { // i==0 is the coverage density map, i>0 are the per-tree type coverage maps
-#pragma omp parallel for schedule(dynamic) num_threads(2)
+#pragma omp parallel for schedule(dynamic)
 		for (int i = (use_density ? 0 : 1); i <= NUM_TREE_TYPES; ++i) { // Note: i should be signed
 			float const tds(TREE_DIST_SCALE*(XY_MULT_SIZE/16384.0)*(i==0 ? 1.0 : 0.1)), xscale(tds*DX_VAL*DX_VAL), yscale(tds*DY_VAL*DY_VAL);
 			density_gen[i].build_arrays(xscale*(x1 + xoff2 + 1000*i), yscale*(y1 + yoff2 - 1500*i), xscale, yscale, (x2-x1), (y2-y1), 0, 1); // force_sine_mode=1
@@ -2200,9 +2323,57 @@ void tree_cont_t::gen_trees_tt_within_radius(int x1, int y1, int x2, int y2, poi
 			}
 			if (!check_valid_scenery_pos((pos + vector3d(0.0, 0.0, 0.3*tree_scale)), 0.4*tree_scale, 1)) continue; // approximate bsphere; is_tall=1
 			add_new_tree(rgen, ttype);
-			back().gen_tree(pos, 0, ttype, 1, 1, 0, rgen, 1.0, 1.0, 1.0, tree_4th_branches, 1); // allow bushes
+			to_gen.emplace_back((size() - 1), ttype, pos, rgen); // rgen is reseeded for each position, so trees can be generated later in any order
 		} // for j
 	} // for i
+	gen_pending_trees(to_gen);
+}
+
+// generates trees in parallel; any shared tree data not already in the archetype pool is created by the first tree that uses it, and cobjs are added in tree order, so the result doesn't depend on thread count
+void tree_cont_t::gen_pending_trees(vector<pending_tree_t> &to_gen) {
+
+	bool const verify(VERIFY_TREE_GEN_DETERMINISM && omp_get_max_threads() > 1 && !to_gen.empty());
+	vector<pending_tree_t> const to_gen_orig(verify ? to_gen : vector<pending_tree_t>()); // gen_tree() advances rgen, so keep the starting state
+	vector<tree> verify_trees; // copies of the bound but not yet generated trees, indexed by to_gen
+	for (unsigned i = 0; verify && i < to_gen.size(); ++i) {verify_trees.push_back(operator[](to_gen[i].ix));}
+	vector<unsigned> pass_ixs[2]; // {private/created/first use of shared tree data, later uses of shared tree data created in the first pass}
+	set<tree_data_t const *> to_create;
+
+	for (unsigned i = 0; i < to_gen.size(); ++i) {
+		tree_data_t const *const td(operator[](to_gen[i].ix).get_shared_tdata());
+		bool const first_pass(td == NULL || td->is_created() || to_create.insert(td).second);
+		pass_ixs[!first_pass].push_back(i);
+	}
+	for (unsigned p = 0; p < 2; ++p) {
+		vector<unsigned> const &ixs(pass_ixs[p]);
+
+#pragma omp parallel for schedule(dynamic,1) if (ixs.size() > 1)
+		for (int i = 0; i < (int)ixs.size(); ++i) {
+			pending_tree_t &pt(to_gen[ixs[i]]);
+			operator[](pt.ix).gen_tree(pt.pos, 0, pt.ttype, 1, 0, 0, pt.rgen, 1.0, 1.0, 1.0, tree_4th_branches, 1); // add_cobjs=0; allow bushes
+		}
+	}
+	for (auto i = to_gen.begin(); i != to_gen.end(); ++i) {operator[](i->ix).add_tree_collision_objects();} // not thread safe
+	if (!verify) return;
+	// regenerate the same trees on a single thread in to_gen order and compare; shared tree data created above is cleared and recreated
+	vector<unsigned> mt_hashes(to_gen.size());
+	for (unsigned i = 0; i < to_gen.size(); ++i) {mt_hashes[i] = operator[](to_gen[i].ix).get_gen_hash();}
+	for (auto i = to_create.begin(); i != to_create.end(); ++i) {const_cast<tree_data_t *>(*i)->clear_data();}
+	unsigned num_mismatch(0);
+
+	for (unsigned i = 0; i < to_gen.size(); ++i) {
+		pending_tree_t pt(to_gen_orig[i]);
+		tree &t(verify_trees[i]);
+		t.gen_tree(pt.pos, 0, pt.ttype, 1, 0, 0, pt.rgen, 1.0, 1.0, 1.0, tree_4th_branches, 1);
+		t.add_tree_collision_objects();
+
+		if (t.get_gen_hash() != mt_hashes[i]) {
+			std::cerr << "Error: tree " << pt.ix << " differs between single and multithreaded generation" << endl;
+			++num_mismatch;
+		}
+		t.remove_collision_objects();
+	}
+	assert(num_mismatch == 0);
 }
 
 
@@ -2294,14 +2465,116 @@ void tree_data_manager_t::ensure_init() {
 
 	if (max_unique_trees > 0 && empty()) {
 		resize(max_unique_trees);
+		last_tree_scale = tree_scale;
+		last_rgi        = rand_gen_index;
+		gen_archetypes();
 	}
 	else if (tree_scale != last_tree_scale || rand_gen_index != last_rgi) {
 		for (iterator i = begin(); i != end(); ++i) {i->clear_data();}
 		last_tree_scale = tree_scale;
 		last_rgi        = rand_gen_index;
+		gen_archetypes();
 	}
 }
 
+unsigned tree_data_manager_t::get_num_per_type() const {return max(1U, (unsigned)size()/NUM_TREE_TYPES);}
+
+struct tree_archetype_params_t { // everything other than tree_types that affects generated archetypes; all fields are 4 bytes, so there's no padding
+	unsigned magic, num, rgi, has_4th_branches, gen_roots;
+	float tree_scale, tree_depth, deadness, dead_prob, br_scale, nl_scale, height_scale, leaf_cc, tree_cc;
+};
+
+unsigned tree_data_manager_t::get_params_hash() const {
+
+	tree_archetype_params_t params;
+	params.magic            = TREE_ARCHETYPE_MAGIC;
+	params.num              = size();
+	params.rgi              = rand_gen_index;
+	params.has_4th_branches = tree_4th_branches;
+	params.gen_roots        = gen_tree_roots;
+	params.tree_scale       = tree_scale;
+	params.tree_depth       = get_default_tree_depth();
+	params.deadness         = tree_deadness;
+	params.dead_prob        = tree_dead_prob;
+	params.br_scale         = branch_radius_scale;
+	params.nl_scale         = nleaves_scale;
+	params.height_scale     = tree_height_scale;
+	params.leaf_cc          = leaf_color_coherence;
+	params.tree_cc          = tree_color_coherence;
+	return (hash_by_bytes<tree_archetype_params_t>()(params) ^ jenkins_one_at_a_time_hash((uint8_t const *)tree_types, NUM_TREE_TYPES*sizeof(tree_type)));
+}
+
+string tree_data_manager_t::get_cache_filename() const { // shares the tiled terrain cache dir; returns an empty string if caching is disabled
+	if (tile_cache_dir.empty()) return string();
+	std::ostringstream oss;
+	oss << tile_cache_dir << "/tree_archetypes_" << std::hex << get_params_hash() << ".gz"; // zlib compressed
+	return oss.str();
+}
+
+void tree_data_manager_t::gen_archetype(unsigned ix) { // archetype ix has the same tree type that add_new_tree() selects for it
+
+	assert(ix < size());
+	rand_gen_t rgen;
+	rgen.set_state(ix+1, rand_gen_index+1);
+	rgen.rand_mix();
+	int type(min(ix/get_num_per_type(), unsigned(NUM_TREE_TYPES-1)));
+	bool const create_bush(rgen.rand_probability(tree_types[type].bush_prob));
+	if (create_bush) {type = (type + 1) % NUM_TREE_TYPES;} // mix up the tree types so that bushes stand out from trees
+	tree_type const &treetype(tree_types[type]);
+	operator[](ix).gen_tree_data(type, 0, get_default_tree_depth(), treetype.height_scale, treetype.branch_radius, 1.0, treetype.branch_break_off,
+		tree_4th_branches, NULL, create_bush, rgen);
+}
+
+void tree_data_manager_t::gen_archetypes() { // generates all archetypes up front so that memory is fixed and trees can be generated in parallel
+
+	if (empty()) return;
+	timer_t timer("Gen Tree Archetypes");
+	string const fn(get_cache_filename());
+
+	if (fn.empty() || !read_archetypes(fn)) {
+		int const num(size());
+#pragma omp parallel for schedule(dynamic,1)
+		for (int i = 0; i < num; ++i) {gen_archetype(i);} // tree_builder_t is thread safe
+		if (!fn.empty()) {write_archetypes(fn);}
+	}
+	unsigned leaf_mem(0), branch_mem(0);
+
+	for (const_iterator i = begin(); i != end(); ++i) {
+		leaf_mem   += i->get_leaf_mem  ();
+		branch_mem += i->get_branch_mem();
+	}
+	cout << "Tree archetypes: " << size() << ", leaf mem: " << leaf_mem/1024 << "KB, branch mem: " << branch_mem/1024 << "KB" << endl;
+}
+
+bool tree_data_manager_t::read_archetypes(string const &fn) {
+
+	binary_file_reader reader;
+	if (!reader.open(fn, 1)) return 0; // quiet=1; not yet cached
+	unsigned header[2] = {0, 0}; // {magic, num}
+	if (!reader.read(header, sizeof(unsigned), 2) || header[0] != TREE_ARCHETYPE_MAGIC || header[1] != size()) return 0; // stale
+
+	for (iterator i = begin(); i != end(); ++i) {
+		if (!i->read(reader)) {std::cerr << "Error reading tree archetype cache file " << fn << endl; return 0;} // will be regenerated
+	}
+	return 1;
+}
+
+void tree_data_manager_t::write_archetypes(string const &fn) const {
+
+	std::ostringstream tmp_fn;
+	tmp_fn << fn.substr(0, fn.size()-3) << ".tmp.gz"; // write to a temp file so that readers never see a partial file
+	unsigned const header[2] = {TREE_ARCHETYPE_MAGIC, (unsigned)size()};
+	bool success(0);
+	{
+		binary_file_writer writer;
+		success = (writer.open(tmp_fn.str()) && writer.write(header, sizeof(unsigned), 2));
+		for (const_iterator i = begin(); i != end() && success; ++i) {success &= i->write(writer);}
+	}
+	if (success && std::rename(tmp_fn.str().c_str(), fn.c_str()) == 0) return; // done
+	std::remove(tmp_fn.str().c_str());
+	std::cerr << "Error writing tree archetype cache file " << fn << endl;
+}
+
 void tree_data_manager_t::clear_context() {
 	for (iterator i = begin(); i != end(); ++i) {i->clear_context();}
 }
@@ -2316,6 +2589,12 @@ unsigned tree_data_manager_t::get_gpu_mem() const {
 	return mem;
 }
 
+unsigned tree_data_manager_t::get_cpu_mem() const {
+	unsigned mem(0);
+	for (const_iterator i = begin(); i != end(); ++i) {mem += i->get_leaf_mem() + i->get_branch_mem();}
+	return mem;
+}
+
 
 unsigned tree_cont_t::get_gpu_mem() const {
 	unsigned mem(0);
@@ -8,6 +8,7 @@
 #include "shaders.h"
 #include "gl_ext_arb.h"
 #include "asteroid.h"
+#include "worker_pool.h"
 
 
 // temperatures
@@ -25,6 +26,7 @@ float const BOIL_TEMP        = 30.0;
 float const NO_AIR_TEMP      = 32.0;
 float const NDIV_SIZE_SCALE  = 15.0;
 float const NEBULA_PROB      = 0.65;
+float const SYSTEM_BVH_RADIUS = MAX_SYSTEM_EXTENT + MAX_PLANET_EXTENT; // upper bound on system.radius + MAX_PLANET_EXTENT
 
 bool const SHOW_SPHERE_TIME  = 0; // debugging
 
@@ -39,6 +41,8 @@ unsigned const MAX_SYSTEMS_PER_GALAXY  = 500;
 unsigned const MAX_PLANETS_PER_SYSTEM  = 16;
 unsigned const MAX_MOONS_PER_PLANET    = 8;
 unsigned const GAS_GIANT_TSIZE         = 1024;
+unsigned const PLACEHOLDER_TSIZE       = 32; // low res texture used until the full res texture is generated in the background
+unsigned const PLANET_TEX_CACHE_SIZE   = 32; // max number of full res planet/moon textures to keep
 unsigned const GAS_GIANT_BANDS         = 63;
 
 int   const RAND_CONST       = 1;
@@ -1334,6 +1338,7 @@ void ugalaxy::process(ucell const &cell) {
 	assert(tot_systems == num_systems);
 	calc_bounding_sphere();
 	calc_color();
+	build_system_bvh();
 	lrq_rad = 0.0;
 	//PRINT_TIME("Gen Galaxy");
 
@@ -2045,6 +2050,64 @@ void uobj_solid::gen_colorAB(float delta) {
 // *** TEXTURES ***
 
 
+class planet_tex_cache_t { // completed and pending background texture jobs, keyed by all texture inputs; main thread only
+
+	struct key_t { // {rseed1, rseed2}, size, and surface colors/params, which can change over time (moon temperature, dying sun, etc.)
+		int seeds[2];
+		unsigned size;
+		unsigned char colors[6];
+		float params[5]; // {temp, water, lava, atmos, snow_thresh}
+
+		bool operator==(key_t const &k) const {return (!(*this < k) && !(k < *this));}
+		bool operator< (key_t const &k) const {
+			if (seeds[0] != k.seeds[0]) return (seeds[0] < k.seeds[0]);
+			if (seeds[1] != k.seeds[1]) return (seeds[1] < k.seeds[1]);
+			if (size     != k.size    ) return (size     < k.size    );
+			if (!std::equal(colors, colors+6, k.colors)) {return std::lexicographical_compare(colors, colors+6, k.colors, k.colors+6);}
+			return std::lexicographical_compare(params, params+5, k.params, k.params+5);
+		}
+	};
+	map<key_t, p_tex_gen_job> jobs;
+	deque<key_t> add_order;
+
+public:
+	static key_t get_key(rand_gen_t const &rgen, unsigned size, surface_color_gen_t const &cgen) {
+		key_t key;
+		key.seeds[0] = rgen.rseed1;
+		key.seeds[1] = rgen.rseed2;
+		key.size     = size;
+		for (unsigned i = 0; i < 3; ++i) {key.colors[i] = cgen.a[i]; key.colors[i+3] = cgen.b[i];}
+		key.params[0] = cgen.temp;
+		key.params[1] = cgen.water;
+		key.params[2] = cgen.lava;
+		key.params[3] = cgen.atmos;
+		key.params[4] = cgen.snow_thresh;
+		return key;
+	}
+
+	p_tex_gen_job find(key_t const &key) const {
+		auto it(jobs.find(key));
+		return ((it == jobs.end()) ? p_tex_gen_job() : it->second);
+	}
+	void add(key_t const &key, p_tex_gen_job const &job) {
+		if (!jobs.insert(make_pair(key, job)).second) return; // already present
+		add_order.push_back(key);
+
+		while (add_order.size() > PLANET_TEX_CACHE_SIZE) { // evict the oldest; any body using it still holds a reference
+			jobs.erase(add_order.front());
+			add_order.pop_front();
+		}
+	}
+	void remove(key_t const &key) {
+		if (jobs.erase(key) == 0) return;
+		add_order.erase(std::find(add_order.begin(), add_order.end(), key));
+	}
+};
+
+planet_tex_cache_t planet_tex_cache;
+worker_pool_t planet_tex_workers(2); // each job also splits its rows across OpenMP threads
+
+
 void urev_body::check_gen_texture(unsigned size) {
 
 	if (use_procedural_shader()) return; // no texture used
@@ -2060,23 +2123,101 @@ void urev_body::check_gen_texture(unsigned size) {
 		gen_surface();
 	}
 	else if (tsize0 != tsize) { // new texture size
+		cancel_tex_job();
 		::free_texture(tid); // delete old texture
 	}
 	else {
-		return; // nothing to do
+		check_tex_job_complete(); // replace the placeholder once the full texture is ready
+		return;
 	}
 	create_rocky_texture(tsize0); // new texture
 }
 
 
+surface_color_gen_t urev_body::get_surface_color_gen() const {
+
+	surface_color_gen_t cgen;
+	get_colors(cgen.a, cgen.b);
+	cgen.temp        = temp;
+	cgen.water       = water;
+	cgen.lava        = lava;
+	cgen.atmos       = atmos;
+	cgen.snow_thresh = snow_thresh;
+	cgen.wr_scale    = 1.0/max(0.01, (1.0 - water));
+	return cgen;
+}
+
+
 void urev_body::create_rocky_texture(unsigned size) {
 
 	tsize = size;
 	assert(tsize <= MAX_TEXTURE_SIZE);
-	vector<unsigned char> data(3*tsize*tsize);
-	gen_texture_data_and_heightmap(&data.front(), tsize);
-	setup_texture(tid, 0, 1, 0);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, tsize, tsize, 0, GL_RGB, GL_UNSIGNED_BYTE, &data.front());
+	assert(surface != nullptr);
+	surface_color_gen_t const cgen(get_surface_color_gen());
+	wr_scale = cgen.wr_scale;
+
+	if (tsize > PLACEHOLDER_TSIZE) { // large texture: generate in the background, or reuse a cached texture for this seed and size
+		auto const key(planet_tex_cache.get_key(rgen, tsize, cgen));
+		tex_job = planet_tex_cache.find(key);
+
+		if (tex_job == nullptr) {
+			tex_job.reset(new planet_tex_gen_job_t(tsize, cgen));
+			planet_tex_cache.add(key, tex_job);
+			p_tex_gen_job const job(tex_job);
+			noise_gen_3d const noise(*surface); // copy the sine params so that the job doesn't reference the surface (which has GL state)
+			float const max_mag(surface->max_mag);
+
+			planet_tex_workers.add_job([job, noise, max_mag, cgen]() {
+				if (job->cancel) return;
+				unsigned const sz(job->size);
+				job->data.resize(3*sz*sz);
+				job->heightmap.resize(sz*sz);
+				noise.gen_texture_data_and_heightmap(cgen, &job->data.front(), &job->heightmap.front(), sz, max_mag, &job->cancel);
+				job->done = 1;
+			});
+		}
+		if (check_tex_job_complete()) return; // cached texture was already complete
+	}
+	// small texture or placeholder: generate inline
+	unsigned const sz(min(tsize, PLACEHOLDER_TSIZE));
+	vector<unsigned char> data(3*sz*sz);
+	vector<float> heightmap(sz*sz);
+	surface->gen_texture_data_and_heightmap(cgen, &data.front(), &heightmap.front(), sz, surface->max_mag);
+	upload_rocky_texture(data, heightmap, sz);
+}
+
+
+void urev_body::upload_rocky_texture(vector<unsigned char> const &data, vector<float> const &heightmap, unsigned size) {
+
+	assert(surface != nullptr);
+	assert(data.size() == 3*size*size && heightmap.size() == size*size);
+	surface->setup(size, max(water, lava), 0);
+	surface->heightmap = heightmap; // copy, since the cache may still own the data
+	surface->sd.invalidate(); // heightmap has changed, so the sphere must be regenerated
+	surface->clear_cache();
+	if (tid == 0) {setup_texture(tid, 0, 1, 0);} else {bind_2d_texture(tid);}
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE, &data.front());
+}
+
+
+bool urev_body::check_tex_job_complete() { // returns 1 if the job has completed
+
+	if (tex_job == nullptr || !tex_job->done) return 0;
+	if (tex_job->is_valid() && tex_job->size == tsize) {upload_rocky_texture(tex_job->data, tex_job->heightmap, tex_job->size);}
+	tex_job.reset(); // the cache holds the data for later reuse
+	return 1;
+}
+
+
+void urev_body::cancel_tex_job() {
+
+	if (tex_job == nullptr) return;
+
+	if (!tex_job->done) { // not yet complete - cancel and remove the partial result from the cache
+		tex_job->cancel = 1;
+		planet_tex_cache.remove(planet_tex_cache.get_key(rgen, tex_job->size, tex_job->cgen));
+	}
+	tex_job.reset();
 }
 
 
@@ -2124,7 +2265,7 @@ void urev_body::upload_colors_to_shader(shader_t &s) const {
 }
 
 
-void urev_body::get_surface_color(unsigned char *data, float val, float phi) const { // val in [0,1]
+void surface_color_gen_t::get_surface_color(unsigned char *data, float val, float phi) const { // val in [0,1]
 
 	bool const frozen(temp < FREEZE_TEMP);
 	unsigned char const white[3] = {255, 255, 255};
@@ -2259,6 +2400,27 @@ void ugalaxy::clear_systems() {
 	sols.clear();
 	clusters.clear();
 	asteroid_fields.clear();
+	system_bvh.clear();
+}
+
+
+void ugalaxy::build_system_bvh() {
+
+	vector<sphere_with_id_t> spheres(sols.size());
+	for (unsigned i = 0; i < sols.size(); ++i) {spheres[i] = sphere_with_id_t(sols[i].pos, 0.0, i);} // points; radius is added in the queries
+	system_bvh.add_spheres(spheres, 0);
+}
+
+
+// returns systems that may be within expand*(system.radius + MAX_PLANET_EXTENT) + r_add of pos; callers must still test system.radius
+void ugalaxy::get_systems_near_pt(point const &pos, float expand, float r_add, vector<unsigned> &ids) const {
+	system_bvh.get_ids_int_sphere(pos, (expand*SYSTEM_BVH_RADIUS + r_add), ids);
+}
+
+// returns systems that may intersect the line segment from start to start+dir*dist expanded by line_radius
+void ugalaxy::get_systems_near_line(point const &start, vector3d const &dir, float dist, float line_radius, vector<unsigned> &ids) const {
+	// extend the end by the system radius to include systems that intersect the extended line near the end point
+	system_bvh.get_ids_int_line(start, (start + dir*(dist + SYSTEM_BVH_RADIUS)), (line_radius + SYSTEM_BVH_RADIUS), ids);
 }
 
 
@@ -2775,7 +2937,8 @@ int universe_t::get_closest_object(s_object &result, point pos, int max_level, b
 	pos -= cell.pos;
 	float const planet_thresh(expand*4.0*MAX_PLANET_EXTENT + r_add), moon_thresh(expand*2.0*MAX_PLANET_EXTENT + r_add);
 	float const pt_sq(planet_thresh*planet_thresh), mt_sq(moon_thresh*moon_thresh);
-	static int last_galaxy(-1), last_cluster(-1), last_system(-1);
+	static int last_galaxy(-1), last_system(-1); // search hints
+	static vector<unsigned> sys_ids; // systems close to pos
 	int const first_galaxy_to_try((galaxy_hint >= 0) ? galaxy_hint : last_galaxy);
 	unsigned const ng((unsigned)cell.galaxies->size());
 	unsigned const go((first_galaxy_to_try >= 0 && first_galaxy_to_try < int(ng)) ? last_galaxy : 0);
@@ -2813,98 +2976,91 @@ int universe_t::get_closest_object(s_object &result, point pos, int max_level, b
 				}
 			}
 		}
-		unsigned const num_clusters((unsigned)galaxy.clusters.size());
-		unsigned const co((last_cluster >= 0 && last_cluster < int(num_clusters) && gc == go) ? last_cluster : 0);
-
-		for (unsigned cl_ = 0; cl_ < num_clusters && !found_system; ++cl_) { // find cluster
-			unsigned cl(cl_);
-			if (cl == 0) cl = co; else if (cl == co) cl = 0;
-			ugalaxy::system_cluster const &cluster(galaxy.clusters[cl]);
-			float const testval(expand*cluster.bounds + r_add);
-			if (p2p_dist_sq(pos, cluster.center) > testval*testval) continue;
-			unsigned const cs1(cluster.s1), cs2(cluster.s2);
-			unsigned const so((last_system >= int(cs1) && last_system < int(cs2) && cl == co) ? last_system : cs1);
-
-			for (unsigned s_ = cs1; s_ < cs2 && !found_system; ++s_) {
-				unsigned s(s_);
-				if (s == cs1) s = so; else if (s == so) s = cs1;
-				ussystem &system(galaxy.sols[s]);
-				assert(system.cluster_id == cl); // testing
-				float const dists_sq(p2p_dist_sq(pos, system.pos)), testval2(expand*(system.radius + MAX_PLANET_EXTENT) + r_add);
-				if (dists_sq > testval2*testval2) continue;
-				float dists(sqrt(dists_sq));
-				found_system = (expand <= 1.0 && dists < system.radius);
-				
-				if (system.sun.is_ok() || get_destroyed) {
-					dists -= system.sun.radius;
+		sys_ids.clear();
+		galaxy.get_systems_near_pt(pos, expand, r_add, sys_ids);
 
-					if (dists < result.dist) {
-						result.assign(gc, cl, s, dists, UTYPE_SYSTEM, &system.sun);
+		if (gc == go) { // try the last system first
+			for (unsigned i = 1; i < sys_ids.size(); ++i) {
+				if ((int)sys_ids[i] == last_system) {std::swap(sys_ids[0], sys_ids[i]); break;}
+			}
+		}
+		for (unsigned s_ = 0; s_ < sys_ids.size() && !found_system; ++s_) {
+			unsigned const s(sys_ids[s_]);
+			ussystem &system(galaxy.sols[s]);
+			unsigned const cl(system.cluster_id);
+			float const dists_sq(p2p_dist_sq(pos, system.pos)), testval2(expand*(system.radius + MAX_PLANET_EXTENT) + r_add);
+			if (dists_sq > testval2*testval2) continue;
+			float dists(sqrt(dists_sq));
+			found_system = (expand <= 1.0 && dists < system.radius);
+			
+			if (system.sun.is_ok() || get_destroyed) {
+				dists -= system.sun.radius;
 
-						if (dists <= 0.0) { // sun collision
-							result.val = 2; return 2; // system
-						}
+				if (dists < result.dist) {
+					result.assign(gc, cl, s, dists, UTYPE_SYSTEM, &system.sun);
+
+					if (dists <= 0.0) { // sun collision
+						result.val = 2; return 2; // system
 					}
 				}
-				if (max_level == UTYPE_SYSTEM || max_level == UTYPE_STAR) continue; // system/star
-
-				if (include_asteroids && system.asteroid_belt != nullptr) { // check for asteroid belt collisions
-					if (system.asteroid_belt->sphere_might_intersect(pos, expand*system.asteroid_belt->get_max_asteroid_radius()+r_add)) {
-						// asteroid positions are dynamic, so spatial subdivision is difficult - we just do a slow linear iteration here
-						for (uasteroid_field::const_iterator j = system.asteroid_belt->begin(); j != system.asteroid_belt->end(); ++j) {
-							if (!dist_less_than(pos, j->pos, expand*j->radius+r_add)) continue;
-							result.assign(gc, cl, s, p2p_dist(pos, j->pos), UTYPE_ASTEROID, NULL);
-							result.asteroid_field = AST_BELT_ID; // special asteroid belt identifier
-							result.asteroid       = (j - system.asteroid_belt->begin());
-						}
+			}
+			if (max_level == UTYPE_SYSTEM || max_level == UTYPE_STAR) continue; // system/star
+
+			if (include_asteroids && system.asteroid_belt != nullptr) { // check for asteroid belt collisions
+				if (system.asteroid_belt->sphere_might_intersect(pos, expand*system.asteroid_belt->get_max_asteroid_radius()+r_add)) {
+					// asteroid positions are dynamic, so spatial subdivision is difficult - we just do a slow linear iteration here
+					for (uasteroid_field::const_iterator j = system.asteroid_belt->begin(); j != system.asteroid_belt->end(); ++j) {
+						if (!dist_less_than(pos, j->pos, expand*j->radius+r_add)) continue;
+						result.assign(gc, cl, s, p2p_dist(pos, j->pos), UTYPE_ASTEROID, NULL);
+						result.asteroid_field = AST_BELT_ID; // special asteroid belt identifier
+						result.asteroid       = (j - system.asteroid_belt->begin());
 					}
 				}
-				unsigned const np((unsigned)system.planets.size());
+			}
+			unsigned const np((unsigned)system.planets.size());
+			
+			for (unsigned pc = 0; pc < np; ++pc) { // find planet
+				uplanet &planet(system.planets[pc]);
+				float distp_sq(p2p_dist_sq(pos, planet.pos));
+				if (distp_sq > pt_sq) continue;
+				float const distp(sqrt(distp_sq) - planet.radius);
+				//if (include_asteroids && planet.asteroid_belt != nullptr) {}
 				
-				for (unsigned pc = 0; pc < np; ++pc) { // find planet
-					uplanet &planet(system.planets[pc]);
-					float distp_sq(p2p_dist_sq(pos, planet.pos));
-					if (distp_sq > pt_sq) continue;
-					float const distp(sqrt(distp_sq) - planet.radius);
-					//if (include_asteroids && planet.asteroid_belt != nullptr) {}
-					
-					if (planet.is_ok() || get_destroyed) {
-						if (distp < result.dist) {
-							result.assign(gc, cl, s, distp, UTYPE_PLANET, &planet);
-							result.planet = pc;
+				if (planet.is_ok() || get_destroyed) {
+					if (distp < result.dist) {
+						result.assign(gc, cl, s, distp, UTYPE_PLANET, &planet);
+						result.planet = pc;
 
-							if (distp <= 0.0) { // planet collision
-								result.val = 2; return 2;
-							}
+						if (distp <= 0.0) { // planet collision
+							result.val = 2; return 2;
 						}
 					}
-					if (max_level == UTYPE_PLANET) continue; // planet
-					unsigned const nm((unsigned)planet.moons.size());
-					
-					for (unsigned mc = 0; mc < nm; ++mc) { // find moon
-						umoon &moon(planet.moons[mc]);
-						if (!moon.is_ok() && !get_destroyed) continue;
-						float const distm_sq(p2p_dist_sq(pos, moon.pos));
-						if (distm_sq > mt_sq)                continue;
-						float const distm(sqrt(distm_sq) - moon.radius);
-
-						if (distm < result.dist) {
-							result.assign(gc, cl, s, distm, UTYPE_MOON, &moon);
-							result.planet = pc;
-							result.moon   = mc;
-
-							if (distm <= 0.0) { // moon collision
-								result.val = 1; return 2;
-							}
+				}
+				if (max_level == UTYPE_PLANET) continue; // planet
+				unsigned const nm((unsigned)planet.moons.size());
+				
+				for (unsigned mc = 0; mc < nm; ++mc) { // find moon
+					umoon &moon(planet.moons[mc]);
+					if (!moon.is_ok() && !get_destroyed) continue;
+					float const distm_sq(p2p_dist_sq(pos, moon.pos));
+					if (distm_sq > mt_sq)                continue;
+					float const distm(sqrt(distm_sq) - moon.radius);
+
+					if (distm < result.dist) {
+						result.assign(gc, cl, s, distm, UTYPE_MOON, &moon);
+						result.planet = pc;
+						result.moon   = mc;
+
+						if (distm <= 0.0) { // moon collision
+							result.val = 1; return 2;
 						}
-					} // moon
-				} // planet
-			} // system
-		} // cluster
+					}
+				} // moon
+			} // planet
+		} // system
 	} // galaxy
 	result.val = ((result.dist < CELL_SIZE) ? 1 : -1);
 	if (result.galaxy  >= 0) {last_galaxy  = result.galaxy; }
-	if (result.cluster >= 0) {last_cluster = result.cluster;}
 	if (result.system  >= 0) {last_system  = result.system; }
 	return (result.val == 1);
 }
@@ -3074,23 +3230,22 @@ bool universe_t::get_trajectory_collisions(line_query_state &lqs, s_object &resu
 			}
 			float asteroid_dist(ctest.dist);
 
-			// clusters
-			for (unsigned c = 0; c < galaxy.clusters.size(); ++c) {
-				ugalaxy::system_cluster const &cl(galaxy.clusters[c]);
-				if (!dist_less_than(curr, cl.center, (cl.bounds + dist))) continue;
-				if (!line_intersect_sphere(curr, dir, cl.center, (cl.bounds+line_radius), rdist, ldist, t)) continue;
-				
-				for (unsigned i = cl.s1; i < cl.s2; ++i) { // search for systems
-					float const s_radius(galaxy.sols[i].radius + MAX_PLANET_EXTENT);
-					if (!dist_less_than(curr, galaxy.sols[i].pos, (s_radius + dist))) continue;
-
-					if (line_intersect_sphere(curr, dir, galaxy.sols[i].pos, (s_radius+line_radius), rdist, ldist, t)) {
-						ctest.index = i; // line passes through system
-						ctest.dist  = ldist;
-						ctest.rad   = rdist;
-						ctest.t     = t;
-						sv.push_back(ctest);
-					}
+			// systems
+			vector<unsigned> &sys_ids(lqs.sys_ids);
+			sys_ids.resize(0);
+			galaxy.get_systems_near_line(curr, dir, dist, line_radius, sys_ids);
+
+			for (auto s = sys_ids.begin(); s != sys_ids.end(); ++s) {
+				unsigned const i(*s);
+				float const s_radius(galaxy.sols[i].radius + MAX_PLANET_EXTENT);
+				if (!dist_less_than(curr, galaxy.sols[i].pos, (s_radius + dist))) continue;
+
+				if (line_intersect_sphere(curr, dir, galaxy.sols[i].pos, (s_radius+line_radius), rdist, ldist, t)) {
+					ctest.index = i; // line passes through system
+					ctest.dist  = ldist;
+					ctest.rad   = rdist;
+					ctest.t     = t;
+					sv.push_back(ctest);
 				}
 			}
 			std::sort(sv.begin(), sv.end());
@@ -3352,6 +3507,7 @@ vector3d ustar::get_solar_wind_accel(point const &obj_pos, float obj_mass, float
 
 void urev_body::free_texture() { // and also free vbos
 
+	cancel_tex_job();
 	if (surface != nullptr) {surface->free_context();}
 	::free_texture(tid);
 	tsize = 0;
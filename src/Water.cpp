@@ -106,6 +106,90 @@ extern coll_obj_group coll_objects;
 extern water_params_t water_params;
 
 
+// bounding rectangle of mesh cells that may have nonzero ripple state; everything outside of it is calm and is skipped by the ripple solver
+struct ripple_region_t {
+
+	int x1, y1, x2, y2; // inclusive
+
+	ripple_region_t() {clear();}
+	void clear() {x1 = y1 = 0; x2 = y2 = -1;}
+	bool empty() const {return (x1 > x2 || y1 > y2);}
+	int width () const {return (x2 - x1 + 1);}
+	int height() const {return (y2 - y1 + 1);}
+	void set_all() {x1 = y1 = 0; x2 = MESH_X_SIZE-1; y2 = MESH_Y_SIZE-1;}
+	void add(int x, int y) {add_rect(x, y, x, y);}
+
+	void add_rect(int rx1, int ry1, int rx2, int ry2) {
+		if (rx1 > rx2 || ry1 > ry2) return; // empty
+		if (empty()) {x1 = rx1; y1 = ry1; x2 = rx2; y2 = ry2; return;}
+		x1 = min(x1, rx1); y1 = min(y1, ry1); x2 = max(x2, rx2); y2 = max(y2, ry2);
+	}
+	ripple_region_t expand_clamped(int d) const { // also clips to the current mesh size
+		ripple_region_t r;
+		if (empty()) return r;
+		r.x1 = max(x1-d, 0); r.y1 = max(y1-d, 0); r.x2 = min(x2+d, MESH_X_SIZE-1); r.y2 = min(y2+d, MESH_Y_SIZE-1);
+		return r;
+	}
+};
+
+
+// double buffer for compute_ripples(): the stencil reads neighbor heights and source masks from these flat arrays while it writes ripples[][]
+struct ripple_buffers_t {
+
+	ripple_region_t snap; // area covered by rvals and smask
+	vector<float> rvals, acc_next;
+	vector<unsigned short> smask; // inside8 bits of cells that emit ripples this step, 0 for all other cells
+	vector<int> row_x1, row_x2;
+	vector<unsigned char> row_active;
+	vector<pair<float, float> > calm_valley_levels; // {zval, depth} of each valley when calm water was last updated
+	float calm_wpz, calm_zbot, calm_def_level;
+	int calm_mode;
+
+	ripple_buffers_t() : calm_wpz(0.0), calm_zbot(0.0), calm_def_level(0.0), calm_mode(-1) {}
+	float get_rval(int i, int j) const {return rvals[(i - snap.y1)*snap.width() + (j - snap.x1)];}
+	unsigned short get_smask(int i, int j) const {return smask[(i - snap.y1)*snap.width() + (j - snap.x1)];}
+	void invalidate_calm() {calm_mode = -1;}
+
+	void take_snapshot(ripple_region_t const &snap_) {
+		snap = snap_;
+		int const sw(snap.width());
+		rvals.resize(sw*snap.height());
+		smask.resize(rvals.size());
+
+#pragma omp parallel for schedule(static,16) if (rvals.size() > 4096)
+		for (int i = snap.y1; i <= snap.y2; ++i) {
+			int const off((i - snap.y1)*sw - snap.x1);
+
+			for (int j = snap.x1; j <= snap.x2; ++j) {
+				bool const src(wminside[i][j] && water_matrix[i][j] >= z_min_matrix[i][j] /*&& get_water_enabled(j, i)*/);
+				if (src) {fix_fp_mag(ripples[i][j].rval);}
+				rvals[off+j] = ripples[i][j].rval;
+				smask[off+j] = (src ? watershed_matrix[i][j].inside8 : 0); // bit 0x01 is always set for water cells
+			}
+		}
+	}
+	bool calm_water_levels_changed(int mode) { // returns true if any water level that calm cells depend on has moved since the last call
+		bool changed(mode != calm_mode || calm_wpz != water_plane_z || calm_zbot != zbottom || calm_def_level != def_water_level || calm_valley_levels.size() != valleys.size());
+		calm_valley_levels.resize(valleys.size());
+
+		for (unsigned i = 0; i < valleys.size(); ++i) {
+			pair<float, float> const level(valleys[i].zval, valleys[i].depth);
+			if (calm_valley_levels[i] == level) continue;
+			calm_valley_levels[i] = level;
+			changed = 1;
+		}
+		calm_mode = mode;
+		calm_wpz  = water_plane_z;
+		calm_zbot = zbottom;
+		calm_def_level = def_water_level;
+		return changed;
+	}
+};
+
+ripple_region_t ripple_region;
+ripple_buffers_t rbuf;
+
+
 void calc_water_normals();
 void compute_ripples();
 void update_valleys_and_draw_spillover();
@@ -693,6 +777,159 @@ inline void update_water_edges(int i, int j) {
 }
 
 
+// slow path of the ripple stencil for cells on the mesh border, where some of the 8 neighbors don't exist
+float calc_edge_ripple_dacc(int i, int j, float &outflow) {
+
+	// {di, dj, bit of the neighbor's inside8 mask that points back at this cell}
+	static int const nbors[8][3] = {{0,-1,0x08}, {0,1,0x02}, {-1,0,0x10}, {1,0,0x04}, {-1,-1,0x80}, {-1,1,0x40}, {1,-1,0x100}, {1,1,0x20}};
+	float const rmij(rbuf.get_rval(i, j));
+	float inflow(0.0);
+	outflow = 0.0;
+
+	for (unsigned n = 0; n < 8; ++n) {
+		int const ii(i + nbors[n][0]), jj(j + nbors[n][1]);
+		if (point_outside_mesh(jj, ii)) continue;
+		float const dz((rmij - rbuf.get_rval(ii, jj))*((n < 4) ? 1.0f : SQRTOFTWOINV));
+		outflow += dz;
+		if (rbuf.get_smask(ii, jj) & nbors[n][2]) {inflow -= dz;}
+	}
+	return inflow;
+}
+
+
+// applies damping to the ripple at (i,j) and writes the resulting water surface height; returns the new ripple value
+inline float update_ripple_water_cell(int i, int j, float rval, float acc, float rm_atten, float rdamp1, float rdamp2, bool update_iter) {
+
+	float ripple_zval(0.0);
+
+	if (wminside[i][j]) {
+		float const zval(rdamp1*(rval + rdamp2*acc)); // ripple wave height
+		ripple_zval = ((fabs(zval) < TOLERANCE) ? 0.0 : zval); // prevent small floating point numbers
+	}
+	if (wminside[i][j] == 1) { // dynamic water
+		int const wsi(watershed_matrix[i][j].wsi);
+		assert(size_t(wsi) < valleys.size());
+
+		if (water_matrix[i][j] < z_min_matrix[i][j] && fabs(rval) < 1.0E-4 && fabs(acc) < 1.0E-4) { // under ground - no ripple
+			if (update_iter) {water_matrix[i][j] = valleys[wsi].zval;}
+			return rval;
+		}
+		float const depth(valleys[wsi].depth);
+
+		if (depth < 0) {
+			if (update_iter) {water_matrix[i][j] = valleys[wsi].zval;}
+			return rm_atten*rval;
+		}
+		float const zval(max(min(ripple_zval, depth), -depth)); // max ripple height equals water depth
+		water_matrix[i][j] = valleys[wsi].zval + zval;
+		return rm_atten*zval;
+	}
+	if (wminside[i][j] == 2) { // fixed water
+		water_matrix[i][j] = max((water_plane_z + min(MAX_RIPPLE_HEIGHT, ripple_zval)), zbottom);
+		return rm_atten*ripple_zval;
+	}
+	if (update_iter) {
+		if (get_water_enabled(j, i)) {update_water_edges(i, j);}
+		else {return 0.0;} // not sure if this is correct, or if there is something else that should be done here
+	}
+	return rval;
+}
+
+
+inline float mask_bit(unsigned short mask, unsigned short bit) {return ((mask & bit) ? 1.0f : 0.0f);}
+
+// one ripple step over the cells in proc; reads neighbor heights and source masks from rbuf and writes ripples[][] and water_matrix[][];
+// returns true if any source cell still has a significant accumulator, and shrinks ripple_region to the cells left with nonzero state
+bool step_ripple_region(ripple_region_t const &proc, float rm_atten, float rdamp1, float rdamp2, bool update_iter) {
+
+	int const sw(rbuf.snap.width()), pw(proc.width()), nrows(proc.height());
+	rbuf.acc_next.resize(pw*nrows);
+	rbuf.row_x1.resize(nrows);
+	rbuf.row_x2.resize(nrows);
+	rbuf.row_active.resize(nrows);
+
+#pragma omp parallel for schedule(static,8) if (pw*nrows > 4096)
+	for (int y = 0; y < nrows; ++y) {
+		int const i(proc.y1 + y);
+		float *const an(&rbuf.acc_next[y*pw] - proc.x1); // all row pointers are indexed by mesh x
+		float const *const r0(&rbuf.rvals[(i - rbuf.snap.y1)*sw] - rbuf.snap.x1);
+		unsigned short const *const m0(&rbuf.smask[(i - rbuf.snap.y1)*sw] - rbuf.snap.x1);
+		ripple_state *const rs(ripples[i]);
+		bool const int_row(i > 0 && i < MESH_Y_SIZE-1);
+		int const jx1(int_row ? max(proc.x1, 1) : proc.x2+1), jx2(min(proc.x2, MESH_X_SIZE-2)); // interior columns
+		unsigned active(0);
+
+		if (jx1 <= jx2) { // fast mode: all 8 neighbors are inside the mesh and the snapshot
+			float const *const rn(r0 - sw), *const rp(r0 + sw);
+			unsigned short const *const mn(m0 - sw), *const mp(m0 + sw);
+
+			for (int j = jx1; j <= jx2; ++j) {
+				float const rmij(r0[j]);
+				float const d0(rmij - r0[j-1]), d1(rmij - rn[j]), d2(rmij - r0[j+1]), d3(rmij - rp[j]);
+				float const d4(rmij - rn[j-1]), d5(rmij - rp[j-1]), d6(rmij - rp[j+1]), d7(rmij - rn[j+1]);
+				float const outflow(d0 + d1 + d2 + d3 + SQRTOFTWOINV*(d4 + d5 + d6 + d7));
+				// gather the transfers that source neighbors send to this cell; their dz is the negation of ours
+				float const inflow(-(mask_bit(m0[j-1], 0x08)*d0 + mask_bit(mn[j], 0x10)*d1 + mask_bit(m0[j+1], 0x02)*d2 + mask_bit(mp[j], 0x04)*d3 +
+					SQRTOFTWOINV*(mask_bit(mn[j-1], 0x80)*d4 + mask_bit(mp[j-1], 0x100)*d5 + mask_bit(mp[j+1], 0x20)*d6 + mask_bit(mn[j+1], 0x40)*d7)));
+				bool const src((m0[j] & 0x01) != 0);
+				float const acc_atten(rm_atten*rs[j].acc);
+				float acc((src ? (acc_atten - outflow) : rs[j].acc) + inflow);
+				fix_fp_mag(acc);
+				an[j] = acc;
+				active |= unsigned(src && fabs(acc_atten) > 1.0E-6);
+			}
+		}
+		for (int j = proc.x1; j <= proc.x2; ++j) { // border cells
+			if (jx1 <= jx2 && j == jx1) {j = jx2; continue;} // skip the interior span
+			bool const src((m0[j] & 0x01) != 0);
+			float const acc_atten(rm_atten*rs[j].acc);
+			float outflow(0.0);
+			float const inflow(calc_edge_ripple_dacc(i, j, outflow));
+			float acc((src ? (acc_atten - outflow) : rs[j].acc) + inflow);
+			fix_fp_mag(acc);
+			an[j] = acc;
+			active |= unsigned(src && fabs(acc_atten) > 1.0E-6);
+		}
+		int rx1(proc.x2+1), rx2(proc.x1-1);
+
+		for (int j = proc.x1; j <= proc.x2; ++j) {
+			rs[j].acc  = an[j];
+			rs[j].rval = update_ripple_water_cell(i, j, r0[j], an[j], rm_atten, rdamp1, rdamp2, update_iter);
+			if (rs[j].rval != 0.0 || rs[j].acc != 0.0) {rx1 = min(rx1, j); rx2 = max(rx2, j);}
+		}
+		rbuf.row_x1[y] = rx1;
+		rbuf.row_x2[y] = rx2;
+		rbuf.row_active[y] = (active != 0);
+	} // for y
+	bool any_active(0);
+
+	// cells outside proc were already calm, so the new active region is the union of the nonzero spans
+	for (int y = 0; y < nrows; ++y) {
+		ripple_region.add_rect(rbuf.row_x1[y], (proc.y1 + y), rbuf.row_x2[y], (proc.y1 + y));
+		any_active |= (rbuf.row_active[y] != 0);
+	}
+	return any_active;
+}
+
+
+// refreshes water_matrix for calm cells outside proc, but only when a water level they depend on has changed or on update_iter steps
+void update_calm_water(ripple_region_t const &proc, float rm_atten, float rdamp1, float rdamp2, bool update_iter) {
+
+	bool const changed(rbuf.calm_water_levels_changed(1));
+	if (!update_iter && !changed) return; // calm water is unchanged
+	
+#pragma omp parallel for schedule(static,16)
+	for (int i = 0; i < MESH_Y_SIZE; ++i) {
+		bool const in_proc(i >= proc.y1 && i <= proc.y2);
+
+		for (int j = 0; j < MESH_X_SIZE; ++j) {
+			if (in_proc && j == proc.x1) {j = proc.x2; continue;} // already updated by the ripple stencil
+			update_ripple_water_cell(i, j, 0.0, 0.0, rm_atten, rdamp1, rdamp2, update_iter); // ripple stays at zero
+		}
+	}
+}
+
+
 void compute_ripples() {
 
 	if (DISABLE_WATER) return;
@@ -703,138 +940,28 @@ void compute_ripples() {
 	if (temperature > W_FREEZE_POINT && (start_ripple || first_water_run)) {
 		float const tstep(max(fticks, 0.25f)); // ensure some min amount of damping to prevent unstable ripples when the framerate is very high
 		float const rm_atten(pow(RIPPLE_MAT_ATTEN, tstep)), rdamp1(pow(RIPPLE_DAMP1, tstep)), rdamp2(RIPPLE_DAMP2*tstep);
+		ripple_region_t const proc(ripple_region.expand_clamped(1)); // active cells plus the neighbors they can spread into
 		start_ripple = 0;
+		ripple_region.clear(); // recomputed by step_ripple_region()
 
-		for (int i = 0; i < MESH_Y_SIZE; ++i) {
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
-				if (!wminside[i][j] || water_matrix[i][j] < z_min_matrix[i][j] /*|| !get_water_enabled(j, i)*/) continue;
-				short const i8(watershed_matrix[i][j].inside8);
-				fix_fp_mag(ripples[i][j].rval);
-				float const rmij(ripples[i][j].rval);
-				float &acc(ripples[i][j].acc);
-				fix_fp_mag(acc);
-				acc *= rm_atten;
-				if (!start_ripple && fabs(acc) > 1.0E-6) start_ripple = 1;
-
-				// 00 0- -0 0+ +0 -- +- ++ -+  22  11
-				// 01 02 04 08 10 20 40 80 100 200 400
-				if (point_interior_to_mesh(j, i)) { // fast mode
-					float const d0( rmij - ripples[i  ][j-1].rval);
-					if (i8 & 0x02)  ripples[i  ][j-1].acc += d0;
-					float const d2( rmij - ripples[i  ][j+1].rval);
-					if (i8 & 0x08)  ripples[i  ][j+1].acc += d2;
-					float const d4((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x20)  ripples[i-1][j-1].acc += d4;
-					float const d1( rmij - ripples[i-1][j  ].rval);
-					if (i8 & 0x04)  ripples[i-1][j  ].acc += d1;
-					float const d7((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x100) ripples[i-1][j+1].acc += d7;
-					float const d5((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x40)  ripples[i+1][j-1].acc += d5;
-					float const d3( rmij - ripples[i+1][j  ].rval);
-					if (i8 & 0x10)  ripples[i+1][j  ].acc += d3;
-					float const d6((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
-					if (i8 & 0x80)  ripples[i+1][j+1].acc += d6;
-					acc -= d0 + d1 + d2 + d3 + d4 + d5 + d6 + d7;
-					fix_fp_mag(acc);
-					continue;
-				}
-				if (j > 0) {
-					float const dz(rmij - ripples[i][j-1].rval);
-					if (i8 & 0x02) ripples[i][j-1].acc += dz;
-					acc -= dz;
-
-					if (i > 0) {
-						float const dz((rmij - ripples[i-1][j-1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x20) ripples[i-1][j-1].acc += dz;
-						acc -= dz;
-					}
-					if (i < MESH_Y_SIZE-1) {
-						float const dz((rmij - ripples[i+1][j-1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x40) ripples[i+1][j-1].acc += dz;
-						acc -= dz;
-					}
-				}
-				if (i > 0) {
-					float const dz(rmij - ripples[i-1][j].rval);
-					if (i8 & 0x04) ripples[i-1][j].acc += dz;
-					acc -= dz;
-				}
-				if (j < MESH_X_SIZE-1) {
-					float const dz(rmij - ripples[i][j+1].rval);
-					if (i8 & 0x08) ripples[i][j+1].acc += dz;
-					acc -= dz;
-
-					if (i < MESH_Y_SIZE-1) {
-						float const dz((rmij - ripples[i+1][j+1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x80) ripples[i+1][j+1].acc += dz;
-						acc -= dz;
-					}
-					if (i > 0) {
-						float const dz((rmij - ripples[i-1][j+1].rval)*SQRTOFTWOINV);
-						if (i8 & 0x100) ripples[i-1][j+1].acc += dz;
-						acc -= dz;
-					}
-				}
-				if (i < MESH_Y_SIZE-1) {
-					float const dz(rmij - ripples[i+1][j].rval);
-					if (i8 & 0x10) ripples[i+1][j].acc += dz;
-					acc -= dz;
-				}
-				fix_fp_mag(acc);
-			} // for j
-		} // for i
-		if (DEBUG_RIPPLE_TIME) dtime1 += GET_DELTA_TIME;
-		
-		for (int i = 0; i < MESH_Y_SIZE; ++i) {
-			for (int j = 0; j < MESH_X_SIZE; ++j) {
-				float ripple_zval(0.0);
-
-				if (wminside[i][j]) {
-					float const zval(rdamp1*(ripples[i][j].rval + rdamp2*ripples[i][j].acc)); // ripple wave height
-					ripple_zval = ((fabs(zval) < TOLERANCE) ? 0.0 : zval); // prevent small floating point numbers
-				}
-				if (wminside[i][j] == 1) { // dynamic water
-					int const wsi(watershed_matrix[i][j].wsi);
-					assert(size_t(wsi) < valleys.size());
-
-					if (water_matrix[i][j] < z_min_matrix[i][j] && fabs(ripples[i][j].rval) < 1.0E-4 && fabs(ripples[i][j].acc) < 1.0E-4) { // under ground - no ripple
-						if (update_iter) water_matrix[i][j] = valleys[wsi].zval;
-						continue;
-					}
-					float const depth(valleys[wsi].depth);
-
-					if (depth < 0) {
-						ripples[i][j].rval *= rm_atten;
-						if (update_iter) water_matrix[i][j] = valleys[wsi].zval;
-						continue;
-					}
-					float const zval(max(min(ripple_zval, depth), -depth)); // max ripple height equals water depth
-					ripples[i][j].rval = rm_atten*zval;
-					water_matrix[i][j] = valleys[wsi].zval + zval;
-				}
-				else if (wminside[i][j] == 2) { // fixed water
-					ripples[i][j].rval = rm_atten*ripple_zval;
-					water_matrix[i][j] = water_plane_z + min(MAX_RIPPLE_HEIGHT, ripple_zval);
-					water_matrix[i][j] = max(water_matrix[i][j], zbottom);
-				}
-				else if (update_iter) {
-					if (get_water_enabled(j, i)) {
-						update_water_edges(i, j);
-					}
-					else {
-						ripples[i][j].rval = 0.0; // not sure if this is correct, or if there is something else that should be done here
-					}
-				}
-			} // for j
-		} // for i
+		if (!proc.empty()) {
+			rbuf.take_snapshot(proc.expand_clamped(1));
+			if (DEBUG_RIPPLE_TIME) dtime1 += GET_DELTA_TIME;
+			start_ripple = step_ripple_region(proc, rm_atten, rdamp1, rdamp2, update_iter);
+		}
+		update_calm_water(proc, rm_atten, rdamp1, rdamp2, update_iter);
 		if (DEBUG_RIPPLE_TIME) dtime2 += GET_DELTA_TIME;
 	}
 	else { // no ripple
-		matrix_clear_2d(ripples);
+		if (!ripple_region.empty()) {
+			matrix_clear_2d(ripples);
+			ripple_region.clear();
+		}
+		bool const changed(rbuf.calm_water_levels_changed(0));
 
 		// must clear ripples at least once at the beginning
-		if (NO_ICE_RIPPLES || counter == 0 || temperature > W_FREEZE_POINT) {
+		if ((NO_ICE_RIPPLES || counter == 0 || temperature > W_FREEZE_POINT) && (changed || update_iter || counter == 0)) {
+#pragma omp parallel for schedule(static,16)
 			for (int i = 0; i < MESH_Y_SIZE; ++i) {
 				for (int j = 0; j < MESH_X_SIZE; ++j) {
 					if (wminside[i][j] == 1) {
@@ -921,6 +1048,7 @@ void add_splash(point const &pos, int xpos, int ypos, float energy, float radius
 			if (((i - ypos)*(i - ypos) + (j - xpos)*(j - ypos)) <= radsq && wminside[i][j]) {ripples[i][j].rval += splash_size;}
 		}
 	}
+	ripple_region.add_rect(x1, y1, x2, y2);
 	start_ripple = 1;
 }
 
@@ -938,6 +1066,7 @@ void add_waves() { // add waves due to wind
 	static float wave_time(0.0);
 	wave_time += fticks_clamped;
 	if (wave_time > 4000.0) {wave_time = 0.0;} // reset at 4000 ticks (2 min. or so) to avoid FP error
+	vector<int> row_x1(MESH_Y_SIZE, MESH_X_SIZE), row_x2(MESH_Y_SIZE, -1); // range of ripples modified in each row
 	
 #pragma omp parallel for schedule(static,8) num_threads(2)
 	for (int y = 0; y < MESH_Y_SIZE; ++y) {
@@ -959,8 +1088,11 @@ void add_waves() { // add waves due to wind
 				ripples[y][x].rval += wval;
 			}
 			start_ripple = 1;
+			row_x1[y] = min(row_x1[y], x);
+			row_x2[y] = max(row_x2[y], x);
 		}
 	}
+	for (int y = 0; y < MESH_Y_SIZE; ++y) {ripple_region.add_rect(row_x1[y], y, row_x2[y], y);}
 	//PRINT_TIME("Add Waves");
 }
 
@@ -1077,16 +1209,34 @@ void update_valleys_and_draw_spillover() {
 
 	// check for spillover offscreen or into another pool
 	int const ijd[4][4] = {{0,1,0,1}, {0,-1,0,0}, {1,0,1,0}, {-1,0,0,0}};
+	static vector<vector<int> > spill_cands; // per-row cells that border dry land or a different pool
+	spill_cands.resize(MESH_Y_SIZE);
 
+	// only pool border cells can spill, so find them in parallel, then process them serially in the same order as a full scan
+#pragma omp parallel for schedule(static,16)
 	for (int i = 1; i < MESH_Y_SIZE-1; ++i) {
+		spill_cands[i].clear();
+
 		for (int j = 1; j < MESH_X_SIZE-1; ++j) {
 			if (wminside[i][j] != 1) continue;
 			int const wsi(watershed_matrix[i][j].wsi);
+			if (valleys[wsi].zval < z_min_matrix[i][j]) continue;
+
+			for (unsigned k = 0; k < 4; ++k) {
+				int const ii(i+ijd[k][0]), jj(j+ijd[k][1]);
+				if (wminside[ii][jj] == 1 && watershed_matrix[ii][jj].wsi == wsi) continue; // same pool
+				spill_cands[i].push_back(j);
+				break;
+			}
+		}
+	}
+	for (int i = 1; i < MESH_Y_SIZE-1; ++i) {
+		for (auto j = spill_cands[i].begin(); j != spill_cands[i].end(); ++j) {
+			int const wsi(watershed_matrix[i][*j].wsi);
 			float const zval(valleys[wsi].zval);
-			if (zval < z_min_matrix[i][j]) continue;
 
 			for (unsigned k = 0; k < 4; ++k) {
-				check_spillover(i+ijd[k][0], j+ijd[k][1], i+ijd[k][2], j+ijd[k][3], i, j, zval, wsi);
+				check_spillover(i+ijd[k][0], *j+ijd[k][1], i+ijd[k][2], *j+ijd[k][3], i, *j, zval, wsi);
 			}
 		}
 	}
@@ -1355,6 +1505,7 @@ void calc_watershed() {
 	calc_water_flow();
 	init_water_springs(NUM_WATER_SPRINGS);
 	matrix_clear_2d(ripples);
+	ripple_region.clear();
 	first_water_run = 1;
 
 	for (int i = 0; i < MESH_Y_SIZE; ++i) {
@@ -1459,14 +1610,20 @@ void calc_water_flow() {
 	}
 	valleys.clear();
 	spill.clear();
+	rbuf.invalidate_calm(); // valley indices may have changed
+	vector<vector<int> > row_minima(MESH_Y_SIZE);
 
+#pragma omp parallel for schedule(static,16)
 	for (int i = 0; i < MESH_Y_SIZE; ++i) {
+		vector<int> &rm(row_minima[i]);
+
 		for (int j = 0; j < MESH_X_SIZE; ++j) {
 			if (wminside[i][j] != 1) continue;
 			int const wmij(watershed_matrix[i][j].x + MESH_X_SIZE*watershed_matrix[i][j].y);
-			if (minima.empty() || wmij != minima.back()) minima.push_back(wmij);
+			if (rm.empty() || wmij != rm.back()) rm.push_back(wmij);
 		}
 	}
+	for (int i = 0; i < MESH_Y_SIZE; ++i) {minima.insert(minima.end(), row_minima[i].begin(), row_minima[i].end());}
 	unsigned const msize((unsigned)minima.size());
 	if (msize == 0) return;
 	std::sort(minima.begin(), minima.end());
@@ -1489,12 +1646,14 @@ void calc_water_flow() {
 	}
 	spill.init((unsigned)valleys.size());
 	vector<int> vmap(XY_MULT_SIZE, 0);
+	int num_watershed(0);
 
 	for (unsigned k = 0; k < valleys.size(); ++k) {
 		int const index(valleys[k].x + MESH_X_SIZE*valleys[k].y);
 		assert(index < XY_MULT_SIZE);
 		vmap[index] = k+1;
 	}
+#pragma omp parallel for schedule(static,16) reduction(+:num_watershed)
 	for (int i = 0; i < MESH_Y_SIZE; ++i) {
 		for (int j = 0; j < MESH_X_SIZE; ++j) {
 			if (wminside[i][j] == 1) {
@@ -1507,13 +1666,14 @@ void calc_water_flow() {
 				else {
 					watershed_matrix[i][j].wsi = vmap[index]-1;
 				}
-				++total_watershed;
+				++num_watershed;
 			}
 			else {
 				watershed_matrix[i][j].wsi = -1; // invalid
 			}
 		}
 	}
+	total_watershed = num_watershed;
 	for (unsigned i = 0; i < wsections.size(); ++i) {
 		int const x1(max(0, wsections[i].x1)), y1(max(0, wsections[i].y1));
 		int const x2(min(MESH_X_SIZE-1, wsections[i].x2)), y2(min(MESH_Y_SIZE-1, wsections[i].y2));
@@ -1629,6 +1789,7 @@ void make_outside_water(int x, int y) {
 	wminside[y][x] = 2; // make outside water (anything else we need to update? what if all of a valley disappears?)
 	watershed_matrix[y][x].wsi = -1; // invalid
 	water_matrix[y][x] = water_plane_z; // may be unnecessary
+	ripple_region.add(x, y); // let the ripple solver update this cell
 }
 
 
@@ -141,7 +141,7 @@ bool fish_t::update(rand_gen_t &rgen, tile_t const *const tile) {
 		if (speed > FISH_SPEED) { // moving fast
 			velocity *= pow(0.96f, fticks); // slow down
 		}
-		else if ((rand() & 127) == 0) { // randomly update direction
+		else if ((rgen.rand() & 127) == 0) { // randomly update direction
 			dir += rgen.signed_rand_vector_xy(0.25); // 25% change max
 			dir.normalize();
 			velocity = dir * speed; // always flies in the direction it's pointed in
@@ -163,7 +163,7 @@ bool bird_t::update(rand_gen_t &rgen, tile_t const *const tile) { // Note: tile
 
 	if (!enabled || !animate2 || !birds_active()) return 0;
 
-	if (!flocking && (rand() & 1) == 0) { // randomly update direction
+	if (!flocking && (rgen.rand() & 1) == 0) { // randomly update direction
 		float const speed(velocity.mag());
 		dir += rgen.signed_rand_vector_xy(0.05); // 5% change max
 		dir.normalize();
@@ -184,44 +184,102 @@ void bird_t::apply_force_xy_const_vel(vector3d const &force) {
 	flocking = 1;
 }
 
+void flock_grid_t::clear() {
+	px.clear(); py.clear(); vx.clear(); vy.clear();
+	for (unsigned i = 0; i <= NUM_CELLS; ++i) {cell_start[i] = 0;}
+}
+
+void flock_grid_t::build(vector<bird_t> const &birds, cube_t const &tile_bcube) { // counting sort of enabled birds into cells
+
+	clear();
+	if (birds.empty()) return;
+	float const cx_scale(GRID_SZ/tile_bcube.dx()), cy_scale(GRID_SZ/tile_bcube.dy());
+	vector<unsigned char> cixs(birds.size(), NUM_CELLS); // NUM_CELLS = disabled
+	unsigned counts[NUM_CELLS] = {0};
+
+	for (unsigned i = 0; i < birds.size(); ++i) {
+		bird_t const &b(birds[i]);
+		if (!b.is_enabled()) continue;
+		// birds that have left the tile but not yet migrated are clamped to the edge cells
+		int const cx(max(0, min(int(GRID_SZ)-1, int(floor((b.pos.x - tile_bcube.x1())*cx_scale)))));
+		int const cy(max(0, min(int(GRID_SZ)-1, int(floor((b.pos.y - tile_bcube.y1())*cy_scale)))));
+		cixs[i] = (unsigned char)(cy*GRID_SZ + cx);
+		++counts[cixs[i]];
+	}
+	for (unsigned c = 0; c < NUM_CELLS; ++c) {cell_start[c+1] = cell_start[c] + counts[c];}
+	unsigned const num(cell_start[NUM_CELLS]);
+	px.resize(num); py.resize(num); vx.resize(num); vy.resize(num);
+	unsigned ins_pos[NUM_CELLS];
+	for (unsigned c = 0; c < NUM_CELLS; ++c) {ins_pos[c] = cell_start[c];}
+
+	for (unsigned i = 0; i < birds.size(); ++i) {
+		if (cixs[i] == NUM_CELLS) continue; // disabled
+		unsigned const ix(ins_pos[cixs[i]]++);
+		bird_t const &b(birds[i]);
+		px[ix] = b.pos.x; py[ix] = b.pos.y; vx[ix] = b.velocity.x; vy[ix] = b.velocity.y;
+	}
+}
+
+void vect_bird_t::build_flock_grid(tile_t const *const tile) {
+	grid.build(*this, tile->get_mesh_bcube_global());
+}
+
 void vect_bird_t::flock(tile_t const *const tile) { // boids
 
-	// Note: this is per-tile
+	// Note: this is per-tile, and reads neighbor positions/velocities from the flock grids of this tile and its 8 neighbors,
+	// which must all be built before any tile flocks; this makes flocking independent of tile update order and thread count
 	// see https://www.blog.drewcutchins.com/blog/2018-8-16-flocking
 	//if (display_mode & 0x10) return; // TESTING
 	if (!animate2 || this->empty()) return;
+	int const G(flock_grid_t::GRID_SZ);
 	float const neighbor_dist(0.5*get_tile_width()), nd_sq(neighbor_dist*neighbor_dist);
 	float const sep_dist_sq(0.2*nd_sq), cohesion_dist_sq(0.3*nd_sq), align_dist_sq(0.25*nd_sq);
 	float const mass(100.0), sep_strength(0.05), cohesion_strength(0.05), align_strength(0.5);
+	cube_t const bcube(tile->get_mesh_bcube_global());
+	float const cx_scale(G/bcube.dx()), cy_scale(G/bcube.dy()), cell_sz(min(bcube.dx(), bcube.dy())/G);
+	assert(max(sep_dist_sq, max(cohesion_dist_sq, align_dist_sq)) <= cell_sz*cell_sz); // 3x3 cell query must cover all neighbors
 	tile_xy_pair const tp(tile->get_tile_xy_pair());
+	flock_grid_t const *grids[3][3] = {}; // [dy+1][dx+1]
 
+	for (int dy = -1; dy <= 1; ++dy) {
+		for (int dx = -1; dx <= 1; ++dx) {
+			tile_t const *const adj_tile((dx == 0 && dy == 0) ? tile : get_tile_from_xy(tile_xy_pair(tp.x + dx, tp.y + dy)));
+			if (adj_tile) {grids[dy+1][dx+1] = &adj_tile->get_birds().grid;}
+		}
+	}
 	for (auto i = this->begin(); i != this->end(); ++i) {
 		if (!i->is_enabled()) continue;
-		vector3d sep_force(zero_vector), avg_pos(zero_vector), avg_vel(zero_vector), tot_force(zero_vector);
+		float const pxi(i->pos.x), pyi(i->pos.y);
+		// cell relative to this tile's grid; may be -1 or G if the bird has left the tile but not yet migrated
+		int const gx(max(-1, min(G, int(floor((pxi - bcube.x1())*cx_scale))))), gy(max(-1, min(G, int(floor((pyi - bcube.y1())*cy_scale)))));
+		float fx(0.0), fy(0.0), apx(0.0), apy(0.0), avx(0.0), avy(0.0);
 		unsigned pcount(0), vcount(0);
 
-		for (int dy = -1; dy <= 1; ++dy) {
-			for (int dx = -1; dx <= 1; ++dx) {
-				tile_t *const adj_tile(get_tile_from_xy(tile_xy_pair(tp.x + dx, tp.y + dy))); // Note: could cache this if needed
-				if (!adj_tile) continue;
-				vect_bird_t &birds(adj_tile->get_birds());
-
-				for (auto j = birds.begin(); j != birds.end(); ++j) {
-					if (!j->is_enabled()) continue;
-					if (i == j) continue; // skip self
-					float const dxy_sq(p2p_dist_xy_sq(i->pos, j->pos)); // Note: ignores zval
-
-					if (dxy_sq < sep_dist_sq) { // separation
-						vector3d const delta(i->pos - j->pos), sep_force(delta/dxy_sq); // force decreases with distance
-						tot_force += sep_force*sep_strength;
-					}
-					if (dxy_sq < cohesion_dist_sq) {avg_pos += j->pos;      ++pcount;}
-					if (dxy_sq < align_dist_sq   ) {avg_vel += j->velocity; ++vcount;}
+		for (int cy = gy-1; cy <= gy+1; ++cy) {
+			int const ty((cy < 0) ? -1 : ((cy >= G) ? 1 : 0));
+
+			for (int cx = gx-1; cx <= gx+1; ++cx) {
+				int const tx((cx < 0) ? -1 : ((cx >= G) ? 1 : 0));
+				flock_grid_t const *const g(grids[ty+1][tx+1]);
+				if (!g) continue;
+				unsigned const lcx(cx - tx*G), lcy(cy - ty*G), s(g->get_cell_start(lcx, lcy)), e(g->get_cell_end(lcx, lcy));
+				float const *const px(g->px.data()), *const py(g->py.data()), *const vx(g->vx.data()), *const vy(g->vy.data());
+
+#pragma omp simd reduction(+:fx,fy,apx,apy,avx,avy,pcount,vcount)
+				for (unsigned j = s; j < e; ++j) {
+					float const dx(pxi - px[j]), dy(pyi - py[j]), dxy_sq(dx*dx + dy*dy); // Note: ignores zval
+					bool const other(dxy_sq > 0.0f); // skip self (and exactly coincident birds)
+					float const sep_scale((other && dxy_sq < sep_dist_sq) ? sep_strength/dxy_sq : 0.0f); // separation; force decreases with distance
+					bool const coh(other && dxy_sq < cohesion_dist_sq), aln(other && dxy_sq < align_dist_sq);
+					fx  += sep_scale*dx; fy += sep_scale*dy;
+					apx += (coh ? px[j] : 0.0f); apy += (coh ? py[j] : 0.0f); pcount += coh;
+					avx += (aln ? vx[j] : 0.0f); avy += (aln ? vy[j] : 0.0f); vcount += aln;
 				} // for j
-			} // for dx
-		} // for dy
-		if (pcount > 0) {tot_force += (avg_pos/pcount - i->pos)*cohesion_strength;} // cohesion
-		if (vcount > 0) {tot_force += avg_vel*(align_strength/vcount);} // alignment
+			} // for cx
+		} // for cy
+		vector3d tot_force(fx, fy, 0.0);
+		if (pcount > 0) {tot_force += vector3d((apx/pcount - pxi), (apy/pcount - pyi), 0.0)*cohesion_strength;} // cohesion
+		if (vcount > 0) {tot_force += vector3d(avx, avy, 0.0)*(align_strength/vcount);} // alignment
 		if (tot_force != zero_vector) {i->apply_force_xy_const_vel(tot_force/mass);}
 	} // for i
 }
@@ -71,6 +71,20 @@ public:
 	void draw(shader_t &s) const;
 };
 
+class flock_grid_t { // per-tile spatial hash of enabled bird positions/velocities in SoA form, for flocking neighbor queries
+public:
+	static unsigned const GRID_SZ = 3; // cells per tile in x and y; cell size must be >= the max flocking query distance
+	static unsigned const NUM_CELLS = GRID_SZ*GRID_SZ;
+	vector<float> px, py, vx, vy; // sorted by cell; xy only since flocking ignores zval
+	unsigned cell_start[NUM_CELLS+1]; // index of the first bird in each cell; last entry is the total count
+
+	flock_grid_t() {clear();}
+	void clear();
+	void build(vector<bird_t> const &birds, cube_t const &tile_bcube);
+	unsigned get_cell_start(unsigned cx, unsigned cy) const {return cell_start[cy*GRID_SZ + cx];}
+	unsigned get_cell_end  (unsigned cx, unsigned cy) const {return cell_start[cy*GRID_SZ + cx + 1];}
+};
+
 
 class animal_group_base_t {
 protected:
@@ -101,6 +115,9 @@ struct vect_fish_t : public animal_group_t<fish_t> {
 };
 
 struct vect_bird_t : public animal_group_t<bird_t> {
+	flock_grid_t grid; // snapshot of this tile's birds, built for all tiles before any tile flocks
+
+	void build_flock_grid(tile_t const *const tile);
 	void flock(tile_t const *const tile);
 	static void begin_draw(shader_t &s);
 	static void end_draw(shader_t &s);
@@ -17,11 +17,11 @@ public:
 	binary_file_io() : fp(nullptr), gzf(nullptr) {}
 	~binary_file_io() {close();}
 
-	bool open(string const &filename, char const *const mode, string const &purpose) {
+	bool open(string const &filename, char const *const mode, string const &purpose, bool quiet=0) {
 		if (filename.empty()) return 0;
 		if (is_gz_file(filename)) {gzf = gzopen(filename.c_str(), mode);} else {fp = fopen(filename.c_str(), mode);}
 		if (is_valid()) return 1;
-		std::cerr << "Failed to open file " << filename << " for " << purpose << ".";
+		if (!quiet) std::cerr << "Failed to open file " << filename << " for " << purpose << ".";
 		return 0;
 	}
 	bool is_valid() const {return (fp || gzf);}
@@ -34,7 +34,7 @@ public:
 };
 
 struct binary_file_reader : public binary_file_io {
-	bool open(string const &filename) {return binary_file_io::open(filename, "rb", "reading");}
+	bool open(string const &filename, bool quiet=0) {return binary_file_io::open(filename, "rb", "reading", quiet);} // quiet: missing files are expected
 
 	bool read(void *ptr, size_t sz, size_t count) {
 		if      (fp ) {return (fread (ptr, sz, count, fp) == count);}
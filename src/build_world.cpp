@@ -52,10 +52,10 @@ extern bool clear_landscape_vbo, use_voxel_cobjs, tree_4th_branches, lm_alloc, r
 extern int camera_view, camera_mode, camera_reset, animate2, recreated, temp_change, preproc_cube_cobjs, precip_mode;
 extern int is_cloudy, num_smileys, load_coll_objs, world_mode, start_ripple, has_snow_accum, has_accumulation, scrolling, num_items, camera_coll_id;
 extern int num_dodgeballs, display_mode, game_mode, num_trees, tree_mode, has_scenery2, UNLIMITED_WEAPONS, ground_effects_level;
-extern float temperature, zmin, TIMESTEP, base_gravity, orig_timestep, fticks, tstep, sun_rot, czmax, czmin, dodgeball_metalness;
+extern float temperature, zmin, TIMESTEP, base_gravity, fticks, tstep, sun_rot, czmax, czmin, dodgeball_metalness;
 extern double camera_zh;
 extern point cpos2, orig_camera, orig_cdir;
-extern unsigned create_voxel_landscape, scene_smap_vbo_invalid, num_dynam_parts, max_num_mat_spheres, init_item_counts[];
+extern unsigned coll_change_counter, create_voxel_landscape, scene_smap_vbo_invalid, num_dynam_parts, max_num_mat_spheres, init_item_counts[];
 extern obj_type object_types[];
 extern string cobjs_out_fn;
 extern coll_obj_group coll_objects;
@@ -281,6 +281,61 @@ bool check_player_proximity(point const &pos, float radius, bool use_bottom) {
 }
 
 
+unsigned get_obj_steps_per_frame(dwobject const &obj, int type, unsigned group_flags, bool large_radius) {
+
+	if (obj.flags & CAMERA_VIEW) return 4*LG_STEPS_PER_FRAME; // smaller timesteps if camera view
+	if (type == PLASMA || type == BALL || type == SAWBLADE) return 3*LG_STEPS_PER_FRAME;
+	if (is_rocket_type(type)) return 2*LG_STEPS_PER_FRAME;
+	if (large_radius /*|| type == STAR5 || type == SHELLC*/ || type == FRAGMENT) return LG_STEPS_PER_FRAME;
+	if (type == SHRAPNEL) return max(1, min(((obj.direction == W_GRENADE) ? 4 : 20), int(0.2*obj.velocity.mag())));
+	if (type == PRECIP || (group_flags & PRECIPITATION)) return 1;
+	return SM_STEPS_PER_FRAME;
+}
+
+bool obj_needs_line_coll(dwobject const &obj, unsigned spf) {
+	return (MORE_COLL_TSTEPS && obj.status == 1 && spf < LG_STEPS_PER_FRAME && obj.pos.z < czmax && obj.pos.z > czmin);
+}
+
+int get_obj_line_coll_cindex(dwobject const &obj, float time, float grav_dz, float radius) {
+
+	int cindex(-1);
+	point pos2(obj.pos + obj.velocity*time); // makes precipitation slower, but collision detection is more correct
+	pos2.z -= grav_dz; // maybe want to try with and without this?
+	// Note: we only do the line intersection test if the object moves by more than its radius this frame (static leaves don't)
+	// Note: could also test pos.z > v_collision_matrix[y][x].zmax
+	if (!dist_less_than(obj.pos, pos2, radius)) {check_coll_line(obj.pos, pos2, cindex, -1, 0, 0);} // return value is unused
+	return cindex;
+}
+
+
+struct obj_prepass_t { // computed in parallel before the serial object advance; only used if neither the object nor the collision state has changed since
+	dwobject next; // result of advance_free_flight(), if advanced
+	point pos;
+	vector3d vel;
+	int cindex, time;
+	short type, flags;
+	bool valid, advanced;
+	obj_prepass_t() : cindex(-1), time(0), type(0), flags(0), valid(0), advanced(0) {}
+	bool matches(dwobject const &obj) const {
+		return (valid && obj.status == 1 && obj.pos == pos && obj.velocity == vel && obj.time == time && obj.type == type && obj.flags == flags);
+	}
+};
+
+
+bool advance_obj_free_flight(dwobject &obj, unsigned spf) { // same steps as the advance_object() calls in process_groups()
+
+	if (spf == 1) return obj.advance_free_flight(0, tstep);
+	float const substep(tstep/float(spf));
+	point const obj_pos(obj.pos);
+
+	for (unsigned k = 0; k < spf; ++k) {
+		if (!obj.advance_free_flight(k, substep)) return 0;
+		if (obj.pos == obj_pos) break; // stopped
+	}
+	return 1;
+}
+
+
 void object_line_coll(dwobject &obj, point const &old_pos, float radius, unsigned obj_index, int &cindex) {
 
 	vector3d cnorm(zero_vector);
@@ -292,7 +347,7 @@ void object_line_coll(dwobject &obj, point const &old_pos, float radius, unsigne
 		obj.flags |= OBJ_COLLIDED;
 		obj.pos    = cpos; // move it to collision point
 		bool coll(0);
-		if (cindex >= 0) coll     = (obj.check_vert_collision(obj_index, 1, 0, NULL, all_zeros, 0, 0, cindex) != 0);
+		if (cindex >= 0) coll     = (obj.check_vert_collision(obj_index, 1, 0, tstep, NULL, all_zeros, 0, 0, cindex) != 0);
 		if (!coll)       obj.pos += cnorm*(0.99*radius); // move so it only slightly collides
 		assert(!is_nan(obj.pos));
 	}
@@ -327,6 +382,7 @@ void process_groups() {
 	camera_follow = 0;
 	build_cobj_tree(1, 0); // could also do after group processing
 	cur_frame_explosions.clear();
+	static vector<obj_prepass_t> prepass;
 	
 	for (int i = 0; i < num_groups; ++i) {
 		obj_group &objg(obj_groups[i]);
@@ -387,7 +443,36 @@ void process_groups() {
 		if (reflective) {cp.metalness = dodgeball_metalness; cp.tscale = 0.0; cp.color = WHITE; cp.spec_color = WHITE; cp.shine = 100.0;} // reflective metal sphere
 		size_t const iter_count((large_radius || type == MAT_SPHERE || app_rate > 0) ? max_objs : objg.end_id); // optimization to use end_id when valid
 		bool defer_remove_cobj(0);
-
+		unsigned const prepass_counter(coll_change_counter);
+		prepass.clear();
+
+		// airborne objects that won't hit anything this frame are advanced in parallel on copies, along with the read-only cobj line queries;
+		// objects that may collide are advanced serially below, since collisions apply callbacks, damage, sounds, decals, splashes, and spawns;
+		// large radius objects add dynamic cobjs, and smileys are processed in a rotated order, so they're handled serially
+		if (!large_radius && type != SMILEY && iter_count >= 64) {
+			prepass.resize(iter_count);
+
+#pragma omp parallel for schedule(dynamic,64)
+			for (int j = 0; j < (int)iter_count; ++j) {
+				dwobject const &obj(objg.get_obj(j));
+				if (obj.status != 1 || obj.time < 0 || obj.health < 0.0 || !is_over_mesh(obj.pos)) continue;
+				if ((obj.flags & XY_STOPPED) && (obj.flags & Z_STOPPED)) continue;
+				if (type == PLASMA && obj.velocity.mag_sq() < 1.0) continue; // will be disabled
+				unsigned const spf(get_obj_steps_per_frame(obj, type, flags, large_radius));
+				obj_prepass_t &pp(prepass[j]);
+				pp.pos   = obj.pos;
+				pp.vel   = obj.velocity;
+				pp.time  = obj.time;
+				pp.type  = obj.type;
+				pp.flags = (obj.flags & ~PLATFORM_COLL); // cleared before the advance
+				pp.valid = 1;
+				if (obj_needs_line_coll(obj, spf)) {pp.cindex = get_obj_line_coll_cindex(obj, time, grav_dz, radius);}
+				if (pp.cindex >= 0) continue; // may hit this cobj
+				pp.next       = obj;
+				pp.next.flags = pp.flags;
+				pp.advanced   = advance_obj_free_flight(pp.next, spf);
+			}
+		}
 		for (size_t jj = 0; jj < iter_count; ++jj) {
 			unsigned const j(unsigned((type == SMILEY) ? (jj + scounter)%max_objs : jj)); // handle smiley permutation
 			dwobject &obj(objg.get_obj(j));
@@ -470,40 +555,32 @@ void process_groups() {
 
 						// What about rolling objects (type_flags & OBJ_ROLLS) on the ground (status == 3)?
 						if (obj.status == 1 && is_over_mesh(pos) && !((obj_flags & XY_STOPPED) && (obj_flags & Z_STOPPED))) {
-							if (obj.flags & CAMERA_VIEW) {spf = 4*LG_STEPS_PER_FRAME;} // smaller timesteps if camera view
-							else if (type == PLASMA || type == BALL || type == SAWBLADE) {spf = 3*LG_STEPS_PER_FRAME;}
-							else if (is_rocket_type(type)) {spf = 2*LG_STEPS_PER_FRAME;}
-							else if (large_radius /*|| type == STAR5 || type == SHELLC*/ || type == FRAGMENT) {spf = LG_STEPS_PER_FRAME;}
-							else if (type == SHRAPNEL) {spf = max(1, min(((obj.direction == W_GRENADE) ? 4 : 20), int(0.2*obj.velocity.mag())));}
-							else if (type == PRECIP || (flags & PRECIPITATION)) {spf = 1;}
-							else {spf = SM_STEPS_PER_FRAME;}
-
-							if (MORE_COLL_TSTEPS && obj.status == 1 && spf < LG_STEPS_PER_FRAME && pos.z < czmax && pos.z > czmin) {
-								point pos2(pos + obj.velocity*time); // makes precipitation slower, but collision detection is more correct
-								pos2.z -= grav_dz; // maybe want to try with and without this?
-								// Note: we only do the line intersection test if the object moves by more than its radius this frame (static leaves don't)
-								// Note: could also test pos.z > v_collision_matrix[y][x].zmax
-								if (!dist_less_than(pos, pos2, radius)) {check_coll_line(pos, pos2, cindex, -1, 0, 0);} // return value is unused
-							}
+							spf = get_obj_steps_per_frame(obj, type, flags, large_radius);
 							assert(spf > 0);
+							// cobjs or the mesh may have changed since the prepass due to collisions of earlier objects
+							bool const precomputed(j < prepass.size() && prepass[j].matches(obj) && coll_change_counter == prepass_counter);
 
+							if (precomputed && prepass[j].advanced) { // free flight
+								obj = prepass[j].next;
+								spf = 0; // already advanced
+							}
+							else if (obj_needs_line_coll(obj, spf)) {
+								if (precomputed) {cindex = prepass[j].cindex;}
+								else {cindex = get_obj_line_coll_cindex(obj, time, grav_dz, radius);} // teleported, collided, or not precomputed
+							}
 							if (spf > 1) {
 								assert(fticks > 0.0);
-								orig_timestep = TIMESTEP; // incremental multistep object advance
-								TIMESTEP     /= float(spf);
-								tstep         = TIMESTEP*fticks;
+								float const substep(tstep/float(spf)); // incremental multistep object advance
 								point const obj_pos(obj.pos);
 								
 								for (unsigned k = 0; k < spf; ++k) {
-									obj.advance_object(!recreated, k, j);
+									obj.advance_object(!recreated, k, j, substep);
 									if (obj.status != 1)    break; // no longer airborne
 									if (obj.pos == obj_pos) break; // stopped
 								}
-								TIMESTEP = orig_timestep;
-								tstep    = time;
 							}
 						}
-						if (spf == 1) {obj.advance_object(!recreated, 0, j);}
+						if (spf == 1) {obj.advance_object(!recreated, 0, j, tstep);}
 						obj.verify_data();
 						
 						if (!obj.disabled() && cindex >= 0 && !large_radius && spf < LG_STEPS_PER_FRAME) { // test collision with this cobj
@@ -730,6 +807,8 @@ void coll_obj::shift_by(vector3d const &vd, bool force, bool no_texture_offset)
 	if (!no_texture_offset && cp.tscale != 0.0 && !was_a_cube()) {texture_offset -= vd;}
 	if (cgroup_id >= 0) {cobj_groups.invalidate_group(cgroup_id);} // force recompute of center of mass, etc.
 	if (is_movable()) {last_coll = 8;} // mark as moving/collided to prevent the physics system from putting this cobj to sleep
+	if (status == COLL_STATIC && id >= 0) {update_static_cobj_tree_bounds(id);}
+	++coll_change_counter;
 }
 
 void coll_obj::move_cobj(vector3d const &vd, bool update_colls) {
@@ -877,6 +956,7 @@ void add_all_coll_objects(const char *coll_obj_file, bool re_add) {
 		if (has_scenery2) {add_scenery_cobjs();}
 	}
 	bool const verbose(!scrolling);
+	compact_coll_cells(); // pack the static cobjs added above
 	if (verbose) {cobj_stats();}
 	pre_rt_bvh_build_hook(); // required for light ray tracing so that BVH nodes are properly expanded
 	build_cobj_tree(0, verbose);
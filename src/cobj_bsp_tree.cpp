@@ -4,19 +4,28 @@
 
 #include "3DWorld.h"
 #include "cobj_bsp_tree.h"
+#include "model3d.h" // for check_coll_line_batch()
+#include "mesh.h" // for v_collision_matrix
+#include <cfloat> // for FLT_MAX
 
 
 unsigned const MAX_LEAF_SIZE = 2;
 float const POLY_TOLER       = 1.0E-6;
+float const LEAF_BCUBE_TOLER = 1.0E-5; // keeps cached leaf bounds conservative, and nonzero in size for axis aligned polygons
 float const OVERLAP_AMT      = 0.02;
+unsigned const NO_LEAF_IX    = ~0U; // cobj_leaf_ixs value for cobjs not in the tree
+unsigned const DROP_RAY_BATCH_SIZE = 64; // rays per shared BVH traversal in check_drop_rays_batch()
+unsigned const DROP_RAY_MAX_CELLS  = 16; // rays spanning more mesh cells than this skip the empty cell test
 
 
-extern bool mt_cobj_tree_build, begin_motion;
+extern bool mt_cobj_tree_build, cobj_tree_benchmark, begin_motion; // cobj_tree_benchmark: print static BVH query rates after each static rebuild
 extern int display_mode, frame_counter, cobj_counter;
+extern unsigned coll_change_counter;
 extern coll_obj_group coll_objects;
 extern vector<unsigned> falling_cobjs;
 extern set<unsigned> moving_cobjs;
 extern platform_cont platforms;
+extern model3ds all_models;
 
 
 // *** coll_tquad / tquad_t ***
@@ -317,6 +326,23 @@ bool cobj_tree_tquads_t::check_coll_line(point const &p1, point const &p2, point
 }
 
 
+void cobj_tree_tquads_t::check_coll_line_batch(vector<batch_ray_t> &rays) const { // exact, closest hit; doesn't return color
+
+	traverse_ray_batch(rays, [&](tree_node const &n, unsigned r, node_ix_mgr &nixm) {
+		batch_ray_t &ray(rays[r]);
+		float t(0.0);
+		vector3d cnorm;
+
+		for (unsigned i = n.start; i < n.end; ++i) {
+			if (!objects[i].line_int_exact(ray.p1, ray.p2, t, cnorm, 0.0, ray.tmax)) continue;
+			ray.register_hit(t, cnorm, -1);
+			nixm.dinv = vector3d(ray.cpos - ray.p1);
+			nixm.dinv.invert();
+		}
+	});
+}
+
+
 // *** cobj_tree_sphere_t ***
 
 
@@ -361,6 +387,30 @@ void cobj_tree_sphere_t::get_ids_int_sphere(point const &center, float radius, v
 }
 
 
+void cobj_tree_sphere_t::get_ids_int_line(point const &p1, point const &p2, float line_radius, vector<unsigned> &ids) const {
+
+	if (objects.empty()) return;
+	unsigned const num_nodes((unsigned)nodes.size());
+
+	for (unsigned nix = 0; nix < num_nodes;) {
+		tree_node const &n(nodes[nix]);
+		assert(n.start <= n.end);
+		cube_t bcube(n);
+		bcube.expand_by(line_radius);
+
+		if (!check_line_clip(p1, p2, bcube.d)) {
+			assert(n.next_node_id > nix);
+			nix = n.next_node_id; // failed the bounding cube test
+			continue;
+		}
+		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+			if (pt_line_seg_dist_less_than(objects[i].pos, p1, p2, (line_radius + objects[i].radius))) {ids.push_back(objects[i].id);}
+		}
+		++nix;
+	}
+}
+
+
 // *** cobj_bvh_tree ***
 
 
@@ -395,6 +445,8 @@ void cobj_bvh_tree::clear() {
 
 	cobj_tree_base::clear();
 	cixs.resize(0);
+	leaf_bcubes.resize(0);
+	cobj_leaf_ixs.resize(0);
 }
 
 
@@ -415,7 +467,7 @@ void cobj_bvh_tree::add_cobjs(bool verbose) {
 
 
 // to be called from within add_cobjs() or after a call to add_cobj_ids()
-void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
+void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build, bool cache_leaf_bounds) {
 
 	max_depth = max_leaf_count = num_leaf_nodes = 0;
 	nodes.resize(get_conservative_num_nodes(cixs.size()) + 64*do_mt_build); // add 8 extra nodes for each of 8 top level splits
@@ -431,6 +483,45 @@ void cobj_bvh_tree::build_tree_from_cixs(bool do_mt_build) {
 		nodes.resize(ptd.get_next_node_ix());
 	}
 	nodes[root].next_node_id = (unsigned)nodes.size();
+	if (cache_leaf_bounds) {build_leaf_bcubes();} else {leaf_bcubes.clear(); cobj_leaf_ixs.clear();}
+}
+
+
+// the dynamic tree's cobjs are removed and re-added at new positions every frame after the tree is built, so only static trees cache bounds
+void cobj_bvh_tree::build_leaf_bcubes() {
+
+	leaf_bcubes.clear();
+	cobj_leaf_ixs.clear();
+	if (!is_static) return;
+	unsigned const num(cixs.size());
+	leaf_bcubes.resize(num);
+	cobj_leaf_ixs.resize(cobjs->size(), NO_LEAF_IX);
+
+#pragma omp parallel for schedule(static) if (num > 10000)
+	for (int i = 0; i < (int)num; ++i) {
+		leaf_bcubes[i].copy_from(get_cobj(i));
+		leaf_bcubes[i].expand_by(LEAF_BCUBE_TOLER);
+	}
+	for (unsigned i = 0; i < num; ++i) {cobj_leaf_ixs[cixs[i]] = i;}
+}
+
+
+// static cobjs can be moved, rotated, removed, and re-added without rebuilding the tree; keep their cached bounds current;
+// if !bounds_valid (removed cobj whose index may be reused), the cached bounds always pass so that only the cobj itself is tested
+void cobj_bvh_tree::update_leaf_bcube(unsigned cid, bool bounds_valid) {
+
+	if (cid >= cobj_leaf_ixs.size()) return; // not cached, or added after the tree was built
+	unsigned const ix(cobj_leaf_ixs[cid]);
+	if (ix == NO_LEAF_IX) return; // not in this tree
+	assert(ix < leaf_bcubes.size() && cixs[ix] == cid);
+	
+	if (bounds_valid) {
+		leaf_bcubes[ix].copy_from(get_cobj(ix));
+		leaf_bcubes[ix].expand_by(LEAF_BCUBE_TOLER);
+	}
+	else {
+		leaf_bcubes[ix] = cube_t(-FLT_MAX, FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX, FLT_MAX);
+	}
 }
 
 
@@ -452,6 +543,7 @@ bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpo
 			// Note: we test cobj against the original (unclipped) p1 and p2 so that t is correct
 			// Note: we probably don't need to return cnorm and cpos in inexact mode, but it shouldn't be too expensive to do so
 			if ((int)cixs[i] == ignore_cobj) continue;
+			if (!leaf_bcube_int_line(i, nixm)) continue; // uses the clipped line in exact mode
 			coll_obj const &c(get_cobj(i));
 			if (!obj_ok(c))                  continue;
 			if (skip_non_drawn  && !c.cp.might_be_drawn())                    continue;
@@ -476,6 +568,28 @@ bool cobj_bvh_tree::check_coll_line(point const &p1, point const &p2, point &cpo
 }
 
 
+// batched version of check_coll_line() with exact=1, test_alpha=0, and no skip flags
+void cobj_bvh_tree::check_coll_line_batch(vector<batch_ray_t> &rays, int ignore_cobj) const {
+
+	traverse_ray_batch(rays, [&](tree_node const &n, unsigned r, node_ix_mgr &nixm) {
+		batch_ray_t &ray(rays[r]);
+		float t(0.0);
+		vector3d cnorm;
+
+		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
+			if ((int)cixs[i] == ignore_cobj) continue;
+			if (!leaf_bcube_int_line(i, nixm)) continue; // uses the clipped line
+			coll_obj const &c(get_cobj(i));
+			if (!obj_ok(c)) continue;
+			if (!c.line_int_exact(ray.p1, ray.p2, t, cnorm, 0.0, ray.tmax)) continue;
+			ray.register_hit(t, cnorm, cixs[i]);
+			nixm.dinv = vector3d(ray.cpos - ray.p1);
+			nixm.dinv.invert();
+		}
+	});
+}
+
+
 bool cobj_bvh_tree::check_point_contained(point const &p, int &cindex) const {
 
 	unsigned const num_nodes((unsigned)nodes.size());
@@ -514,6 +628,7 @@ void cobj_bvh_tree::get_intersecting_cobjs(cube_t const &cube, vector<unsigned>
 		}
 		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
 			if ((int)cixs[i] == ignore_cobj) continue;
+			if (!leaf_bcube_int_cube(i, cube, toler)) continue;
 			coll_obj const &c(get_cobj(i));
 			if (check_ccounter && c.counter == cobj_counter) continue;
 			if (!cube.intersects(c, toler) || !obj_ok(c))    continue;
@@ -602,7 +717,7 @@ void cobj_bvh_tree::get_coll_sphere_cobjs(point const &center, float radius, int
 		++nix;
 		
 		for (unsigned i = n.start; i < n.end; ++i) { // check leaves
-			if ((int)cixs[i] != ignore_cobj && get_cobj(i).intersects(bcube)) vcd.check_cobj(cixs[i]);
+			if ((int)cixs[i] != ignore_cobj && leaf_bcube_int_cube(i, bcube) && get_cobj(i).intersects(bcube)) vcd.check_cobj(cixs[i]);
 		}
 	}
 }
@@ -768,14 +883,67 @@ void build_static_moving_cobj_tree() {
 	}
 	if (!moving_cids.empty()) {
 		cobj_tree_static_moving.add_cobj_ids(moving_cids);
-		cobj_tree_static_moving.build_tree_from_cixs(0);
+		cobj_tree_static_moving.build_tree_from_cixs(0, 0); // these cobjs move every frame, so don't cache leaf bounds
 	}
 }
 
+// must be called by every writer of static cobj bounds that doesn't rebuild the static trees: shift_by(), re_add_coll_cobj(), and remove_coll_object()
+void update_static_cobj_tree_bounds(unsigned cid, bool bounds_valid) {
+	cobj_tree_static.update_leaf_bcube(cid, bounds_valid);
+	cobj_tree_occlude.update_leaf_bcube(cid, bounds_valid);
+}
+
+// single threaded query throughput on the static tree, for comparing BVH and coll_obj layout changes
+void cobj_tree_query_benchmark(cobj_bvh_tree const &tree) {
+
+	cube_t scene_bcube;
+	if (!tree.get_root_bcube(scene_bcube)) return;
+	unsigned const NUM_QUERIES = 100000;
+	float const query_radius(0.01*scene_bcube.get_max_extent());
+	rand_gen_t rgen;
+	vector<point> pts(2*NUM_QUERIES);
+	vector<unsigned> cobjs;
+	unsigned num_hits(0), num_ints(0), num_sphere_ints(0);
+	for (auto i = pts.begin(); i != pts.end(); ++i) {*i = rgen.gen_rand_cube_point(scene_bcube);}
+	RESET_TIME;
+
+	for (unsigned i = 0; i < NUM_QUERIES; ++i) {
+		point cpos;
+		vector3d cnorm;
+		int cindex(-1);
+		num_hits += tree.check_coll_line(pts[2*i], pts[2*i+1], cpos, cnorm, cindex, -1, 1, 0, 0, 0, 0); // exact
+	}
+	int const line_time(max(1, GET_DELTA_TIME));
+
+	for (unsigned i = 0; i < NUM_QUERIES; ++i) {
+		cube_t cube(pts[i], pts[i]);
+		cube.expand_by(query_radius);
+		tree.get_intersecting_cobjs(cube, cobjs, -1, 0.0, 0, -1);
+		num_ints += cobjs.size();
+		cobjs.clear();
+	}
+	int const cube_time(max(1, GET_DELTA_TIME - line_time));
+
+	for (unsigned i = 0; i < NUM_QUERIES; ++i) { // same traversal as get_coll_sphere_cobjs(), followed by an exact sphere test rather than vert_coll_detector
+		point const &center(pts[NUM_QUERIES + i]);
+		cube_t cube(center, center);
+		cube.expand_by(query_radius);
+		tree.get_intersecting_cobjs(cube, cobjs, -1, 0.0, 0, -1);
+		for (auto c = cobjs.begin(); c != cobjs.end(); ++c) {num_sphere_ints += coll_objects.get_cobj(*c).sphere_intersects(center, query_radius);}
+		cobjs.clear();
+	}
+	int const sphere_time(max(1, GET_DELTA_TIME - line_time - cube_time));
+	cout << "Cobj tree benchmark: leaves: " << tree.get_num_objs() << ", line queries/s: " << 1000ULL*NUM_QUERIES/line_time << " (hits: " << num_hits
+		 << "), cube queries/s: " << 1000ULL*NUM_QUERIES/cube_time << " (ints: " << num_ints << "), sphere queries/s: " << 1000ULL*NUM_QUERIES/sphere_time
+		 << " (ints: " << num_sphere_ints << ")" << endl;
+}
+
 void build_cobj_tree(bool dynamic, bool verbose) {
 	
+	++coll_change_counter; // query results may change
 	if (!dynamic) { // static
 		get_tree(0).add_cobjs(verbose);
+		if (cobj_tree_benchmark) {cobj_tree_query_benchmark(get_tree(0));}
 		cobj_tree_occlude.add_cobjs(verbose);
 		//cout << "occluders: " << cobj_tree_occlude.get_num_objs() << endl;
 		//cobj_tree_triangles.add_cobjs(coll_objects, verbose);
@@ -811,6 +979,81 @@ bool check_coll_line_tree(point const &p1, point const &p2, int &cindex, int ign
 	return 0;
 }
 
+inline unsigned spread_bits_16(unsigned v) { // 0000abcd => 0a0b0c0d
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// conservative: returns 0 only if every mesh cell the ray spans has no static cobjs overlapping the ray's z-range
+bool drop_ray_may_hit_static_cobj(batch_ray_t const &ray) {
+
+	point const &p1(ray.p1), &p2(ray.get_end());
+	int const x1(get_xpos(min(p1.x, p2.x))), x2(get_xpos(max(p1.x, p2.x))), y1(get_ypos(min(p1.y, p2.y))), y2(get_ypos(max(p1.y, p2.y)));
+	if (point_outside_mesh(x1, y1) || point_outside_mesh(x2, y2)) return 1; // no cell data
+	if (unsigned(x2 - x1 + 1)*unsigned(y2 - y1 + 1) > DROP_RAY_MAX_CELLS) return 1; // not worth testing
+	float const zlo(min(p1.z, p2.z)), zhi(max(p1.z, p2.z));
+
+	for (int y = y1; y <= y2; ++y) {
+		for (int x = x1; x <= x2; ++x) {
+			coll_cell const &cell(v_collision_matrix[y][x]);
+			if (!cell.empty() && zlo <= cell.zmax && zhi >= cell.zmin) return 1;
+		}
+	}
+	return 0; // only the mesh can be hit
+}
+
+// closest hit queries for many mostly vertical rays (snow coverage, rain splashes, leaf accumulation);
+// rays are sorted into spatially coherent batches that each traverse the static/dynamic cobj BVHs and model BVHs once;
+// rays over mesh cells with no static cobjs in their z-range skip the static BVH; model BVHs must already be built
+void check_drop_rays_batch(vector<batch_ray_t> &rays, int ignore_cobj, bool inc_dynamic, bool inc_voxels, bool inc_models, bool use_mt) {
+
+	if (rays.empty() || world_mode != WMODE_GROUND) return;
+	unsigned const num_rays((unsigned)rays.size()), num_batches((num_rays - 1)/DROP_RAY_BATCH_SIZE + 1); // ceiling
+	vector<pair<unsigned, unsigned> > order(num_rays); // {morton order mesh cell, ray index}
+
+	for (unsigned i = 0; i < num_rays; ++i) {
+		point const &p(rays[i].p1);
+		unsigned const x(get_xpos_clamp(p.x)), y(get_ypos_clamp(p.y));
+		order[i] = make_pair(((spread_bits_16(y) << 1) | spread_bits_16(x)), i);
+	}
+	sort(order.begin(), order.end());
+	bool const inc_dynamic_tree(inc_dynamic && begin_motion);
+
+#pragma omp parallel for schedule(dynamic,1) if (use_mt)
+	for (int b = 0; b < (int)num_batches; ++b) {
+		unsigned const start(b*DROP_RAY_BATCH_SIZE), end(min(num_rays, start+DROP_RAY_BATCH_SIZE));
+		vector<batch_ray_t> batch, static_batch;
+		vector<unsigned> static_ixs;
+
+		for (unsigned i = start; i < end; ++i) {
+			batch_ray_t const &ray(rays[order[i].second]);
+			if (drop_ray_may_hit_static_cobj(ray)) {static_ixs.push_back((unsigned)batch.size()); static_batch.push_back(ray);}
+			batch.push_back(ray);
+		}
+		cobj_tree_static.check_coll_line_batch(static_batch, ignore_cobj);
+		for (unsigned i = 0; i < static_ixs.size(); ++i) {batch[static_ixs[i]] = static_batch[i];}
+		cobj_tree_static_moving.check_coll_line_batch(batch, ignore_cobj);
+		if (inc_dynamic_tree) {cobj_tree_dynamic.check_coll_line_batch(batch, ignore_cobj);}
+
+		if (inc_voxels) { // voxels have their own acceleration structure, so query them individually
+			for (auto r = batch.begin(); r != batch.end(); ++r) {
+				point cpos;
+				vector3d cnorm;
+				int cindex(-1);
+				if (!check_voxel_coll_line(r->p1, r->get_end(), cpos, cnorm, cindex, ignore_cobj, 1)) continue;
+				float const len(p2p_dist(r->p1, r->p2));
+				r->register_hit(((len > 0.0) ? min(r->tmax, p2p_dist(r->p1, cpos)/len) : 0.0f), cnorm, cindex);
+			}
+		}
+		if (inc_models) {all_models.check_coll_line_batch(batch);}
+		for (unsigned i = start; i < end; ++i) {rays[order[i].second] = batch[i - start];}
+	} // for b
+}
+
 // used in destroy_cobj for cobj destroy/modification and connected/anchoring tests
 void get_intersecting_cobjs_tree(cube_t const &cube, vector<unsigned> &cobjs, int ignore_cobj, float toler,
 	bool dynamic, bool check_ccounter, int id_for_cobj_int)
@@ -7,6 +7,20 @@
 #include "physics_objects.h"
 
 
+struct batch_ray_t { // line segment for batched queries; p1 and p2 are unchanged, and hits shorten the segment to cpos
+	point p1, p2, cpos;
+	vector3d cnorm;
+	float tmax; // fraction of p1 => p2 to the closest hit so far
+	int cindex; // closest hit cobj; -1 for model hits
+	bool hit;
+
+	batch_ray_t() : tmax(1.0), cindex(-1), hit(0) {}
+	batch_ray_t(point const &p1_, point const &p2_) : p1(p1_), p2(p2_), cpos(p2_), cnorm(zero_vector), tmax(1.0), cindex(-1), hit(0) {}
+	point const &get_end() const {return cpos;}
+	void register_hit(float t, vector3d const &n, int cix) {tmax = t; cpos = p1 + (p2 - p1)*t; cnorm = n; cindex = cix; hit = 1;}
+};
+
+
 class cobj_tree_base {
 
 protected:
@@ -40,6 +54,38 @@ protected:
 		bool (* get_line_clip_func) (point const &p1, vector3d const &dinv, float const d[3][2]); // function pointer
 	};
 
+	// visits each leaf node intersected by a spatially coherent batch of rays: branch nodes are tested once against the bounds of the whole batch,
+	// and only leaf nodes are clipped against each ray; leaf_func(node, ray_ix, nixm) should update nixm.dinv when it shortens the ray
+	template<typename F> void traverse_ray_batch(vector<batch_ray_t> const &rays, F const &leaf_func) const {
+		if (nodes.empty() || rays.empty()) return;
+		vector<node_ix_mgr> nixms;
+		nixms.reserve(rays.size());
+		cube_t bcube(rays.front().p1, rays.front().p1);
+
+		for (auto r = rays.begin(); r != rays.end(); ++r) {
+			nixms.emplace_back(nodes, r->p1, r->get_end());
+			bcube.union_with_pt(r->p1);
+			bcube.union_with_pt(r->get_end());
+		}
+		unsigned const num_nodes((unsigned)nodes.size());
+
+		for (unsigned nix = 0; nix < num_nodes;) {
+			tree_node const &n(nodes[nix]);
+
+			if (!bcube.intersects(n)) {
+				assert(n.next_node_id > nix);
+				nix = n.next_node_id; // failed the bbox test
+				continue;
+			}
+			++nix;
+			if (n.start == n.end) continue; // branch node
+
+			for (unsigned r = 0; r < nixms.size(); ++r) {
+				if (nixms[r].get_line_clip_func(nixms[r].p1, nixms[r].dinv, n.d)) {leaf_func(n, r, nixms[r]);}
+			}
+		}
+	}
+
 public:
 	cobj_tree_base() : max_depth(0), max_leaf_count(0), num_leaf_nodes(0) {}
 	bool is_empty() const {return nodes.empty();}
@@ -84,6 +130,7 @@ public:
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA &color, bool exact) const {
 		return check_coll_line(p1, p2, cpos, cnorm, &color, NULL, -1, exact);
 	}
+	void check_coll_line_batch(vector<batch_ray_t> &rays) const;
 };
 
 
@@ -102,6 +149,7 @@ public:
 	vector<unsigned> ids; // for using in get_ids_int_sphere()
 	void add_spheres(vector<sphere_with_id_t> &spheres_, bool verbose);
 	void get_ids_int_sphere(point const &center, float radius, vector<unsigned> &ids) const;
+	void get_ids_int_line(point const &p1, point const &p2, float line_radius, vector<unsigned> &ids) const;
 };
 
 
@@ -109,6 +157,8 @@ class cobj_bvh_tree : public cobj_tree_base {
 
 	coll_obj_group const *cobjs;
 	vector<unsigned> cixs;
+	vector<cube_t> leaf_bcubes; // bounds of each leaf in cixs order (static trees only), so that most leaf tests don't touch the cold coll_obj data
+	vector<unsigned> cobj_leaf_ixs; // cobj index => leaf index, for updating leaf_bcubes when a static cobj moves
 	bool is_static, is_dynamic, occluders_only, cubes_only, inc_voxel_cobjs;
 
 	struct per_thread_data {
@@ -129,6 +179,9 @@ class cobj_bvh_tree : public cobj_tree_base {
 	void calc_node_bbox(tree_node &n) const;
 	void build_tree_top_level_omp();
 	void build_tree(unsigned nix, unsigned skip_dims, unsigned depth, per_thread_data &ptd);
+	void build_leaf_bcubes();
+	bool leaf_bcube_int_line(unsigned i, node_ix_mgr const &nixm) const {return (leaf_bcubes.empty() || nixm.get_line_clip_func(nixm.p1, nixm.dinv, leaf_bcubes[i].d));}
+	bool leaf_bcube_int_cube(unsigned i, cube_t const &c, float toler=0.0) const {return (leaf_bcubes.empty() || c.intersects(leaf_bcubes[i], toler));}
 
 	bool obj_ok(coll_obj const &c) const {
 		return (((is_static && c.status == COLL_STATIC) || (is_dynamic && c.status == COLL_DYNAMIC) || (!is_static && !is_dynamic)) &&
@@ -144,9 +197,11 @@ public:
 	void clear();
 	void add_cobj_ids(vector<unsigned> const &cids) {assert(cixs.empty() && !cids.empty()); cixs = cids;}
 	void add_cobjs(bool verbose);
-	void build_tree_from_cixs(bool do_mt_build);
+	void build_tree_from_cixs(bool do_mt_build, bool cache_leaf_bounds=1);
+	void update_leaf_bcube(unsigned cid, bool bounds_valid);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 		bool exact, int test_alpha, bool skip_non_drawn, bool skip_init_colls, bool skip_movable) const;
+	void check_coll_line_batch(vector<batch_ray_t> &rays, int ignore_cobj) const;
 	bool check_point_contained(point const &p, int &cindex) const;
 	void get_intersecting_cobjs(cube_t const &cube, vector<unsigned> &cobjs, int ignore_cobj, float toler, bool check_ccounter, int id_for_cobj_int) const;
 	bool is_cobj_contained(point const &viewer, point const *const pts, unsigned npts, int ignore_cobj, int &cobj) const;
@@ -155,6 +210,9 @@ public:
 };
 
 
+void check_drop_rays_batch(vector<batch_ray_t> &rays, int ignore_cobj, bool inc_dynamic, bool inc_voxels, bool inc_models, bool use_mt);
+
+
 #endif // _COBJ_BSP_TREE_H_
 
 
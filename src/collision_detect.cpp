@@ -20,11 +20,13 @@ float const CAMERA_MESH_DZ   = 0.1; // max dz on mesh
 // Global Variables
 bool camera_on_snow(0);
 int camera_coll_id(-1);
+unsigned coll_change_counter(0); // incremented when cobjs are added/removed/moved or the mesh changes; validates collision results computed in advance
 float czmin(FAR_DISTANCE), czmax(-FAR_DISTANCE), coll_rmax(0.0);
 point camera_last_pos(all_zeros); // not sure about this, need to reset sometimes
 coll_obj_group coll_objects;
 cobj_groups_t cobj_groups;
 cobj_draw_groups cdraw_groups;
+vector<int> coll_cell_packed_cvals;
 
 extern bool lm_alloc, has_snow;
 extern int camera_coll_smooth, game_mode, world_mode, xoff, yoff, camera_change, display_mode, scrolling, animate2;
@@ -101,11 +103,12 @@ void decal_obj::check_cobj() {
 	else {
 		int const xpos(get_xpos(ipos.x)), ypos(get_ypos(ipos.y));
 		if (point_outside_mesh(xpos, ypos)) {status = 0; return;}
-		vector<int> const &cvals(v_collision_matrix[ypos][xpos].cvals);
+		coll_cell const &cell(v_collision_matrix[ypos][xpos]);
+		unsigned const ncv(cell.size());
 		cid = -1;
 
-		for (unsigned i = 0; i < cvals.size(); ++i) {
-			if (is_on_cobj(cvals[i])) {cid = cvals[i]; break;}
+		for (unsigned i = 0; i < ncv; ++i) {
+			if (is_on_cobj(cell.get(i))) {cid = cell.get(i); break;}
 		}
 		if (cid >= 0) {cobj_cent_mass = coll_objects.get_cobj(cid).get_center_of_mass();}
 	}
@@ -635,28 +638,89 @@ void coll_obj::re_add_coll_cobj(int index, int remove_old) {
 	status    = COLL_STATIC;
 	counter   = 0;
 	id        = index;
+	++coll_change_counter;
+	update_static_cobj_tree_bounds(index); // bounds may have changed since it was removed
 }
 
 void coll_cell::clear(bool clear_vectors) {
 
 	if (clear_vectors) {
-		if (cvals.capacity() > INIT_CCELL_SIZE) {cvals.clear();} else {cvals.resize(0);}
+		if (ovals.capacity() > INIT_CCELL_SIZE) {ovals.clear();} else {ovals.resize(0);}
+		pbeg = npacked = 0; // Note: packed entries are reclaimed on the next compaction
 	}
 	zmin =  FAR_DISTANCE;
 	zmax = -FAR_DISTANCE;
 }
 
+bool coll_cell::remove_entry(int index) { // preserves the order of the remaining entries
+
+	for (auto i = ovals.begin(); i != ovals.end(); ++i) { // check the overlay first, since dynamic cobjs are removed every frame
+		if (*i == index) {ovals.erase(i); return 1;}
+	}
+	int *const vals(coll_cell_packed_cvals.data() + pbeg);
+
+	for (unsigned k = 0; k < npacked; ++k) {
+		if (vals[k] != index) continue;
+		std::copy(vals+k+1, vals+npacked, vals+k); // leaves an unused slot at the end until the next compaction
+		--npacked;
+		return 1;
+	}
+	return 0;
+}
+
+
+// move static cobj entries from the per-cell overlay vectors into one packed array (compressed sparse row layout);
+// dynamic entries stay in the overlay; cells are independent once the offsets are known, so both passes run in parallel
+void compact_coll_cells() {
+
+	if (v_collision_matrix == NULL) return;
+	//RESET_TIME;
+	unsigned const ncells(XY_MULT_SIZE);
+	coll_cell *const cells(v_collision_matrix[0]); // allocated as one contiguous block
+	vector<unsigned> offsets(ncells+1, 0);
+
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)ncells; ++i) {
+		coll_cell const &cell(cells[i]);
+		unsigned num(cell.npacked);
+		for (auto v = cell.ovals.begin(); v != cell.ovals.end(); ++v) {num += (coll_objects[*v].status == COLL_STATIC);}
+		offsets[i+1] = num;
+	}
+	for (unsigned i = 0; i < ncells; ++i) {offsets[i+1] += offsets[i];}
+	vector<int> packed(offsets[ncells]);
+
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)ncells; ++i) {
+		coll_cell &cell(cells[i]);
+		unsigned pos(offsets[i]);
+		vector<int> ovals;
+		for (unsigned k = 0; k < cell.npacked; ++k) {packed[pos++] = coll_cell_packed_cvals[cell.pbeg+k];}
+
+		for (auto v = cell.ovals.begin(); v != cell.ovals.end(); ++v) {
+			if (coll_objects[*v].status == COLL_STATIC) {packed[pos++] = *v;} else {ovals.push_back(*v);}
+		}
+		assert(pos == offsets[i+1]);
+		cell.pbeg    = offsets[i];
+		cell.npacked = pos - offsets[i];
+		cell.ovals.swap(ovals); // frees the overlay memory if there are no dynamic entries
+	}
+	coll_cell_packed_cvals.swap(packed);
+	//PRINT_TIME("Compact Coll Cells");
+}
+
 
 void cobj_stats() {
 
-	unsigned ncv(0), nonempty(0), ncobj(0);
+	unsigned ncv(0), nonempty(0), ncobj(0), novl(0);
 	unsigned const csize((unsigned)coll_objects.size());
 
 	for (int y = 0; y < MESH_Y_SIZE; ++y) {
 		for (int x = 0; x < MESH_X_SIZE; ++x) {
-			unsigned const sz((unsigned)v_collision_matrix[y][x].cvals.size());
+			coll_cell const &cell(v_collision_matrix[y][x]);
+			unsigned const sz(cell.size());
 			ncv += sz;
 			nonempty += (sz > 0);
+			novl += (unsigned)cell.ovals.size();
 		}
 	}
 	for (unsigned i = 0; i < csize; ++i) {
@@ -664,7 +728,7 @@ void cobj_stats() {
 	}
 	if (ncobj > 0) {
 		cout << "bins = " << XY_MULT_SIZE << ", ne = " << nonempty << ", cobjs = " << ncobj
-			 << ", ent = " << ncv << ", per c = " << ncv/ncobj << ", per bin = " << ncv/XY_MULT_SIZE << endl;
+			 << ", ent = " << ncv << ", overlay = " << novl << ", per c = " << ncv/ncobj << ", per bin = " << ncv/XY_MULT_SIZE << endl;
 	}
 }
 
@@ -675,10 +739,10 @@ void add_coll_point(int i, int j, int index, float zminv, float zmaxv, int add_t
 	coll_cell &vcm(v_collision_matrix[i][j]);
 	vcm.add_entry(index);
 	coll_obj const &cobj(coll_objects.get_cobj(index));
-	unsigned const size((unsigned)vcm.cvals.size());
+	unsigned const size((unsigned)vcm.ovals.size());
 
-	if (size > 1 && cobj.status == COLL_STATIC && coll_objects[vcm.cvals[size-2]].status == COLL_DYNAMIC) {
-		std::rotate(vcm.cvals.begin(), vcm.cvals.begin()+size-1, vcm.cvals.end()); // rotate last point to first point???
+	if (size > 1 && cobj.status == COLL_STATIC && coll_objects[vcm.ovals[size-2]].status == COLL_DYNAMIC) {
+		std::rotate(vcm.ovals.begin(), vcm.ovals.begin()+size-1, vcm.ovals.end()); // rotate last point to first point??? (packed entries are always static)
 	}
 	if (is_dynamic) return;
 
@@ -725,6 +789,8 @@ int remove_coll_object(int index, bool reset_draw) {
 		return 0;
 	}
 	if (c.status == COLL_FREED) return 0;
+	++coll_change_counter;
+	if (c.status == COLL_STATIC) {update_static_cobj_tree_bounds(index, 0);} // index may be reused by a cobj with different bounds
 	coll_objects.remove_index_from_ids(index);
 	if (reset_draw) {c.cp.draw = 0;}
 	c.status   = COLL_FREED;
@@ -740,15 +806,7 @@ int remove_coll_object(int index, bool reset_draw) {
 
 	for (int i = y1; i <= y2; ++i) {
 		for (int j = x1; j <= x2; ++j) {
-			vector<int> &cvals(v_collision_matrix[i][j].cvals);
-			unsigned const num_cvals(cvals.size());
-			
-			for (unsigned k = 0; k < num_cvals; ++k) {
-				if (cvals[k] == index) {
-					cvals.erase(cvals.begin()+k); // can't change zmin or zmax (I think)
-					break; // should only be in here once
-				}
-			}
+			v_collision_matrix[i][j].remove_entry(index); // can't change zmin or zmax (I think); should only be in here once
 		}
 	}
 	cobj_manager.free_index(index);
@@ -773,19 +831,31 @@ void purge_coll_freed(bool force) {
 		for (int j = 0; j < MESH_X_SIZE; ++j) {
 			bool changed(0);
 			coll_cell &vcm(v_collision_matrix[i][j]);
-			unsigned const size((unsigned)vcm.cvals.size());
+			unsigned const size(vcm.size());
 
 			for (unsigned k = 0; k < size && !changed; ++k) {
-				if (coll_objects[vcm.cvals[k]].freed_unused()) changed = 1;
+				if (coll_objects[vcm.get(k)].freed_unused()) changed = 1;
 			}
 			// Note: don't actually have to recalculate zmin/zmax unless a removed object was on the top or bottom of the coll cell
 			if (!changed) continue;
 			vcm.zmin = mesh_height[i][j];
 			vcm.zmax = zmin;
-			vector<int>::const_iterator in(vcm.cvals.begin());
-			vector<int>::iterator o(vcm.cvals.begin());
+			int *const packed(coll_cell_packed_cvals.data() + vcm.pbeg);
+			unsigned npacked(0);
+
+			for (unsigned k = 0; k < vcm.npacked; ++k) {
+				coll_obj &cobj(coll_objects[packed[k]]);
+
+				if (!cobj.freed_unused()) {
+					if (cobj.status == COLL_STATIC) {vcm.update_zmm(cobj.d[2][0], cobj.d[2][1]);}
+					packed[npacked++] = packed[k];
+				}
+			}
+			vcm.npacked = npacked;
+			vector<int>::const_iterator in(vcm.ovals.begin());
+			vector<int>::iterator o(vcm.ovals.begin());
 
-			for (; in != vcm.cvals.end(); ++in) {
+			for (; in != vcm.ovals.end(); ++in) {
 				coll_obj &cobj(coll_objects[*in]);
 
 				if (!cobj.freed_unused()) {
@@ -793,7 +863,7 @@ void purge_coll_freed(bool force) {
 					*o++ = *in;
 				}
 			}
-			vcm.cvals.erase(o, vcm.cvals.end()); // excess capacity?
+			vcm.ovals.erase(o, vcm.ovals.end()); // excess capacity?
 			h_collision_matrix[i][j] = vcm.zmax; // need to think about add_to_hcm...
 		}
 	}
@@ -803,6 +873,7 @@ void purge_coll_freed(bool force) {
 		if (coll_objects[i].status == COLL_FREED) cobj_manager.free_index(i);
 	}
 	cobj_manager.cobjs_removed = 0;
+	if (force) {compact_coll_cells();}
 	//PRINT_TIME("Purge");
 }
 
@@ -817,6 +888,7 @@ void remove_all_coll_obj() {
 			h_collision_matrix[i][j] = mesh_height[i][j];
 		}
 	}
+	coll_cell_packed_cvals.clear();
 	for (unsigned i = 0; i < coll_objects.size(); ++i) {
 		if (coll_objects[i].status != COLL_UNUSED) {
 			coll_objects.remove_index_from_ids(i);
@@ -830,6 +902,7 @@ void remove_all_coll_obj() {
 void coll_obj_group::set_coll_obj_props(int index, int type, float radius, float radius2, int platform_id, cobj_params const &cparams) {
 	
 	coll_obj &cobj(at(index)); // Note: this is the *only* place a new cobj is allocated/created
+	++coll_change_counter;
 	cobj.texture_offset = zero_vector;
 	cobj.cp          = cparams;
 	cobj.id          = index;
@@ -917,12 +990,12 @@ int check_legal_move(int x_new, int y_new, float zval, float radius, int &cindex
 
 	if (point_outside_mesh(x_new, y_new)) return 0; // object out of simulation region
 	coll_cell const &cell(v_collision_matrix[y_new][x_new]);
-	if (cell.cvals.empty()) return 1;
+	if (cell.empty()) return 1;
 	float const xval(get_xval(x_new)), yval(get_yval(y_new)), z1(zval - radius), z2(zval + radius);
 	point const pval(xval, yval, zval);
 
-	for (int k = (int)cell.cvals.size()-1; k >= 0; --k) { // iterate backwards
-		int const index(cell.cvals[k]);
+	for (int k = (int)cell.size()-1; k >= 0; --k) { // iterate backwards
+		int const index(cell.get(k));
 		if (index < 0) continue;
 		coll_obj &cobj(coll_objects.get_cobj(index));
 		if (cobj.no_collision()) continue;
@@ -1072,6 +1145,7 @@ void vert_coll_detector::check_cobj(int index) {
 	if (z1 > cobj.d[2][1] || z2 < cobj.d[2][0]) return;
 	if (pos.x < (cobj.d[0][0]-o_radius) || pos.x > (cobj.d[0][1]+o_radius)) return;
 	if (pos.y < (cobj.d[1][0]-o_radius) || pos.y > (cobj.d[1][1]+o_radius)) return;
+	if (query_only) {++num_cands; return;} // would be tested for intersection
 	bool const player_step(player && ((type == CAMERA && camera_change) || (cobj.d[2][1] - z1) <= o_radius*C_STEP_HEIGHT));
 	check_cobj_intersect(index, 1, player_step);
 
@@ -1472,10 +1546,9 @@ void vert_coll_detector::check_cobj_intersect(int index, bool enable_cfs, bool p
 				if (otype.flags & OBJ_IS_DROP) {obj.velocity = zero_vector;}
 			}
 			if (type != DYNAM_PART && obj.velocity != zero_vector) {
-				assert(TIMESTEP > 0.0);
 				float friction_adj(friction);
 				if (norm.z > 0.25 && (cobj.is_wet() || cobj.is_snow_cov())) {friction_adj *= 0.25;} // slippery when wet, icy, or snow covered
-				if (friction_adj > 0.0) {obj.velocity *= (1.0 - min(1.0f, (tstep/TIMESTEP)*friction_adj));} // apply kinetic friction
+				if (friction_adj > 0.0) {obj.velocity *= (1.0 - min(1.0f, fticks*friction_adj));} // apply kinetic friction
 				//for (unsigned i = 0; i < 3; ++i) {obj.velocity[i] *= (1.0 - fabs(norm[i]));} // norm must be normalized
 				orthogonalize_dir(obj.velocity, norm, obj.velocity, 0); // rolling friction model
 			}
@@ -1589,7 +1662,7 @@ void vert_coll_detector::init_reset_pos() {
 
 int vert_coll_detector::check_coll() {
 
-	pold -= obj.velocity*tstep;
+	pold -= obj.velocity*timestep;
 	assert(!is_nan(pold));
 	assert(type >= 0 && type < NUM_TOT_OBJS);
 	o_radius = obj.get_true_radius();
@@ -1607,15 +1680,29 @@ int vert_coll_detector::check_coll() {
 }
 
 
+bool vert_coll_detector::has_coll_candidates() { // same queries as check_coll(), but only counts the cobjs that pass the bounds tests; no side effects
+
+	assert(only_cobj < 0);
+	query_only = 1;
+	o_radius   = obj.get_true_radius();
+	init_reset_pos();
+
+	for (int d = 0; d < 1+!skip_dynamic; ++d) {
+		get_coll_sphere_cobjs_tree(obj.pos, o_radius, -1, *this, (d != 0));
+	}
+	return (num_cands > 0);
+}
+
+
 // ************ end vert_coll_detector ************
 
 
 // 0 = no vert coll, 1 = X coll, 2 = Y coll, 3 = X + Y coll
-int dwobject::check_vert_collision(int obj_index, int do_coll_funcs, int iter, vector3d *cnorm,
+int dwobject::check_vert_collision(int obj_index, int do_coll_funcs, int iter, float timestep, vector3d *cnorm,
 	vector3d const &mdir, bool skip_dynamic, bool only_drawn, int only_cobj, bool skip_movable)
 {
 	if (world_mode == WMODE_INF_TERRAIN) {
-		point const p_last(pos - velocity*tstep);
+		point const p_last(pos - velocity*timestep);
 		float const o_radius(get_true_radius());
 		vector3d cnorm(plus_z);
 		
@@ -1627,7 +1714,7 @@ int dwobject::check_vert_collision(int obj_index, int do_coll_funcs, int iter, v
 			if (friction < STICK_THRESHOLD) {
 				if (otype.elasticity == 0.0 || (flags & IS_CUBE_FLAG) || !object_bounce(3, cnorm, 0.8, 0.0)) { // elasticity is hard-coded to 0.8 here
 					if (type != DYNAM_PART && velocity != zero_vector) {
-						if (friction > 0.0) {velocity *= (1.0 - min(1.0f, (tstep/TIMESTEP)*friction));} // apply kinetic friction
+						if (friction > 0.0) {velocity *= (1.0 - min(1.0f, fticks*friction));} // apply kinetic friction
 						orthogonalize_dir(velocity, cnorm, velocity, 0); // rolling friction model
 					}
 				}
@@ -1650,7 +1737,7 @@ int dwobject::check_vert_collision(int obj_index, int do_coll_funcs, int iter, v
 		return 0; // no vert coll
 	}
 	if (world_mode != WMODE_GROUND) return 0;
-	vert_coll_detector vcd(*this, obj_index, do_coll_funcs, iter, cnorm, mdir, skip_dynamic, only_drawn, only_cobj, skip_movable);
+	vert_coll_detector vcd(*this, obj_index, do_coll_funcs, iter, cnorm, timestep, mdir, skip_dynamic, only_drawn, only_cobj, skip_movable);
 	return vcd.check_coll();
 }
 
@@ -1662,7 +1749,7 @@ int dwobject::multistep_coll(point const &last_pos, int obj_index, unsigned nste
 	float const dist(cmove.mag()); // 0.018
 
 	if (dist < 1.0E-6 || nsteps == 1) {
-		any_coll |= check_vert_collision(obj_index, 1, 0); // collision detection
+		any_coll |= check_vert_collision(obj_index, 1, 0, tstep); // collision detection
 	}
 	else {
 		float const step(dist/(float)nsteps);
@@ -1673,7 +1760,7 @@ int dwobject::multistep_coll(point const &last_pos, int obj_index, unsigned nste
 		for (unsigned i = 0; i < nsteps && !disabled(); ++i) {
 			point const lpos(pos);
 			pos      += cmove*step;
-			any_coll |= check_vert_collision(obj_index, (i==nsteps-1), 0, NULL, dpos); // collision detection
+			any_coll |= check_vert_collision(obj_index, (i==nsteps-1), 0, tstep, NULL, dpos); // collision detection
 
 			if (type == CAMERA && !camera_change) {
 				for (unsigned d = 0; d < 2; ++d) { // x,y
@@ -1885,8 +1972,8 @@ int set_true_obj_height(point &pos, point const &lpos, float step_height, float
 	int any_coll(0), moved(0);
 	float zceil(0.0), zfloor(0.0);
 
-	for (int k = (int)cell.cvals.size()-1; k >= 0; --k) { // iterate backwards
-		int const index(cell.cvals[k]);
+	for (int k = (int)cell.size()-1; k >= 0; --k) { // iterate backwards
+		int const index(cell.get(k));
 		if (index < 0) continue;
 		coll_obj const &cobj(coll_objects.get_cobj(index));
 		if (cobj.d[2][0] > z2)         continue; // above the top of the object - can't affect it
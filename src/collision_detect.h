@@ -429,12 +429,21 @@ void copy_polygon_to_cobj(polygon_t const &poly, coll_obj &cobj);
 void copy_tquad_to_cobj(coll_tquad const &tquad, coll_obj &cobj);
 
 
-struct coll_cell { // size = 52
+extern vector<int> coll_cell_packed_cvals; // static cobj indices of all coll_cells, packed in cell order (CSR layout)
+
+
+struct coll_cell { // size = 40
 
 	float zmin, zmax;
-	vector<int> cvals;
+	unsigned pbeg, npacked; // range in coll_cell_packed_cvals, rebuilt by compact_coll_cells()
+	vector<int> ovals; // overlay for entries added since the last compaction; usually empty for static scenes
 
+	coll_cell() : zmin(FAR_DISTANCE), zmax(-FAR_DISTANCE), pbeg(0), npacked(0) {}
 	void clear(bool clear_vectors);
+	unsigned size() const {return (npacked + (unsigned)ovals.size());}
+	bool empty() const {return (npacked == 0 && ovals.empty());}
+	int get(unsigned i) const {return ((i < npacked) ? coll_cell_packed_cvals[pbeg+i] : ovals[i-npacked]);} // packed entries come first
+	bool remove_entry(int index);
 
 	void update_zmm(float zmin_, float zmax_) {
 		assert(zmin_ <= zmax_);
@@ -442,8 +451,8 @@ struct coll_cell { // size = 52
 		zmax = max(zmax_, zmax);
 	}
 	void add_entry(int index) {
-		if (INIT_CCELL_SIZE > 0 && cvals.capacity() == 0) {cvals.reserve(INIT_CCELL_SIZE);}
-		cvals.push_back(index);
+		if (INIT_CCELL_SIZE > 0 && ovals.capacity() == 0) {ovals.reserve(INIT_CCELL_SIZE);}
+		ovals.push_back(index);
 	}
 };
 
@@ -82,12 +82,13 @@ bool check_face_containment(cube_t const &cube, int dim, int dir, int cobj) {
 	int const x(get_xpos(cent.x)), y(get_ypos(cent.y));
 	if (point_outside_mesh(x, y)) return 0;
 	coll_cell const &cell(v_collision_matrix[y][x]);
-	unsigned const ncv((unsigned)cell.cvals.size());
+	unsigned const ncv(cell.size());
 
 	for (unsigned i = 0; i < ncv; ++i) { // test for internal faces to be removed
-		coll_obj const &c(coll_objects[cell.cvals[i]]);
+		int const cix(cell.get(i));
+		coll_obj const &c(coll_objects[cix]);
 		if (c.type != COLL_CUBE || !c.fixed || c.may_be_dynamic() || c.destroy >= SHATTERABLE) continue;
-		if ((int)cell.cvals[i] == cobj || c.is_semi_trans() || fabs(c.d[dim][!dir] - cube.d[dim][dir]) > TOLER_) continue;
+		if (cix == cobj || c.is_semi_trans() || fabs(c.d[dim][!dir] - cube.d[dim][dir]) > TOLER_) continue;
 		bool contained(1);
 
 		for (unsigned k = 0; k < 2 && contained; ++k) {
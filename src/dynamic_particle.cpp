@@ -89,8 +89,9 @@ void dynamic_particle::apply_physics(float stepsize, int index) { // begin_motio
 		}
 		break;
 	}
+	float const timestep(TIMESTEP*fticks*stepsize);
+
 	if (moves) {
-		float const timestep(TIMESTEP*fticks*stepsize);
 
 		if (gravity) {
 			float const vz(-min(TERMINAL_VEL, -(velocity.z - base_gravity*GRAVITY*timestep)));
@@ -106,7 +107,7 @@ void dynamic_particle::apply_physics(float stepsize, int index) { // begin_motio
 		dwobject obj(DYNAM_PART, pos, velocity, 1, 10000.0); // make a DYNAM_PART object for collision detection
 		object_types[DYNAM_PART].radius = radius;
 		//obj.multistep_coll(last_pos, index, NUM_COLL_STEPS);
-		obj.check_vert_collision(index, 0, 0); // ignoring return value
+		obj.check_vert_collision(index, 0, 0, timestep); // ignoring return value
 		pos = obj.pos;
 		float const vmag(obj.velocity.mag());
 		if (vmag > TOLERANCE) {velocity = obj.velocity*(velocity.mag()/vmag);} // same magnitude
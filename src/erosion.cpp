@@ -5,36 +5,82 @@
 #include "3DWorld.h"
 #include "mesh.h"
 #include <cfloat> // for FLT_EPSILON
+#include <climits> // for INT_MIN/INT_MAX
 
 
+int const EROSION_TILE_SIZE = 64; // droplets are simulated per tile; must be >= 2*EROSION_HALO
+int const EROSION_HALO      = 32; // distance a droplet can travel outside of its tile before it's suspended and handed to the neighbor tile
+bool const EROSION_BENCHMARK = 0; // print droplet throughput for each apply_erosion() call
+unsigned const EROSION_BATCH_SIZE = 65536; // max droplets queued at once, to bound memory usage for large num_iters
+
 extern float erode_amount, water_plane_z;
 
 
-// see http://ranmantaru.com/blog/2011/10/08/water-erosion-on-heightmap-terrain/
-void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
+struct erosion_droplet_t { // all state needed to suspend a droplet at a tile boundary and resume it later
+	rand_gen_t rgen;
+	unsigned iter, num_moves;
+	bool started;
+	int xi, zi;
+	float xp, zp, xf, zf, s, v, w, dx, dz, h, h00, h10, h01, h11;
 
-	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
-	RESET_TIME;
-	// Kq and minSlope are for soil carry capacity.
-	// Kw is water evaporation speed.
-	// Kr is erosion speed (how fast the soil is removed).
-	// Kd is deposition speed (how fast the extra sediment is dropped).
-	// Ki is direction inertia. Higher values make channel turns smoother.
-	// g is gravity that accelerates the flows.
-	float const Kq=10, Kw=0.001f, Kr=0.9f, Kd=0.02f, Ki=0.1f, minSlope=0.05f, g=20, Kg=g*2;
-	int const PAD(4), NX(xsize+2*PAD), NY(ysize+2*PAD);
-	unsigned const MAX_PATH_LEN(4*NX*NY);
-	vector<vector2d> erosion(NX*NY, vector2d(0.0, 0.0));
-	vector<float> mh_padded(NX*NY);
+	erosion_droplet_t(unsigned iter_, int xi_, int zi_, rand_gen_t const &rgen_) : rgen(rgen_), iter(iter_), num_moves(0), started(0),
+		xi(xi_), zi(zi_), xp(xi), zp(zi), xf(0), zf(0), s(0), v(0), w(1), dx(0), dz(0), h(0), h00(0), h10(0), h01(0), h11(0) {}
+};
+
+
+// Tiles are processed in four phases of a 2x2 checkerboard. A droplet only accesses cells within EROSION_HALO of its tile, so same colored
+// tiles never touch the same cells and can run in parallel. Each tile runs its droplets serially in a fixed order, and suspended droplets
+// are redistributed serially between phases, which makes the result independent of the number of threads.
+class erosion_sim_t {
+
+	int NX, NY, ntx, nty;
+	vector<vector2d> erosion;
+	vector<float> mh_padded;
+	vector<vector<erosion_droplet_t>> tile_droplets, tile_suspended;
+
+	unsigned get_tile_ix(int x, int z) const {
+		return (max(min(z, NY-1), 0)/EROSION_TILE_SIZE)*ntx + max(min(x, NX-1), 0)/EROSION_TILE_SIZE;
+	}
+	bool run_droplet(erosion_droplet_t &d, int const core[2][2]);
+
+public:
+	erosion_sim_t(float const *heightmap, int xsize, int ysize, int pad);
+	void run(unsigned num_iters, int pad, int xsize, int ysize, unsigned &num_phases);
+	void run_pending(unsigned num_pending, unsigned &num_phases);
+	void write_heightmap(float *heightmap, int xsize, int ysize, int pad, float min_zval) const;
+};
+
+
+erosion_sim_t::erosion_sim_t(float const *heightmap, int xsize, int ysize, int pad) : NX(xsize+2*pad), NY(ysize+2*pad) {
+
+	ntx = (NX + EROSION_TILE_SIZE - 1)/EROSION_TILE_SIZE;
+	nty = (NY + EROSION_TILE_SIZE - 1)/EROSION_TILE_SIZE;
+	erosion.resize(NX*NY, vector2d(0.0, 0.0));
+	mh_padded.resize(NX*NY);
+	tile_droplets.resize(ntx*nty);
+	tile_suspended.resize(ntx*nty);
 
 	// pad mesh by 1 unit on each side to create a buffer of trash around the edges that can be discarded
 	for (int y = 0; y < NY; ++y) {
-		int const offset(max(min(y-PAD, ysize-1), 0)*xsize);
+		int const offset(max(min(y-pad, ysize-1), 0)*xsize);
 
 		for (int x = 0; x < NX; ++x) {
-			mh_padded[y*NX + x] = heightmap[max(min(x-PAD, xsize-1), 0) + offset];
+			mh_padded[y*NX + x] = heightmap[max(min(x-pad, xsize-1), 0) + offset];
 		}
 	}
+}
+
+
+void erosion_sim_t::write_heightmap(float *heightmap, int xsize, int ysize, int pad, float min_zval) const {
+
+	// remove padding and clamp to min_zval
+	for (int y = 0; y < ysize; ++y) {
+		for (int x = 0; x < xsize; ++x) {
+			heightmap[y*xsize + x] = max(min_zval, mh_padded[(y+pad)*NX + x+pad]);
+		}
+	}
+}
+
 
 #define HMAP_INDEX(x, y) (NX*max(min(y, NY-1), 0) + max(min(x, NX-1), 0))
 #define HMAP(x, y) mh_padded[HMAP_INDEX(x, y)]
@@ -63,103 +109,179 @@ void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsig
 	e.x=r; e.y=d; \
 }
 
-#pragma omp parallel for schedule(dynamic,1)
-	for (int iter=0; iter < (int)num_iters; ++iter) {
-		rand_gen_t rgen;
-		rgen.set_state(iter+11, 79*iter+121);
-		int xi = PAD + (rgen.rand()%xsize);
-		int zi = PAD + (rgen.rand()%ysize);
-		float xp=xi, zp=zi, xf=0, zf=0, s=0, v=0, w=1, dx=0, dz=0;
-		float h=HMAP(xi, zi), h00=h, h10=HMAP(xi+1, zi), h01=HMAP(xi, zi+1), h11=HMAP(xi+1, zi+1);
-
-		unsigned numMoves=0;
-		for (; numMoves<MAX_PATH_LEN; ++numMoves) {
-			// calc gradient
-			float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
-			// calc next pos
-			dx=(dx-gx)*Ki+gx;
-			dz=(dz-gz)*Ki+gz;
-
-			float dl=sqrtf(dx*dx+dz*dz);
-			if (dl<=FLT_EPSILON) { // pick random dir
-				float a=rgen.rand_float()*TWO_PI;
-				dx=cosf(a); dz=sinf(a);
-			}
-			else {
-				dx/=dl; dz/=dl;
+// see http://ranmantaru.com/blog/2011/10/08/water-erosion-on-heightmap-terrain/
+// returns true if the droplet is done, false if it left the core region {{xmin, xmax}, {zmin, zmax}} and was suspended
+bool erosion_sim_t::run_droplet(erosion_droplet_t &d, int const core[2][2]) {
+
+	// Kq and minSlope are for soil carry capacity.
+	// Kw is water evaporation speed.
+	// Kr is erosion speed (how fast the soil is removed).
+	// Kd is deposition speed (how fast the extra sediment is dropped).
+	// Ki is direction inertia. Higher values make channel turns smoother.
+	// g is gravity that accelerates the flows.
+	float const Kq=10, Kw=0.001f, Kr=0.9f, Kd=0.02f, Ki=0.1f, minSlope=0.05f, g=20, Kg=g*2;
+	unsigned const MAX_PATH_LEN(4*NX*NY);
+	rand_gen_t &rgen(d.rgen);
+	int xi=d.xi, zi=d.zi;
+	float xp=d.xp, zp=d.zp, xf=d.xf, zf=d.zf, s=d.s, v=d.v, w=d.w, dx=d.dx, dz=d.dz;
+	float h=d.h, h00=d.h00, h10=d.h10, h01=d.h01, h11=d.h11;
+	if (!d.started) {h=HMAP(xi, zi); h00=h; h10=HMAP(xi+1, zi); h01=HMAP(xi, zi+1); h11=HMAP(xi+1, zi+1); d.started=1;}
+
+	unsigned numMoves=d.num_moves;
+	for (; numMoves<MAX_PATH_LEN; ++numMoves) {
+		// each move accesses cells in [xi-1, xi+2] x [zi-1, zi+2]; suspend if that could leave the region owned by this tile
+		if (xi < core[0][0] || xi > core[0][1] || zi < core[1][0] || zi > core[1][1]) {
+			d.xi=xi; d.zi=zi; d.xp=xp; d.zp=zp; d.xf=xf; d.zf=zf; d.s=s; d.v=v; d.w=w; d.dx=dx; d.dz=dz;
+			d.h=h; d.h00=h00; d.h10=h10; d.h01=h01; d.h11=h11; d.num_moves=numMoves;
+			return 0;
+		}
+		// calc gradient
+		float gx=h00+h01-h10-h11, gz=h00+h10-h01-h11;
+		// calc next pos
+		dx=(dx-gx)*Ki+gx;
+		dz=(dz-gz)*Ki+gz;
+
+		float dl=sqrtf(dx*dx+dz*dz);
+		if (dl<=FLT_EPSILON) { // pick random dir
+			float a=rgen.rand_float()*TWO_PI;
+			dx=cosf(a); dz=sinf(a);
+		}
+		else {
+			dx/=dl; dz/=dl;
+		}
+		float nxp=xp+dx, nzp=zp+dz;
+		// sample next height
+		int nxi=floor(nxp), nzi=floor(nzp);
+		float nxf=nxp-nxi, nzf=nzp-nzi;
+		float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
+		float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
+		// adjust by HALF_DXY = average mesh texel size - this is river depth
+		if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
+
+		// if higher than current, try to deposit sediment up to neighbour height
+		bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
+		if (nh>=h || outside) {
+			float ds=(nh-h)+0.001f;
+
+			if (ds>=s || outside) {
+				ds=s;
+				DEPOSIT(h) // deposit all sediment
+				s=0;
+				break; // stop
 			}
-			float nxp=xp+dx, nzp=zp+dz;
-			// sample next height
-			int nxi=floor(nxp), nzi=floor(nzp);
-			float nxf=nxp-nxi, nzf=nzp-nzi;
-			float nh00=HMAP(nxi, nzi), nh10=HMAP(nxi+1, nzi), nh01=HMAP(nxi, nzi+1), nh11=HMAP(nxi+1, nzi+1);
-			float nh=(nh00*(1-nxf)+nh10*nxf)*(1-nzf)+(nh01*(1-nxf)+nh11*nxf)*nzf;
-			// adjust by HALF_DXY = average mesh texel size - this is river depth
-			if (max(max(nh00, nh10), max(nh01, nh11)) < water_plane_z - HALF_DXY) break; // reached ocean water, stop and ignore sediment
-
-			// if higher than current, try to deposit sediment up to neighbour height
-			bool const outside(xi < 0 || zi < 0 || xi >= NX || zi >= NY);
-			if (nh>=h || outside) {
-				float ds=(nh-h)+0.001f;
-
-				if (ds>=s || outside) {
-					ds=s;
-					DEPOSIT(h) // deposit all sediment
-					s=0;
-					break; // stop
+			DEPOSIT(h)
+			s-=ds;
+			v=0;
+		}
+		// compute transport capacity
+		float dh=h-nh;
+		float slope=dh;
+		//float slope=dh/sqrtf(dh*dh+1);
+		float q=max(slope, minSlope)*v*w*Kq;
+
+		// deposit/erode (don't erode more than dh)
+		float ds=s-q;
+		if (ds>=0) { // deposit
+			ds*=Kd;
+			//ds=minval(ds, 1.0f);
+			DEPOSIT(dh)
+			s-=ds;
+		}
+		else { // erode
+			ds*=-Kr;
+			ds=min(ds, dh*0.99f);
+			ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
+
+			for (int z=zi-1; z<=zi+2; ++z) {
+				float zo=z-zp, zo2=zo*zo;
+
+				for (int x=xi-1; x<=xi+2; ++x) {
+					float xo=x-xp;
+					float w=1-(xo*xo+zo2)*0.25f;
+					if (w<=0) continue;
+					w*=0.1591549430918953f;
+					ERODE(x, z, w)
 				}
-				DEPOSIT(h)
-				s-=ds;
-				v=0;
 			}
-			// compute transport capacity
-			float dh=h-nh;
-			float slope=dh;
-			//float slope=dh/sqrtf(dh*dh+1);
-			float q=max(slope, minSlope)*v*w*Kq;
-
-			// deposit/erode (don't erode more than dh)
-			float ds=s-q;
-			if (ds>=0) { // deposit
-				ds*=Kd;
-				//ds=minval(ds, 1.0f);
-				DEPOSIT(dh)
-				s-=ds;
-			}
-			else { // erode
-				ds*=-Kr;
-				ds=min(ds, dh*0.99f);
-				ds*=((get_bare_ls_tid(nh) == ROCK_TEX) ? 0.5 : 2.0); // rock erodes slower than dirt/sand
-
-				for (int z=zi-1; z<=zi+2; ++z) {
-					float zo=z-zp, zo2=zo*zo;
-
-					for (int x=xi-1; x<=xi+2; ++x) {
-						float xo=x-xp;
-						float w=1-(xo*xo+zo2)*0.25f;
-						if (w<=0) continue;
-						w*=0.1591549430918953f;
-						ERODE(x, z, w)
-					}
-				}
-				dh-=ds;
-				s+=ds;
+			dh-=ds;
+			s+=ds;
+		}
+		// move to the neighbor
+		v=sqrtf(v*v+Kg*dh);
+		w*=1-Kw;
+		xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
+		h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
+	} // for numMoves
+	if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << d.iter << endl;}
+	return 1;
+}
+
+#undef HMAP_INDEX
+#undef HMAP
+#undef DEPOSIT_AT
+#undef DEPOSIT
+#undef ERODE
+
+
+void erosion_sim_t::run(unsigned num_iters, int pad, int xsize, int ysize, unsigned &num_phases) {
+
+	static_assert(EROSION_TILE_SIZE >= 2*EROSION_HALO && EROSION_HALO > 3, "invalid erosion tile/halo size");
+
+	num_phases = 0;
+
+	for (unsigned batch_start = 0; batch_start < num_iters; batch_start += EROSION_BATCH_SIZE) { // batches are run to completion in order
+		unsigned const batch_end(min(num_iters, batch_start + EROSION_BATCH_SIZE));
+
+		for (unsigned iter = batch_start; iter < batch_end; ++iter) { // droplets are assigned to their starting tiles in iteration order
+			rand_gen_t rgen;
+			rgen.set_state(iter+11, 79*iter+121);
+			int const xi(pad + (rgen.rand()%xsize)), zi(pad + (rgen.rand()%ysize));
+			tile_droplets[get_tile_ix(xi, zi)].emplace_back(iter, xi, zi, rgen);
+		}
+		run_pending(batch_end - batch_start, num_phases);
+	} // for batch_start
+}
+
+void erosion_sim_t::run_pending(unsigned num_pending, unsigned &num_phases) {
+
+	for (unsigned phase = 0; num_pending > 0; phase = (phase+1)&3, ++num_phases) {
+#pragma omp parallel for schedule(dynamic,1)
+		for (int tix = 0; tix < ntx*nty; ++tix) {
+			int const tx(tix%ntx), ty(tix/ntx);
+			if ((unsigned)((tx&1) + 2*(ty&1)) != phase) continue;
+			vector<erosion_droplet_t> &droplets(tile_droplets[tix]);
+			if (droplets.empty()) continue;
+			int const x1(tx*EROSION_TILE_SIZE), y1(ty*EROSION_TILE_SIZE), x2(x1 + EROSION_TILE_SIZE - 1), y2(y1 + EROSION_TILE_SIZE - 1);
+			// tiles on the edge of the grid also own everything beyond it, since out of range accesses are clamped to the edge
+			int const core[2][2] = {{((tx == 0) ? INT_MIN : (x1 - EROSION_HALO + 1)), ((tx == ntx-1) ? INT_MAX : (x2 + EROSION_HALO - 2))},
+			                        {((ty == 0) ? INT_MIN : (y1 - EROSION_HALO + 1)), ((ty == nty-1) ? INT_MAX : (y2 + EROSION_HALO - 2))}};
+
+			for (auto d = droplets.begin(); d != droplets.end(); ++d) {
+				if (!run_droplet(*d, core)) {tile_suspended[tix].push_back(*d);}
 			}
-			// move to the neighbor
-			v=sqrtf(v*v+Kg*dh);
-			w*=1-Kw;
-			xp=nxp; zp=nzp; xi=nxi; zi=nzi; xf=nxf; zf=nzf;
-			h=nh; h00=nh00; h10=nh10; h01=nh01; h11=nh11;
-		} // for numMoves
-		if (numMoves>=MAX_PATH_LEN) {cout << "droplet path is too long: " << iter << endl;}
-	} // for iter
+			droplets.clear();
+		} // for tix
+		num_pending = 0;
 
-	// remove padding and clamp to min_zval
-	for (int y = 0; y < ysize; ++y) {
-		for (int x = 0; x < xsize; ++x) {
-			heightmap[y*xsize + x] = max(min_zval, mh_padded[(y+PAD)*NX + x+PAD]);
+		for (unsigned tix = 0; tix < tile_suspended.size(); ++tix) { // hand suspended droplets to their new tiles in a fixed order
+			for (auto d = tile_suspended[tix].begin(); d != tile_suspended[tix].end(); ++d) {tile_droplets[get_tile_ix(d->xi, d->zi)].push_back(*d);}
+			num_pending += tile_suspended[tix].size();
+			tile_suspended[tix].clear();
 		}
-	}
-	PRINT_TIME("Erosion");
+	} // for phase
 }
 
+
+// results are deterministic and independent of the number of threads
+void apply_erosion(float *heightmap, int xsize, int ysize, float min_zval, unsigned num_iters) {
+
+	if (num_iters == 0 || erode_amount <= 0.0) return; // erosion disabled
+	RESET_TIME;
+	int const PAD(4);
+	unsigned num_phases(0);
+	erosion_sim_t sim(heightmap, xsize, ysize, PAD);
+	sim.run(num_iters, PAD, xsize, ysize, num_phases);
+	sim.write_heightmap(heightmap, xsize, ysize, PAD, min_zval);
+	if (EROSION_BENCHMARK) {cout << "Erosion: " << xsize << "x" << ysize << ", " << num_iters << " droplets, " << num_phases << " tile phases, " << 1000ULL*num_iters/max(1, GET_DELTA_TIME) << " droplets/s" << endl;}
+	PRINT_TIME("Erosion");
+}
@@ -827,8 +827,8 @@ void uparticle::set_params(unsigned ptype_, point const &pos_, vector3d const &v
 
 bool uparticle::dec_ref() {
 	
-	if (alloc_block == NULL) return 0;
-	alloc_block->free_object();
+	if (!handle.is_valid()) return 0;
+	get_free_obj_allocator<uparticle>().free_object(handle); // Note: may reset this object
 	return 1;
 }
 
@@ -983,7 +983,7 @@ void uparticle_cloud::draw_obj(uobj_draw_data &ddata) const { // Note: assumes G
 // ************ US_PROJECTILE ************
 
 
-us_projectile::us_projectile(unsigned type) : tup_time(0), alloc_block(NULL) {
+us_projectile::us_projectile(unsigned type) : tup_time(0) {
 
 	flags = (OBJ_FLAGS_TARG | OBJ_FLAGS_PROJ);
 	set_type(type);
@@ -1008,8 +1008,8 @@ void us_projectile::set_type(unsigned type) {
 
 bool us_projectile::dec_ref() {
 	
-	if (alloc_block == NULL) return 0;
-	alloc_block->free_object();
+	if (!handle.is_valid()) return 0;
+	get_free_obj_allocator<us_projectile>().free_object(handle); // Note: may reset this object
 	return 1;
 }
 
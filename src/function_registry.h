@@ -409,6 +409,7 @@ int  remove_coll_object(int index, bool reset_draw=1);
 int  remove_reset_coll_obj(int &index);
 void purge_coll_freed(bool force);
 void remove_all_coll_obj();
+void compact_coll_cells();
 void cobj_stats();
 int  collision_detect_large_sphere(point &pos, float radius, unsigned flags);
 int  check_legal_move(int x_new, int y_new, float zval, float radius, int &cindex);
@@ -428,6 +429,7 @@ void free_cobj_draw_group_vbos();
 
 // function prototypes - coll_cell_search
 void build_static_moving_cobj_tree();
+void update_static_cobj_tree_bounds(unsigned cid, bool bounds_valid=1);
 void build_cobj_tree(bool dynamic=0, bool verbose=1);
 bool check_coll_line_exact_tree(point const &p1, point const &p2, point &cpos, vector3d &cnorm, int &cindex, int ignore_cobj,
 	bool dynamic=0, int test_alpha=0, bool skip_non_drawn=0, bool include_voxels=1, bool skip_init_colls=0, bool skip_movable=0, bool no_stat_moving=0);
@@ -789,6 +791,8 @@ bool is_any_dlight_visible(point const &p);
 // function prototypes - smoke
 void add_smoke(point const &pos, float val);
 void distribute_smoke();
+void clear_smoke();
+void invalidate_smoke_flow();
 float get_smoke_at_pos(point const &pos);
 void update_smoke_indir_tex_range(unsigned x_start, unsigned x_end, unsigned y_start, unsigned y_end, unsigned z_start=0, unsigned z_end=0, bool update_lighting=1);
 bool upload_smoke_indir_texture();
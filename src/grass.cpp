@@ -12,13 +12,15 @@
 #include "draw_utils.h"
 
 
+bool const FREE_TT_GRASS_BLADES = 1; // free tiled terrain grass blades after the VBO upload; they're regenerated if the VBO is lost
+
 bool grass_enabled(1), use_grass_tess(0);
 unsigned grass_density(0);
 float grass_length(0.02), grass_width(0.002), flower_density(0.0);
 
 extern int default_ground_tex, read_landscape, display_mode, animate2, frame_counter, draw_model;
 extern unsigned create_voxel_landscape;
-extern float vegetation, zmin, zmax, fticks, h_dirt[], leaf_color_coherence, tree_deadness, relh_adj_tex, zmax_est, snow_cov_amt;
+extern float vegetation, zmin, zmax, fticks, tstep, h_dirt[], leaf_color_coherence, tree_deadness, relh_adj_tex, zmax_est, snow_cov_amt;
 extern double tfticks;
 extern colorRGBA leaf_base_color, flower_color;
 extern vector3d wind;
@@ -50,14 +52,91 @@ void detail_scenery_t::setup_shaders_post(shader_t &s) { // used for grass and f
 
 // *** grass ***
 
-void grass_manager_t::grass_t::merge(grass_t const &g) {
+void encode_octahedral(vector3d const &v, unsigned char oct[2]) { // v need not be normalized
+
+	float const l1(fabs(v.x) + fabs(v.y) + fabs(v.z));
+	float x((l1 > 0.0) ? v.x/l1 : 0.0), y((l1 > 0.0) ? v.y/l1 : 0.0);
+
+	if (v.z < 0.0) { // fold the lower hemisphere over the diagonals
+		float const ox(x);
+		x = (1.0 - fabs(y))*((x >= 0.0) ? 1.0 : -1.0);
+		y = (1.0 - fabs(ox))*((y >= 0.0) ? 1.0 : -1.0);
+	}
+	oct[0] = (unsigned char)round_fp(127.5*(x + 1.0));
+	oct[1] = (unsigned char)round_fp(127.5*(y + 1.0));
+}
+
+vector3d decode_octahedral(unsigned char const oct[2]) {
+
+	float x(oct[0]*(2.0f/255.0f) - 1.0f), y(oct[1]*(2.0f/255.0f) - 1.0f);
+	float const z(1.0f - fabs(x) - fabs(y));
+
+	if (z < 0.0) {
+		float const ox(x);
+		x = (1.0f - fabs(y))*((x >= 0.0) ? 1.0f : -1.0f);
+		y = (1.0f - fabs(ox))*((y >= 0.0) ? 1.0f : -1.0f);
+	}
+	return vector3d(x, y, z).get_norm();
+}
+
+// 8-bit log2 scale with 16 steps per octave (~4.4% precision), covering 1/256 to 256 units; 0 is reserved for zero
+unsigned char encode_log_scale(float v, float unit) {return ((v <= 0.0) ? 0 : (unsigned char)max(1, min(255, (round_fp(16.0*log2f(v/unit)) + 128))));}
+float decode_log_scale(unsigned char v, float unit) {return ((v == 0) ? 0.0f : unit*exp2f((int(v) - 128)/16.0f));}
+
+void grass_manager_t::grass_quant_t::init(cube_t const &bounds) {
+
+	for (unsigned i = 0; i < 3; ++i) {
+		float const sz(bounds.d[i][1] - bounds.d[i][0]);
+		base[i]      = bounds.d[i][0];
+		scale[i]     = sz/65535.0;
+		inv_scale[i] = ((sz > 0.0) ? 65535.0/sz : 0.0);
+	}
+	len_unit = grass_length;
+	w_unit   = grass_width;
+}
+
+point grass_manager_t::grass_quant_t::get_pos(grass_t const &g) const {return point((base.x + scale.x*g.p[0]), (base.y + scale.y*g.p[1]), (base.z + scale.z*g.p[2]));}
+vector3d grass_manager_t::grass_quant_t::get_dir (grass_t const &g) const {return (g.is_removed() ? zero_vector : decode_log_scale(g.len, len_unit)*decode_octahedral(g.dir));}
+vector3d grass_manager_t::grass_quant_t::get_norm(grass_t const &g) const {return decode_octahedral(g.n);}
+float grass_manager_t::grass_quant_t::get_width (grass_t const &g) const {return decode_log_scale(g.w, w_unit);}
 
-	p   = (p + g.p)*0.5; // average locations
-	float const dmag1(dir.mag()), dmag2(g.dir.mag());
-	dir = (dir/dmag1 + g.dir/dmag2).get_norm() * (0.5*(dmag1 + dmag2)); // average directions and lengths independently
-	n   = (n + g.n).get_norm(); // average normals
-	w  += g.w; // add widths to preserve surface area
-	//UNROLL_3X(c[i_] = (unsigned char)(unsigned(c[i_]) + unsigned(g.c[i_]))/2;) // don't average colors because they're used for the density filtering hash
+void grass_manager_t::grass_quant_t::set_pos(grass_t &g, point const &p) const { // clamped to the bounds
+	UNROLL_3X(g.p[i_] = (unsigned short)max(0, min(65535, round_fp((p[i_] - base[i_])*inv_scale[i_])));)
+}
+void grass_manager_t::grass_quant_t::set_dir(grass_t &g, vector3d const &dir) const {
+	g.len = encode_log_scale(dir.mag(), len_unit);
+	encode_octahedral(dir, g.dir);
+}
+void grass_manager_t::grass_quant_t::set_norm (grass_t &g, vector3d const &n) const {encode_octahedral(n, g.n);}
+void grass_manager_t::grass_quant_t::set_width(grass_t &g, float w) const {g.w = encode_log_scale(w, w_unit);}
+
+grass_manager_t::grass_t grass_manager_t::grass_quant_t::encode(point const &p, vector3d const &dir, vector3d const &n, unsigned char const *const c, float w, bool on_mesh) const {
+
+	grass_t g;
+	set_pos(g, p);
+	set_dir(g, dir);
+	set_norm(g, n);
+	set_width(g, w);
+	UNROLL_3X(g.c[i_] = c[i_];)
+	g.on_mesh = on_mesh;
+	return g;
+}
+
+float grass_manager_t::grass_quant_t::dist_sq(grass_t const &a, grass_t const &b) const { // computed directly from the quantized positions
+	float dsq(0.0);
+	UNROLL_3X(float const d(scale[i_]*(int(a.p[i_]) - int(b.p[i_]))); dsq += d*d;)
+	return dsq;
+}
+
+void grass_manager_t::grass_quant_t::merge(grass_t &g, grass_t const &g2) const {
+
+	vector3d const dir1(get_dir(g)), dir2(get_dir(g2));
+	float const dmag1(dir1.mag()), dmag2(dir2.mag());
+	set_pos  (g, (get_pos(g) + get_pos(g2))*0.5); // average locations
+	set_dir  (g, (dir1/dmag1 + dir2/dmag2).get_norm() * (0.5*(dmag1 + dmag2))); // average directions and lengths independently
+	set_norm (g, (get_norm(g) + get_norm(g2)).get_norm()); // average normals
+	set_width(g, (get_width(g) + get_width(g2))); // add widths to preserve surface area
+	//UNROLL_3X(g.c[i_] = (unsigned char)(unsigned(g.c[i_]) + unsigned(g2.c[i_]))/2;) // don't average colors because they're used for the density filtering hash
 }
 
 void grass_manager_t::clear() {
@@ -96,7 +175,7 @@ void grass_manager_t::add_grass_blade_int(point const &pos, float cscale, bool o
 	}
 	float const length(grass_length*rgen_.rand_uniform(0.7, 1.3));
 	float const width( grass_width *rgen_.rand_uniform(0.7, 1.3));
-	grass_.push_back(grass_t(pos, dir*length, norm, color, width, on_mesh));
+	grass_.push_back(quant.encode(pos, dir*length, norm, color, width, on_mesh));
 }
 
 void grass_manager_t::create_new_vbo() {
@@ -106,24 +185,36 @@ void grass_manager_t::create_new_vbo() {
 	data_valid = 0;
 }
 
-void grass_manager_t::add_to_vbo_data(grass_t const &g, vector<grass_data_t> &data, unsigned &ix, vector3d const &norm) const {
+void grass_manager_t::add_to_vbo_data(grass_t const &g, grass_data_t *data, vector3d const &norm) const { // writes 3 vertices
 
-	point p2(g.p + g.dir); p2.z += 0.05*grass_length;
-	vector3d const binorm(cross_product(g.dir, g.n));
-	vector3d const delta(binorm*(0.5*g.w/binorm.mag()));
+	point const p(quant.get_pos(g));
+	vector3d const dir(quant.get_dir(g));
+	point p2(p + dir); p2.z += 0.05*grass_length;
+	vector3d const binorm(cross_product(dir, quant.get_norm(g)));
+	float const bmag(binorm.mag());
+	vector3d const delta((bmag > 0.0) ? binorm*(0.5*quant.get_width(g)/bmag) : zero_vector); // removed blades are degenerate
 	norm_comp const nc(norm);
-	assert(ix+2 < data.size());
-	data[ix++].assign(g.p-delta, nc.n, g.c);
-	data[ix++].assign(g.p+delta, nc.n, g.c);
-	data[ix++].assign(p2,        nc.n, g.c);
+	data[0].assign(p-delta, nc.n, g.c);
+	data[1].assign(p+delta, nc.n, g.c);
+	data[2].assign(p2,      nc.n, g.c);
 }
 
-void grass_manager_t::scale_grass(float lscale, float wscale) {
+// fills 3*(end - start) vertices starting at data, in parallel for large ranges; use_mesh_normals: interpolated mesh normal for blades on the mesh, else +z
+void grass_manager_t::fill_vbo_data(grass_data_t *data, unsigned start, unsigned end, bool use_mesh_normals) const {
 
-	for (auto i = grass.begin(); i != grass.end(); ++i) {
-		i->dir *= lscale;
-		i->w   *= wscale;
+	assert(start <= end && end <= grass.size());
+#pragma omp parallel for schedule(static) if (end - start > 8192)
+	for (int i = start; i < (int)end; ++i) {
+		grass_t const &g(grass[i]);
+		vector3d const norm((use_mesh_normals && g.on_mesh) ? interpolate_mesh_normal(quant.get_pos(g)) : plus_z); // use grass normal? 2-sided lighting?
+		add_to_vbo_data(g, (data + 3*(i - start)), norm);
 	}
+}
+
+void grass_manager_t::scale_grass(float lscale, float wscale) {
+
+	quant.len_unit *= lscale; // lengths and widths are stored relative to these units, so there's no per-blade update
+	quant.w_unit   *= wscale;
 	clear_vbo();
 }
 
@@ -177,7 +268,7 @@ void grass_tile_manager_t::gen_lod_block(unsigned bix, unsigned lod) {
 		unsigned const end_val(min(i+search_dist, end_ix));
 
 		for (unsigned cur = i+1; cur < end_val; ++cur) {
-			float const dist_sq(p2p_dist_sq(grass[i].p, grass[cur].p));
+			float const dist_sq(quant.dist_sq(grass[i], grass[cur]));
 					
 			if (dist_sq < dmin_sq) {
 				dmin_sq  = dist_sq;
@@ -187,7 +278,7 @@ void grass_tile_manager_t::gen_lod_block(unsigned bix, unsigned lod) {
 		if (merge_ix > i) {
 			assert(merge_ix < grass.size());
 			assert(merge_ix-start_ix < used.size());
-			grass.back().merge(grass[merge_ix]);
+			quant.merge(grass.back(), grass[merge_ix]);
 			used[merge_ix-start_ix] = 1;
 		}
 	} // for i
@@ -200,6 +291,12 @@ void grass_tile_manager_t::clear() {
 
 	grass_manager_t::clear();
 	for (unsigned lod = 0; lod < NUM_GRASS_LODS; ++lod) {vbo_offsets[lod].clear();}
+	num_blades = 0;
+}
+
+void grass_tile_manager_t::scale_grass(float lscale, float wscale) {
+	if (grass.empty()) {clear();} // blades were freed after upload; regenerate them with the new length and width
+	else {grass_manager_t::scale_grass(lscale, wscale);}
 }
 
 
@@ -208,14 +305,10 @@ void grass_tile_manager_t::upload_data() {
 	if (empty()) return;
 	RESET_TIME;
 	vector<grass_data_t> data(3*size()); // 3 vertices per grass blade
-
-	for (unsigned i = 0, ix = 0; i < size(); ++i) {
-		vector3d const &norm(plus_z); // use grass normal? 2-sided lighting? generate normals in vertex shader?
-		//vector3d const &norm(grass[i].n);
-		add_to_vbo_data(grass[i], data, ix, norm);
-	}
+	fill_vbo_data(data.data(), 0, size(), 0); // +z normals; generate normals in vertex shader?
 	upload_to_vbo(vbo, data, 0, 1);
 	data_valid = 1;
+	if (FREE_TT_GRASS_BLADES) {clear_cont(grass);} // drawing only needs the VBO and vbo_offsets
 	PRINT_TIME("Grass Tile Upload");
 }
 
@@ -225,12 +318,16 @@ void grass_tile_manager_t::gen_grass() {
 	RESET_TIME;
 	assert(NUM_GRASS_LODS > 0);
 	assert((MESH_X_SIZE % GRASS_BLOCK_SZ) == 0 && (MESH_Y_SIZE % GRASS_BLOCK_SZ) == 0);
+	assert(grass.empty());
+	rgen = rand_gen_pregen_t(); // reset so that freed blades are regenerated the same way
+	quant.init(cube_t(0.0, GRASS_BLOCK_SZ*DX_VAL, 0.0, GRASS_BLOCK_SZ*DY_VAL, 0.0, 0.0)); // block relative; z is always 0
 
 	for (unsigned lod = 0; lod < NUM_GRASS_LODS; ++lod) {
 		vbo_offsets[lod].resize(NUM_RND_GRASS_BLOCKS+1);
 		vbo_offsets[lod][0] = grass.size(); // start
 		for (unsigned i = 0; i < NUM_RND_GRASS_BLOCKS; ++i) {gen_lod_block(i, lod);}
 	}
+	num_blades = grass.size();
 	PRINT_TIME("Grass Tile Gen");
 }
 
@@ -238,8 +335,8 @@ void grass_tile_manager_t::gen_grass() {
 void grass_tile_manager_t::update() { // to be called once per frame
 
 	if (!is_grass_enabled()) {clear(); return;}
-	if (empty()    ) {gen_grass();}
-	if (vbo == 0   ) {create_new_vbo();}
+	if (vbo == 0) {create_new_vbo();}
+	if (empty() && (num_blades == 0 || !data_valid)) {gen_grass();} // first use, or blades were freed after the last upload
 	if (!data_valid) {upload_data();}
 }
 
@@ -251,7 +348,7 @@ unsigned grass_tile_manager_t::render_block(unsigned block_ix, unsigned lod, flo
 	assert(lod < NUM_GRASS_LODS);
 	assert(block_ix+1 < vbo_offsets[lod].size());
 	unsigned const start_ix(vbo_offsets[lod][block_ix]), end_ix(vbo_offsets[lod][block_ix+1]);
-	assert(start_ix < end_ix && end_ix <= grass.size());
+	assert(start_ix < end_ix && end_ix <= num_blades);
 	unsigned const num_tris(ceil(density*(end_ix - start_ix)));
 	if (num_tris == 0) return 0;
 	bind_vbo(vbo); // needed because incoming vbo is 0 (so that instance attrib array isn't bound to a vbo)
@@ -293,6 +390,8 @@ public:
 	void gen_grass() {
 		RESET_TIME;
 		float const dz_inv(1.0/(zmax - zmin));
+		float const qz1(min(zbottom, zmin)), qz2(max(max(zmax, ztop), czmax) + grass_length), qdz(0.25*(qz2 - qz1)); // padded for mesh height changes
+		quant.init(cube_t(-X_SCENE_SIZE-DX_VAL, X_SCENE_SIZE+DX_VAL, -Y_SCENE_SIZE-DY_VAL, Y_SCENE_SIZE+DY_VAL, qz1-qdz, qz2+qdz));
 		object_types[GRASS].radius = 0.0;
 		rgen.pregen_floats(10000);
 		unsigned num_voxel_polys(0), num_voxel_blades(0);
@@ -347,8 +446,8 @@ public:
 					cube_t const test_cube(xval-0.5*DX_VAL, xval+0.5*DX_VAL, yval-0.5*DY_VAL, yval+0.5*DY_VAL, mesh_height[y][x], czmax+grass_length);
 					float const nz_thresh = 0.4;
 
-					for (unsigned k = 0; k < cell.cvals.size(); ++k) {
-						int const index(cell.cvals[k]);
+					for (unsigned k = 0; k < cell.size(); ++k) {
+						int const index(cell.get(k));
 						if (index < 0) continue;
 						coll_obj const &cobj(coll_objects.get_cobj(index));
 						if (cobj.type != COLL_POLYGON || cobj.cp.cobj_type != COBJ_TYPE_VOX_TERRAIN) continue;
@@ -412,7 +511,7 @@ public:
 						if (density < 1.0 && rgen_.randd() >= density) continue; // skip - density too low
 					}
 					// skip grass intersecting cobjs
-					if (do_cobj_check && dwobject(GRASS, pos).check_vert_collision(0, 0, 0)) continue; // make a GRASS object for collision detection
+					if (do_cobj_check && dwobject(GRASS, pos).check_vert_collision(0, 0, 0, tstep)) continue; // make a GRASS object for collision detection
 
 					if (create_voxel_landscape) {
 						if (point_inside_voxel_terrain(pos)) continue; // inside voxel volume
@@ -439,27 +538,19 @@ public:
 	void upload_data_to_vbo(unsigned start, unsigned end, bool alloc_data) const {
 		if (start == end) return; // nothing to update
 		assert(start < end && end <= grass.size());
-		unsigned const num_verts(3*(end - start)), block_size(3*4096); // must be a multiple of 3
+		unsigned const block_size(alloc_data ? 65536 : 4096); // in blades; large blocks for the initial upload so that each one is filled in parallel
 		unsigned const vntc_sz(sizeof(grass_data_t));
-		unsigned offset(3*start);
-		vertex_data_buffer.resize(min(num_verts, block_size));
+		vertex_data_buffer.resize(3*min((end - start), block_size));
 		bind_vbo(vbo);
 		if (alloc_data) {upload_vbo_data(NULL, 3*grass.size()*vntc_sz);} // initial upload (setup, no data)
 		
-		for (unsigned i = start, ix = 0; i < end; ++i) {
-			//vector3d norm(grass[i].n); // use grass normal? 2-sided lighting?
-			//vector3d norm(surface_normals[get_ypos(p1.y)][get_xpos(p1.x)]);
-			vector3d const norm(grass[i].on_mesh ? interpolate_mesh_normal(grass[i].p) : plus_z); // use +z normal for voxels
-			add_to_vbo_data(grass[i], vertex_data_buffer, ix, norm);
-
-			if (ix == block_size || i+1 == end) { // filled block or last entry
-				upload_vbo_sub_data(&vertex_data_buffer.front(), offset*vntc_sz, ix*vntc_sz); // upload part or all of the data
-				offset += ix;
-				ix = 0; // reset to the beginning of the buffer
-			}
+		for (unsigned i = start; i < end; i += block_size) {
+			unsigned const block_end(min(end, (i + block_size)));
+			fill_vbo_data(&vertex_data_buffer.front(), i, block_end, 1); // use +z normal for voxels
+			upload_vbo_sub_data(&vertex_data_buffer.front(), 3*i*vntc_sz, 3*(block_end - i)*vntc_sz); // upload part or all of the data
 		}
-		assert(offset == 3*end);
 		bind_vbo(0);
+		if (alloc_data) {clear_cont(vertex_data_buffer);} // free the large initial staging buffer; later updates are small
 	}
 
 	float get_xy_bounds(point const &pos, float radius, int &x1, int &y1, int &x2, int &y2) const {
@@ -502,9 +593,10 @@ public:
 				if (start == end) continue; // no grass at this location
 
 				for (unsigned i = start; i < end; ++i) {
-					if (p2p_dist_xy_sq(pos, grass[i].p) > rad_sq) continue; // too far away
-					if (grass[i].dir == zero_vector) continue; // removed
-					pos.z = max(pos.z, (grass[i].p.z + grass[i].dir.z + radius));
+					point const gpos(quant.get_pos(grass[i]));
+					if (p2p_dist_xy_sq(pos, gpos) > rad_sq) continue; // too far away
+					if (grass[i].is_removed()) continue;
+					pos.z = max(pos.z, (gpos.z + quant.get_dir(grass[i]).z + radius));
 					return 1; // early terminate at first grass blade
 				}
 			}
@@ -529,14 +621,17 @@ public:
 		unsigned start, end;
 		unsigned const ix(get_start_and_end(x, y, start, end));
 		unsigned min_up(end+1), max_up(start);
+		float const z_toler(max(0.01f*grass_width, quant.scale.z)); // at least one quantization step
 
 		for (unsigned i = start; i < end; ++i) { // will do nothing if there's no grass here
 			grass_t &g(grass[i]);
-			if (!g.on_mesh || g.dir == zero_vector) continue; // not on mesh, or already "removed"
-			float const mh(interpolate_mesh_zval(g.p.x, g.p.y, 0.0, 0, 1));
+			if (!g.on_mesh || g.is_removed()) continue; // not on mesh, or already "removed"
+			point gpos(quant.get_pos(g));
+			float const mh(interpolate_mesh_zval(gpos.x, gpos.y, 0.0, 0, 1));
 
-			if (fabs(g.p.z - mh) > 0.01*grass_width) { // is there any way we can check the ground texture to see if we sill have grass texture here?
-				g.p.z  = mh;
+			if (fabs(gpos.z - mh) > z_toler) { // is there any way we can check the ground texture to see if we sill have grass texture here?
+				gpos.z = mh;
+				quant.set_pos(g, gpos);
 				min_up = min(min_up, i);
 				max_up = max(max_up, i);
 			}
@@ -568,31 +663,35 @@ public:
 
 				for (unsigned i = start; i < end; ++i) { // will do nothing if there's no grass here
 					grass_t &g(grass[i]);
-					float const dsq(p2p_dist_xy_sq(pos, g.p));
+					point const gpos(quant.get_pos(g));
+					float const dsq(p2p_dist_xy_sq(pos, gpos));
 					if (dsq > rad_sq) continue; // too far away
-					if (g.dir == zero_vector) continue; // already "removed" (uncommon case)
+					if (g.is_removed()) continue; // already "removed" (uncommon case)
 					bool const underwater(maybe_underwater && g.on_mesh);
+					vector3d dir(quant.get_dir(g));
 					bool updated(0);
 
 					if (cut) {
-						float const length(g.dir.mag());
+						float const length(dir.mag());
 
 						if (length > 0.25*grass_length) {
-							g.dir  *= sqrt(dsq)*rad_inv;
+							dir    *= sqrt(dsq)*rad_inv;
+							quant.set_dir(g, dir);
 							updated = 1;
 						}
 					}
 					if (crush) {
 						vector3d const &sn(surface_normals[y][x]);
-						float const length(g.dir.mag());
+						float const length(dir.mag());
 
-						if (fabs(dot_product(g.dir, sn)) > 0.1*length) { // update if not flat against the mesh
-							float const om_reld(1.0 - sqrt(dsq)*rad_inv), dx(g.p.x - pos.x), dy(g.p.y - pos.y), atten_val(1.0 - om_reld*om_reld);
+						if (fabs(dot_product(dir, sn)) > 0.1*length) { // update if not flat against the mesh
+							float const om_reld(1.0 - sqrt(dsq)*rad_inv), dx(gpos.x - pos.x), dy(gpos.y - pos.y), atten_val(1.0 - om_reld*om_reld);
 							vector3d const new_dir(vector3d(dx, dy, -(sn.x*dx + sn.y*dy)/sn.z).get_norm()); // point away from crushing point
 
-							if (dot_product(g.dir, new_dir) < 0.95*length) { // update if not already aligned
-								g.dir   = (g.dir*(atten_val/length) + new_dir*(1.0 - atten_val)).get_norm()*length;
-								g.n     = (g.n*atten_val + sn*(1.0 - atten_val)).get_norm();
+							if (dot_product(dir, new_dir) < 0.95*length) { // update if not already aligned
+								dir = (dir*(atten_val/length) + new_dir*(1.0 - atten_val)).get_norm()*length;
+								quant.set_dir (g, dir);
+								quant.set_norm(g, (quant.get_norm(g)*atten_val + sn*(1.0 - atten_val)).get_norm());
 								updated = 1;
 							}
 						}
@@ -610,14 +709,14 @@ public:
 						UNROLL_3X(updated |= (g.c[i_] > 0);)
 						if (updated) {UNROLL_3X(g.c[i_] = (unsigned char)(atten_val*g.c[i_]);)}
 					}
-					if (check_uw && underwater && (g.p.z + g.dir.mag()) <= water_matrix[y][x]) {
+					if (check_uw && underwater && (gpos.z + dir.mag()) <= water_matrix[y][x]) {
 						unsigned char uwc[3] = {120,  100, 50};
 						UNROLL_3X(updated |= (g.c[i_] != uwc[i_]);)
 						if (updated) {UNROLL_3X(g.c[i_] = (unsigned char)(0.9*g.c[i_] + 0.1*uwc[i_]);)}
 					}
 					if (remove) {
 						// Note: if we're removing, it doesn't make sense to do any other operations since they won't have any effect
-						g.dir   = zero_vector; // make zero length (can't actually remove it)
+						quant.set_dir(g, zero_vector); // make zero length (can't actually remove it)
 						updated = 1;
 					}
 					if (updated) {
@@ -24,26 +24,46 @@ struct detail_scenery_t : public vbo_wrap_t {
 class grass_manager_t : public detail_scenery_t {
 
 protected:
-	struct grass_t { // size = 44
-		point p;
-		vector3d dir, n;
+	struct grass_t { // size = 16; compact quantized format, decoded with grass_quant_t
+		unsigned short p[3]; // position within the quantization bounds
+		unsigned char dir[2], n[2]; // octahedral encoded unit vectors
+		unsigned char len, w; // log2 encoded length and width relative to the quantization units; len == 0 is a removed blade
 		unsigned char c[3];
-		unsigned char on_mesh : 1;
-		float w;
+		unsigned char on_mesh;
 
 		grass_t() {} // optimization
-		grass_t(point const &p_, vector3d const &dir_, vector3d const &n_, unsigned char const *const c_, float w_, bool on_mesh_)
-			: p(p_), dir(dir_), n(n_), on_mesh(on_mesh_), w(w_) {c[0] = c_[0]; c[1] = c_[1]; c[2] = c_[2];}
-		void merge(grass_t const &g);
+		bool is_removed() const {return (len == 0);}
+	};
+
+	struct grass_quant_t { // maps between grass_t and world space values
+		point base;
+		vector3d scale, inv_scale;
+		float len_unit, w_unit;
+
+		grass_quant_t() : base(all_zeros), scale(zero_vector), inv_scale(zero_vector), len_unit(1.0), w_unit(1.0) {}
+		void init(cube_t const &bounds); // also sets units from the current grass length and width
+		point    get_pos  (grass_t const &g) const;
+		vector3d get_dir  (grass_t const &g) const; // scaled by length
+		vector3d get_norm (grass_t const &g) const;
+		float    get_width(grass_t const &g) const;
+		void set_pos  (grass_t &g, point const &p) const;
+		void set_dir  (grass_t &g, vector3d const &dir) const;
+		void set_norm (grass_t &g, vector3d const &n) const;
+		void set_width(grass_t &g, float w) const;
+		grass_t encode(point const &p, vector3d const &dir, vector3d const &n, unsigned char const *const c, float w, bool on_mesh) const;
+		float dist_sq(grass_t const &a, grass_t const &b) const;
+		void merge(grass_t &g, grass_t const &g2) const;
 	};
 
 	vector<grass_t> grass;
+	grass_quant_t quant;
 	bool data_valid;
 	rand_gen_pregen_t rgen;
 	typedef vert_norm_comp_color grass_data_t;
 
 	vector3d interpolate_mesh_normal(point const &pos) const;
 	void add_grass_blade_int(point const &pos, float cscale, bool on_mesh, vector<grass_t> &grass_, rand_gen_pregen_t &rgen_) const;
+	void fill_vbo_data(grass_data_t *data, unsigned start, unsigned end, bool use_mesh_normals) const;
 
 public:
 	grass_manager_t() : data_valid(0) {}
@@ -54,7 +74,7 @@ public:
 	void clear();
 	void add_grass_blade(point const &pos, float cscale, bool on_mesh) {add_grass_blade_int(pos, cscale, on_mesh, grass, rgen);}
 	void create_new_vbo();
-	void add_to_vbo_data(grass_t const &g, vector<grass_data_t> &data, unsigned &ix, vector3d const &norm) const;
+	void add_to_vbo_data(grass_t const &g, grass_data_t *data, vector3d const &norm) const;
 	void scale_grass(float lscale, float wscale);
 	void begin_draw() const;
 	void end_draw() const;
@@ -64,15 +84,16 @@ public:
 class grass_tile_manager_t : public grass_manager_t {
 
 	vector<unsigned> vbo_offsets[NUM_GRASS_LODS];
-	unsigned start_render_ix, end_render_ix;
+	unsigned start_render_ix, end_render_ix, num_blades; // num_blades is still valid after the blades are freed
 
 	void gen_block(unsigned bix);
 	void gen_lod_block(unsigned bix, unsigned lod);
 
 public:
-	grass_tile_manager_t() : start_render_ix(0), end_render_ix(0) {}
+	grass_tile_manager_t() : start_render_ix(0), end_render_ix(0), num_blades(0) {}
 	void clear();
-	unsigned get_gpu_mem() const {return (vbo ? 3*size()*sizeof(grass_data_t) : 0);}
+	void scale_grass(float lscale, float wscale);
+	unsigned get_gpu_mem() const {return (vbo ? 3*num_blades*sizeof(grass_data_t) : 0);}
 	void upload_data();
 	void gen_grass();
 	void update();
@@ -277,7 +277,7 @@ void lmap_manager_t::copy_data(lmap_manager_t const &src, float blend_weight) {
 // *this = val*lmc + (1.0 - val)*(*this)
 void lmcell::mix_lighting_with(lmcell const &lmc, float val) {
 
-	float const omv(1.0 - val); // Note: we ignore the flow values and smoke for now
+	float const omv(1.0 - val); // Note: we ignore the flow values for now
 	sv = val*lmc.sv + omv*sv;
 	gv = val*lmc.gv + omv*gv;
 	UNROLL_3X(sc[i_] = val*lmc.sc[i_] + omv*sc[i_];)
@@ -497,10 +497,12 @@ void create_dlight_volumes() {indir_dlight_group_manager.create_needed_llvols();
 bool has_fixed_cobjs(int x, int y) {
 
 	assert(!point_outside_mesh(x, y));
-	vector<int> const &cvals(v_collision_matrix[y][x].cvals);
+	coll_cell const &cell(v_collision_matrix[y][x]);
+	unsigned const ncv(cell.size());
 
-	for (vector<int>::const_iterator i = cvals.begin(); i != cvals.end(); ++i) {
-		if (coll_objects[*i].fixed && coll_objects[*i].status == COLL_STATIC) {return 1;}
+	for (unsigned i = 0; i < ncv; ++i) {
+		coll_obj const &cobj(coll_objects[cell.get(i)]);
+		if (cobj.fixed && cobj.status == COLL_STATIC) {return 1;}
 	}
 	return 0;
 }
@@ -521,6 +523,7 @@ void clear_lightmap() {
 	if (!lmap_manager.is_allocated()) return;
 	kill_current_raytrace_threads(); // kill raytrace threads and wait for them to finish since they are using the current lightmap
 	lmap_manager.clear_cells();
+	clear_smoke(); // smoke blocks cache lightmap flow values
 	using_lightmap = 0;
 	lm_alloc       = 0;
 	czmin0         = czmin;
@@ -537,10 +540,10 @@ void calc_flow_profile(r_profile flow_prof[3], int i, int j, bool proc_cobjs, fl
 
 	if (proc_cobjs) {
 		coll_cell const &cell(v_collision_matrix[i][j]);
-		unsigned const ncv((unsigned)cell.cvals.size());
+		unsigned const ncv(cell.size());
 
 		for (unsigned q = 0; q < ncv; ++q) {
-			unsigned const cid(cell.cvals[q]);
+			unsigned const cid(cell.get(q));
 			coll_obj const &cobj(coll_objects.get_cobj(cid));
 			if (cobj.status != COLL_STATIC) continue;
 			if (cobj.d[2][1] < zbottom)     continue; // below the mesh
@@ -797,6 +800,7 @@ void update_flow_for_voxels(vector<cube_t> const &cubes) {
 			} // for x
 		} //for y
 	}
+	invalidate_smoke_flow();
 	//PRINT_TIME("Update Flow");
 }
 
@@ -28,12 +28,12 @@ protected:
 
 unsigned const lmcell_ltype_off[NUM_LIGHTING_TYPES] = {0, 4, 8, 0}; // sky, global, local, sky cobj accum, dynamic
 
-struct lmcell { // size = 52
+struct lmcell { // size = 48
 
-	float sc[3], sv, gc[3], gv, lc[3], smoke; // *c[3]: RGB sky, global, local colors
-	unsigned char pflow[3]; // flow: x, y, z
+	float sc[3], sv, gc[3], gv, lc[3]; // *c[3]: RGB sky, global, local colors
+	unsigned char pflow[3]; // flow: x, y, z; smoke values are stored separately in smoke.cpp
 	
-	lmcell() : sv(0.0), gv(0.0), smoke(0.0) {UNROLL_3X(sc[i_] = gc[i_] = lc[i_] = 0.0; pflow[i_] = 255;)}
+	lmcell() : sv(0.0), gv(0.0) {UNROLL_3X(sc[i_] = gc[i_] = lc[i_] = 0.0; pflow[i_] = 255;)}
 	float       *get_offset(int ltype)       {return (sc + lmcell_ltype_off[ltype]);}
 	float const *get_offset(int ltype) const {return (sc + lmcell_ltype_off[ltype]);}
 	static unsigned get_dsz(int ltype)       {return ((ltype == LIGHTING_LOCAL) ? 3 : 4);}
@@ -49,6 +49,7 @@ short     ***volume_matrix = NULL;
 
 extern bool last_int, mesh_invalidated;
 extern int world_mode, MAX_RUN_DIST, xoff, yoff, I_TIMESCALE2, DISABLE_WATER;
+extern unsigned coll_change_counter;
 extern float zmax, zmin, water_plane_z, def_water_level, temperature, max_obj_radius;
 
 
@@ -215,6 +216,7 @@ void update_mesh_height(int xpos, int ypos, int rad, float scale, float offset,
 		}
 	}
 
+	if (!to_update.empty()) {++coll_change_counter;} // objects may now collide with the mesh
 	// second pass to update adjacency data
 	for (vector<mesh_update_t>::const_iterator i = to_update.begin(); i != to_update.end(); ++i) {
 		update_matrix_element(i->x, i->y); // requires mesh_height
@@ -580,6 +580,19 @@ void gen_rx_ry(float &rx, float &ry) {
 	ry = rgen.rand_float() + 1.0;
 }
 
+unsigned get_mesh_gen_params_hash() { // changes when any input to procedural height generation changes; used as part of the tiled terrain cache key
+
+	float rx, ry;
+	gen_rx_ry(rx, ry);
+	vector<float> vals(&sinTable[0][0], &sinTable[0][0]+5*F_TABLE_SIZE);
+	float const params[] = {rx, ry, mesh_scale, mesh_scale_z, zmin, zmax, zmax_est, zmax_est2, custom_glaciate_exp, DX_VAL, DY_VAL,
+		float(GLACIATE), float(start_eval_sin), float(mesh_gen_mode), float(mesh_gen_shape)};
+	vals.insert(vals.end(), params, params+sizeof(params)/sizeof(float));
+	float const *const hp((float const *)&hmap_params); // all floats
+	vals.insert(vals.end(), hp, hp+sizeof(hmap_params_t)/sizeof(float));
+	return jenkins_one_at_a_time_hash((uint8_t const *)vals.data(), vals.size()*sizeof(float));
+}
+
 
 bool mesh_xy_grid_cache_t::build_arrays(float x0, float y0, float dx, float dy,
 	unsigned nx, unsigned ny, bool cache_values, bool force_sine_mode, bool no_wait)
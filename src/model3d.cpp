@@ -2015,6 +2015,41 @@ bool model3d::check_coll_line(point const &p1, point const &p2, point &cpos, vec
 	return coll;
 }
 
+// Note: doesn't build the BVH, so it's safe to call from multiple threads
+void model3d::check_coll_line_batch(vector<batch_ray_t> &rays) const {
+
+	if (coll_tree.is_empty()) return;
+	if (transforms.empty()) {coll_tree.check_coll_line_batch(rays); return;}
+	vector<batch_ray_t> xf_rays;
+	vector<unsigned> ixs;
+
+	for (auto xf = transforms.begin(); xf != transforms.end(); ++xf) {
+		cube_t const xf_bcube(xf->get_xformed_cube(bcube));
+		xf_rays.clear();
+		ixs.clear();
+
+		for (unsigned i = 0; i < rays.size(); ++i) {
+			batch_ray_t const &ray(rays[i]);
+			if (!check_line_clip(ray.p1, ray.get_end(), xf_bcube.d)) continue;
+			batch_ray_t xf_ray(ray.p1, ray.p2);
+			xf->inv_xform_pos(xf_ray.p1);
+			xf->inv_xform_pos(xf_ray.p2);
+			xf_ray.tmax = ray.tmax; // affine transform, so the fraction along the line is unchanged
+			xf_ray.cpos = xf_ray.p1 + (xf_ray.p2 - xf_ray.p1)*ray.tmax;
+			xf_rays.push_back(xf_ray);
+			ixs.push_back(i);
+		}
+		coll_tree.check_coll_line_batch(xf_rays);
+
+		for (unsigned i = 0; i < xf_rays.size(); ++i) {
+			if (!xf_rays[i].hit) continue;
+			vector3d cnorm(xf_rays[i].cnorm);
+			xf->xform_pos_rm(cnorm);
+			rays[ixs[i]].register_hit(xf_rays[i].tmax, cnorm, -1);
+		}
+	}
+}
+
 
 void model3d::get_all_mat_lib_fns(set<string> &mat_lib_fns) const {
 	for (deque<material_t>::const_iterator m = materials.begin(); m != materials.end(); ++m) {mat_lib_fns.insert(m->filename);}
@@ -2292,6 +2327,10 @@ bool model3ds::check_coll_line(point const &p1, point const &p2, point &cpos, ve
 	return ret;
 }
 
+void model3ds::check_coll_line_batch(vector<batch_ray_t> &rays) const {
+	for (const_iterator m = begin(); m != end(); ++m) {m->check_coll_line_batch(rays);}
+}
+
 
 void model3ds::write_to_cobj_file(ostream &out) const {
 	for (const_iterator m = begin(); m != end(); ++m) {m->write_to_cobj_file(out);}
@@ -528,6 +528,7 @@ public:
 	void build_cobj_tree(bool verbose);
 	bool check_coll_line_cur_xf(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA &color, bool exact);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA &color, bool exact, bool build_bvh_if_needed=0);
+	void check_coll_line_batch(vector<batch_ray_t> &rays) const;
 	bool get_needs_alpha_test() const {return needs_alpha_test;}
 	bool get_needs_bump_maps () const {return needs_bump_maps;}
 	bool uses_spec_map()        const {return has_spec_maps;}
@@ -560,6 +561,7 @@ struct model3ds : public deque<model3d> {
 	cube_t get_bcube(bool only_reflective);
 	void build_cobj_trees(bool verbose);
 	bool check_coll_line(point const &p1, point const &p2, point &cpos, vector3d &cnorm, colorRGBA &color, bool exact, bool build_bvh_if_needed=0);
+	void check_coll_line_batch(vector<batch_ray_t> &rays) const;
 	void write_to_cobj_file(std::ostream &out) const;
 };
 
@@ -6,9 +6,7 @@
 #define _OBJ_SORT_H_
 
 #include "ship.h"
-
-unsigned const LEFT_EDGE_BIT = 0x80000000U;
-
+#include <unordered_map>
 
 struct cached_obj : public sphere_t {
 
@@ -32,14 +30,38 @@ struct cached_obj : public sphere_t {
 };
 
 
-struct interval {
-
-	float val;
-	unsigned ix;
-
-	interval() {}
-	interval(float v, unsigned i, bool l) : val(v), ix(i) {if (l) ix |= LEFT_EDGE_BIT;}
-	bool operator<(interval const &iv) const {return (val < iv.val);}
+// multi-level hashed uniform grid, used as the broadphase for universe object collisions;
+// objects are stored by center in the lowest level whose cell size is at least their diameter, and each level is 4x larger than the one below it
+class uobj_coll_grid_t {
+
+	static unsigned const NUM_LEVELS = 8;
+	static unsigned const NOT_IN_GRID = NUM_LEVELS;
+
+	struct obj_cell_t {
+		uint64_t key;
+		unsigned level, cell_pos; // cell_pos is the index into the cell's object list
+		obj_cell_t() : key(0), level(NOT_IN_GRID), cell_pos(0) {}
+	};
+	typedef std::unordered_map<uint64_t, vector<unsigned>> cell_map_t;
+
+	cell_map_t cells[NUM_LEVELS];
+	float max_radius[NUM_LEVELS];
+	float base_cell_sz;
+	vector<obj_cell_t> obj_cells; // indexed the same as objs
+	vector<vector<pair<unsigned, unsigned>>> thread_pairs;
+
+	float get_cell_sz(unsigned level) const {return base_cell_sz*float(1U << (2*level));}
+	unsigned get_level(float radius) const;
+	void get_cell(point const &pos, unsigned level, int cell[3]) const;
+	static uint64_t get_key(int const cell[3]);
+	void insert(unsigned ix, unsigned level, uint64_t key, float radius);
+	void remove(unsigned ix);
+
+public:
+	uobj_coll_grid_t() : base_cell_sz(0.0) {clear();}
+	void clear();
+	void update(vector<cached_obj> const &objs, vector<unsigned char> const &in_grid);
+	void get_pairs(vector<cached_obj> const &objs, vector<pair<unsigned, unsigned>> &pairs);
 };
 
 
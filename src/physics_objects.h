@@ -198,16 +198,18 @@ struct dwobject : public basic_physics_obj { // size = 67(68) (dynamic world obj
 	float get_true_radius() const;
 	float get_true_density() const;
 	float get_true_mass() const;
-	void advance_object(bool disable_motionless_objects, int iter, int obj_index);
-	int surface_advance();
+	void advance_object(bool disable_motionless_objects, int iter, int obj_index, float timestep);
+	void integrate_airborne(int iter, float timestep, float air_factor, bool coll_last_frame);
+	bool advance_free_flight(int iter, float timestep);
+	int surface_advance(float timestep);
 	void set_orient_for_coll(vector3d const *const forced_norm);
-	int check_water_collision(float vz_old);
+	int check_water_collision(float vz_old, float timestep);
 	void surf_collide_obj() const;
 	void elastic_collision(point const &obj_pos, float energy, int obj_type);
 	int object_bounce(int coll_type, vector3d &norm, float elasticity2, float z_offset, vector3d const &obj_vel=zero_vector);
-	int object_still_stopped(int obj_index);
+	int object_still_stopped(int obj_index, float timestep);
 	void do_coll_damage();
-	int check_vert_collision(int obj_index, int do_coll_funcs, int iter, vector3d *cnorm=NULL,
+	int check_vert_collision(int obj_index, int do_coll_funcs, int iter, float timestep, vector3d *cnorm=NULL,
 		vector3d const &mdir=all_zeros, bool skip_dynamic=0, bool only_drawn=0, int only_cobj=-1, bool skip_movable=0);
 	int multistep_coll(point const &last_pos, int obj_index, unsigned nsteps);
 	void update_vel_from_damage(vector3d const &dv);
@@ -229,10 +231,10 @@ class vert_coll_detector {
 
 	dwobject &obj;
 	int type, iter;
-	bool player, already_bounced, skip_dynamic, only_drawn, skip_movable;
+	bool player, already_bounced, skip_dynamic, only_drawn, skip_movable, query_only;
 	int coll, obj_index, do_coll_funcs, only_cobj;
-	unsigned cdir, lcoll;
-	float z_old, o_radius, z1, z2;
+	unsigned cdir, lcoll, num_cands;
+	float z_old, o_radius, z1, z2, timestep;
 	point pos, pold;
 	vector3d motion_dir, obj_vel;
 	vector3d *cnorm;
@@ -243,14 +245,15 @@ class vert_coll_detector {
 	void init_reset_pos();
 public:
 	vert_coll_detector(dwobject &obj_, int obj_index_, int do_coll_funcs_, int iter_, vector3d *cnorm_,
-		vector3d const &mdir=zero_vector, bool skip_dynamic_=0, bool only_drawn_=0, int only_cobj_=-1, bool skip_movable_=0) :
+		float timestep_, vector3d const &mdir=zero_vector, bool skip_dynamic_=0, bool only_drawn_=0, int only_cobj_=-1, bool skip_movable_=0) :
 	obj(obj_), type(obj.type), iter(iter_), player(type == CAMERA || type == SMILEY || type == WAYPOINT),
-	already_bounced(0), skip_dynamic(skip_dynamic_), only_drawn(only_drawn_), skip_movable(skip_movable_), coll(0), obj_index(obj_index_),
-	do_coll_funcs(do_coll_funcs_), only_cobj(only_cobj_), cdir(0), lcoll(0), z_old(obj.pos.z), o_radius(0.0),
-	z1(0.0), z2(0.0), pos(obj.pos), pold(obj.pos), motion_dir(mdir), obj_vel(obj.velocity), cnorm(cnorm_) {}
+	already_bounced(0), skip_dynamic(skip_dynamic_), only_drawn(only_drawn_), skip_movable(skip_movable_), query_only(0), coll(0), obj_index(obj_index_),
+	do_coll_funcs(do_coll_funcs_), only_cobj(only_cobj_), cdir(0), lcoll(0), num_cands(0), z_old(obj.pos.z), o_radius(0.0),
+	z1(0.0), z2(0.0), timestep(timestep_), pos(obj.pos), pold(obj.pos), motion_dir(mdir), obj_vel(obj.velocity), cnorm(cnorm_) {}
 
 	void check_cobj(int index);
 	int check_coll();
+	bool has_coll_candidates();
 };
 
 
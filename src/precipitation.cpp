@@ -6,6 +6,7 @@
 #include "draw_utils.h"
 #include "shaders.h"
 #include "mesh.h"
+#include "cobj_bsp_tree.h"
 
 
 float const TT_PRECIP_DIST  = 20.0;
@@ -23,6 +24,7 @@ template <unsigned VERTS_PER_PRIM> class precip_manager_t {
 protected:
 	typedef vert_wrap_t vert_type_t;
 	vector<vert_type_t> verts;
+	vector<batch_ray_t> splash_rays; // drops that hit a cobj this frame, resolved together in add_cobj_splashes()
 	rand_gen_t rgen;
 	float prev_zmin, cur_zmin, prev_zmax, cur_zmax, precip_dist;
 	bool check_water_coll, check_mesh_coll, check_cobj_coll;
@@ -91,12 +93,7 @@ public:
 			return 0;
 		}
 		else if (check_cobj_coll && bot_pos.z < v_collision_matrix[y][x].zmax) { // possible cobj collision
-			if (splashes != nullptr && check_splash_dist(bot_pos)) {
-				point cpos;
-				vector3d cnorm;
-				int cindex;
-				if (camera_pdu.point_visible_test(bot_pos) && check_coll_line_exact(pos, bot_pos, cpos, cnorm, cindex, 0.0, camera_coll_id)) {splashes->push_back(sphere_t(cpos, 1.0));}
-			}
+			if (splashes != nullptr && check_splash_dist(bot_pos) && camera_pdu.point_visible_test(bot_pos)) {splash_rays.push_back(batch_ray_t(pos, bot_pos));}
 			return 0;
 		}
 		return 1;
@@ -113,6 +110,12 @@ public:
 		else if (!in_range(pos))                            {pos = gen_pt(pos.z   );} // move inside the range
 		else if (!is_bot_pos_valid(pos, bot_pos, splashes)) {pos = gen_pt(cur_zmax);} // start again near the top
 	}
+	void add_cobj_splashes(deque<sphere_t> &splashes) {
+		if (splash_rays.empty()) return;
+		check_drop_rays_batch(splash_rays, camera_coll_id, 1, 1, 0, 0); // dynamic cobjs and voxels, but not models
+		for (auto i = splash_rays.begin(); i != splash_rays.end(); ++i) {if (i->hit) {splashes.push_back(sphere_t(i->cpos, 1.0));}}
+		splash_rays.clear();
+	}
 	void check_size() {verts.resize(VERTS_PER_PRIM*get_num_precip(), all_zeros);}
 };
 
@@ -160,6 +163,7 @@ public:
 			if (animate2) {verts[i].v += vcur; vcur += vinc;}
 			verts[i+1].v = verts[i].v + dir;
 		}
+		add_cobj_splashes(splashes);
 		gen_draw_data();
 	}
 	void render() const { // partially transparent
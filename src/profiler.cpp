@@ -3,6 +3,7 @@
 // 4/20/13
 
 #include "3DWorld.h"
+#include <mutex>
 
 using std::string;
 
@@ -17,15 +18,17 @@ class timing_profiler {
 	};
 
 	map<string, entry_t> entries;
+	mutable std::mutex entries_mutex; // times may be registered from worker threads
 
 public:
 	bool enabled;
 
 	timing_profiler() : enabled(0) {}
-	void clear() {entries.clear();}
+	void clear() {std::lock_guard<std::mutex> lock(entries_mutex); entries.clear();}
 
 	void register_time(const char *str, int delta_time) {
 		if (enabled) {
+			std::lock_guard<std::mutex> lock(entries_mutex);
 			entries[str].add(delta_time);
 		}
 		else {
@@ -33,6 +36,7 @@ public:
 		}
 	}
 	void stats() const {
+		std::lock_guard<std::mutex> lock(entries_mutex);
 		cout << "name count total max average" << endl;
 		unsigned max_name(0);
 		for (auto i = entries.begin(); i != entries.end(); ++i) {max_name = max(max_name, (unsigned)i->first.size());}
@@ -52,6 +56,8 @@ void toggle_timing_profiler() {
 	global_profiler.enabled ^= 1;
 }
 
+bool timing_profiler_enabled() {return global_profiler.enabled;}
+
 void register_timing_value(const char *str, int delta_time) {
 	global_profiler.register_time(str, delta_time);
 }
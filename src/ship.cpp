@@ -10,6 +10,7 @@
 #include "shaders.h"
 #include "draw_utils.h"
 #include "gl_ext_arb.h"
+#include <omp.h>
 
 
 bool const TIMETEST          = (GLOBAL_TIMETEST || 0);
@@ -20,10 +21,11 @@ unsigned const NUM_EXTRA_DAM = 4;
 
 bool player_autopilot(0), player_auto_stop(0), hold_fighters(0), dock_fighters(0);
 int onscreen_display(0);
-unsigned alloced_fobjs[3] = {0}; // testing
+unsigned alloced_fobjs[5] = {0}; // testing: {ships alloced, ships freed, proj+part blocks, blocks created, blocks reused}
 float uobj_rmax(0.0), urm_ship(0.0), urm_static(0.0), urm_proj(0.0);
 point player_death_pos(all_zeros), universe_origin(all_zeros);
 vector<free_obj *> uobjs; // ships, projectiles, etc.
+vector<free_obj *> phys_order, new_phys_objs; // uobjs in physics order, and uobjs added since the last physics merge
 vector<cached_obj> coll_objs; // only collision objects
 vector<cached_obj> ships[NUM_ALIGNMENT], all_ships; // ships only - do we want vectors of u_ship*?
 vector<cached_obj> stat_objs; // static objects, for intersection tests
@@ -266,7 +268,8 @@ void show_stats() {
 	}
 	print_univ_owner_stats();
 	cout << "Alloced: Ships: " << alloced_fobjs[0] << " - " << alloced_fobjs[1] << " = " <<
-		(alloced_fobjs[0] - alloced_fobjs[1]) << ", Proj+Part: " << alloced_fobjs[2] << " (x100)" << endl;
+		(alloced_fobjs[0] - alloced_fobjs[1]) << ", Proj+Part: " << alloced_fobjs[2] << " (x" << BLOCK_SIZE << "), blocks created: " <<
+		alloced_fobjs[3] << ", reused: " << alloced_fobjs[4] << endl;
 }
 
 
@@ -426,7 +429,10 @@ bool add_uobj(free_obj *obj, int coll_test) {
 		unsigned const coll_ix(check_for_obj_coll(obj->get_pos(), obj->get_c_radius()));
 		coll = (coll_ix > 0);
 	}
-	if (!coll || coll_test != 2) uobjs.push_back(obj);
+	if (!coll || coll_test != 2) {
+		uobjs.push_back(obj);
+		new_phys_objs.push_back(obj);
+	}
 	return coll;
 }
 
@@ -481,6 +487,9 @@ void remove_bad_cobjs_and_particles(vector<cached_obj> &objs) {
 }
 
 
+bool phys_order_less(free_obj const *a, free_obj const *b) {return (a->get_mem_order_key() < b->get_mem_order_key());}
+
+
 void apply_univ_physics() {
 
 	if (show_framerate) show_stats();
@@ -494,6 +503,7 @@ void apply_univ_physics() {
 	if (TIMETEST) PRINT_TIME("  Get Cached");
 	unsigned const nobjs((unsigned)c_uobjs.size());
 	assert(uobjs.size() == nobjs);
+	unsigned const nadded((unsigned)new_phys_objs.size()); // objects added after this point wait for the next frame
 	all_ships.resize(0);
 	stat_objs.resize(0);
 	coll_proj.resize(0);
@@ -557,8 +567,18 @@ void apply_univ_physics() {
 		if (TIMETEST) PRINT_TIME("  AI Action");
 
 		// c_uobjs is invalid at this point
-		// don't update nobjs - delay first physics event for new objects until next frame
-		for (unsigned i = 0; i < nobjs; ++i) {uobjs[i]->apply_physics();}
+		// don't update nobjs - delay first physics event for new objects until next frame;
+		// non-pooled objects are processed in order of addition, followed by pooled particles and projectiles in memory (block, slot) order;
+		// phys_order stays sorted across frames, so only the newly added objects are sorted and merged in (removals are done in purge_old_objs())
+		if (nadded > 0) {
+			size_t const nold(phys_order.size());
+			stable_sort(new_phys_objs.begin(), new_phys_objs.begin()+nadded, phys_order_less);
+			phys_order.insert(phys_order.end(), new_phys_objs.begin(), new_phys_objs.begin()+nadded);
+			inplace_merge(phys_order.begin(), phys_order.begin()+nold, phys_order.end(), phys_order_less);
+			new_phys_objs.erase(new_phys_objs.begin(), new_phys_objs.begin()+nadded);
+		}
+		assert(phys_order.size() == nobjs);
+		for (auto i = phys_order.begin(); i != phys_order.end(); ++i) {(*i)->apply_physics();}
 		if (TIMETEST) PRINT_TIME("  Apply Physics");
 		float const timestep(fticks/NUM_TIMESTEPS);
 
@@ -566,19 +586,28 @@ void apply_univ_physics() {
 			collision_detect_objects(coll_objs, t);
 			if (t == 0) {remove_bad_cobjs_and_particles(coll_objs);}
 
-			for (unsigned i = 0; i < nobjs; ++i) {
-				if (!uobjs[i]->is_ok()) {
+			for (auto i = phys_order.begin(); i != phys_order.end(); ++i) {
+				free_obj *const uobj(*i);
+
+				if (!uobj->is_ok()) {
 					// nothing
 				}
-				else if (uobjs[i]->get_flags() & (OBJ_FLAGS_DIST | OBJ_FLAGS_ORBT)) {
-					if (t == 0) uobjs[i]->advance_time(fticks);
+				else if (uobj->get_flags() & (OBJ_FLAGS_DIST | OBJ_FLAGS_ORBT)) {
+					if (t == 0) uobj->advance_time(fticks);
 				}
 				else {
-					uobjs[i]->advance_time(timestep);
+					uobj->advance_time(timestep);
 				}
 			}
 		}
 		if (TIMETEST) PRINT_TIME("  Advance + Collision");
+
+		if (TIMETEST) { // per-frame proj+part block allocations
+			static unsigned last_alloced[2] = {0};
+			cout << "  Blocks created: " << (alloced_fobjs[3] - last_alloced[0]) << " reused: " << (alloced_fobjs[4] - last_alloced[1]) << endl;
+			last_alloced[0] = alloced_fobjs[3];
+			last_alloced[1] = alloced_fobjs[4];
+		}
 	}
 	else {
 		player_ship().apply_physics();
@@ -622,15 +651,176 @@ bool proc_coll(free_obj *o1, free_obj *o2) {
 }
 
 
+void uobj_coll_grid_t::clear() {
+
+	for (unsigned l = 0; l < NUM_LEVELS; ++l) {
+		cells[l].clear();
+		max_radius[l] = 0.0;
+	}
+	obj_cells.clear();
+	base_cell_sz = 0.0;
+}
+
+
+unsigned uobj_coll_grid_t::get_level(float radius) const {
+
+	unsigned level(0);
+	for (float cell_sz = base_cell_sz; level+1 < NUM_LEVELS && cell_sz < 2.0*radius; ++level, cell_sz *= 4.0) {}
+	return level;
+}
+
+
+void uobj_coll_grid_t::get_cell(point const &pos, unsigned level, int cell[3]) const {
+
+	float const cell_sz_inv(1.0/get_cell_sz(level));
+	int const max_cell(1 << 20); // 21 bits per dim, including sign
+	UNROLL_3X(cell[i_] = max(-max_cell, min(max_cell-1, int(floor(pos[i_]*cell_sz_inv))));)
+}
+
+
+uint64_t uobj_coll_grid_t::get_key(int const cell[3]) {
+
+	uint64_t key(0);
+	UNROLL_3X(key = (key << 21) | (uint64_t(cell[i_] + (1 << 20)) & 0x1FFFFF);)
+	return key;
+}
+
+
+void uobj_coll_grid_t::insert(unsigned ix, unsigned level, uint64_t key, float radius) {
+
+	assert(level < NUM_LEVELS);
+	vector<unsigned> &cell(cells[level][key]);
+	obj_cell_t &oc(obj_cells[ix]);
+	oc.key      = key;
+	oc.level    = level;
+	oc.cell_pos = (unsigned)cell.size();
+	cell.push_back(ix);
+	max_radius[level] = max(max_radius[level], radius); // never decreases until the next full rebuild
+}
+
+
+void uobj_coll_grid_t::remove(unsigned ix) {
+
+	obj_cell_t &oc(obj_cells[ix]);
+	if (oc.level == NOT_IN_GRID) return;
+	auto it(cells[oc.level].find(oc.key));
+	assert(it != cells[oc.level].end());
+	vector<unsigned> &cell(it->second);
+	assert(oc.cell_pos < cell.size() && cell[oc.cell_pos] == ix);
+	cell[oc.cell_pos] = cell.back(); // swap with last and pop
+	obj_cells[cell.back()].cell_pos = oc.cell_pos;
+	cell.pop_back();
+	if (cell.empty()) {cells[oc.level].erase(it);}
+	oc.level = NOT_IN_GRID;
+}
+
+
+// in_grid[i] is 0 for objects that should be excluded this timestep;
+// incremental if objs is the same set of objects as the last call, otherwise the grid is rebuilt
+void uobj_coll_grid_t::update(vector<cached_obj> const &objs, vector<unsigned char> const &in_grid) {
+
+	unsigned const size((unsigned)objs.size());
+	assert(in_grid.size() == size);
+
+	if (obj_cells.size() != size || base_cell_sz == 0.0) { // full rebuild
+		clear();
+		float min_radius(0.0), max_rad(0.0);
+
+		for (unsigned i = 0; i < size; ++i) {
+			if (!in_grid[i]) continue;
+			min_radius = ((min_radius == 0.0) ? objs[i].radius : min(min_radius, objs[i].radius));
+			max_rad    = max(max_rad, objs[i].radius);
+		}
+		if (min_radius == 0.0) return; // no objects
+		// the smallest objects get the lowest level, unless the size range is too large, in which case the largest objects get the top level
+		base_cell_sz = 2.0*max(min_radius, max_rad/float(1U << (2*(NUM_LEVELS-1))));
+		obj_cells.resize(size);
+	}
+	for (unsigned i = 0; i < size; ++i) {
+		if (!in_grid[i]) {remove(i); continue;}
+		unsigned const level(get_level(objs[i].radius));
+		int cell[3];
+		get_cell(objs[i].pos, level, cell);
+		uint64_t const key(get_key(cell));
+		obj_cell_t const &oc(obj_cells[i]);
+		if (oc.level == level && oc.key == key) {max_radius[level] = max(max_radius[level], objs[i].radius); continue;} // same cell
+		remove(i);
+		insert(i, level, key, objs[i].radius);
+	}
+}
+
+
+unsigned get_coll_bad_flags(unsigned flags) {
+
+	unsigned bad_flags(OBJ_FLAGS_BAD_);
+	if ( flags & OBJ_FLAGS_PART) {bad_flags |= OBJ_FLAGS_PART;} // skip particle-particle collisions
+	if ( flags & OBJ_FLAGS_NOC2) {bad_flags |= OBJ_FLAGS_NOC2;} // both objects have their C2 flags set, skip the collision
+	if ((flags & OBJ_FLAGS_PROJ) && (flags & OBJ_FLAGS_NOPC)) {bad_flags |= OBJ_FLAGS_PROJ;} // no projectile-projectile collision
+	return bad_flags;
+}
+
+bool coll_pair_valid(cached_obj const &o1, cached_obj const &o2) {
+	return (!(o2.flags & get_coll_bad_flags(o1.flags)) && !(o1.flags & get_coll_bad_flags(o2.flags)) && dist_less_than(o1.pos, o2.pos, (o1.radius + o2.radius)));
+}
+
+
+// returns pairs of intersecting objects {i, j} with i < j, sorted so that the result is independent of the number of threads;
+// each object only queries levels at or above its own, so the search is at most 3x3x3 cells per level
+void uobj_coll_grid_t::get_pairs(vector<cached_obj> const &objs, vector<pair<unsigned, unsigned>> &pairs) {
+
+	pairs.clear();
+	if (base_cell_sz == 0.0) return; // empty
+	assert(obj_cells.size() == objs.size());
+	thread_pairs.resize(omp_get_max_threads());
+	for (auto i = thread_pairs.begin(); i != thread_pairs.end(); ++i) {i->clear();}
+
+#pragma omp parallel for schedule(dynamic,64)
+	for (int i = 0; i < (int)objs.size(); ++i) {
+		unsigned const level_i(obj_cells[i].level);
+		if (level_i == NOT_IN_GRID) continue;
+		vector<pair<unsigned, unsigned>> &tpairs(thread_pairs[omp_get_thread_num()]);
+		cached_obj const &oi(objs[i]);
+
+		for (unsigned l = level_i; l < NUM_LEVELS; ++l) {
+			if (cells[l].empty()) continue;
+			vector3d const range(all_ones*(oi.radius + max_radius[l]));
+			int lo[3], hi[3], cell[3];
+			get_cell((oi.pos - range), l, lo);
+			get_cell((oi.pos + range), l, hi);
+
+			for (cell[0] = lo[0]; cell[0] <= hi[0]; ++cell[0]) {
+				for (cell[1] = lo[1]; cell[1] <= hi[1]; ++cell[1]) {
+					for (cell[2] = lo[2]; cell[2] <= hi[2]; ++cell[2]) {
+						auto it(cells[l].find(get_key(cell)));
+						if (it == cells[l].end()) continue;
+
+						for (auto j = it->second.begin(); j != it->second.end(); ++j) {
+							if ((int)*j == i || (l == level_i && (int)*j < i)) continue; // same level pairs are found from both sides, so only keep one
+							if (!coll_pair_valid(oi, objs[*j])) continue;
+							tpairs.push_back(make_pair(min((unsigned)i, *j), max((unsigned)i, *j)));
+						}
+					}
+				}
+			}
+		} // for l
+	} // for i
+	for (auto i = thread_pairs.begin(); i != thread_pairs.end(); ++i) {pairs.insert(pairs.end(), i->begin(), i->end());}
+	sort(pairs.begin(), pairs.end()); // deterministic processing order
+}
+
+
 void collision_detect_objects(vector<cached_obj> &objs, unsigned t) {
 
 	//RESET_TIME;
 	unsigned const size((unsigned)objs.size());
-	static vector<interval> intervals;
-	intervals.clear();
-	intervals.reserve(2*size);
+	static uobj_coll_grid_t coll_grid;
+	static vector<unsigned char> in_grid;
+	static vector<pair<unsigned, unsigned>> pairs;
+	if (t == 0) {coll_grid.clear();} // objs is a new set of objects each frame; otherwise the grid is updated incrementally
+	in_grid.resize(size);
 
 	for (unsigned i = 0; i < size; ++i) {
+		in_grid[i] = 0;
 		if (objs[i].flags & OBJ_FLAGS_BAD_) continue;
 
 		if (t > 0 && (objs[i].flags & (OBJ_FLAGS_DIST | OBJ_FLAGS_ORBT))) {
@@ -638,59 +828,21 @@ void collision_detect_objects(vector<cached_obj> &objs, unsigned t) {
 			continue;
 		}
 		if (t > 0) {objs[i].refresh();} // physics advance was run since last refresh
-		double const radius(objs[i].radius), val(objs[i].pos.x);
-		float const left(float(val - radius)), right(float(val + radius));
-		assert(radius > 0.0);
-		if (left == right) continue; // floating point precision limitation or bug?
-		assert(left < right);
-		intervals.push_back(interval(left,  i, 1));
-		intervals.push_back(interval(right, i, 0));
+		assert(objs[i].radius > 0.0);
+		in_grid[i] = 1;
 	}
-	unsigned const size2((unsigned)intervals.size());
-	static vector<unsigned> locs, work;
-	locs.resize(size);
-	work.clear();
-	sort(intervals.begin(), intervals.end());
-
-	for (unsigned i = 0; i < size2; ++i) {
-		unsigned const ix(intervals[i].ix & ~LEFT_EDGE_BIT), ix_flags(objs[ix].flags);
-		unsigned bad_flags(OBJ_FLAGS_BAD_);
-		if ( ix_flags & OBJ_FLAGS_PART) {bad_flags |= OBJ_FLAGS_PART;} // skip particle-particle collisions
-		if ( ix_flags & OBJ_FLAGS_NOC2) {bad_flags |= OBJ_FLAGS_NOC2;} // both objects have their C2 flags set, skip the collision
-		if ((ix_flags & OBJ_FLAGS_PROJ) && (ix_flags & OBJ_FLAGS_NOPC)) {bad_flags |= OBJ_FLAGS_PROJ;} // no projectile-projectile collision
-		
-		if (intervals[i].ix & LEFT_EDGE_BIT) { // start a new sphere
-			unsigned const wsize((unsigned)work.size());
-
-			if (wsize > 0) {
-				point const pos_i(objs[ix].pos);
-				float const c_radius_i(objs[ix].radius), pisd(pos_i.y);
-
-				for (unsigned k = 0; k < wsize; ++k) {
-					cached_obj &obj(objs[work[k]]);
-					if (obj.flags & bad_flags) continue;
-					float const radius(c_radius_i + obj.radius);
-					if (fabs(pisd - obj.pos.y) > radius || !dist_less_than(pos_i, obj.pos, radius)) continue; // no intersection
-
-					if (proc_coll(objs[ix].obj, obj.obj)) {
-						objs[ix].refresh(); // ???
-						obj.refresh(); // ???
-					}
-				}
-			}
-			locs[ix] = wsize;
-			work.push_back(ix);
-		}
-		else { // end a current sphere
-			assert(!work.empty());
-			unsigned const lix(locs[ix]);
-			//assert(ix < size && lix < work.size() && work[lix] == ix && locs[work.back()] == work.size()-1);
-			swap(work[lix], work.back());
-			locs[work[lix]] = lix;
-			work.pop_back();
+	coll_grid.update(objs, in_grid);
+	coll_grid.get_pairs(objs, pairs);
+
+	for (auto p = pairs.begin(); p != pairs.end(); ++p) { // narrowphase, serial and in sorted order
+		cached_obj &o1(objs[p->first]), &o2(objs[p->second]);
+		if (!coll_pair_valid(o1, o2)) continue; // recheck, since earlier collisions may have moved or invalidated these objects
+
+		if (proc_coll(o1.obj, o2.obj)) {
+			o1.refresh();
+			o2.refresh();
 		}
 	}
-	assert(work.empty());
 	//PRINT_TIME("Collision");
 }
 
@@ -698,11 +850,11 @@ void collision_detect_objects(vector<cached_obj> &objs, unsigned t) {
 uparticle *gen_particle(unsigned type, colorRGBA const &c1, colorRGBA const &c2, unsigned lt, point const &pos,
 						vector3d const &vel, float size, float damage, unsigned align, bool coll, int texture_id)
 {
-	static free_obj_allocator<uparticle> allocator;
-	uparticle *part = allocator.alloc(type);
+	uparticle *part = get_free_obj_allocator<uparticle>().alloc(type);
 	part->set_params(type, pos, vel, signed_rand_vector_norm(), size, c1, c2, lt, damage, align, coll, texture_id);
 	if (type == PTYPE_GLOW) {part->add_flag(OBJ_FLAGS_NOLT);} // no lights on a glow particle
 	uobjs.push_back(part);
+	new_phys_objs.push_back(part);
 	return part;
 }
 
@@ -752,8 +904,7 @@ void add_parts_projs(point const &pos, float radius, vector3d const &dir, colorR
 us_projectile *create_projectile(unsigned type, free_obj const *const parent, unsigned align, point const &pos,
 								 vector3d const &vel, vector3d const &dir, vector3d const &upv)
 {
-	static free_obj_allocator<us_projectile> allocator;
-	us_projectile *proj(allocator.alloc(type));
+	us_projectile *proj(get_free_obj_allocator<us_projectile>().alloc(type));
 	proj->set_parent(parent);
 	proj->set_align(align);
 	proj->set_pos(pos);
@@ -1096,6 +1247,9 @@ void purge_old_objs() {
 		}
 	}
 	if (nbad == 0) return; // no bad objects
+	auto const is_removed([](free_obj const *obj) {return obj->to_be_removed();}); // while pointers are all valid
+	phys_order.erase(remove_if(phys_order.begin(), phys_order.end(), is_removed), phys_order.end());
+	new_phys_objs.erase(remove_if(new_phys_objs.begin(), new_phys_objs.end(), is_removed), new_phys_objs.end());
 	static vector<free_obj *> uobjs2;
 	uobjs2.resize(0);
 	uobjs2.reserve(nobjs - nbad);
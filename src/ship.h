@@ -132,6 +132,17 @@ string    const align_names[NUM_ALIGNMENT] = {"Neutral", "Player", "Government",
 template<typename T> class free_obj_block;
 template<typename T> class free_obj_allocator;
 
+
+struct free_obj_handle { // generational handle to an object in a free_obj_allocator pool; becomes stale once the object is freed
+
+	unsigned block_id, slot, gen;
+
+	free_obj_handle() : block_id(~0U), slot(0), gen(0) {}
+	free_obj_handle(unsigned b, unsigned s, unsigned g) : block_id(b), slot(s), gen(g) {}
+	bool is_valid() const {return (block_id != ~0U);}
+	unsigned long long get_mem_order_key() const {return ((((unsigned long long)block_id) << 32) | slot);} // grouped by block
+};
+
 class s_object;
 class urev_body;
 class free_obj;
@@ -803,6 +814,7 @@ public:
 	virtual int get_gravity(vector3d &vgravity, point const &mpos) const {return 0;}
 	virtual bool fire_weapon(vector3d const &fire_dir, float target_dist) {return 0;} // default - do nothing (should this be here?)
 	virtual bool dec_ref() {return 0;} // could be const?
+	virtual unsigned long long get_mem_order_key() const {return 0;} // for iterating over pooled objects in memory order; 0 = not pooled
 	virtual void reset_target() {target_obj = NULL;}
 	virtual bool source_is_player()            const {return ((parent == NULL) ? 0 : parent->source_is_player());}
 	virtual u_ship_base const *get_ship_base() const {assert(0); return NULL;} // sort of a hack
@@ -961,18 +973,20 @@ class uparticle : public free_obj {
 	float angle, rrate, damage_v;
 	vector3d axis;
 	colorRGBA color1, color2;
-	free_obj_block<uparticle> *alloc_block;
+	free_obj_handle handle; // invalid if not allocated from the pool
 
 public:
 	friend class free_obj_allocator<uparticle>;
 	static unsigned const max_type = NUM_PTYPES;
 
-	uparticle() : alloc_block(NULL) {}
+	uparticle() {}
 	uparticle(unsigned ptype_, point const &pos_, vector3d const &vel, vector3d const &d, float radius_, colorRGBA const &c1,
-		colorRGBA const &c2, unsigned lt, float damage_, unsigned align, bool coll_, int tid) : alloc_block(NULL) {
+		colorRGBA const &c2, unsigned lt, float damage_, unsigned align, bool coll_, int tid) {
 		set_params(ptype_, pos_, vel, d, radius_, c1, c2, lt, damage_, align, coll_, tid);
 	}
-	void reset() {alloc_block = NULL; free_obj::reset();}
+	void reset() {handle = free_obj_handle(); free_obj::reset();}
+	free_obj_handle const &get_handle() const {return handle;}
+	unsigned long long get_mem_order_key() const {return (handle.is_valid() ? ((1ULL << 62) | handle.get_mem_order_key()) : 0);}
 	void set_params(unsigned ptype_, point const &pos_, vector3d const &vel, vector3d const &d, float radius_,
 		colorRGBA const &c1, colorRGBA const &c2, unsigned lt, float damage_, unsigned align, bool coll_, int tid);
 	void set_type(unsigned type) {ptype = type;}
@@ -1030,14 +1044,16 @@ private:
 	unsigned wclass;
 	unsigned tup_time;
 	float armor;
-	free_obj_block<us_projectile> *alloc_block;
+	free_obj_handle handle; // invalid if not allocated from the pool
 
 public:
 	friend class free_obj_allocator<us_projectile>;
 	static unsigned const max_type = NUM_UWEAP;
 
 	us_projectile(unsigned type=UWEAP_NONE);
-	void reset() {alloc_block = NULL; free_obj::reset();}
+	void reset() {handle = free_obj_handle(); free_obj::reset();}
+	free_obj_handle const &get_handle() const {return handle;}
+	unsigned long long get_mem_order_key() const {return (handle.is_valid() ? ((2ULL << 62) | handle.get_mem_order_key()) : 0);}
 	void set_type(unsigned type);
 	bool dec_ref();
 	us_weapon const &specs() const;
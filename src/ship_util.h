@@ -11,6 +11,7 @@
 #include "draw_utils.h" // for line_tquad_draw_t
 
 unsigned const BLOCK_SIZE = 1000;
+unsigned const MAX_SPARE_BLOCKS = 4; // per object type
 
 extern unsigned alloced_fobjs[]; // testing
 
@@ -147,13 +148,35 @@ struct line_int_data {
 };
 
 
+template<typename T> class free_obj_allocator;
+template<typename T> free_obj_allocator<T> &get_free_obj_allocator();
+
+
 template<typename T> class free_obj_block {
 
 	T objs[BLOCK_SIZE];
-	unsigned used, freed;
+	unsigned gens[BLOCK_SIZE]; // incremented each time an object is freed, so that old handles to its slot become stale
+	unsigned id, used, freed;
 	bool in_use, valid;
 public:
-	free_obj_block() : used(0), freed(0), in_use(0), valid(1) {}
+	free_obj_block(unsigned id_, unsigned gen=0) : id(id_), used(0), freed(0), in_use(0), valid(1) { // gen > any handle gen of a previous block with this id
+		for (unsigned i = 0; i < BLOCK_SIZE; ++i) {gens[i] = gen;}
+	}
+	unsigned get_id() const {return id;}
+	unsigned get_max_gen() const {
+		unsigned max_gen(0);
+		for (unsigned i = 0; i < BLOCK_SIZE; ++i) {max_gen = max(max_gen, gens[i]);}
+		return max_gen;
+	}
+	free_obj_handle get_handle(T const *const obj) const {
+		assert(obj >= objs && obj < objs+used);
+		unsigned const slot(obj - objs);
+		return free_obj_handle(id, slot, gens[slot]);
+	}
+	T *get(free_obj_handle const &h) const {
+		assert(h.block_id == id && h.slot < BLOCK_SIZE);
+		return ((h.slot < used && gens[h.slot] == h.gen) ? const_cast<T *>(&objs[h.slot]) : NULL);
+	}
 
 	T *alloc(unsigned type) {
 		assert(valid);
@@ -165,34 +188,63 @@ public:
 		if (VERIFY_REFS) objs[used].verify_status();
 		return &objs[used++];
 	}
-	bool free_object() {
-		assert(valid);
+	bool free_object(unsigned slot) {
+		assert(valid && slot < used);
+		++gens[slot]; // invalidate handles to this object
 		if (++freed == BLOCK_SIZE) {
-			if (in_use) {
-				for (unsigned i = 0; i < BLOCK_SIZE; ++i) objs[i].reset(); // is this necessary?
-				used = freed = 0; // re-initialize
-			}
-			else {
-				valid = 0; // in case someone tries to use this deleted block
-				assert(alloced_fobjs[2] > 0);
-				--alloced_fobjs[2];
-				delete this; // is this legal?
-			}
+			if (in_use) {clear();} // re-initialize
+			else {get_free_obj_allocator<T>().release_block(this);} // Note: may delete this
 			return 0;
 		}
 		return 1;
 	}
+	void clear() {
+		for (unsigned i = 0; i < BLOCK_SIZE; ++i) objs[i].reset(); // is this necessary?
+		used = freed = 0;
+	}
 	void set_in_use(bool val) {assert(valid); in_use = val;}
+	void invalidate() {valid = 0;} // in case someone tries to use this deleted block
 };
 
 
+// one allocator per object type (see get_free_obj_allocator()); fully freed blocks are kept in spare_blocks and reused,
+// rather than constructing and destroying BLOCK_SIZE objects each time a block is needed;
+// objects are referenced by generational handles, which can be checked for staleness even after their block has been deleted;
+// the ids of deleted blocks are reused, with generations starting above those of the deleted block so that old handles stay stale
 template<typename T> class free_obj_allocator {
 
 	free_obj_block<T> *last;
+	vector<free_obj_block<T> *> blocks; // indexed by block id; NULL for deleted blocks
+	vector<free_obj_block<T> *> spare_blocks;
+	vector<pair<unsigned, unsigned> > free_ids; // {id, first gen} of deleted blocks
 	free_obj_allocator(free_obj_allocator const &); // forbidden
 	void operator=(free_obj_allocator const &); // forbidden
+
+	free_obj_block<T> *get_block() {
+		if (spare_blocks.empty()) {
+			++alloced_fobjs[2];
+			++alloced_fobjs[3];
+
+			if (!free_ids.empty()) { // reuse the id of a deleted block
+				unsigned const id(free_ids.back().first);
+				assert(id < blocks.size() && blocks[id] == NULL);
+				blocks[id] = new free_obj_block<T>(id, free_ids.back().second);
+				free_ids.pop_back();
+				return blocks[id];
+			}
+			blocks.push_back(new free_obj_block<T>(blocks.size()));
+			return blocks.back();
+		}
+		free_obj_block<T> *const block(spare_blocks.back());
+		spare_blocks.pop_back();
+		++alloced_fobjs[4];
+		return block;
+	}
 public:
-	free_obj_allocator() : last(new free_obj_block<T>) {last->set_in_use(1);}
+	free_obj_allocator() {
+		last = get_block();
+		last->set_in_use(1);
+	}
 
 	T *alloc(unsigned type) {
 		assert(last != NULL);
@@ -200,24 +252,51 @@ public:
 		
 		if (ptr == NULL) {
 			last->set_in_use(0); // unlock so that it can be freed
-			last = new free_obj_block<T>;
-			++alloced_fobjs[2];
+			last = get_block();
 			assert(last != NULL);
 			last->set_in_use(1); // lock so that it can't be freed
 			ptr = last->alloc(type);
 			assert(ptr != NULL);
 		}
-		ptr->alloc_block = last;
+		ptr->handle = last->get_handle(ptr);
 		if (VERIFY_REFS) ptr->verify_status();
 		return ptr;
 	}
 
+	T *get(free_obj_handle const &h) const { // returns NULL if the object has been freed
+		if (!h.is_valid() || h.block_id >= blocks.size() || blocks[h.block_id] == NULL) return NULL;
+		return blocks[h.block_id]->get(h);
+	}
+	void free_object(free_obj_handle const &h) {
+		assert(get(h) != NULL); // not already freed
+		blocks[h.block_id]->free_object(h.slot); // Note: may delete the block
+	}
+
+	void release_block(free_obj_block<T> *block) { // called when all objects in an unlocked block have been freed
+		assert(block != NULL && block != last);
+		block->clear();
+		if (spare_blocks.size() < MAX_SPARE_BLOCKS) {spare_blocks.push_back(block); return;}
+		block->invalidate();
+		assert(block->get_id() < blocks.size() && blocks[block->get_id()] == block);
+		blocks[block->get_id()] = NULL;
+		free_ids.push_back(make_pair(block->get_id(), block->get_max_gen()));
+		assert(alloced_fobjs[2] > 0);
+		--alloced_fobjs[2];
+		delete block;
+	}
+
 	~free_obj_allocator() { // Note: last should free itself when its reference count drops to zero
 	  //delete last; // what about the other pointers?
 	}
 };
 
 
+template<typename T> free_obj_allocator<T> &get_free_obj_allocator() { // shared by all callers, so that each object type has a single pool
+	static free_obj_allocator<T> allocator;
+	return allocator;
+}
+
+
 // ship_config.cpp
 void setup_ships();
 bool is_valid_starting_ship_pos(point const &spos, unsigned sclass);
@@ -87,9 +87,12 @@ void small_tree_group::finalize(bool low_detail) {
 	vbo_vnc_block_manager_t &vbo_mgr(vbo_manager[low_detail]);
 	vbo_mgr.clear(0); // clear_pts_mem = 0
 	vbo_mgr.reserve_pts(num_pine_trees*(low_detail ? 1 : PINE_TREE_NPTS));
-	if (!low_detail) {vbo_mgr.reserve_offsets(num_pine_trees);}
-	//if (!low_detail) {for (auto i = begin(); i != end(); ++i) {i->alloc_pine_tree_pts(vbo_mgr);}} // correct, but doesn't seem to help
-#pragma omp parallel for schedule(static,1) num_threads(3) if (!low_detail)
+
+	if (!low_detail) { // assign each pine tree its range of points in tree order, so that they can be filled in parallel without locking
+		vbo_mgr.reserve_offsets(num_pine_trees+1);
+		for (auto i = begin(); i != end(); ++i) {i->alloc_pine_tree_pts(vbo_mgr);}
+	}
+#pragma omp parallel for schedule(dynamic,16) if (!low_detail)
 	for (int i = 0; i < (int)size(); ++i) {operator[](i).calc_points(vbo_mgr, low_detail);}
 	for (const_iterator i = begin(); i != end(); ++i) {palm_vbo_mem += i->get_palm_mem();}
 }
@@ -103,9 +106,9 @@ void small_tree_group::finalize_upload_and_clear_pts(bool low_detail) {
 		tree_instances.finalize_upload_and_clear_pts(0); // high detail
 		return;
 	}
-	//RESET_TIME;
+	RESET_TIME;
 	finalize(low_detail);
-	//if (!low_detail) {PRINT_TIME("Finalize");}
+	if (!low_detail && timing_profiler_enabled()) {PRINT_TIME("Pine Tree Finalize");}
 	vbo_manager[low_detail].upload_and_clear_points();
 	//if (!low_detail) {PRINT_TIME("Finalize + Upload");}
 }
@@ -159,6 +162,7 @@ void small_tree_group::clear_all() {
 	clear_vbos(); // required to clear palm tree VBOs
 	clear();
 	clear_vbo_manager_and_ids();
+	draw_order.clear();
 	generated       = 0;
 	max_tree_radius = 0.0;
 }
@@ -234,22 +238,39 @@ bool small_tree_group::draw_trunks(bool shadow_only, bool all_visible, bool skip
 	return all_drawn;
 }
 
+template<typename T, typename C> void insertion_sort(vector<T> &v, C const &comp) { // linear time when v is nearly sorted, as when the camera moves a small amount
+
+	for (unsigned i = 1; i < v.size(); ++i) {
+		if (!comp(v[i], v[i-1])) continue; // already in order
+		T const val(v[i]);
+		unsigned j(i);
+		for (; j > 0 && comp(val, v[j-1]); --j) {v[j] = v[j-1];}
+		v[j] = val;
+	}
+}
+
 void small_tree_group::sort_by_dist_to_camera() {
 
 	point const camera(get_camera_pos());
 	if (dist_less_than(camera, last_cpos, CAMERA_RADIUS)) return; // no sort needed
 	last_cpos = camera;
-	sort(begin(), end(), small_tree::comp_by_type_dist(camera));
+	insertion_sort(*this, small_tree::comp_by_type_dist(camera)); // trees are already sorted by type and by distance from the last camera pos
 }
 
-void small_tree_group::get_back_to_front_ordering(vector<pair<float, unsigned> > &to_draw, vector3d const &xlate) const { // for leaves
+void small_tree_group::update_draw_order(vector3d const &xlate) { // for leaves; sort front to back for early Z culling
 
 	point const ref_pos(get_camera_pos() - xlate);
+	float const bucket_sz_inv(1.0/max(max_tree_radius, TOLERANCE)); // trees within the same bucket are close enough that draw order doesn't matter
+	bool const full_sort(draw_order.size() != size()); // trees were added or removed
 
-	for (const_iterator i = begin(); i != end(); ++i) {
-		if (i->are_leaves_visible(xlate)) {to_draw.push_back(make_pair(p2p_dist_sq(i->get_pos(), ref_pos), i-begin()));}
+	if (full_sort) {
+		draw_order.resize(size());
+		for (unsigned i = 0; i < size(); ++i) {draw_order[i].second = i;}
 	}
-	sort(to_draw.begin(), to_draw.end()); // sort front to back for early Z culling
+	for (auto i = draw_order.begin(); i != draw_order.end(); ++i) {i->first = unsigned(p2p_dist(operator[](i->second).get_pos(), ref_pos)*bucket_sz_inv);}
+	auto const comp([](pair<unsigned, unsigned> const &a, pair<unsigned, unsigned> const &b) {return (a.first < b.first);});
+	if (full_sort) {sort(draw_order.begin(), draw_order.end(), comp);}
+	else {insertion_sort(draw_order, comp);} // only trees that changed buckets since the last frame move
 }
 
 
@@ -309,9 +330,8 @@ void small_tree_group::draw_pine_leaves(shader_t &s, bool shadow_only, bool low_
 	}
 	else if (sort_front_to_back) {
 		assert(!low_detail);
-		vector<pair<float, unsigned> > to_draw;
-		get_back_to_front_ordering(to_draw, xlate);
-		for (unsigned i = 0; i < to_draw.size(); ++i) {operator[](to_draw[i].second).draw_pine_leaves(vbomgr, xlate);}
+		update_draw_order(xlate);
+		for (auto i = draw_order.begin(); i != draw_order.end(); ++i) {operator[](i->second).draw_pine_leaves(vbomgr, xlate);} // skips non-visible trees
 	}
 	else {
 		for (const_iterator i = begin(); i != end(); ++i) {i->draw_pine_leaves(vbomgr, xlate);}
@@ -943,11 +963,10 @@ void small_tree::calc_points(vbo_vnc_block_manager_t &vbo_manager, bool low_deta
 			assert(vbo_mgr_ix >= 0);
 			vbo_manager.update_range(points, PINE_TREE_NPTS, leaf_color, vbo_mgr_ix, vbo_mgr_ix+1);
 		}
-		/*else if (vbo_mgr_ix >= 0) { // already allocated, just copy the points (requires additional code to be enabled in small_tree_group::finalize())
+		else if (vbo_mgr_ix >= 0) { // already allocated in small_tree_group::finalize(), just copy the points; okay to run in parallel
 			vbo_manager.fill_pts_from(points, PINE_TREE_NPTS, leaf_color, vbo_mgr_ix);
-		}*/
-		else { // we only get into this case when running in parallel
-			#pragma omp critical(pine_tree_vbo_update)
+		}
+		else { // single tree added (serial)
 			vbo_mgr_ix = vbo_manager.add_points_with_offset(points, PINE_TREE_NPTS, leaf_color);
 		}
 	}
@@ -105,6 +105,7 @@ struct small_tree_group : public vector<small_tree> {
 		bool operator<(tree_inst_t const &i) const {return (id < i.id);}
 	};
 	vector<tree_inst_t> tree_insts[2]; // pine trees, palm trees
+	vector<pair<unsigned, unsigned> > draw_order; // {distance bucket, tree index}, kept sorted front to back across frames
 	
 	small_tree_group() : generated(0), instanced(0), num_pine_trees(0), num_palm_trees(0), num_trunk_pts(0), palm_vbo_mem(0), max_tree_radius(0.0), last_cpos(all_zeros)
 	{all_bcube.set_to_zeros();}
@@ -128,7 +129,7 @@ struct small_tree_group : public vector<small_tree> {
 	bool check_sphere_coll(point &center, float radius) const;
 	bool line_intersect(point const &p1, point const &p2, float *t=NULL) const;
 	void translate_by(vector3d const &vd);
-	void get_back_to_front_ordering(vector<pair<float, unsigned> > &to_draw, vector3d const &xlate) const;
+	void update_draw_order(vector3d const &xlate);
 	bool draw_trunks(bool shadow_only, bool all_visible=0, bool skip_lines=0, vector3d const &xlate=zero_vector) const;
 	void draw_tree_insts(shader_t &s, bool draw_all, vector3d const &xlate, int xlate_loc, vector<tree_inst_t> &insts, bool is_pine);
 	void draw_pine_insts(shader_t &s, bool draw_all, vector3d const &xlate, int xlate_loc) {draw_tree_insts(s, draw_all, xlate, xlate_loc, tree_insts[0], 1);}
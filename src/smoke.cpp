@@ -10,8 +10,7 @@
 
 
 bool const DYNAMIC_SMOKE     = 1; // looks cool
-int const SMOKE_SKIPVAL      = 8;
-int const SMOKE_SEND_SKIP    = 8;
+int const SMOKE_SKIPVAL      = 8; // frames per grid sweep of the original serial solver; used to derive per-frame rates
 int const INDIR_LT_SEND_SKIP = 12;
 
 float const SMOKE_DENSITY    = 1.0;
@@ -24,7 +23,7 @@ float const SMOKE_THRESH     = 1.0/255.0;
 
 
 bool smoke_visible(0), smoke_exists(0), have_indir_smoke_tex(0);
-unsigned smoke_tid(0), last_smoke_update(0);
+unsigned smoke_tid(0);
 colorRGB const_indir_color(BLACK);
 cube_t cur_smoke_bb;
 vector<unsigned char> smoke_tex_data; // several MB
@@ -51,35 +50,6 @@ bool check_smoke_bounds(point const &pt) {
 }
 
 
-struct smoke_entry_t {
-	short zmin, zmax;
-	smoke_entry_t() {clear();}
-	bool valid() const {return (zmin < zmax);}
-	void clear() {zmin = 10000; zmax = 0;}
-	void update(short zval) {zmin = min(zmin, zval); zmax = max(zmax, short(zval+1));}
-};
-
-class smoke_grid_t {
-	vector<smoke_entry_t> zrng; // z smoke ranges for each xy grid element
-public:
-	void ensure_zrng() {
-		if (zrng.empty()) {zrng.resize(XY_MULT_SIZE);} else {assert((int)zrng.size() == XY_MULT_SIZE);}
-	}
-	void register_smoke(int x, int y, int z) {
-		ensure_zrng();
-		assert(!point_outside_mesh(x, y));
-		zrng[y*MESH_X_SIZE + x].update(z);
-	}
-	smoke_entry_t &get_z_range(int x, int y) {
-		ensure_zrng();
-		assert(!point_outside_mesh(x, y));
-		return zrng[y*MESH_X_SIZE + x];
-	}
-};
-
-smoke_grid_t smoke_grid;
-
-
 struct smoke_manager {
 	bool enabled, smoke_vis;
 	float tot_smoke;
@@ -97,13 +67,12 @@ struct smoke_manager {
 		enabled   = 0;
 		smoke_vis = 0;
 	}
-	void add_smoke(int x, int y, int z, float smoke_amt) {
+	void add_smoke_bcube(cube_t const &bc, float smoke_amt) { // bc bounds the smoke cells of one block
 		if (smoke_amt == 0) return; // can't happen?
-		point const pos(get_xval(x), get_yval(y), get_zval(z));
 
-		if (is_smoke_visible(pos) && check_smoke_bounds(pos)) {
-			bbox.union_with_pt(pos);
-			cur_smoke_bb.union_with_pt(pos);
+		if (camera_pdu.cube_visible(bc) && check_smoke_bounds(bc.get_cube_center())) {
+			bbox.union_with_cube(bc);
+			cur_smoke_bb.union_with_cube(bc);
 			smoke_vis = 1;
 		}
 		tot_smoke += smoke_amt;
@@ -118,46 +87,299 @@ struct smoke_manager {
 	}
 };
 
-smoke_manager smoke_man, next_smoke_man;
+smoke_manager smoke_man;
 
 
 inline void adjust_smoke_val(float &val, float delta) {val = max(0.0f, min(SMOKE_MAX_VAL, (val + delta)));}
 
+
+unsigned const SMOKE_BLOCK_SZ = 8; // cells per block in each dimension
+unsigned const SMOKE_BLOCK_NC = SMOKE_BLOCK_SZ*SMOKE_BLOCK_SZ*SMOKE_BLOCK_SZ;
+int const SMOKE_NO_BLOCK      = -1; // grid position inside the lightmap that has no smoke block
+int const SMOKE_OUTSIDE       = -2; // grid position outside the lightmap
+
+// per-frame diffusion rates; the old solver swept the grid once every SMOKE_SKIPVAL frames and visited each face from both sides
+float const SMOKE_RATE_XY     = 2.0*SMOKE_DIS_XY;
+float const SMOKE_RATE_ZU     = 2.0*SMOKE_DIS_ZU/SMOKE_SKIPVAL;
+float const SMOKE_RATE_ZD     = 2.0*SMOKE_DIS_ZD/SMOKE_SKIPVAL;
+
+
+// a cube of smoke cells stored {y, x, z} with z varying fastest, matching the layout of the smoke texture
+struct smoke_block_t {
+
+	float smoke[2][SMOKE_BLOCK_NC]; // double buffered: diffusion reads [cur] and writes [!cur]
+	unsigned char flow[SMOKE_BLOCK_NC][3]; // copy of lmcell::pflow
+	unsigned char valid[SMOKE_BLOCK_NC]; // cell exists in the lightmap
+	int pos[3], nbors[6]; // block grid position; neighbor block indices {-x, +x, -y, +y, -z, +z} for the current step
+	int lo[3], hi[3]; // local bounds of cells with smoke after the last step
+	float tot_smoke;
+	bool flow_valid, had_smoke, has_smoke;
+
+	static unsigned get_ix(int x, int y, int z) {return ((y*SMOKE_BLOCK_SZ + x)*SMOKE_BLOCK_SZ + z);}
+
+	void init(int bx, int by, int bz) {
+		pos[0] = bx; pos[1] = by; pos[2] = bz;
+		for (unsigned i = 0; i < 2; ++i) {memset(smoke[i], 0, SMOKE_BLOCK_NC*sizeof(float));}
+		tot_smoke  = 0.0;
+		flow_valid = had_smoke = has_smoke = 0;
+	}
+	void fetch_flow() { // copy flow values and cell validity from the lightmap
+		for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) {
+			for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {
+				int const gx(pos[0]*SMOKE_BLOCK_SZ + x), gy(pos[1]*SMOKE_BLOCK_SZ + y);
+				lmcell const *const vldata(point_outside_mesh(gx, gy) ? NULL : lmap_manager.get_column(gx, gy));
+
+				for (unsigned z = 0; z < SMOKE_BLOCK_SZ; ++z) {
+					unsigned const ix(get_ix(x, y, z));
+					int const gz(pos[2]*SMOKE_BLOCK_SZ + z);
+					valid[ix] = (vldata != NULL && lmap_manager.is_valid_cell(gx, gy, gz));
+					UNROLL_3X(flow[ix][i_] = (valid[ix] ? vldata[gz].pflow[i_] : 0);)
+				}
+			}
+		}
+		flow_valid = 1;
+	}
+	unsigned get_face_mask(unsigned cur) { // returns the faces that have smoke in them; also sets had_smoke
+		unsigned mask(0);
+		had_smoke = 0;
+
+		for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) {
+			for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {
+				for (unsigned z = 0; z < SMOKE_BLOCK_SZ; ++z) {
+					if (smoke[cur][get_ix(x, y, z)] == 0.0) continue;
+					unsigned const l[3] = {x, y, z};
+					for (unsigned d = 0; d < 3; ++d) {mask |= ((l[d] == 0) << (2*d)) | ((l[d] == SMOKE_BLOCK_SZ-1) << (2*d+1));}
+					had_smoke = 1;
+				}
+			}
+		}
+		return mask;
+	}
+};
+
+
+class smoke_block_grid_t {
+
+	vector<smoke_block_t> blocks; // freed blocks are reused
+	vector<int> grid; // block index for each grid position, or SMOKE_NO_BLOCK
+	vector<unsigned> active, free_list, dirty; // dirty is grid positions whose texture data is out of date
+	vector<unsigned char> is_dirty;
+	int gsz[3]; // grid size in blocks
+	unsigned cur; // smoke buffer that is read from
+
+	unsigned get_gix(int bx, int by, int bz) const {return ((by*gsz[0] + bx)*gsz[2] + bz);}
+	bool in_grid(int bx, int by, int bz) const {return (bx >= 0 && by >= 0 && bz >= 0 && bx < gsz[0] && by < gsz[1] && bz < gsz[2]);}
+
+	int get_block_ix(int bx, int by, int bz) const {
+		return (in_grid(bx, by, bz) ? grid[get_gix(bx, by, bz)] : SMOKE_OUTSIDE);
+	}
+	void mark_dirty(smoke_block_t const &b) {
+		unsigned const gix(get_gix(b.pos[0], b.pos[1], b.pos[2]));
+		if (is_dirty[gix]) return;
+		is_dirty[gix] = 1;
+		dirty.push_back(gix);
+	}
+	unsigned alloc_block(int bx, int by, int bz) {
+		unsigned const gix(get_gix(bx, by, bz));
+		assert(grid[gix] == SMOKE_NO_BLOCK);
+		unsigned ix(blocks.size());
+		if (free_list.empty()) {blocks.push_back(smoke_block_t());} else {ix = free_list.back(); free_list.pop_back();}
+		blocks[ix].init(bx, by, bz);
+		grid[gix] = ix;
+		active.push_back(ix);
+		return ix;
+	}
+	// gets the smoke of the neighbor of local cell l in block b across face {dim, dir} and the flow through that face; returns false if there is no neighbor cell
+	bool get_nbor(smoke_block_t const &b, unsigned const l[3], unsigned dim, unsigned dir, float &sn, float &flow) const {
+		int n[3] = {int(l[0]), int(l[1]), int(l[2])};
+		n[dim] += (dir ? 1 : -1);
+		smoke_block_t const *nb(&b);
+
+		if (n[dim] < 0 || n[dim] >= (int)SMOKE_BLOCK_SZ) { // in an adjacent block
+			int const nix(b.nbors[2*dim + dir]);
+			if (nix == SMOKE_OUTSIDE) return 0;
+			n[dim] = (n[dim] + SMOKE_BLOCK_SZ) % SMOKE_BLOCK_SZ;
+			nb = ((nix == SMOKE_NO_BLOCK) ? NULL : &blocks[nix]);
+		}
+		unsigned const cix(smoke_block_t::get_ix(l[0], l[1], l[2]));
+
+		if (nb == NULL) { // no smoke on either side of this face, since the block would have been allocated
+			sn   = 0.0;
+			flow = b.flow[cix][dim];
+			return 1;
+		}
+		unsigned const nix(smoke_block_t::get_ix(n[0], n[1], n[2]));
+		if (!nb->valid[nix]) return 0;
+		sn   = nb->smoke[cur][nix];
+		flow = (dir ? b.flow[cix][dim] : nb->flow[nix][dim]); // flow is stored in the cell on the low side of the face
+		return 1;
+	}
+	void diffuse_block(smoke_block_t &b) const {
+		float *const dest(b.smoke[!cur]);
+		b.tot_smoke = 0.0;
+		b.has_smoke = 0;
+		UNROLL_3X(b.lo[i_] = SMOKE_BLOCK_SZ; b.hi[i_] = 0;)
+
+		for (unsigned y = 0; y < SMOKE_BLOCK_SZ; ++y) {
+			for (unsigned x = 0; x < SMOKE_BLOCK_SZ; ++x) {
+				for (unsigned z = 0; z < SMOKE_BLOCK_SZ; ++z) {
+					unsigned const ix(smoke_block_t::get_ix(x, y, z)), l[3] = {x, y, z};
+					dest[ix] = 0.0;
+					if (!b.valid[ix]) continue;
+					float const s(b.smoke[cur][ix]);
+					float delta(0.0);
+
+					for (unsigned dim = 0; dim < 3; ++dim) {
+						for (unsigned dir = 0; dir < 2; ++dir) {
+							float sn(0.0), flow(0.0);
+
+							if (!get_nbor(b, l, dim, dir, sn, flow)) { // edge cell has infinite smoke capacity and zero total smoke
+								if (s > 0.0) {delta -= ((dim < 2) ? SMOKE_DIS_XY : 0.5*(SMOKE_DIS_ZU + SMOKE_DIS_ZD)/SMOKE_SKIPVAL);}
+								continue;
+							}
+							if (sn == s || flow == 0) continue;
+							float rate(SMOKE_RATE_XY);
+							if (dim == 2) {rate = (((sn > s) == (dir != 0)) ? SMOKE_RATE_ZD : SMOKE_RATE_ZU);} // smoke rises faster than it sinks
+							delta += rate*(flow/255.0)*(sn - s);
+						}
+					}
+					float val(s);
+					adjust_smoke_val(val, delta);
+					if (val < SMOKE_THRESH) continue;
+					dest[ix]     = val;
+					b.tot_smoke += val;
+					b.has_smoke  = 1;
+					UNROLL_3X(b.lo[i_] = min(b.lo[i_], (int)l[i_]); b.hi[i_] = max(b.hi[i_], (int)l[i_]);)
+				} // for z
+			} // for x
+		} // for y
+	}
+
+public:
+	smoke_block_grid_t() : cur(0) {UNROLL_3X(gsz[i_] = 0;)}
+	bool empty() const {return active.empty();}
+
+	void clear() {
+		blocks.clear();
+		grid.clear();
+		active.clear();
+		free_list.clear();
+		dirty.clear();
+		is_dirty.clear();
+		UNROLL_3X(gsz[i_] = 0;)
+	}
+	void ensure_grid() {
+		int const sz[3] = {int((MESH_X_SIZE + SMOKE_BLOCK_SZ - 1)/SMOKE_BLOCK_SZ), int((MESH_Y_SIZE + SMOKE_BLOCK_SZ - 1)/SMOKE_BLOCK_SZ), int((MESH_SIZE[2] + SMOKE_BLOCK_SZ - 1)/SMOKE_BLOCK_SZ)};
+		if (!grid.empty() && sz[0] == gsz[0] && sz[1] == gsz[1] && sz[2] == gsz[2]) return;
+		clear();
+		UNROLL_3X(gsz[i_] = sz[i_];)
+		grid.resize(gsz[0]*gsz[1]*gsz[2], SMOKE_NO_BLOCK);
+		is_dirty.resize(grid.size(), 0);
+	}
+	void invalidate_flow() {
+		for (auto i = active.begin(); i != active.end(); ++i) {blocks[*i].flow_valid = 0;}
+	}
+	float get_smoke(int x, int y, int z) const {
+		if (grid.empty() || x < 0 || y < 0 || z < 0) return 0.0;
+		int const bix(get_block_ix(x/SMOKE_BLOCK_SZ, y/SMOKE_BLOCK_SZ, z/SMOKE_BLOCK_SZ));
+		if (bix < 0) return 0.0;
+		return blocks[bix].smoke[cur][smoke_block_t::get_ix(x%SMOKE_BLOCK_SZ, y%SMOKE_BLOCK_SZ, z%SMOKE_BLOCK_SZ)];
+	}
+	void add_smoke(int x, int y, int z, float val) {
+		ensure_grid();
+		int const bx(x/SMOKE_BLOCK_SZ), by(y/SMOKE_BLOCK_SZ), bz(z/SMOKE_BLOCK_SZ);
+		if (!in_grid(bx, by, bz)) return;
+		int bix(grid[get_gix(bx, by, bz)]);
+		if (bix == SMOKE_NO_BLOCK) {bix = alloc_block(bx, by, bz);}
+		smoke_block_t &b(blocks[bix]);
+		adjust_smoke_val(b.smoke[cur][smoke_block_t::get_ix(x%SMOKE_BLOCK_SZ, y%SMOKE_BLOCK_SZ, z%SMOKE_BLOCK_SZ)], val);
+		mark_dirty(b);
+	}
+	bool has_dirty() const {return !dirty.empty();}
+
+	void diffuse(smoke_manager &sman) { // one double-buffered diffusion step over the active blocks
+		if (!lmap_manager.is_allocated()) {clear(); return;} // lightmap was freed
+		unsigned const num_active(active.size());
+		vector<unsigned> face_masks(num_active, 0);
+
+#pragma omp parallel for schedule(dynamic,4)
+		for (int i = 0; i < (int)num_active; ++i) {
+			smoke_block_t &b(blocks[active[i]]);
+			if (!b.flow_valid) {b.fetch_flow();}
+			face_masks[i] = b.get_face_mask(cur);
+		}
+		for (unsigned i = 0; i < num_active; ++i) { // allocate blocks that smoke can spread into
+			for (unsigned f = 0; f < 6; ++f) {
+				if (!(face_masks[i] & (1 << f))) continue;
+				int p[3] = {blocks[active[i]].pos[0], blocks[active[i]].pos[1], blocks[active[i]].pos[2]};
+				p[f>>1] += ((f & 1) ? 1 : -1);
+				if (get_block_ix(p[0], p[1], p[2]) == SMOKE_NO_BLOCK) {alloc_block(p[0], p[1], p[2]);}
+			}
+		}
+#pragma omp parallel for schedule(static,1)
+		for (int i = num_active; i < (int)active.size(); ++i) {blocks[active[i]].fetch_flow();} // new blocks
+
+		for (auto i = active.begin(); i != active.end(); ++i) {
+			smoke_block_t &b(blocks[*i]);
+
+			for (unsigned f = 0; f < 6; ++f) {
+				int p[3] = {b.pos[0], b.pos[1], b.pos[2]};
+				p[f>>1] += ((f & 1) ? 1 : -1);
+				b.nbors[f] = get_block_ix(p[0], p[1], p[2]);
+			}
+		}
+#pragma omp parallel for schedule(dynamic,2)
+		for (int i = 0; i < (int)active.size(); ++i) {diffuse_block(blocks[active[i]]);}
+		cur ^= 1;
+		unsigned num_kept(0);
+
+		for (auto i = active.begin(); i != active.end(); ++i) { // free empty blocks and gather stats
+			smoke_block_t &b(blocks[*i]);
+			if (b.had_smoke || b.has_smoke) {mark_dirty(b);}
+
+			if (!b.has_smoke) {
+				grid[get_gix(b.pos[0], b.pos[1], b.pos[2])] = SMOKE_NO_BLOCK;
+				free_list.push_back(*i);
+				continue;
+			}
+			int lo[3], hi[3];
+			UNROLL_3X(lo[i_] = b.pos[i_]*SMOKE_BLOCK_SZ + b.lo[i_]; hi[i_] = b.pos[i_]*SMOKE_BLOCK_SZ + b.hi[i_];)
+			sman.add_smoke_bcube(cube_t(get_xyz_pos(lo[0], lo[1], lo[2]), get_xyz_pos(hi[0], hi[1], hi[2])), b.tot_smoke);
+			active[num_kept++] = *i;
+		}
+		active.resize(num_kept);
+	}
+	template<typename F> void send_dirty_blocks(F send_func) { // send_func(x1, x2, y1, y2, z1, z2)
+		for (auto i = dirty.begin(); i != dirty.end(); ++i) {
+			int const bz(*i % gsz[2]), bx((*i / gsz[2]) % gsz[0]), by(*i / (gsz[2]*gsz[0]));
+			unsigned const x1(bx*SMOKE_BLOCK_SZ), y1(by*SMOKE_BLOCK_SZ), z1(bz*SMOKE_BLOCK_SZ);
+			send_func(x1, min(x1+SMOKE_BLOCK_SZ, (unsigned)MESH_X_SIZE), y1, min(y1+SMOKE_BLOCK_SZ, (unsigned)MESH_Y_SIZE), z1, min(z1+SMOKE_BLOCK_SZ, (unsigned)MESH_SIZE[2]));
+			is_dirty[*i] = 0;
+		}
+		dirty.clear();
+	}
+	void clear_dirty() {
+		for (auto i = dirty.begin(); i != dirty.end(); ++i) {is_dirty[*i] = 0;}
+		dirty.clear();
+	}
+};
+
+smoke_block_grid_t smoke_blocks;
+
+void clear_smoke() {smoke_blocks.clear();} // called when the lightmap is freed
+void invalidate_smoke_flow() {smoke_blocks.invalidate_flow();} // called when lmcell::pflow values change
+
 void add_smoke(point const &pos, float val) {
 
 	if (!DYNAMIC_SMOKE || (display_mode & 0x80) || !game_mode || val == 0.0 || pos.z >= czmax) return;
-	lmcell *const lmc(lmap_manager.get_lmcell(pos));
-	if (!lmc) return;
+	if (!lmap_manager.get_lmcell(pos)) return;
 	int const xpos(get_xpos(pos.x)), ypos(get_ypos(pos.y));
 	if (point_outside_mesh(xpos, ypos) || pos.z >= v_collision_matrix[ypos][xpos].zmax || pos.z < mesh_height[ypos][xpos]) return; // above all cobjs/outside
 	if (no_smoke_over_mesh && !is_mesh_disabled(xpos, ypos)) return;
 	if (!check_smoke_bounds(pos)) return;
 	//if (!check_coll_line(pos, point(pos.x, pos.y, czmax), cindex, -1, 1, 0)) return; // too slow
-	adjust_smoke_val(lmc->smoke, SMOKE_DENSITY*val);
+	smoke_blocks.add_smoke(xpos, ypos, get_zpos(pos.z), SMOKE_DENSITY*val);
 	smoke_exists |= smoke_man.is_smoke_visible(pos);
-	smoke_grid.register_smoke(xpos, ypos, get_zpos(pos.z));
-}
-
-
-void diffuse_smoke(int x, int y, int z, lmcell &adj, float pos_rate, float neg_rate, int dim, int dir) {
-
-	float delta(0.0); // Note: not using fticks due to instability
-	
-	if (lmap_manager.is_valid_cell(x, y, z)) {
-		lmcell &lmc(lmap_manager.get_lmcell(x, y, z));
-		unsigned char const flow(dir ? adj.pflow[dim] : lmc.pflow[dim]);
-		if (flow == 0) return;
-		float const cur_smoke(lmc.smoke);
-		delta  = (flow/255.0)*(adj.smoke - cur_smoke); // diffusion out of current cell and into cell xyz (can be negative)
-		delta *= ((delta < 0.0) ? neg_rate : pos_rate);
-		adjust_smoke_val(lmc.smoke, delta);
-		delta  = (lmc.smoke - cur_smoke); // actual change
-		if (lmc.smoke > 0.0) {smoke_grid.register_smoke(x, y, z);}
-	}
-	else { // edge cell has infinite smoke capacity and zero total smoke
-		delta = 0.5*(pos_rate + neg_rate);
-	}
-	adjust_smoke_val(adj.smoke, -delta);
 }
 
 
@@ -165,52 +387,15 @@ void distribute_smoke() { // called at most once per frame
 
 	//RESET_TIME;
 	if (!DYNAMIC_SMOKE || !smoke_exists || !animate2) return;
-	assert(SMOKE_SKIPVAL > 0);
-	static int cur_skip(0);
-	static rand_gen_t rgen;
-	
-	if (cur_skip == 0) {
-		//cout << "tot_smoke: " << smoke_man.tot_smoke << ", enabled: " << smoke_exists << ", visible: " << smoke_visible << endl;
-		smoke_man     = next_smoke_man;
-		smoke_man.adj_bbox();
-		smoke_visible = smoke_man.smoke_vis;
-		smoke_exists  = smoke_man.enabled;
-		next_smoke_man.reset();
-	}
 	/*if ((display_mode & 0x10) && !smoke_bounds.empty()) {
 		cur_smoke_bb = smoke_bounds[0];
 		for (vector<cube_t>::const_iterator i = smoke_bounds.begin()+1; i != smoke_bounds.end(); ++i) {cur_smoke_bb.union_with_cube(*i);}
 	}*/
-	float const xy_rate(SMOKE_DIS_XY*SMOKE_SKIPVAL);
-	int const dx(rgen.rand() & 1), dy(rgen.rand() & 1); // randomize the processing order
-	
-	// openmp doesn't really help here
-	for (int y = cur_skip; y < MESH_Y_SIZE; y += SMOKE_SKIPVAL) { // split the computation across several frames
-		for (int x = 0; x < MESH_X_SIZE; ++x) {
-			lmcell *vldata(lmap_manager.get_column(x, y));
-			if (vldata == NULL) continue;
-			smoke_entry_t &zrange(smoke_grid.get_z_range(x, y));
-			if (!zrange.valid()) continue;
-			bool any_z_has_smoke(0);
-			
-			for (int z = zrange.zmin; z < zrange.zmax; ++z) {
-				lmcell &lmc(vldata[z]);
-				if (lmc.smoke < SMOKE_THRESH) {lmc.smoke = 0.0;}
-				if (lmc.smoke == 0.0) continue;
-				//if (get_zval(z) > v_collision_matrix[y][x].zmax) {lmc.smoke = 0.0; continue;} // open space above - smoke goes up
-				next_smoke_man.add_smoke(x, y, z, lmc.smoke);
-				diffuse_smoke(x+(dx ?  1 : -1), y, z, lmc, xy_rate, xy_rate, 0,  dx);
-				diffuse_smoke(x+(dx ? -1 :  1), y, z, lmc, xy_rate, xy_rate, 0, !dx);
-				diffuse_smoke(x, y+(dy ?  1 : -1), z, lmc, xy_rate, xy_rate, 1,  dy);
-				diffuse_smoke(x, y+(dy ? -1 :  1), z, lmc, xy_rate, xy_rate, 1, !dy);
-				diffuse_smoke(x, y, (z - 1), lmc, SMOKE_DIS_ZD, SMOKE_DIS_ZU, 2, 0);
-				diffuse_smoke(x, y, (z + 1), lmc, SMOKE_DIS_ZU, SMOKE_DIS_ZD, 2, 1);
-				any_z_has_smoke = 1;
-			} // for z
-			if (!any_z_has_smoke) {zrange.clear();} // mark this xy as not having smoke
-		} // for x
-	} // for y
-	cur_skip = (cur_skip+1) % SMOKE_SKIPVAL;
+	smoke_man.reset();
+	smoke_blocks.diffuse(smoke_man);
+	smoke_man.adj_bbox();
+	smoke_visible = smoke_man.smoke_vis;
+	smoke_exists  = smoke_man.enabled;
 	//PRINT_TIME("Distribute Smoke");
 }
 
@@ -221,16 +406,13 @@ float get_smoke_at_pos(point const &pos) {
 	if (pos.z <= czmin0 || pos.z >= czmax) return 0.0;
 	int const x(get_xpos(pos.x)), y(get_ypos(pos.y)), z(get_zpos(pos.z));
 	if (point_outside_mesh(x, y) || z < 0 || z >= MESH_SIZE[2]) return 0.0;
-	lmcell const *const vldata(lmap_manager.get_column(x, y));
-	return ((vldata == NULL) ? 0.0 : vldata[z].smoke);
+	return smoke_blocks.get_smoke(x, y, z);
 }
 
 
 void reset_smoke_tex_data() {smoke_tex_data.clear();}
 
 
-#define CLEAR_Z_RANGE(z1, z2) for (int z = z1; z < (int)z2; ++z) {data[4*(off + z)+3] = 0;}
-
 void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol_ixs, lmcell const &default_lmc,
 	unsigned x_start, unsigned x_end, unsigned z_start, unsigned z_end, unsigned y, bool update_lighting)
 {
@@ -253,22 +435,11 @@ void update_smoke_row(vector<unsigned char> &data, vector<unsigned> const &llvol
 				if (local_light_volumes[llvol_ixs[i]]->check_xy_bounds(x, y)) {llv_ix_s = min(i, llv_ix_s); llv_ix_e = max(i+1, llv_ix_e);}
 			}
 		}
-		else { // update smoke only
-			smoke_entry_t const &zrange(smoke_grid.get_z_range(x, y));
-			
-			if (!zrange.valid()) { // no smoke in this row
-				CLEAR_Z_RANGE(z_start, z_end);
-				continue;
-			}
-			CLEAR_Z_RANGE(z_start, zrange.zmin);
-			CLEAR_Z_RANGE(zrange.zmax, z_end);
-			z_start = zrange.zmin;
-			z_end   = zrange.zmax;
-		}
 		for (unsigned z = z_start; z < z_end; ++z) {
 			unsigned const off2(ncomp*(off + z));
-			if (vlm == NULL || vlm[z].smoke == 0.0) {data[off2+3] = 0;}
-			else {data[off2+3] = (unsigned char)(255*CLIP_TO_01(smoke_scale*vlm[z].smoke));} // alpha: smoke
+			float const smoke((vlm == NULL) ? 0.0 : smoke_blocks.get_smoke(x, y, z));
+			if (smoke == 0.0) {data[off2+3] = 0;}
+			else {data[off2+3] = (unsigned char)(255*CLIP_TO_01(smoke_scale*smoke));} // alpha: smoke
 			if (!do_lighting) continue; // lighting not needed
 				
 			if (check_z_thresh && get_zval(z+1) < mh) { // adjust by one because GPU will interpolate the texel
@@ -338,7 +509,6 @@ bool upload_smoke_indir_texture() {
 		have_indir_smoke_tex = 0;
 		return 0;
 	}
-	assert((MESH_Y_SIZE%SMOKE_SEND_SKIP) == 0);
 	// ok when texture z size is not a power of 2
 	unsigned const sz(MESH_X_SIZE*MESH_Y_SIZE*MESH_SIZE[2]), ncomp(4);
 
@@ -361,17 +531,25 @@ bool upload_smoke_indir_texture() {
 		if ((*i)->needs_update()) {(*i)->mark_updated(); lighting_changed = 1;}
 	}
 	bool const full_update(smoke_tid == 0 || (!no_sun_lpos_update && lighting_changed));
-	bool const could_have_smoke(smoke_exists || last_smoke_update > 0);
-	if (!full_update && !could_have_smoke && !lmap_manager.was_updated && !lighting_changed) return 0; // return 1?
-	if (full_update ) {last_cur_ambient  = cur_ambient; last_cur_diffuse = cur_diffuse;}
-	if (smoke_exists) {last_smoke_update = SMOKE_SEND_SKIP;} else if (last_smoke_update > 0) {--last_smoke_update;}
+	if (!full_update && !smoke_blocks.has_dirty() && !lmap_manager.was_updated) return 0; // return 1?
 	static int cur_block(0);
-	unsigned const skipval(could_have_smoke ? SMOKE_SEND_SKIP : INDIR_LT_SEND_SKIP);
-	unsigned const block_size(MESH_Y_SIZE/skipval);
-	unsigned const y_start(full_update ? 0           :  cur_block*block_size);
-	unsigned const y_end  (full_update ? MESH_Y_SIZE : (y_start + block_size));
-	update_smoke_indir_tex_range(0, MESH_X_SIZE, y_start, y_end, 0, MESH_SIZE[2], full_update);
-	cur_block = (full_update ? 0 : (cur_block+1) % skipval);
+
+	if (full_update) { // lighting and smoke for the entire volume
+		last_cur_ambient = cur_ambient; last_cur_diffuse = cur_diffuse;
+		update_smoke_indir_tex_range(0, MESH_X_SIZE, 0, MESH_Y_SIZE, 0, MESH_SIZE[2], 1);
+		smoke_blocks.clear_dirty();
+		cur_block = 0;
+	}
+	else {
+		if (lmap_manager.was_updated) { // send updated indirect lighting in slices of rows spread across several frames
+			unsigned const block_size(MESH_Y_SIZE/INDIR_LT_SEND_SKIP), y_start(cur_block*block_size);
+			unsigned const y_end((cur_block+1 == INDIR_LT_SEND_SKIP) ? MESH_Y_SIZE : (y_start + block_size));
+			if (y_start < y_end) {update_smoke_indir_tex_range(0, MESH_X_SIZE, y_start, y_end, 0, MESH_SIZE[2], 0);}
+			cur_block = (cur_block+1) % INDIR_LT_SEND_SKIP;
+		}
+		smoke_blocks.send_dirty_blocks([](unsigned x1, unsigned x2, unsigned y1, unsigned y2, unsigned z1, unsigned z2) {
+			update_smoke_indir_tex_range(x1, x2, y1, y2, z1, z2, 0);}); // only blocks where smoke has changed
+	}
 	if (cur_block == 0) {lmap_manager.was_updated = 0;} // only stop updating after we wrap around to the beginning again
 	have_indir_smoke_tex = 1;
 	//PRINT_TIME("Smoke + Indir Upload");
@@ -6,7 +6,10 @@
 #include "gl_ext_arb.h"
 #include "shaders.h"
 #include "model3d.h"
+#include "cobj_bsp_tree.h"
+#include "binary_file_io.h"
 #include <omp.h>
+#include <unordered_map>
 
 
 unsigned const VOXELS_PER_DIV = 8; // 1024 for 128 vertex mesh
@@ -46,6 +49,10 @@ struct zval_avg {
 	//       so we can have at max 64M snowflakes.
 	//       However, we can get snow to stack up at a vertical edge so we need to clamp the count
 	void update(float zval) {if (c < MAX_COUNT) {++c; z += zval;}}
+	void merge(zval_avg const &zv) { // combine two partial sums, clamping the count and keeping the average
+		unsigned const tot((unsigned)c + zv.c);
+		if (tot > MAX_COUNT) {z = (z + zv.z)*MAX_COUNT/tot; c = MAX_COUNT;} else {z += zv.z; c = tot;}
+	}
 	bool valid() const {return (c > 0);}
 	float getz() const {return z/c;}
 };
@@ -81,6 +88,7 @@ struct voxel_z_pair {
 	zval_avg z;
 	voxel_z_pair() {}
 	voxel_z_pair(voxel_t const &v_, zval_avg const &z_=zval_avg()) : v(v_), z(z_) {}
+	bool operator<(voxel_z_pair const &vz) const {return (v < vz.v);}
 };
 
 
@@ -234,34 +242,47 @@ public:
 };
 
 
-class voxel_map : public map<voxel_t, zval_avg> { // must be a sorted map
+class voxel_map : public vector<voxel_z_pair> { // sorted by voxel with unique entries; see finalize()
+
+	vector<unsigned char> used; // entries that have already been added to a strip
+
 public:
-	zval_avg find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_map *cur_x_map=NULL);
+	zval_avg find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, bool mark_used=0);
+	bool is_used(unsigned i) const {assert(i < used.size()); return (used[i] != 0);}
+	void mark_used(unsigned i) {assert(i < used.size()); used[i] = 1;}
+	void finalize();
 	bool read(char const *const fn);
 	bool write(char const *const fn) const;
 };
 
 
-struct data_block { // packed voxel_z_pair for read/write
+struct data_block { // packed voxel_z_pair for reading legacy files
 	coord_type p[3];
 	count_type c;
 	float z;
 
-	void add_to_map(voxel_map &vmap) const {
-		voxel_t v;
-		for (unsigned i = 0; i < 3; ++i) v.p[i] = p[i];
-		vmap[v] = zval_avg(c, z);
-	}
-	void set_from_map_iter(voxel_map::const_iterator it) {
-		for (unsigned i = 0; i < 3; ++i) p[i] = it->first.p[i];
-		c = it->second.c;
-		z = it->second.z;
-	}
+	voxel_z_pair get_pair() const {return voxel_z_pair(voxel_t(p[0], p[1], p[2]), zval_avg(c, z));}
 };
 
+typedef unordered_map<voxel_t, zval_avg, hash_by_bytes<voxel_t> > voxel_hash_map_t; // unsorted, for accumulation
+unsigned const SNOW_FILE_MAGIC = 0x534E5732; // "SNW2": delta encoded streams; files without it are a flat array of data_blocks
+
+
+void voxel_map::finalize() { // entries must be sorted; merges duplicate voxels
+
+	unsigned num(0);
+
+	for (const_iterator i = begin(); i != end(); ++i) {
+		if (num > 0 && (*this)[num-1].v == i->v) {(*this)[num-1].z.merge(i->z);} else {(*this)[num++] = *i;}
+	}
+	resize(num);
+	used.clear();
+	used.resize(size(), 0);
+}
+
 
 // this tends to take a large fraction of the preprocessing time
-zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, voxel_map *cur_x_map) {
+zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth, bool mark_used) {
 
 	coord_type best_dz(0);
 	zval_avg res;
@@ -269,17 +290,14 @@ zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth,
 	v2_s.p[2] -= min(Z_CHECK_RANGE, (int)v2_s.p[2]);
 	v2_e.p[2] += Z_CHECK_RANGE+1; // one past the end
 
-	for (iterator it = lower_bound(v2_s); it != end() && it->first < v2_e;) { // Note: no increment of it
-		zval_avg const z2(it->second);
+	for (const_iterator it = std::lower_bound(begin(), end(), voxel_z_pair(v2_s)); it != end() && it->v < v2_e; ++it) {
+		unsigned const ix(it - begin());
+		if (mark_used && used[ix]) continue; // already in a strip
+		zval_avg const z2(it->z);
 		assert(z2.valid());
-		if (zv_old.valid() && fabs(z2.getz() - zv_old.getz()) > depth) {++it; continue;} // delta z too large
-		voxel_t const v2(it->first);
-
-		if (cur_x_map) {
-			erase(it++);
-			(*cur_x_map)[v2] = z2;
-		} else {++it;}
-		coord_type const dz(v2.p[2] - v.p[2]);
+		if (zv_old.valid() && fabs(z2.getz() - zv_old.getz()) > depth) continue; // delta z too large
+		if (mark_used) {used[ix] = 1;}
+		coord_type const dz(it->v.p[2] - v.p[2]);
 		if (!res.valid() || abs(dz) < abs(best_dz)) {best_dz = dz;}
 		res.c += z2.c;
 		res.z += z2.z;
@@ -289,49 +307,87 @@ zval_avg voxel_map::find_adj_z(voxel_t &v, zval_avg const &zv_old, float depth,
 }
 
 
+template<typename T> bool read_snow_stream(binary_file_reader &reader, vector<T> &v, unsigned num) {
+	v.resize(num);
+	return (num == 0 || reader.read(&v.front(), sizeof(T), num));
+}
+template<typename T> bool write_snow_stream(binary_file_writer &writer, vector<T> const &v) {
+	return (v.empty() || writer.write(&v.front(), sizeof(T), v.size()));
+}
+
+// files are zlib compressed if the filename ends in .gz
 bool voxel_map::read(char const *const fn) {
 
-	FILE *fp;
 	assert(fn != NULL);
-	if (!open_file(fp, fn, "snow map", "rb")) return 0;
+	binary_file_reader reader;
+	if (!reader.open(fn)) return 0;
 	cout << "Reading snow file from " << fn << endl;
-	size_t const n(fread(&vox_delta, sizeof(float), 3, fp));
-	assert(n == 3);
-	unsigned map_size(0);
-	size_t const sz_read(fread(&map_size, sizeof(unsigned), 1, fp));
-	assert(sz_read == 1);
+	unsigned header(0), map_size(0);
+	point file_vox_delta; // only assigned to vox_delta if the read succeeds
+	if (!reader.read(&header, sizeof(unsigned), 1)) return 0;
+	bool const legacy(header != SNOW_FILE_MAGIC);
 	
-	for (unsigned i = 0; i < map_size; ++i) {
-		data_block data;
-		size_t const n(fread(&data, sizeof(data_block), 1, fp));
-		assert(n == 1);
-		data.add_to_map(*this);
+	if (legacy) { // header was vox_delta.x
+		memcpy(&file_vox_delta.x, &header, sizeof(float));
+		if (!reader.read(&file_vox_delta.y, sizeof(float), 2)) return 0;
+	}
+	else if (!reader.read(&file_vox_delta.x, sizeof(float), 3)) return 0;
+	if (!reader.read(&map_size, sizeof(unsigned), 1)) return 0;
+	clear();
+	reserve(map_size);
+
+	if (legacy) {
+		vector<data_block> data;
+		if (!read_snow_stream(reader, data, map_size)) return 0;
+		for (auto i = data.begin(); i != data.end(); ++i) {push_back(i->get_pair());}
 	}
-	fclose(fp);
+	else {
+		vector<coord_type> dx, dy, z;
+		vector<count_type> c;
+		vector<float> zsum;
+		if (!read_snow_stream(reader, dx, map_size) || !read_snow_stream(reader, dy, map_size) || !read_snow_stream(reader, z, map_size)) return 0;
+		if (!read_snow_stream(reader, c, map_size) || !read_snow_stream(reader, zsum, map_size)) return 0;
+		voxel_t v(0, 0, 0);
+
+		for (unsigned i = 0; i < map_size; ++i) {
+			if (dx[i] != 0) {v.p[1] = 0;} // y restarts at each new x
+			v.p[0] += dx[i];
+			v.p[1] += dy[i];
+			v.p[2]  = z[i];
+			push_back(voxel_z_pair(v, zval_avg(c[i], zsum[i])));
+		}
+	}
+	if (!std::is_sorted(begin(), end())) {std::sort(begin(), end());}
+	finalize();
+	vox_delta = file_vox_delta;
 	return 1;
 }
 
 
 bool voxel_map::write(char const *const fn) const {
 
-	FILE *fp;
 	assert(fn != NULL);
-	if (!open_file(fp, fn, "snow map", "wb")) return 0;
+	binary_file_writer writer;
+	if (!writer.open(fn)) return 0;
 	cout << "Writing snow file to " << fn << endl;
-	size_t const n(fwrite(&vox_delta, sizeof(float), 3, fp));
-	assert(n == 3);
 	unsigned const map_size((unsigned)size()); // should be size_t?
-	size_t const sz_write(fwrite(&map_size, sizeof(map_size), 1, fp));
-	assert(sz_write == 1);
+	if (!writer.write(&SNOW_FILE_MAGIC, sizeof(unsigned), 1) || !writer.write(&vox_delta.x, sizeof(float), 3) || !writer.write(&map_size, sizeof(unsigned), 1)) return 0;
+	// split into separate streams and delta encode x and y, which are mostly small or zero and compress well
+	vector<coord_type> dx(map_size), dy(map_size), z(map_size);
+	vector<count_type> c(map_size);
+	vector<float> zsum(map_size);
+	voxel_t last(0, 0, 0);
 
-	for (const_iterator i = begin(); i != end(); ++i) {
-		data_block data;
-		data.set_from_map_iter(i);
-		size_t const n(fwrite(&data, sizeof(data_block), 1, fp));
-		assert(n == 1);
+	for (unsigned i = 0; i < map_size; ++i) {
+		voxel_t const &v((*this)[i].v);
+		dx[i] = v.p[0] - last.p[0];
+		dy[i] = v.p[1] - ((dx[i] != 0) ? 0 : last.p[1]);
+		z [i] = v.p[2];
+		c [i] = (*this)[i].z.c;
+		zsum[i] = (*this)[i].z.z;
+		last  = v;
 	}
-	fclose(fp);
-	return 1;
+	return (write_snow_stream(writer, dx) && write_snow_stream(writer, dy) && write_snow_stream(writer, z) && write_snow_stream(writer, c) && write_snow_stream(writer, zsum));
 }
 
 
@@ -497,14 +553,23 @@ void create_snow_map(voxel_map &vmap) {
 	float const zval(max(ztop, czmax)), zv_scale(1.0/(zval - zbottom));
 	float const xscale(2.0*X_SCENE_SIZE/num_per_dim), yscale(2.0*Y_SCENE_SIZE/num_per_dim);
 	all_models.build_cobj_trees(1);
+	unsigned const num_threads(omp_get_max_threads());
+	vector<voxel_hash_map_t> thread_maps(num_threads); // one per thread to avoid contention; merged at the end
+	vector<vector<batch_ray_t> > thread_rays(num_threads); // one row of rays per thread
 	cout << "Snow accumulation progress (out of " << num_per_dim << "):     0";
 
 #pragma omp parallel for schedule(dynamic,1)
 	for (int y = 0; y < num_per_dim; ++y) {
-		if (omp_get_thread_num() == 0) {increment_printed_number(y);} // progress for thread 0
+		unsigned const thread_id(omp_get_thread_num());
+		if (thread_id == 0) {increment_printed_number(y);} // progress for thread 0
+		assert(thread_id < num_threads);
+		voxel_hash_map_t &tmap(thread_maps[thread_id]);
 		rand_gen_t rgen;
 		rgen.set_state(123, y);
 
+		vector<batch_ray_t> &rays(thread_rays[thread_id]);
+		rays.clear();
+
 		for (int x = 0; x < num_per_dim; ++x) {
 			point pos1(-X_SCENE_SIZE + x*xscale, -Y_SCENE_SIZE + y*yscale, zval);
 			// add slightly more randomness for numerical precision reasons
@@ -513,12 +578,17 @@ void create_snow_map(voxel_map &vmap) {
 			if (!get_mesh_ice_pt(pos1, pos2)) continue; // invalid point
 			assert(pos2.z < pos1.z);
 			pos1 += get_rand_snow_vect(rgen, 1.0); // add some gaussian randomness for better distribution
-			point cpos;
-			vector3d cnorm;
-			bool invalid(0);
+			rays.push_back(batch_ray_t(pos1, pos2));
+		}
+		check_drop_rays_batch(rays, -1, 0, 1, 1, 0); // static cobjs + voxels + models, already in a parallel loop
+
+		for (auto r = rays.begin(); r != rays.end(); ++r) {
+			point pos1(r->p1), pos2(r->p2), cpos(r->cpos);
+			vector3d cnorm(r->cnorm);
+			bool coll(r->hit), invalid(0);
 			unsigned iter(0);
 			
-			while (check_snow_line_coll(pos1, pos2, cpos, cnorm)) {
+			while (coll) {
 				if (cnorm.z > 0.0) { // collision with a surface that points up - we're done
 					pos2 = cpos;
 					break;
@@ -538,15 +608,36 @@ void create_snow_map(voxel_map &vmap) {
 					break;
 				}
 				++iter;
+				coll = check_snow_line_coll(pos1, pos2, cpos, cnorm); // deflected lines are rare and incoherent, so query them individually
 			} // end while
 			if (!invalid) {
-				voxel_t const voxel(pos2);
-#pragma omp critical(snow_map_update)
-				vmap[voxel].update(pos2.z);
+				tmap[voxel_t(pos2)].update(pos2.z);
 			}
-		} // for x
+		} // for r
 	} // for y
 	cout << endl;
+	// flatten each thread's map into its own sorted range of vmap, then merge the ranges pairwise
+	vector<size_t> range_start(num_threads+1, 0);
+	for (unsigned t = 0; t < num_threads; ++t) {range_start[t+1] = range_start[t] + thread_maps[t].size();}
+	vmap.clear();
+	vmap.resize(range_start.back());
+
+#pragma omp parallel for schedule(dynamic,1)
+	for (int t = 0; t < (int)num_threads; ++t) {
+		auto out(vmap.begin() + range_start[t]);
+		for (auto i = thread_maps[t].begin(); i != thread_maps[t].end(); ++i, ++out) {*out = voxel_z_pair(i->first, i->second);}
+		voxel_hash_map_t().swap(thread_maps[t]); // free memory
+		std::sort(vmap.begin() + range_start[t], vmap.begin() + range_start[t+1]);
+	}
+	for (unsigned step = 1; step < num_threads; step *= 2) {
+#pragma omp parallel for schedule(dynamic,1)
+		for (int t = 0; t < (int)num_threads; t += 2*step) {
+			if (t + step >= num_threads) continue; // no pair
+			unsigned const t_end(min(num_threads, t + 2*step));
+			std::inplace_merge(vmap.begin() + range_start[t], vmap.begin() + range_start[t+step], vmap.begin() + range_start[t_end]);
+		}
+	}
+	vmap.finalize(); // merge voxels hit by more than one thread
 }
 
 
@@ -561,7 +652,6 @@ void add_strip(strip_vect_t const &strip, bool is_edge, int xval, int y_start) {
 void create_snow_strips(voxel_map &vmap) {
 
 	// create strips of snow for rendering
-	voxel_map cur_x_map, last_x_map;
 	unsigned const num_xy_voxels(VOXELS_PER_DIV*VOXELS_PER_DIV*XY_MULT_SIZE);
 	float const delta_depth(snow_depth*num_xy_voxels/(1024.0*1024.0*num_snowflakes));
 	unsigned n_strips(0), n_edge_strips(0), strip_len(0), edge_strip_len(0);
@@ -571,21 +661,18 @@ void create_snow_strips(voxel_map &vmap) {
 	snow_strips.clear();
 	snow_strips.reserve(8*num_xy_voxels/MAX_STRIP_LEN); // should be more than enough
 
-	while (!vmap.empty()) {
-		pair<voxel_t, zval_avg> start(*vmap.begin());
-		voxel_t v1(start.first);
-		zval_avg zv(start.second);
+	for (unsigned ix = 0; ix < vmap.size(); ++ix) { // entries are sorted, so this visits x rows in increasing order
+		if (vmap.is_used(ix)) continue; // already part of a strip
+		voxel_t v1(vmap[ix].v);
+		zval_avg zv(vmap[ix].z);
 		assert(zv.valid());
 
-		if (v1.p[0] != last_x) { // we moved on to the next x-value, so update the x maps
+		if (v1.p[0] != last_x) { // we moved on to the next x-value
 			last_x = v1.p[0];
-			last_x_map.clear();
-			cur_x_map.swap(last_x_map);
 			bool const did_ins(x_strip_map.insert(make_pair(last_x, (unsigned)snow_strips.size())).second);
-			assert(did_ins); // map should guarantee strictly increasing x
+			assert(did_ins); // sorted order should guarantee strictly increasing x
 		}
-		vmap.erase(vmap.begin());
-		cur_x_map[v1] = zv;
+		vmap.mark_used(ix);
 		vs.resize(0);
 		--v1.p[1];
 		vs.push_back(voxel_z_pair(v1)); // zero start
@@ -594,7 +681,7 @@ void create_snow_strips(voxel_map &vmap) {
 		
 		while (1) { // generate a strip in y with constant x
 			++v1.p[1];
-			zv = vmap.find_adj_z(v1, zv, snow_depth, &cur_x_map);
+			zv = vmap.find_adj_z(v1, zv, snow_depth, 1); // mark as used
 			//if (!zv.valid()) --v1.p[1]; // move back one step
 			vs.push_back(voxel_z_pair(v1, zv));
 			if (!zv.valid()) break; // end of strip
@@ -618,7 +705,7 @@ void create_snow_strips(voxel_map &vmap) {
 				bool const end_element(i == 0 || i+1 == sz);
 				voxel_t v2(vs[i].v);
 				++v2.p[0]; // move to next x row
-				zval_avg z2(vmap.find_adj_z(v2, vs[i].z, snow_depth));
+				zval_avg z2(vmap.find_adj_z(v2, vs[i].z, snow_depth)); // next row: no entries used yet
 				if (end_element) z2.c = 0; // zero terminate start/end points
 				strip.add(vs[i], delta_depth); // first edge
 				strip.add(voxel_z_pair(v2, z2), delta_depth); // second edge
@@ -627,7 +714,7 @@ void create_snow_strips(voxel_map &vmap) {
 				if ((end_pos - start_pos) <= 3) continue; // too small for edge srtips
 				voxel_t v3(vs[i].v);
 				--v3.p[0]; // move to prev x row
-				zval_avg z3(last_x_map.find_adj_z(v3, vs[i].z, snow_depth));
+				zval_avg z3(vmap.find_adj_z(v3, vs[i].z, snow_depth)); // prev row: all entries used
 				
 				if (!end_element && !z3.valid()) {
 					last_edge = (unsigned)edge_strip.size() + 2;
@@ -675,17 +762,19 @@ void gen_snow_coverage() {
 	// setup voxel scales
 	vox_delta.assign(VOXELS_PER_DIV/DX_VAL, VOXELS_PER_DIV/DY_VAL, 1.0/(max(DZ_VAL/VOXELS_PER_DIV, snow_depth)));
 	
-	if (read_snow_file) {
+	bool was_read(0);
+
+	if (read_snow_file) { // treat the snow file as a cache: if it's missing or invalid, regenerate and write it
 		RESET_TIME;
-		if (!vmap.read(snow_file)) {has_snow = 0; return;}
-		PRINT_TIME("Read Snow Voxel Map");
+		was_read = vmap.read(snow_file);
+		if (was_read) {PRINT_TIME("Read Snow Voxel Map");} else {cout << "Failed to read snow file; regenerating snow map" << endl;}
 	}
-	else {
+	if (!was_read) {
 		RESET_TIME;
 		create_snow_map(vmap);
 		PRINT_TIME("Build Snow Voxel Map");
 	}
-	if (write_snow_file) {
+	if (write_snow_file || (read_snow_file && !was_read)) {
 		RESET_TIME;
 		vmap.write(snow_file);
 		PRINT_TIME("Write Snow Voxel Map");
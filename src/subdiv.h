@@ -68,6 +68,7 @@ public:
 	bool equal(point const &p, float r, int n) const {
 		return (p == pos && r == radius && n == (int)ndiv && points != NULL);
 	}
+	void invalidate() {radius = 0.0;} // force regeneration on the next equal() check, for example when the perturb map has changed
 };
 
 
@@ -7,12 +7,17 @@
 #include "shaders.h"
 #include "openal_wrap.h"
 #include "heightmap.h"
+#include "worker_pool.h"
+#include "binary_file_io.h"
+#include <omp.h>
 
 
 bool const DEBUG_TILES        = 0;
 bool const DEBUG_TILE_BOUNDS  = 0;
 bool const ENABLE_INST_PINE   = 1; // faster generation, lower GPU memory, slower rendering
 bool const ENABLE_ANIMALS     = 1;
+bool const ENABLE_BKG_TILE_GEN = 1; // generate new tiles on worker threads rather than in the draw thread (CPU mesh gen only)
+bool const USE_HORIZON_SHADOWS = 1; // mesh shadows from a per-tile horizon map, which makes sun/moon movement cheap
 bool const USE_PARAMS_HSCALE  = 0;
 int  const DITHER_NOISE_TEX   = NOISE_GEN_TEX;//PS_NOISE_TEX
 unsigned const NORM_TEXELS    = 512;
@@ -30,6 +35,11 @@ float const SMAP_DEL_THRESH   = 1.3;
 float const SMAP_FADE_THRESH  = 1.5;
 float const OCCLUDER_DIST     = 0.2;
 float const FLOWER_REL_DIST   = 0.9; // flower view distance relative to grass view distance
+float const TILE_UPLOAD_BUDGET_MS = 4.0; // per-frame main thread time for texture creation/upload of newly generated tiles
+unsigned const MAX_POOLED_TILES   = 32;
+unsigned const MIN_TILE_GRID_BITS = 4; // 16x16
+unsigned const TILE_CACHE_MAGIC   = 0x54434831; // "TCH1"; change when the cache file format changes
+unsigned const BIRD_BENCHMARK_NUM = 0; // if nonzero, spawn this many birds split across the tiles once they stop changing and print the animal update time each frame (birds only move in daylight)
 
 int   const LIGHTNING_LIGHT = 2;
 float const LIGHTNING_FREQ  = 200.0; // in ticks (1/40 s)
@@ -39,6 +49,7 @@ float const LITNING_DIST    = 1.2;
 unsigned const NUM_AO_DIRS  = 8; // Note: required to be 8 for adj tile calculation
 unsigned const NUM_AO_STEPS = 8;
 unsigned const AO_RAY_LEN(NUM_AO_STEPS*(NUM_AO_STEPS+1)/2); // 36
+unsigned const NUM_HORIZON_DIRS = 16; // azimuth directions in the horizon map, one byte per texel each (~270KB for a 128x128 tile); shadows interpolate between adjacent directions
 
 enum {FM_NONE, FM_INC_MESH, FM_DEC_MESH, FM_FLATTEN, FM_REM_TREES, FM_ADD_TREES, FM_REM_GRASS, FM_ADD_GRASS, NUM_FIRE_MODES};
 
@@ -46,6 +57,7 @@ enum {FM_NONE, FM_INC_MESH, FM_DEC_MESH, FM_FLATTEN, FM_REM_TREES, FM_ADD_TREES,
 bool tt_lightning_enabled(0), check_tt_mesh_occlusion(1);
 unsigned inf_terrain_fire_mode(0); // none, increase height, decrease height
 string read_hmap_modmap_fn, write_hmap_modmap_fn("heightmap.mod");
+string tile_cache_dir; // if set, generated tile heights, AO, and texture weights are cached here
 hmap_brush_param_t cur_brush_param;
 tile_offset_t model3d_offset;
 
@@ -238,12 +250,12 @@ bool write_default_hmap_modmap() {
 // *** tile_t ***
 
 tile_t::tile_t() : last_occluded_frame(0), weight_tid(0), height_tid(0), normal_tid(0), shadow_tid(0), size(0), stride(0),
-	zvsize(0), gen_tsize(0), decid_trees(tree_data_manager) {}
+	zvsize(0), gen_tsize(0), cache_key(0), horizon_adj_mask(0), decid_trees(tree_data_manager) {}
 
 tile_t::tile_t(unsigned size_, int x, int y) : last_occluded_frame(0), weight_tid(0), height_tid(0), normal_tid(0), shadow_tid(0),
-	size(size_), stride(size+1), zvsize(stride+1), gen_tsize(0), trmax(0.0), min_normal_z(0.0), deltax(DX_VAL), deltay(DY_VAL),
-	shadows_invalid(1), recalc_tree_grass_weights(1), mesh_height_invalid(0), in_queue(0), last_occluded(0), has_any_grass(0),
-	is_distant(0), no_trees(0), just_cleared(0), has_disabled_area(0), mesh_off(xoff-xoff2, yoff-yoff2), decid_trees(tree_data_manager)
+	size(size_), stride(size+1), zvsize(stride+1), gen_tsize(0), cache_key(0), horizon_adj_mask(0), trmax(0.0), min_normal_z(0.0), deltax(DX_VAL), deltay(DY_VAL),
+	shadows_invalid(1), recalc_tree_grass_weights(1), mesh_height_invalid(0), in_queue(0), last_occluded(0), has_any_grass(0), is_distant(0),
+	no_trees(0), just_cleared(0), has_disabled_area(0), mesh_weights_valid(0), cache_valid(0), mesh_off(xoff-xoff2, yoff-yoff2), decid_trees(tree_data_manager)
 {
 	assert(size > 0);
 	x1 = x*size;
@@ -344,6 +356,8 @@ void tile_t::clear() {
 	mesh_weight_data.clear();
 	weight_data.clear();
 	zvals.clear();
+	hpyramid.clear();
+	horizon.clear();
 	clear_shadows();
 	pine_trees.clear_all();
 	decid_trees.clear();
@@ -352,6 +366,24 @@ void tile_t::clear() {
 	clear_flowers();
 }
 
+template<typename T> void take_vector_memory(vector<T> &dest, vector<T> &src) {
+	assert(dest.empty());
+	src.clear(); // keeps capacity
+	dest.swap(src);
+}
+
+void tile_t::recycle_buffers_from(tile_t &tile) { // called on a new tile, which has empty vectors
+	take_vector_memory(zvals,            tile.zvals);
+	take_vector_memory(ao_zvals,         tile.ao_zvals);
+	take_vector_memory(tree_map,         tile.tree_map);
+	take_vector_memory(mesh_weight_data, tile.mesh_weight_data);
+	take_vector_memory(weight_data,      tile.weight_data);
+	take_vector_memory(ao_lighting,      tile.ao_lighting);
+	take_vector_memory(horizon,          tile.horizon);
+	take_vector_memory(grass_blocks,     tile.grass_blocks);
+	for (unsigned l = 0; l < NUM_LIGHT_SRC; ++l) {take_vector_memory(smask[l], tile.smask[l]);}
+}
+
 void tile_t::clear_shadows() {
 
 	for (unsigned l = 0; l < NUM_LIGHT_SRC; ++l) {
@@ -370,6 +402,7 @@ void tile_t::clear_vbo_tid(tile_shadow_map_manager *smap_manager) {
 	scenery.clear_vbos();
 	flowers.clear_vbo();
 	free_texture(weight_tid);
+	mesh_weights_valid = 0; // recalculate with the texture
 	free_texture(height_tid);
 	free_texture(normal_tid);
 	free_texture(shadow_tid);
@@ -377,6 +410,149 @@ void tile_t::clear_vbo_tid(tile_shadow_map_manager *smap_manager) {
 }
 
 
+// *** tile cache ***
+
+unsigned get_mesh_gen_params_hash(); // in mesh_gen.cpp
+
+worker_pool_t tile_gen_workers(2); // used for tile generation and cache writes; each generation job also splits its rows across OpenMP threads
+
+float get_tile_height_quantum() {return max((zmax - zmin), 1.0f)/65536.0f;} // 16 bits of precision across the mesh height range
+int   quantize_tile_height  (float z, float quantum) {return round_fp((z - zmin)/quantum);}
+float dequantize_tile_height(int   v, float quantum) {return (zmin + v*quantum);}
+
+void quantize_tile_heights(vector<float> &zvals) {
+	float const quantum(get_tile_height_quantum());
+	for (auto i = zvals.begin(); i != zvals.end(); ++i) {*i = dequantize_tile_height(quantize_tile_height(*i, quantum), quantum);}
+}
+
+struct tile_cache_params_t { // everything other than tile position that affects cached data; all fields are 4 bytes, so there's no padding
+	unsigned gen_hash, erosion_iters, terrain_env, tiled_mesh_ao, grass_density;
+	float water_z, relh_adj, biome_xoff, steep_thresh[2][2], vegetation, grass_thresh; // grass inputs, since grass blocks are cached
+};
+
+unsigned get_tile_cache_key() { // returns 0 if caching is disabled
+
+	// heightmaps can be modified in fire mode, and cities flatten the terrain and remove grass
+	if (tile_cache_dir.empty() || using_tiled_terrain_hmap_tex() || have_cities()) return 0;
+	tile_cache_params_t params;
+	params.gen_hash      = get_mesh_gen_params_hash();
+	params.erosion_iters = erosion_iters_tt;
+	params.terrain_env   = enable_terrain_env;
+	params.tiled_mesh_ao = enable_tiled_mesh_ao;
+	params.grass_density = grass_density;
+	params.water_z       = get_water_z_height();
+	params.vegetation    = vegetation;
+	params.grass_thresh  = GRASS_THRESH;
+	params.relh_adj      = relh_adj_tex;
+	params.biome_xoff    = biome_x_offset;
+	memcpy(params.steep_thresh, sthresh, sizeof(params.steep_thresh));
+	return max(1U, hash_by_bytes<tile_cache_params_t>()(params)); // 0 is reserved for disabled
+}
+
+struct tile_cache_header_t {
+	unsigned magic, key, size, num_zvals, num_ao, num_weights, num_grass_blocks;
+	unsigned char has_any_grass, has_disabled_area, pad[2];
+	tile_cache_header_t() {memset(this, 0, sizeof(*this));}
+};
+
+template<typename T> void append_bytes(vector<unsigned char> &buf, T const *data, size_t num) {
+	unsigned char const *const ptr((unsigned char const *)data);
+	buf.insert(buf.end(), ptr, ptr+num*sizeof(T));
+}
+
+string tile_t::get_cache_filename() const {
+	tile_xy_pair const txy(get_tile_xy_pair());
+	std::ostringstream oss;
+	oss << tile_cache_dir << "/tile_" << txy.x << "_" << txy.y << "_" << std::hex << cache_key << ".gz"; // zlib compressed
+	return oss.str();
+}
+
+bool tile_t::read_from_cache() {
+
+	//timer_t timer("Read Tile Cache");
+	binary_file_reader reader;
+	if (!reader.open(get_cache_filename(), 1)) return 0; // quiet=1; not yet cached
+	tile_cache_header_t header;
+	unsigned const num_texels(stride*stride), gbd(get_grass_block_dim());
+	if (!reader.read(&header, sizeof(header), 1)) return 0;
+	if (header.magic != TILE_CACHE_MAGIC || header.key != cache_key || header.size != size || header.num_zvals != zvsize*zvsize) return 0; // stale
+	if ((header.num_ao != 0 && header.num_ao != num_texels) || (header.num_weights != 0 && header.num_weights != 4*num_texels)) return 0;
+	if (header.num_grass_blocks != 0 && header.num_grass_blocks != gbd*gbd) return 0;
+	vector<int> zdeltas(header.num_zvals);
+	vector<unsigned char> ao(header.num_ao), weights(header.num_weights);
+	vector<grass_block_t> gblocks(header.num_grass_blocks);
+	if (!reader.read(&zdeltas.front(), sizeof(int), zdeltas.size())) return 0;
+	if (!ao.empty()      && !reader.read(&ao.front(),      sizeof(unsigned char), ao.size()))      return 0;
+	if (!weights.empty() && !reader.read(&weights.front(), sizeof(unsigned char), weights.size())) return 0;
+	if (!gblocks.empty() && !reader.read(&gblocks.front(), sizeof(grass_block_t), gblocks.size())) return 0;
+	float const quantum(get_tile_height_quantum());
+	zvals.resize(zdeltas.size());
+	int v(0);
+	for (unsigned i = 0; i < zvals.size(); ++i) {v += zdeltas[i]; zvals[i] = dequantize_tile_height(v, quantum);}
+	calc_zval_bounds();
+	if (enable_tiled_mesh_ao && !ao.empty()) {ao_lighting.swap(ao);}
+
+	if (!weights.empty()) {
+		mesh_weight_data.swap(weights);
+		grass_blocks.swap(gblocks);
+		has_any_grass     = (header.has_any_grass     != 0);
+		has_disabled_area = (header.has_disabled_area != 0);
+		mesh_weights_valid = 1;
+	}
+	cache_valid = (mesh_weights_valid && (has_ao_lighting() || !enable_tiled_mesh_ao)); // rewrite once the missing data has been calculated
+	return 1;
+}
+
+void tile_t::write_to_cache() { // serialized here, compressed and written on a worker thread
+
+	//timer_t timer("Write Tile Cache");
+	assert(cache_key != 0 && zvals.size() == zvsize*zvsize);
+	cache_valid = 1; // set even if the write fails so that we don't retry every frame
+	tile_cache_header_t header;
+	header.magic            = TILE_CACHE_MAGIC;
+	header.key              = cache_key;
+	header.size             = size;
+	header.num_zvals        = zvals.size();
+	header.num_ao           = ao_lighting.size();
+	header.num_weights      = (mesh_weights_valid ? mesh_weight_data.size() : 0);
+	header.num_grass_blocks = (mesh_weights_valid ? grass_blocks.size()     : 0);
+	header.has_any_grass     = has_any_grass;
+	header.has_disabled_area = has_disabled_area;
+	float const quantum(get_tile_height_quantum());
+	vector<int> zdeltas(zvals.size());
+	int prev(0);
+
+	for (unsigned i = 0; i < zvals.size(); ++i) { // delta encode so that most values are small and compress well
+		int const v(quantize_tile_height(zvals[i], quantum));
+		zdeltas[i] = v - prev;
+		prev = v;
+	}
+	std::shared_ptr<vector<unsigned char>> buf(new vector<unsigned char>);
+	append_bytes(*buf, &header, 1);
+	append_bytes(*buf, zdeltas.data(), zdeltas.size());
+	append_bytes(*buf, ao_lighting.data(), header.num_ao);
+	append_bytes(*buf, mesh_weight_data.data(), header.num_weights);
+	append_bytes(*buf, grass_blocks.data(), header.num_grass_blocks);
+	string const fn(get_cache_filename());
+
+	tile_gen_workers.add_job([buf, fn]() {
+		static std::atomic<unsigned> tmp_id(0);
+		static std::atomic<bool> had_error(0);
+		if (had_error) return; // only report the first error, which is likely an invalid or unwritable tile_cache_dir
+		std::ostringstream tmp_fn;
+		tmp_fn << fn.substr(0, fn.size()-3) << ".tmp" << tmp_id++ << ".gz"; // write to a temp file so that readers never see a partial file
+		bool success(0);
+		{
+			binary_file_writer writer;
+			success = (writer.open(tmp_fn.str()) && writer.write(buf->data(), sizeof(unsigned char), buf->size()));
+		}
+		if (success && std::rename(tmp_fn.str().c_str(), fn.c_str()) == 0) return; // done
+		std::remove(tmp_fn.str().c_str());
+		if (!success) {had_error = 1; std::cerr << "Error writing tile cache file " << fn << endl;}
+	});
+}
+
+
 bool setup_height_gen(mesh_xy_grid_cache_t &height_gen, float x0, float y0, float dx, float dy, unsigned nx, unsigned ny, bool cache_values, bool no_wait=0) {
 
 	bool const add_detail(using_hmap_with_detail());
@@ -392,10 +568,9 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 
 	//timer_t timer("Create Zvals");
 	if (enable_terrain_env) {update_terrain_params();}
+	if (cache_key != 0 && read_from_cache()) return 1; // no need to wait for GPU generation
 	zvals.resize(zvsize*zvsize);
-	mzmin =  FAR_DISTANCE;
-	mzmax = -FAR_DISTANCE;
-	unsigned const block_size(zvsize/4), context_sz(stride + 2*AO_RAY_LEN);
+	unsigned const context_sz(stride + 2*AO_RAY_LEN);
 	bool const using_hmap(using_tiled_terrain_hmap_tex()), add_detail(using_hmap_with_detail()); // add procedural detail to heightmap
 
 	// When using AO + GPU noise generation, it's faster to compute the AO + context and clip the zvals from this rather than making two separate compute calls (one without blocking)
@@ -413,7 +588,7 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 		bool results_ready(setup_height_gen(height_gen, get_xval(x1), get_yval(y1), deltax, deltay, zvsize, zvsize, 0, no_wait)); // cache_values=0
 		if (!results_ready) {assert(no_wait); return 0;} // cached heights are not yet ready
 	}
-	float const xy_mult(1.0/float(size)), wpz_max(get_water_z_height() + ocean_wave_height);
+	float const xy_mult(1.0/float(size));
 
 #pragma omp parallel for schedule(static,1)
 	for (int y = 0; y < (int)zvsize; ++y) {
@@ -436,6 +611,19 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 		} // for x
 	} // for y
 	if (!using_hmap) {apply_erosion(&zvals.front(), zvsize, zvsize, zmin, erosion_iters_tt);} // heightmap is eroded during load
+	// quantize so that newly generated tiles match adjacent tiles read from the cache exactly along their shared edges
+	if (cache_key != 0) {quantize_tile_heights(zvals);}
+	calc_zval_bounds();
+	return 1; // results are ready
+}
+
+void tile_t::calc_zval_bounds() {
+
+	assert(zvals.size() == zvsize*zvsize);
+	unsigned const block_size(zvsize/4);
+	float const wpz_max(get_water_z_height() + ocean_wave_height);
+	mzmin =  FAR_DISTANCE;
+	mzmax = -FAR_DISTANCE;
 
 	for (unsigned yy = 0; yy < 4; ++yy) {
 		for (unsigned xx = 0; xx < 4; ++xx) {
@@ -460,11 +648,11 @@ bool tile_t::create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait) {
 		} // for xx
 	} // for yy
 	assert(mzmin <= mzmax);
+	hpyramid.build(zvals, zvsize, size);
 	radius = 0.5*sqrt((deltax*deltax + deltay*deltay)*size*size + (mzmax - mzmin)*(mzmax - mzmin));
 	ptzmax = dtzmax = mzmin; // no trees yet
 	if (!can_have_trees()) {no_trees = 1;} // mark as no_trees so that trees don't pop when water is disabled later
 	if (DEBUG_TILES) {cout << "new tile coords: " << x1 << " " << y1 << " " << x2 << " " << y2 << endl;}
-	return 1; // results are ready
 }
 
 float tile_t::get_zval_at(float x, float y, bool in_global_space) const {
@@ -485,7 +673,8 @@ float tile_t::get_zval_at(float x, float y, bool in_global_space) const {
 
 void tile_t::calc_mesh_ao_lighting() {
 
-	//timer_t timer("Calc Tile AO Lighting");
+	bool const do_timing(timing_profiler_enabled());
+	double const start_time(do_timing ? omp_get_wtime() : 0.0); // glutGet() isn't safe on worker threads, and ms resolution is too coarse per tile
 	// caclulate ray step directions
 	tile_xy_pair ao_dirs[NUM_AO_DIRS]; // 0  1  2  3  4  5  6  7
 	unsigned ix(0);
@@ -497,6 +686,14 @@ void tile_t::calc_mesh_ao_lighting() {
 	}
 	assert(ix == NUM_AO_DIRS);
 	assert(AO_RAY_LEN <= size);
+	tile_xy_pair ao_offsets[NUM_AO_DIRS][NUM_AO_STEPS]; // position of each ray step relative to the ray origin
+
+	for (unsigned d = 0; d < NUM_AO_DIRS; ++d) {
+		for (unsigned s = 0; s < NUM_AO_STEPS; ++s) { // linear step size increase (Note: must agree with AO_RAY_LEN)
+			int const dist((s + 1)*(s + 2)/2);
+			ao_offsets[d][s] = tile_xy_pair(dist*ao_dirs[d].x, dist*ao_dirs[d].y);
+		}
+	}
 
 	// create context zvals, which may overlap with other tiles (that need not be created at this point)
 	unsigned const context_sz(stride + 2*AO_RAY_LEN);
@@ -514,6 +711,9 @@ void tile_t::calc_mesh_ao_lighting() {
 
 #pragma omp parallel
 	{
+		vector<float> zrow(stride); // per-thread row state
+		vector<unsigned> atten(stride), active(stride);
+
 		if (!use_ao_zvals) {
 #pragma omp for schedule(static,1)
 			for (int y = 0; y < (int)context_sz; ++y) {
@@ -529,37 +729,36 @@ void tile_t::calc_mesh_ao_lighting() {
 				}
 			}
 		}
-		// calculate ao_lighting values by casting rays through the mesh zvals
+		// calculate ao_lighting values by casting rays through the mesh zvals; each ray step is applied to a whole row of texels at once so that it vectorizes
 #pragma omp for schedule(static,1)
 		for (int y = 0; y < (int)stride; ++y) {
-			for (int x = 0; x < (int)stride; ++x) {
-				unsigned atten(0);
-
-				for (unsigned d = 0; d < NUM_AO_DIRS; ++d) {
-					float z0(zvals[y*zvsize + x]);
-					tile_xy_pair step(ao_dirs[d]);
-					tile_xy_pair v(x, y);
-
-					for (unsigned s = 0; s < NUM_AO_STEPS; ++s) {
-						v    += step;
-						z0   += dz;
-						//step += step; // multiply by 2 for exponential step size
-						step += ao_dirs[d]; // linear increase (Note: must agree with max_ray_length)
-						int const xv(v.x + AO_RAY_LEN), yv(v.y + AO_RAY_LEN);
-						//assert(xv >= 0 && yv >= 0 && xv < (int)context_sz && yv < (int)context_sz);
-						
-						if (czv[yv*context_sz + xv] > z0) { // hit a higher point
-							atten += (NUM_AO_STEPS - s); // Note: ambient obscurance - uses actual distance to occluder
-							break;
-						}
-					} // for s
-				} // for d
-				assert(atten <= NUM_AO_DIRS*NUM_AO_STEPS);
-				float const ao_scale(1.0 - float(atten)/float(NUM_AO_DIRS*NUM_AO_STEPS));
+			float const *const row_zvals(&zvals[y*zvsize]);
+			for (unsigned x = 0; x < stride; ++x) {atten[x] = 0;}
+
+			for (unsigned d = 0; d < NUM_AO_DIRS; ++d) {
+				for (unsigned x = 0; x < stride; ++x) {zrow[x] = row_zvals[x]; active[x] = 1;}
+
+				for (unsigned s = 0; s < NUM_AO_STEPS; ++s) {
+					tile_xy_pair const &off(ao_offsets[d][s]);
+					float const *const czv_row(&czv[(y + off.y + AO_RAY_LEN)*context_sz + (off.x + AO_RAY_LEN)]);
+					unsigned const weight(NUM_AO_STEPS - s); // Note: ambient obscurance - uses actual distance to occluder
+#pragma omp simd
+					for (unsigned x = 0; x < stride; ++x) {
+						zrow[x] += dz;
+						unsigned const hit(active[x] & unsigned(czv_row[x] > zrow[x])); // first hit of a higher point ends the ray
+						atten[x]  += hit*weight;
+						active[x] -= hit;
+					}
+				} // for s
+			} // for d
+			for (unsigned x = 0; x < stride; ++x) {
+				assert(atten[x] <= NUM_AO_DIRS*NUM_AO_STEPS);
+				float const ao_scale(1.0 - float(atten[x])/float(NUM_AO_DIRS*NUM_AO_STEPS));
 				ao_lighting[y*stride + x] = (unsigned char)(255.0*ao_scale);
-			} // for x
+			}
 		} // for y
 	}
+	if (do_timing) {register_timing_value("Calc Tile AO Lighting (us)", int(1.0E6*(omp_get_wtime() - start_time)));} // per-tile time; may be called from worker threads
 }
 
 
@@ -632,6 +831,7 @@ void tile_t::calc_shadows(bool calc_sun, bool calc_moon, bool no_push) {
 	for (unsigned l = 0; l < NUM_LIGHT_SRC; ++l) { // calculate mesh shadows for each light source
 		if (!calc_light[l])    continue; // light not enabled
 		if (!smask[l].empty()) continue; // already calculated (cached)
+		if (USE_HORIZON_SHADOWS) {calc_horizon_shadows(l); continue;}
 		smask[l].resize(zvals.size(), 0);
 		//if (normal_zmin < 1.0 && get_light_pos(l).get_norm().xy_mag() < normal_zmin) { // terrain slope lower than sun slope
 		if (no_push) {calc_shadows_for_light(l);} else {proc_tile_queue(this, l);}
@@ -639,6 +839,110 @@ void tile_t::calc_shadows(bool calc_sun, bool calc_moon, bool no_push) {
 }
 
 
+// horizon map: for each texel and azimuth direction, the max elevation angle of the terrain within one tile's distance, quantized to [0, 255] over [0, PI/2];
+// this is computed once per tile from its zvals and those of its adjacent tiles, and mesh shadows for any light direction are then a single compare per texel;
+// terrain more than one tile away doesn't cast shadows, and the map is recomputed when an adjacent tile is added, removed, or has its heights edited
+void tile_t::calc_horizon_map() {
+
+	//timer_t timer("Calc Tile Horizon Map");
+	assert(!zvals.empty());
+	tile_t const *adj[3][3] = {};
+	horizon_adj_mask = 0;
+
+	for (int dy = -1; dy <= 1; ++dy) {
+		for (int dx = -1; dx <= 1; ++dx) {
+			tile_t const *const tile((dx == 0 && dy == 0) ? this : get_adj_tile(dx, dy));
+			if (tile == NULL || tile->is_distant || tile->zvals.empty()) continue; // rays stop at missing tiles and are recomputed if the tile is added later
+			adj[dy+1][dx+1] = tile;
+			horizon_adj_mask |= (1 << get_adj_bit(dx, dy));
+		}
+	}
+	int const isize(size), izvsize(zvsize);
+	unsigned const num_texels(zvals.size());
+	float const ray_len(size), angle_scale(255.0/PI_TWO);
+	horizon.resize(NUM_HORIZON_DIRS*num_texels);
+
+#pragma omp parallel for schedule(static,1)
+	for (int y = 0; y < izvsize; ++y) {
+		for (unsigned d = 0; d < NUM_HORIZON_DIRS; ++d) {
+			float const theta(TWO_PI*d/NUM_HORIZON_DIRS), sx(cos(theta)), sy(sin(theta));
+			float const step_dist(sqrt(sx*sx*deltax*deltax + sy*sy*deltay*deltay));
+			unsigned char *const hz(&horizon[d*num_texels + y*zvsize]);
+
+			for (int x = 0; x < izvsize; ++x) {
+				float const z0(zvals[y*zvsize + x]);
+				float max_slope(0.0);
+
+				for (float t = 1.0; t <= ray_len; t += max(1.0f, 0.125f*t)) { // step size increases with distance
+					int xv(round_fp(x + t*sx)), yv(round_fp(y + t*sy));
+					int const tx((xv < 0) ? 0 : ((xv > isize) ? 2 : 1)), ty((yv < 0) ? 0 : ((yv > isize) ? 2 : 1));
+					tile_t const *const tile(adj[ty][tx]);
+					if (tile == NULL) break; // no data
+					xv -= (tx - 1)*isize;
+					yv -= (ty - 1)*isize;
+					if (xv < 0 || yv < 0 || xv >= izvsize || yv >= izvsize) break; // out of range
+					max_slope = max(max_slope, (tile->zvals[yv*zvsize + xv] - z0)/(t*step_dist));
+				}
+				hz[x] = (unsigned char)min(255, round_fp(angle_scale*atan(max_slope)));
+			} // for x
+		} // for d
+	} // for y
+}
+
+
+// returns true if any texel's shadow state changed
+bool tile_t::calc_horizon_shadows(unsigned l) {
+
+	if (horizon.empty()) {calc_horizon_map();}
+	point const lpos(get_light_pos(l));
+	vector<unsigned char> &sm(smask[l]);
+	unsigned const num_texels(zvals.size());
+	assert(horizon.size() == NUM_HORIZON_DIRS*num_texels);
+	sm.resize(num_texels, 0);
+	bool const no_shadow(l == LIGHT_MOON && combined_gu), all_shadowed(!no_shadow && lpos.z < zmin); // same as calc_mesh_shadows()
+	bool changed(0);
+
+	if (no_shadow || all_shadowed || (lpos.x == 0.0 && lpos.y == 0.0)) {
+		unsigned char const val(all_shadowed ? MESH_SHADOW : 0);
+		for (unsigned i = 0; i < num_texels; ++i) {changed |= (sm[i] != val); sm[i] = val;}
+		return changed;
+	}
+	vector3d const ldir(lpos.get_norm());
+	float const azimuth(atan2(ldir.y, ldir.x)), fd(NUM_HORIZON_DIRS*((azimuth < 0.0) ? (azimuth + TWO_PI) : azimuth)/TWO_PI);
+	unsigned const d0(unsigned(fd) % NUM_HORIZON_DIRS), d1((d0 + 1) % NUM_HORIZON_DIRS);
+	float const w1(fd - floor(fd)), w0(1.0 - w1), elevation(asin(max(ldir.z, 0.0f))*255.0/PI_TWO);
+	unsigned char const *const hz0(&horizon[d0*num_texels]), *const hz1(&horizon[d1*num_texels]);
+
+	for (unsigned i = 0; i < num_texels; ++i) {
+		unsigned char const val((elevation < w0*hz0[i] + w1*hz1[i]) ? MESH_SHADOW : 0);
+		changed |= (sm[i] != val);
+		sm[i] = val;
+	}
+	return changed;
+}
+
+
+void tile_t::update_horizon_shadows() { // called when the sun or moon moves; only updates lights that have already been calculated
+
+	if (horizon.empty()) return;
+
+	for (unsigned l = 0; l < NUM_LIGHT_SRC; ++l) {
+		if (!smask[l].empty() && calc_horizon_shadows(l)) {invalidate_shadows();} // only re-upload the shadow texture if something changed
+	}
+}
+
+
+void tile_t::adj_tile_changed(int dx, int dy, bool added) {
+
+	if (horizon.empty()) return; // not yet calculated
+	unsigned const adj_bit(1 << get_adj_bit(dx, dy));
+	if (!added && !(horizon_adj_mask & adj_bit)) return; // removed tile wasn't used
+	horizon_adj_mask &= ~adj_bit;
+	horizon.clear(); // rays toward this tile were truncated or used its old heights; recomputed with the next shadows
+	clear_shadows();
+}
+
+
 void tile_t::push_tree_ao_shadow(int dx, int dy, point const &pos, float tradius) const {
 
 	tile_t *const adj_tile(get_adj_tile_smap(dx, dy));
@@ -906,133 +1210,144 @@ void get_texture_ixs(int &sand_tex_ix, int &dirt_tex_ix, int &grass_tex_ix, int
 }
 
 
-void tile_t::create_texture(mesh_xy_grid_cache_t &height_gen) {
+// CPU-only part of create_texture(), which may be run on a worker thread before the tile is inserted
+void tile_t::calc_mesh_weights(mesh_xy_grid_cache_t &height_gen) {
 
-	//timer_t timer("Create Tile Weights Texture");
+	//timer_t timer("Calc Tile Weights");
 	assert(zvals.size() == zvsize*zvsize);
 	unsigned const tsize(stride), num_texels(tsize*tsize);
 	int sand_tex_ix(-1), dirt_tex_ix(-1), grass_tex_ix(-1), rock_tex_ix(-1), snow_tex_ix(-1);
 	get_texture_ixs(sand_tex_ix, dirt_tex_ix, grass_tex_ix, rock_tex_ix, snow_tex_ix);
-
-	if (weight_tid == 0) { // create weights
-		has_any_grass = has_disabled_area = 0;
-		grass_blocks.clear();
-		mesh_weight_data.resize(4*num_texels); // RGBA
-		unsigned const grass_block_dim(get_grass_block_dim());
-		float const xy_mult(1.0/float(size)), water_level(get_water_z_height());
-		float const MESH_NOISE_SCALE = 0.003;
-		float const MESH_NOISE_FREQ  = 80.0;
-		float const dz_inv(1.0/(zmax - zmin));
-		float const noise_scale(((mesh_gen_shape == 2) ? 2.0 : 1.0)*MESH_NOISE_SCALE*mesh_scale_z); // add more noise for ridged
-		float const steep_mult_grass(1.0/(sthresh[0][1] - sthresh[0][0]));
-		float const steep_mult_snow (1.0/(sthresh[1][1] - sthresh[1][0]));
-		float const steep_mult_rock (1.0/(0.8f*sthresh[0][0] - 0.5f*sthresh[0][0]));
-		float const vnz_scale((mesh_gen_mode == MGEN_DWARP_GPU) ? SQRT2 : 1.0); // allow for steeper slopes when domain warping is used
-		int const llc_x(x1 - xoff2), llc_y(y1 - yoff2);
-		point const query_pos(get_xval(tsize/2 + llc_x), get_yval(tsize/2 + llc_y), 0.0);
-		bool const check_grass_place(check_city_sphere_coll(query_pos, radius, 0)); // ignore bridges and tunnels for this top-level query
-		bool const check_mesh_mask(check_mesh_disable(query_pos, radius));
-		int k1, k2, k3, k4;
-		height_gen.build_arrays(MESH_NOISE_FREQ*get_xval(x1), MESH_NOISE_FREQ*get_yval(y1), MESH_NOISE_FREQ*deltax,
-			MESH_NOISE_FREQ*deltay, tsize, tsize, 0, 1); // force_sine_mode=1
-		vector<float> rand_vals(tsize*tsize);
-		//bool const same_dirt(params[0][1].dirt == params[0][0].dirt && params[1][0].dirt == params[0][0].dirt && params[1][1].dirt == params[0][0].dirt);
+	has_any_grass = has_disabled_area = 0;
+	grass_blocks.clear();
+	mesh_weight_data.resize(4*num_texels); // RGBA
+	unsigned const grass_block_dim(get_grass_block_dim());
+	float const xy_mult(1.0/float(size)), water_level(get_water_z_height());
+	float const MESH_NOISE_SCALE = 0.003;
+	float const MESH_NOISE_FREQ  = 80.0;
+	float const dz_inv(1.0/(zmax - zmin));
+	float const noise_scale(((mesh_gen_shape == 2) ? 2.0 : 1.0)*MESH_NOISE_SCALE*mesh_scale_z); // add more noise for ridged
+	float const steep_mult_grass(1.0/(sthresh[0][1] - sthresh[0][0]));
+	float const steep_mult_snow (1.0/(sthresh[1][1] - sthresh[1][0]));
+	float const steep_mult_rock (1.0/(0.8f*sthresh[0][0] - 0.5f*sthresh[0][0]));
+	float const vnz_scale((mesh_gen_mode == MGEN_DWARP_GPU) ? SQRT2 : 1.0); // allow for steeper slopes when domain warping is used
+	int const llc_x(x1 - xoff2), llc_y(y1 - yoff2);
+	point const query_pos(get_xval(tsize/2 + llc_x), get_yval(tsize/2 + llc_y), 0.0);
+	bool const check_grass_place(check_city_sphere_coll(query_pos, radius, 0)); // ignore bridges and tunnels for this top-level query
+	bool const check_mesh_mask(check_mesh_disable(query_pos, radius));
+	int k1, k2, k3, k4;
+	height_gen.build_arrays(MESH_NOISE_FREQ*get_xval(x1), MESH_NOISE_FREQ*get_yval(y1), MESH_NOISE_FREQ*deltax,
+		MESH_NOISE_FREQ*deltay, tsize, tsize, 0, 1); // force_sine_mode=1
+	vector<float> rand_vals(tsize*tsize);
+	//bool const same_dirt(params[0][1].dirt == params[0][0].dirt && params[1][0].dirt == params[0][0].dirt && params[1][1].dirt == params[0][0].dirt);
 
 #pragma omp parallel for schedule(static,1) num_threads(2)
-		for (int y = 0; y < (int)tsize-DEBUG_TILE_BOUNDS; ++y) {
-			for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
-				rand_vals[y*tsize + x] = noise_scale*height_gen.eval_index(x, y, 50);
-			}
+	for (int y = 0; y < (int)tsize-DEBUG_TILE_BOUNDS; ++y) {
+		for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
+			rand_vals[y*tsize + x] = noise_scale*height_gen.eval_index(x, y, 50);
 		}
-		for (unsigned y = 0; y < tsize-DEBUG_TILE_BOUNDS; ++y) { // not threadsafe
-			float const yv(float(y)*xy_mult);
+	}
+	for (unsigned y = 0; y < tsize-DEBUG_TILE_BOUNDS; ++y) { // not threadsafe
+		float const yv(float(y)*xy_mult);
 
-			for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
-				unsigned const ix_val(y*tsize + x), off(4*ix_val);
+		for (unsigned x = 0; x < tsize-DEBUG_TILE_BOUNDS; ++x) {
+			unsigned const ix_val(y*tsize + x), off(4*ix_val);
 
-				if (check_mesh_mask && check_mesh_disable(point(get_xval(x + llc_x)+0.5*DX_VAL, get_yval(y + llc_y)+0.5*DY_VAL, 0.0), HALF_DXY)) {
-					mesh_weight_data[off+0] = mesh_weight_data[off+1] = 255; // set invalid values to flag as transparent
-					mesh_weight_data[off+2] = mesh_weight_data[off+3] = 0;   // make sure grass is disabled
-					has_disabled_area = 1;
-					continue;
-				}
-				float weights[NTEX_DIRT] = {0};
-				unsigned const ix(y*zvsize + x);
-				float const mh00(zvals[ix]), mh01(zvals[ix+1]), mh10(zvals[ix+zvsize]), mh11(zvals[ix+zvsize+1]);
-				float const mhmin(min(min(mh00, mh01), min(mh10, mh11))), mhmax(max(max(mh00, mh01), max(mh10, mh11)));
-				float const rand_offset(rand_vals[y*tsize + x]);
-				float const relh1(relh_adj_tex + (mhmin - zmin)*dz_inv + rand_offset);
-				float const relh2(relh_adj_tex + (mhmax - zmin)*dz_inv + rand_offset);
-				get_tids(relh1, k1, k2);
-				get_tids(relh2, k3, k4);
-				bool const same_tid(k1 == k4);
-				float t(0.0);
-				k2 = k4;
-			
-				if (!same_tid) {
-					float const relh(relh_adj_tex + (mh00 - zmin)*dz_inv);
-					get_tids(relh, k1, k2, &t);
-				}
-				float weight_scale(1.0);
-				bool const grass(lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == GROUND_TEX), snow(lttex_dirt[k2].id == SNOW_TEX);
-				has_any_grass |= grass;
-
-				if (grass || snow) {
-					float const *const sti(sthresh[snow]);
-					vector3d const normal(get_norm_not_normalized(ix));
-					float vnz(vnz_scale*normal.z/normal.mag());
-					// add random noise here as well to produce dry patches of dirt and sand in the grass
-					if (grass && vnz > sti[1]) {vnz = CLIP_TO_01(1.0f + 20.0f*rand_offset);}
-
-					if (vnz < sti[1]) { // handle steep slopes (dirt/rock texture replaces grass texture)
-						if (grass) { // ground/grass
-							float rock_weight((lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == ROCK_TEX) ? t : 0.0);
-							float const steepness(1.0 - CLIP_TO_01((vnz - 0.5f*sti[0])*steep_mult_rock));
-							rock_weight  = rock_weight*(1.0 - steepness) + steepness;
-							weight_scale = CLIP_TO_01((vnz - sti[0])*steep_mult_grass);
-							weights[rock_tex_ix] += (1.0 - weight_scale)*rock_weight;
-							weights[dirt_tex_ix] += (1.0 - weight_scale)*(1.0 - rock_weight);
-						}
-						else { // snow
-							weight_scale = CLIP_TO_01(2.0f*(vnz - sti[0])*steep_mult_snow);
-							weights[rock_tex_ix] += 1.0 - weight_scale;
-						}
+			if (check_mesh_mask && check_mesh_disable(point(get_xval(x + llc_x)+0.5*DX_VAL, get_yval(y + llc_y)+0.5*DY_VAL, 0.0), HALF_DXY)) {
+				mesh_weight_data[off+0] = mesh_weight_data[off+1] = 255; // set invalid values to flag as transparent
+				mesh_weight_data[off+2] = mesh_weight_data[off+3] = 0;   // make sure grass is disabled
+				has_disabled_area = 1;
+				continue;
+			}
+			float weights[NTEX_DIRT] = {0};
+			unsigned const ix(y*zvsize + x);
+			float const mh00(zvals[ix]), mh01(zvals[ix+1]), mh10(zvals[ix+zvsize]), mh11(zvals[ix+zvsize+1]);
+			float const mhmin(min(min(mh00, mh01), min(mh10, mh11))), mhmax(max(max(mh00, mh01), max(mh10, mh11)));
+			float const rand_offset(rand_vals[y*tsize + x]);
+			float const relh1(relh_adj_tex + (mhmin - zmin)*dz_inv + rand_offset);
+			float const relh2(relh_adj_tex + (mhmax - zmin)*dz_inv + rand_offset);
+			get_tids(relh1, k1, k2);
+			get_tids(relh2, k3, k4);
+			bool const same_tid(k1 == k4);
+			float t(0.0);
+			k2 = k4;
+		
+			if (!same_tid) {
+				float const relh(relh_adj_tex + (mh00 - zmin)*dz_inv);
+				get_tids(relh, k1, k2, &t);
+			}
+			float weight_scale(1.0);
+			bool const grass(lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == GROUND_TEX), snow(lttex_dirt[k2].id == SNOW_TEX);
+			has_any_grass |= grass;
+
+			if (grass || snow) {
+				float const *const sti(sthresh[snow]);
+				vector3d const normal(get_norm_not_normalized(ix));
+				float vnz(vnz_scale*normal.z/normal.mag());
+				// add random noise here as well to produce dry patches of dirt and sand in the grass
+				if (grass && vnz > sti[1]) {vnz = CLIP_TO_01(1.0f + 20.0f*rand_offset);}
+
+				if (vnz < sti[1]) { // handle steep slopes (dirt/rock texture replaces grass texture)
+					if (grass) { // ground/grass
+						float rock_weight((lttex_dirt[k1].id == GROUND_TEX || lttex_dirt[k2].id == ROCK_TEX) ? t : 0.0);
+						float const steepness(1.0 - CLIP_TO_01((vnz - 0.5f*sti[0])*steep_mult_rock));
+						rock_weight  = rock_weight*(1.0 - steepness) + steepness;
+						weight_scale = CLIP_TO_01((vnz - sti[0])*steep_mult_grass);
+						weights[rock_tex_ix] += (1.0 - weight_scale)*rock_weight;
+						weights[dirt_tex_ix] += (1.0 - weight_scale)*(1.0 - rock_weight);
+					}
+					else { // snow
+						weight_scale = CLIP_TO_01(2.0f*(vnz - sti[0])*steep_mult_snow);
+						weights[rock_tex_ix] += 1.0 - weight_scale;
 					}
 				}
-				weights[k2] += weight_scale*t;
-				weights[k1] += weight_scale*(1.0 - t);
-				float const xv(float(x)*xy_mult);
-				float const dirt_scale(BILINEAR_INTERP(params, dirt, xv, yv)); // slow
-
-				if (dirt_scale < 1.0) { // apply dirt scale: convert dirt to sand
-					weights[sand_tex_ix] += (1.0 - dirt_scale)*weights[dirt_tex_ix];
-					weights[dirt_tex_ix] *= dirt_scale;
+			}
+			weights[k2] += weight_scale*t;
+			weights[k1] += weight_scale*(1.0 - t);
+			float const xv(float(x)*xy_mult);
+			float const dirt_scale(BILINEAR_INTERP(params, dirt, xv, yv)); // slow
+
+			if (dirt_scale < 1.0) { // apply dirt scale: convert dirt to sand
+				weights[sand_tex_ix] += (1.0 - dirt_scale)*weights[dirt_tex_ix];
+				weights[dirt_tex_ix] *= dirt_scale;
+			}
+			if (grass) {
+				float grass_scale((mhmin < water_level) ? 0.0 : BILINEAR_INTERP(params, grass, xv, yv)); // no grass under water
+				
+				if (grass_scale > 0.0 && check_grass_place &&
+					check_city_sphere_coll(point(get_xval(x + llc_x)+0.5*DX_VAL, get_yval(y + llc_y)+0.5*DY_VAL, 0.0), HALF_DXY, 1)) // exclude bridges and tunnels here
+				{
+					weights[dirt_tex_ix] += weights[grass_tex_ix]; // replace grass with dirt
+					weights[grass_tex_ix] = 0.0;
+					grass_scale = 0.0;
 				}
-				if (grass) {
-					float grass_scale((mhmin < water_level) ? 0.0 : BILINEAR_INTERP(params, grass, xv, yv)); // no grass under water
-					
-					if (grass_scale > 0.0 && check_grass_place &&
-						check_city_sphere_coll(point(get_xval(x + llc_x)+0.5*DX_VAL, get_yval(y + llc_y)+0.5*DY_VAL, 0.0), HALF_DXY, 1)) // exclude bridges and tunnels here
-					{
-						weights[dirt_tex_ix] += weights[grass_tex_ix]; // replace grass with dirt
-						weights[grass_tex_ix] = 0.0;
-						grass_scale = 0.0;
-					}
-					else if (grass_scale < 1.0) { // apply grass scale: convert grass to sand
-						float const gscale(CLIP_TO_01(2.5f*(grass_scale - 0.5f) + 0.5f));
-						weights[sand_tex_ix ] += (1.0 - gscale)*weights[grass_tex_ix];
-						weights[grass_tex_ix] *= gscale;
-					}
-					if (grass_scale > 0.0) {add_grass_block_at(x, y, mhmin, mhmax, grass_block_dim);}
-				} // end grass
-				for (unsigned i = 0; i < NTEX_DIRT-1; ++i) { // Note: weights should sum to 1.0, so we can calculate w4 as 1.0-w0-w1-w2-w3
-					mesh_weight_data[off+i] = ((weights[i] <= 0.01) ? 0 : ((weights[i] >= 0.99) ? 255 : (unsigned char)(255.0*weights[i])));
+				else if (grass_scale < 1.0) { // apply grass scale: convert grass to sand
+					float const gscale(CLIP_TO_01(2.5f*(grass_scale - 0.5f) + 0.5f));
+					weights[sand_tex_ix ] += (1.0 - gscale)*weights[grass_tex_ix];
+					weights[grass_tex_ix] *= gscale;
 				}
-			} // for x
-		} // for y
-	}
+				if (grass_scale > 0.0) {add_grass_block_at(x, y, mhmin, mhmax, grass_block_dim);}
+			} // end grass
+			for (unsigned i = 0; i < NTEX_DIRT-1; ++i) { // Note: weights should sum to 1.0, so we can calculate w4 as 1.0-w0-w1-w2-w3
+				mesh_weight_data[off+i] = ((weights[i] <= 0.01) ? 0 : ((weights[i] >= 0.99) ? 255 : (unsigned char)(255.0*weights[i])));
+			}
+		} // for x
+	} // for y
+	mesh_weights_valid = 1;
+}
+
+
+void tile_t::create_texture(mesh_xy_grid_cache_t &height_gen) {
+
+	//timer_t timer("Create Tile Weights Texture");
+	assert(zvals.size() == zvsize*zvsize);
+	unsigned const tsize(stride), num_texels(tsize*tsize);
+	int sand_tex_ix(-1), dirt_tex_ix(-1), grass_tex_ix(-1), rock_tex_ix(-1), snow_tex_ix(-1);
+	get_texture_ixs(sand_tex_ix, dirt_tex_ix, grass_tex_ix, rock_tex_ix, snow_tex_ix);
+
+	if (weight_tid == 0 && !mesh_weights_valid) {calc_mesh_weights(height_gen);} // create weights if they weren't generated in the background
 	else { // use existing weights
-		assert(recalc_tree_grass_weights); // can only get here in this case
+		assert(recalc_tree_grass_weights || weight_tid == 0); // can only get here in these cases
 		assert(mesh_weight_data.size() == 4*num_texels);
 	}
 	weight_data = mesh_weight_data; // deep copy so that tree_map doesn't alter original weights
@@ -1113,7 +1428,6 @@ void tile_t::calc_avg_mesh_color() {
 bool tile_t::update_range(tile_shadow_map_manager &smap_manager) { // if returns 0, tile will be deleted
 
 	update_pine_tree_state(0); // can free pine tree vbos
-	update_animals(); // if any were generated
 	float const dist(get_rel_dist_to_camera());
 	
 	if (dist > CLEAR_DIST_TILES || mesh_height_invalid) {
@@ -1522,8 +1836,9 @@ unsigned tile_t::update_tile_clouds() {
 
 // *** animals ***
 
-template<typename A> void tile_t::propagate_animals_to_neighbor_tiles(animal_group_t<A> &animals) {
+template<typename A> void tile_t::collect_animals_leaving_tile(animal_group_t<A> &animals, vector<pair<tile_xy_pair, A>> &to_move) {
 
+	to_move.clear();
 	if (animals.empty()) return;
 	cube_t range(get_mesh_bcube_global());
 
@@ -1536,13 +1851,26 @@ template<typename A> void tile_t::propagate_animals_to_neighbor_tiles(animal_gro
 		if      (pos.y < range.d[1][0]) {dy = -1;} // move -y
 		else if (pos.y > range.d[1][1]) {dy =  1;} // move +y
 		if (dx == 0 && dy == 0) continue; // position is within the current tile, keep this animal here
-		tile_t *adj(get_adj_tile(dx, dy));
-		if (adj != NULL) {adj->add_animal(animals[i]);} // move to adjacent tile, if one is present - pos should be valid within that tile
+		to_move.emplace_back(tile_xy_pair(dx, dy), animals[i]); // moved later, since the adjacent tile may be updating in another thread
 		animals.remove(i); --i; // remove from current tile
 	}
 }
 
-void tile_t::update_animals() {
+template<typename A> void tile_t::move_animals_to_neighbor_tiles(vector<pair<tile_xy_pair, A>> &to_move) {
+
+	for (auto i = to_move.begin(); i != to_move.end(); ++i) {
+		tile_t *adj(get_adj_tile(i->first.x, i->first.y));
+		if (adj != NULL) {adj->add_animal(i->second);} // move to adjacent tile, if one is present - pos should be valid within that tile
+	}
+	to_move.clear();
+}
+
+void tile_t::move_animals_to_neighbor_tiles() {
+	move_animals_to_neighbor_tiles(fish_to_move);
+	move_animals_to_neighbor_tiles(birds_to_move);
+}
+
+void tile_t::update_animals(unsigned num_birds, bool gen_birds) {
 
 	if (!ENABLE_ANIMALS) return;
 	//timer_t timer("Update Animals");
@@ -1559,20 +1887,21 @@ void tile_t::update_animals() {
 	}
 	else {
 		fish.update(this);
-		propagate_animals_to_neighbor_tiles(fish);
+		collect_animals_leaving_tile(fish, fish_to_move);
 	}
 	if (atmosphere < 0.4 || vegetation < 0.2) {} // no birds
 	else if (!birds.was_generated()) {
+		if (!gen_birds) return; // deferred
 		cube_t range(get_mesh_bcube_global());
 		float const z_range(zmax - zmin);
 		range.d[2][0] = zmax;
 		range.d[2][1] = zmax + 0.50*z_range; // Note: may be in the clouds
-		birds.gen(num_birds_per_tile, range, this);
+		birds.gen(num_birds, range, this);
 	}
 	else {
 		birds.flock(this);
 		birds.update(this);
-		propagate_animals_to_neighbor_tiles(birds);
+		collect_animals_leaving_tile(birds, birds_to_move);
 	}
 }
 
@@ -1587,6 +1916,7 @@ void tile_t::pre_draw(mesh_xy_grid_cache_t &height_gen) {
 	if (weight_tid == 0 || recalc_tree_grass_weights) {create_texture(height_gen);}
 	check_shadow_map_and_normal_texture();
 	ensure_height_tid();
+	if (cache_key != 0 && !cache_valid && mesh_weights_valid && (has_ao_lighting() || !enable_tiled_mesh_ao)) {write_to_cache();} // all cached data is ready
 }
 
 
@@ -1845,35 +2175,139 @@ int tile_t::get_tid_under_point(point const &pos) const {
 }
 
 
+void tile_height_pyramid_t::build(vector<float> const &zvals, unsigned zvsize, unsigned size) {
+
+	assert(zvals.size() == zvsize*zvsize && size < zvsize);
+	levels.clear();
+	unsigned nx((size + BLOCK_SZ - 1)/BLOCK_SZ);
+	levels.push_back(level_t(nx));
+	level_t &base(levels.back());
+
+	for (unsigned by = 0; by < nx; ++by) {
+		for (unsigned bx = 0; bx < nx; ++bx) {
+			pair<float, float> &zr(base.zr[by*nx + bx]);
+			zr.first = FAR_DISTANCE; zr.second = -FAR_DISTANCE;
+			unsigned const x_end(min((bx+1)*BLOCK_SZ, size)), y_end(min((by+1)*BLOCK_SZ, size)); // include the shared verts on the far edges
+
+			for (unsigned y = by*BLOCK_SZ; y <= y_end; ++y) {
+				for (unsigned x = bx*BLOCK_SZ; x <= x_end; ++x) {
+					float const z(zvals[y*zvsize + x]);
+					zr.first = min(zr.first, z); zr.second = max(zr.second, z);
+				}
+			}
+		}
+	}
+	while (nx > 1) { // each level is the union of 2x2 blocks from the level below
+		unsigned const nx2((nx + 1)/2);
+		level_t next(nx2);
+		level_t const &prev(levels.back());
+
+		for (unsigned by = 0; by < nx2; ++by) {
+			for (unsigned bx = 0; bx < nx2; ++bx) {
+				pair<float, float> &zr(next.zr[by*nx2 + bx]);
+				zr.first = FAR_DISTANCE; zr.second = -FAR_DISTANCE;
+
+				for (unsigned y = 2*by; y < min(2*by+2, nx); ++y) {
+					for (unsigned x = 2*bx; x < min(2*bx+2, nx); ++x) {
+						pair<float, float> const &czr(prev.zr[y*nx + x]);
+						zr.first = min(zr.first, czr.first); zr.second = max(zr.second, czr.second);
+					}
+				}
+			}
+		}
+		levels.push_back(next);
+		nx = nx2;
+	}
+}
+
+struct mesh_line_query_t {
+	point v1, v2;
+	float t, xv1, yv1; // t = closest hit so far; {xv1, yv1} = tile LLC in camera space
+	unsigned qx, qy; // quad of the closest hit
+	mesh_line_query_t(point const &v1_, point const &v2_, float t_, float xv1_, float yv1_) : v1(v1_), v2(v2_), t(t_), xv1(xv1_), yv1(yv1_), qx(0), qy(0) {}
+};
+
+// returns the first point on the line that's at or below the mesh surface, where each quad is split into two triangles along the {00, 11} diagonal;
+// t is the max value to consider on input and the hit position on output
 bool tile_t::line_intersect_mesh(point const &v1, point const &v2, float &t, int &xpos, int &ypos) const {
 
-	if (is_distant) return 0; // Note: this can be made to work, but won't work as-is
+	if (is_distant || hpyramid.empty()) return 0; // Note: is_distant can be made to work, but won't work as-is
 	//if (!pine_trees .empty()) {} // TODO: check pine trees with -= dtree_off.get_xlate()
 	//if (!decid_trees.empty()) {} // TODO: check decid trees with -= dtree_off.get_xlate()
-	point v1c(v1), v2c(v2); // clipped verts
-	if (!do_line_clip(v1c, v2c, get_mesh_bcube().d)) return 0;
-	// similar to mesh_intersector::line_intersect_surface_fast()
-	int const xp1(get_xpos(v1c.x) - x1 - xoff + xoff2), yp1(get_ypos(v1c.y) - y1 - yoff + yoff2);
-	int const xp2(get_xpos(v2c.x) - x1 - xoff + xoff2), yp2(get_ypos(v2c.y) - y1 - yoff + yoff2);
-	int const dx(xp2 - xp1), dy(yp2 - yp1), steps(max(1, max(abs(dx), abs(dy))));
-	double const dz(v2c.z - v1c.z), xinc(dx/(double)steps), yinc(dy/(double)steps), zinc(dz/(double)steps);
-	double x(xp1), y(yp1), z(v1c.z - 0.1*fabs(zinc)); // z offset required to avoid problems with zval at bcube.z1
-
-	for (int k = 0; k <= steps; ++k) {
-		int const ix((int)x), iy((int)y);
-
-		if (ix >= 0 && iy >= 0 && ix <= (int)size && iy <= (int)size && zvals[iy*zvsize + ix] > z) {
-			// Note: we use z instead of zvals here because zvals may be much too high if we enter this tile while the line is under the mesh
-			float const cur_t(((z - 0.5*zinc) - v1.z)/(v2.z - v1.z)); // t relative to original v1, v2
-
-			if (cur_t >= 0.0 && cur_t <= 1.0) {
-				xpos = x1 + ix;
-				ypos = y1 + iy;
-				t    = cur_t;
-				return 1;
-			}
+	mesh_line_query_t q(v1, v2, t, get_xval(x1 + xoff - xoff2), get_yval(y1 + yoff - yoff2));
+	if (!line_intersect_node(q, hpyramid.levels.size()-1, 0, 0)) return 0;
+	xpos = x1 + q.qx;
+	ypos = y1 + q.qy;
+	t    = q.t;
+	return 1;
+}
+
+bool tile_t::line_intersect_node(mesh_line_query_t &q, unsigned level, unsigned bx, unsigned by) const {
+
+	assert(level < hpyramid.levels.size());
+	tile_height_pyramid_t::level_t const &lv(hpyramid.levels[level]);
+	unsigned const bsz(tile_height_pyramid_t::BLOCK_SZ << level); // quads per side
+	unsigned const qx1(bx*bsz), qy1(by*bsz), qx2(min(qx1+bsz, size)), qy2(min(qy1+bsz, size));
+	pair<float, float> const &zr(lv.zr[by*lv.nx + bx]);
+	cube_t const bcube((q.xv1 + qx1*deltax), (q.xv1 + qx2*deltax), (q.yv1 + qy1*deltay), (q.yv1 + qy2*deltay), zr.first, zr.second);
+	float tmin(0.0), tmax(1.0);
+	if (!get_line_clip(q.v1, q.v2, bcube.d, tmin, tmax) || tmin >= q.t) return 0; // no hit, or can't be closer than the current hit
+	bool hit(0);
+
+	if (level == 0) { // leaf block: test the individual quads
+		for (unsigned y = qy1; y < qy2; ++y) {
+			for (unsigned x = qx1; x < qx2; ++x) {hit |= line_intersect_quad(q, x, y);}
 		}
-		x += xinc; y += yinc; z += zinc;
+		return hit;
+	}
+	// visit children roughly front to back so that farther children are usually culled by the current hit
+	tile_height_pyramid_t::level_t const &clv(hpyramid.levels[level-1]);
+	bool const xneg(q.v2.x < q.v1.x), yneg(q.v2.y < q.v1.y);
+
+	for (unsigned j = 0; j < 2; ++j) {
+		unsigned const cy(2*by + (yneg ? 1-j : j));
+		if (cy >= clv.nx) continue;
+
+		for (unsigned i = 0; i < 2; ++i) {
+			unsigned const cx(2*bx + (xneg ? 1-i : i));
+			if (cx < clv.nx) {hit |= line_intersect_node(q, level-1, cx, cy);}
+		}
+	}
+	return hit;
+}
+
+bool tile_t::line_intersect_quad(mesh_line_query_t &q, unsigned qx, unsigned qy) const {
+
+	unsigned const ix(qy*zvsize + qx);
+	float const z00(zvals[ix]), z10(zvals[ix+1]), z01(zvals[ix+zvsize]), z11(zvals[ix+zvsize+1]);
+	float const qxv(q.xv1 + qx*deltax), qyv(q.yv1 + qy*deltay);
+	cube_t const bcube(qxv, (qxv + deltax), qyv, (qyv + deltay), min(min(z00, z10), min(z01, z11)), max(max(z00, z10), max(z01, z11)));
+	float tmin(0.0), tmax(1.0);
+	if (!get_line_clip(q.v1, q.v2, bcube.d, tmin, tmax) || tmin >= q.t) return 0;
+	vector3d const dir(q.v2 - q.v1);
+	float const au((q.v1.x - qxv)/deltax), bu(dir.x/deltax), av((q.v1.y - qyv)/deltay), bv(dir.y/deltay); // quad-local {u,v} = a + b*t
+	float tsplit[3] = {tmin, tmax, tmax};
+
+	if (bu != bv) { // split at the diagonal, where the surface changes from one triangle's plane to the other's
+		float const td((av - au)/(bu - bv));
+		if (td > tmin && td < tmax) {tsplit[1] = td;}
+	}
+	for (unsigned n = 0; n < 2; ++n) {
+		float const ta(tsplit[n]), tb(tsplit[n+1]);
+		if (n > 0 && tb <= ta) break;
+		float const tm(0.5*(ta + tb));
+		bool const lower((au + bu*tm) >= (av + bv*tm)); // u >= v => triangle {00, 10, 11}
+		float const dzdu(lower ? (z10 - z00) : (z11 - z01)), dzdv(lower ? (z11 - z10) : (z01 - z00));
+		// height of the line above the surface plane at the ends of this interval; this is linear in t, so we can solve for the crossing
+		float const fa(q.v1.z + dir.z*ta - (z00 + dzdu*(au + bu*ta) + dzdv*(av + bv*ta)));
+		float const fb(q.v1.z + dir.z*tb - (z00 + dzdu*(au + bu*tb) + dzdv*(av + bv*tb)));
+		if (fa > 0.0 && fb > 0.0) continue; // above the surface
+		float const t((fa <= 0.0) ? ta : (ta + (tb - ta)*fa/(fa - fb)));
+		if (t >= q.t) return 0;
+		q.t  = t;
+		q.qx = qx;
+		q.qy = qy;
+		return 1;
 	}
 	return 0;
 }
@@ -1949,28 +2383,232 @@ void lightning_strike_t::end_draw() const {
 // *** tile_draw_t ***
 
 
-tile_draw_t::tile_draw_t() : buildings_valid(0), tiles_gen_prev_frame(0), terrain_zmin(0.0), lod_renderer(USE_TREE_BILLBOARDS) {
+tile_draw_t::tile_draw_t() : buildings_valid(0), tiles_gen_prev_frame(0), bench_num_tiles(0), bench_stable_frames(0), bench_birds_placed(0), terrain_zmin(0.0), last_camera_global(all_zeros), camera_vel(zero_vector),
+	new_tile_upload_ms(1.0), lod_renderer(USE_TREE_BILLBOARDS)
+{
 	assert(MESH_X_SIZE == MESH_Y_SIZE && X_SCENE_SIZE == Y_SCENE_SIZE);
 }
 
 void tile_draw_t::clear(bool no_regen_buildings) {
 
+	cancel_tile_gen_jobs();
 	clear_vbos_tids(); // needed to clear vbo, ivbo, and free list
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ++i) {i->second->clear();} // may not be necessary
 	to_draw.clear();
 	tiles.clear();
+	tile_pool.clear();
+	bench_num_tiles = bench_stable_frames = 0;
+	bench_birds_placed = 0;
 	if (!no_regen_buildings && !have_cities()) {buildings_valid = 0;} // can't regenerate buildings after cities and cars have been placed
 }
 
 void tile_draw_t::insert_tile(tile_t *tile) {
-	bool const did_ins(tiles.insert(make_pair(tile->get_tile_xy_pair(), tile)).second);
+	tile_xy_pair const tp(tile->get_tile_xy_pair());
+	bool const did_ins(tiles.insert(tp, tile));
 	assert(did_ins);
+	update_adj_tile_horizons(tp, 1);
+}
+
+void tile_draw_t::update_adj_tile_horizons(tile_xy_pair const &tp, bool added) { // called when the tile at tp is added or removed
+	if (!USE_HORIZON_SHADOWS) return;
+
+	for (int dy = -1; dy <= 1; ++dy) { // notify adjacent tiles, whose horizon rays may have stopped at or used this tile
+		for (int dx = -1; dx <= 1; ++dx) {
+			if (dx == 0 && dy == 0) continue;
+			tile_t *const adj_tile(tiles.get(tile_xy_pair(tp.x+dx, tp.y+dy)));
+			if (adj_tile) {adj_tile->adj_tile_changed(-dx, -dy, added);}
+		}
+	}
+}
+
+// Note: tile_t can't be assigned because tree_cont_t holds a reference, so we recycle the memory of the large per-tile vectors rather than the tile itself
+tile_t *tile_draw_t::alloc_tile(tile_t const &tile) {
+
+	tile_t *const ret(new tile_t(tile));
+
+	if (!tile_pool.empty()) {
+		ret->recycle_buffers_from(*tile_pool.back());
+		tile_pool.pop_back();
+	}
+	return ret;
+}
+
+void tile_draw_t::free_tile(tile_t *tile) { // tile must have no GPU resources, either because it was cleared or because it was never drawn
+	assert(tile);
+	if (tile_pool.size() < MAX_POOLED_TILES) {tile_pool.emplace_back(tile);} else {delete tile;}
+}
+
+
+void tile_grid_t::unlink(unsigned ix) {
+
+	assert(ix < entries.size());
+	unsigned *cur(&grid[get_cell(entries[ix].first)]);
+	while (*cur != ix) {assert(*cur != NO_ENTRY); cur = &next[*cur];}
+	*cur = next[ix];
+	next[ix] = NO_ENTRY;
+}
+
+void tile_grid_t::rebuild(unsigned new_grid_bits) {
+
+	grid_bits = new_grid_bits;
+	grid.clear();
+	grid.resize((1U << (2*grid_bits)), NO_ENTRY);
+	for (unsigned ix = 0; ix < entries.size(); ++ix) {link(ix);}
+}
+
+bool tile_grid_t::insert(tile_xy_pair const &tp, tile_t *tile) {
+
+	assert(tile);
+	if (find_ix(tp) != NO_ENTRY) return 0; // already exists
+	// keep the grid at least twice as large as the number of tiles in each dimension, so that a square window of tiles has no collisions
+	unsigned new_grid_bits(max(grid_bits, MIN_TILE_GRID_BITS));
+	while ((1U << (2*new_grid_bits)) < 4*(entries.size() + 1)) {++new_grid_bits;}
+	entries.emplace_back(tp, std::unique_ptr<tile_t>(tile));
+	next.push_back(NO_ENTRY);
+	if (new_grid_bits != grid_bits || grid.empty()) {rebuild(new_grid_bits);} else {link(entries.size()-1);}
+	return 1;
+}
+
+tile_grid_t::iterator tile_grid_t::erase(iterator i) {
+
+	unsigned const ix(i - begin()), last(entries.size()-1);
+	unlink(ix);
+
+	if (ix != last) { // move the last entry into this slot
+		unlink(last);
+		entries[ix] = std::move(entries[last]);
+		link(ix);
+	}
+	entries.pop_back();
+	next.pop_back();
+	return (begin() + ix);
+}
+
+point get_camera_pos_no_offset() {return (get_camera_pos() + vector3d(xoff2*DX_VAL, yoff2*DY_VAL, 0.0));} // independent of mesh scrolling
+
+float tile_draw_t::get_gen_priority(tile_t const &tile) const { // lower values are generated first
+
+	float priority(tile.get_draw_priority());
+	float const speed(camera_vel.xy_mag());
+
+	if (speed > TOLERANCE) { // favor tiles in the direction the camera is moving so that they're ready when the camera gets there
+		vector3d const dir(tile.get_center() - get_camera_pos());
+		float const dir_mag(dir.xy_mag());
+		if (dir_mag > TOLERANCE) {priority *= 1.0 - 0.5*max(0.0f, (dir.x*camera_vel.x + dir.y*camera_vel.y)/(dir_mag*speed));}
+	}
+	return priority;
+}
+
+void tile_draw_t::add_tile_gen_job(tile_t *tile, float priority) {
+
+	assert(tile);
+	point const center(tile->get_center() + vector3d(xoff2*DX_VAL, yoff2*DY_VAL, 0.0));
+	bool const calc_weights(!have_cities()); // city queries in the weight calculation depend on the camera offset, which may change during the job
+	p_tile_gen_job const job(new tile_gen_job_t(tile, center, tile->calc_radius(), priority, calc_weights));
+	bool const did_ins(tile_jobs.insert(make_pair(tile->get_tile_xy_pair(), job)).second);
+	assert(did_ins);
+
+	tile_gen_workers.add_job([job]() {
+		if (!job->cancel) {
+			tile_t &tile(*job->tile);
+			mesh_xy_grid_cache_t height_gen; // CPU mode only, so no GL calls
+			tile.create_zvals(height_gen, 0); // may be read from the tile cache, including AO and weights
+			if (enable_tiled_mesh_ao && !tile.has_ao_lighting() && !job->cancel) {tile.calc_mesh_ao_lighting();}
+			if (job->calc_weights && !tile.has_mesh_weights() && !job->cancel) {tile.calc_mesh_weights(height_gen);}
+		}
+		job->done = 1;
+	});
+}
+
+// shadows, trees, and texture uploads are done later in pre_draw() because they depend on adjacent tiles or the GL context
+void tile_draw_t::insert_completed_tiles(bool wait) {
+
+	if (tile_jobs.empty()) return;
+	point const camera(get_camera_pos_no_offset());
+	float const cancel_dist(DELETE_DIST_TILES*get_scaled_tile_radius());
+	vector<pair<float, tile_xy_pair> > completed;
+
+	for (auto i = tile_jobs.begin(); i != tile_jobs.end();) { // Note: no ++i
+		tile_gen_job_t &job(*i->second);
+		if (!job.cancel && !dist_xy_less_than(job.center, camera, (cancel_dist + job.radius))) {job.cancel = 1;} // moved out of range
+		if (wait) {while (!job.done) {std::this_thread::yield();}}
+		if (!job.done) {++i; continue;} // still running
+		
+		if (job.cancel) {
+			job.tile.reset(); // free the tile here rather than on the worker thread
+			tile_jobs.erase(i++);
+			continue;
+		}
+		completed.push_back(make_pair(job.priority, i->first));
+		++i;
+	}
+	sort(completed.begin(), completed.end());
+	// insert tiles in priority order, limited by the measured upload time per new tile
+	unsigned const max_insert(wait ? completed.size() : max(1U, unsigned(TILE_UPLOAD_BUDGET_MS/max(new_tile_upload_ms, 0.1f))));
+
+	for (unsigned n = 0; n < completed.size() && n < max_insert; ++n) {
+		auto it(tile_jobs.find(completed[n].second));
+		assert(it != tile_jobs.end());
+		insert_tile(it->second->tile.release());
+		tile_jobs.erase(it);
+	}
+}
+
+void tile_draw_t::cancel_tile_gen_jobs() { // blocks until the jobs that have been started finish
+
+	for (auto i = tile_jobs.begin(); i != tile_jobs.end(); ++i) {i->second->cancel = 1;}
+
+	for (auto i = tile_jobs.begin(); i != tile_jobs.end(); ++i) {
+		while (!i->second->done) {std::this_thread::yield();}
+		i->second->tile.reset();
+	}
+	tile_jobs.clear();
 }
 
 void tile_draw_t::free_compute_shader() {
 	for (auto i = height_gens.begin(); i != height_gens.end(); ++i) {i->clear_context();}
 }
 
+void tile_draw_t::update_animals() {
+
+	if (!ENABLE_ANIMALS || tiles.empty()) return;
+	RESET_TIME;
+	vector<tile_t *> to_update;
+	to_update.reserve(tiles.size());
+	for (tile_map::const_iterator i = tiles.begin(); i != tiles.end(); ++i) {to_update.push_back(i->second.get());}
+	// sort by tile position so that migration order doesn't depend on tile map iteration order
+	sort(to_update.begin(), to_update.end(), [](tile_t const *const a, tile_t const *const b) {return (a->get_tile_xy_pair() < b->get_tile_xy_pair());});
+	int const num_tiles((int)to_update.size());
+	bool gen_birds(1), bench_placing(0);
+
+	if (BIRD_BENCHMARK_NUM) { // birds are generated once, after the tile set has stopped changing, so that the total is exactly BIRD_BENCHMARK_NUM
+		unsigned const settle_frames = 8;
+		bool const tiles_changed(tiles.size() != bench_num_tiles || !tile_jobs.empty() || tiles_gen_prev_frame > 0);
+		bench_num_tiles     = (unsigned)tiles.size();
+		bench_stable_frames = (tiles_changed ? 0 : bench_stable_frames+1);
+		bench_placing       = (!bench_birds_placed && bench_stable_frames >= settle_frames);
+		gen_birds           = (bench_birds_placed || bench_placing); // tiles created after placement get no birds
+		bench_birds_placed |= bench_placing;
+	}
+#pragma omp parallel for schedule(static,1)
+	for (int i = 0; i < num_tiles; ++i) {to_update[i]->build_flock_grid();} // must be complete for all tiles before any tile flocks
+#pragma omp parallel for schedule(dynamic,1)
+	for (int i = 0; i < num_tiles; ++i) { // tiles only read each other's flock grids
+		unsigned num_birds(num_birds_per_tile); // for newly generated tiles
+		if (BIRD_BENCHMARK_NUM) {num_birds = (bench_placing ? (BIRD_BENCHMARK_NUM/num_tiles + (unsigned(i) < BIRD_BENCHMARK_NUM%num_tiles)) : 0);}
+		to_update[i]->update_animals(num_birds, gen_birds);
+	}
+	for (auto i = to_update.begin(); i != to_update.end(); ++i) {(*i)->move_animals_to_neighbor_tiles();} // serial, in a fixed order
+	if (timing_profiler_enabled()) {PRINT_TIME("Update Animals");}
+
+	if (BIRD_BENCHMARK_NUM && bench_birds_placed) {
+		unsigned tot_birds(0);
+		for (auto i = to_update.begin(); i != to_update.end(); ++i) {tot_birds += (*i)->get_num_birds();}
+		int const dtime(GET_DELTA_TIME);
+		cout << "Update Animals: " << tot_birds << " birds in " << num_tiles << " tiles, " << dtime << " ms, " << tot_birds/max(1, dtime) << " birds/ms" << endl;
+	}
+}
+
 float tile_draw_t::update(float &min_camera_dist) { // view-independent updates; returns terrain zmin
 
 	//timer_t timer("TT Update");
@@ -1998,6 +2636,12 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 	unsigned const init_tiles((unsigned)tiles.size());
 	unsigned num_erased(0);
 	min_camera_dist = FAR_DISTANCE;
+	bool const gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU);
+	// the first set of tiles is generated synchronously; mesh editing requires tiles to be generated in order
+	bool const bkg_gen(ENABLE_BKG_TILE_GEN && !gpu_mode && inf_terrain_fire_mode == FM_NONE && !tiles.empty());
+	point const camera_global(get_camera_pos_no_offset());
+	if (last_camera_global != all_zeros) {camera_vel = 0.9*camera_vel + 0.1*(camera_global - last_camera_global);} // smoothed
+	last_camera_global = camera_global;
 	// Note: we may want to calculate distant low-res or larger tiles when the camera is high above the mesh
 
 	if (!to_gen_zvals.empty()) {
@@ -2011,28 +2655,36 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		}
 		to_gen_zvals.clear();
 	}
+	insert_completed_tiles(!bkg_gen); // wait for all pending jobs if we're no longer using background generation
+	update_animals();
+
 	for (tile_map::iterator i = tiles.begin(); i != tiles.end(); ) { // update tiles and free old tiles (Note: no ++i)
-		if (!i->second->update_range(smap_manager)) { // delete this tile
+		if (!i->second->update_range(smap_manager)) { // delete this tile (too far away, or heights were edited)
+			update_adj_tile_horizons(i->first, 0);
 			i->second->clear();
-			tiles.erase(i++);
+			free_tile(i->second.release());
+			i = tiles.erase(i);
 			++num_erased;
 		} else {++i;}
 	}
+	unsigned const cache_key(get_tile_cache_key()); // recomputed each frame in case generation parameters change
+
 	for (int y = y1; y <= y2; ++y ) { // create new tiles
 		for (int x = x1; x <= x2; ++x ) {
 			tile_xy_pair const txy(x, y);
 			if (tiles.find(txy) != tiles.end()) continue; // already exists
+			if (tile_jobs.find(txy) != tile_jobs.end()) continue; // being generated in the background
 			tile_t tile(get_tile_size(), x, y);
 			if (tile.get_rel_dist_to_camera() >= CREATE_DIST_TILES) continue; // too far away to create
-			tile_t *new_tile(new tile_t(tile));
-			to_gen_zvals.push_back(make_pair(new_tile->get_draw_priority(), new_tile));
+			tile_t *new_tile(alloc_tile(tile));
+			new_tile->set_cache_key(cache_key);
+			to_gen_zvals.push_back(make_pair((bkg_gen ? get_gen_priority(*new_tile) : new_tile->get_draw_priority()), new_tile));
 			//tiles[txy].reset(new_tile);
 		}
 	}
 	//if (to_gen_zvals.size() < max_cpu_tiles) {to_gen_zvals.clear();} // block until at least max_cpu_tiles tiles to generate (lower average gen time, but causes more slow frames/lag)
 	unsigned const num_to_gen(to_gen_zvals.size());
 	unsigned gen_this_frame(min(num_to_gen, max_tile_gen_per_frame));
-	bool const gpu_mode(mesh_gen_mode >= MGEN_SIMPLEX_GPU);
 	
 	// to balance tile gen time across frames, generate a number of tiles equal to the average of this frame and the previous frame
 	if (gen_this_frame > 1 && gen_this_frame < max_tile_gen_per_frame && inf_terrain_fire_mode == FM_NONE) { // disable this mode when editing mesh height to prevent visual artifacts
@@ -2040,7 +2692,19 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 	}
 	tiles_gen_prev_frame = num_to_gen;
 
-	if (num_to_gen == 0) {
+	if (bkg_gen) {
+		// submit the highest priority tiles, but keep the worker queue short so that priorities are reevaluated as the camera moves
+		size_t const max_pending(2*tile_gen_workers.get_num_threads());
+		size_t num_pending(tile_gen_workers.num_pending_jobs());
+		sort(to_gen_zvals.begin(), to_gen_zvals.end());
+
+		for (auto i = to_gen_zvals.begin(); i != to_gen_zvals.end(); ++i) {
+			if (num_pending < max_pending) {add_tile_gen_job(i->second, i->first); ++num_pending;}
+			else {free_tile(i->second);} // will be created in a later frame
+		}
+		to_gen_zvals.clear();
+	}
+	else if (num_to_gen == 0) {
 		// do nothing
 	}
 	else if (gpu_mode && num_to_gen <= max_defer_tiles) { // async generation mode - delay until next frame
@@ -2057,15 +2721,29 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 		// if there are fewer than 4 tiles to generate, use CPU simplex rather than GPU simplex to avoid stalling/flusing the graphics pipeline
 		int const prev_mesh_gen_mode(mesh_gen_mode);
 		if (gpu_mode && gen_this_frame <= max_cpu_tiles) {mesh_gen_mode = MGEN_SIMPLEX;} // GPU simplex => CPU simplex
+		bool const cpu_gen(mesh_gen_mode < MGEN_SIMPLEX_GPU);
+		unsigned const num_threads(omp_get_max_threads());
+
+		if (cpu_gen) { // generate enough tiles to keep all threads busy, and the entire initial view in one pass
+			gen_this_frame = (tiles.empty() ? num_to_gen : min(num_to_gen, max(gen_this_frame, num_threads)));
+		}
 		if (gen_this_frame < num_to_gen) {sort(to_gen_zvals.begin(), to_gen_zvals.end());} // sort by priority if not all generated
 		//ostringstream oss; oss << "Gen " << gen_this_frame << " tiles"; timer_t timer(oss.str());
-
-		for (unsigned i = 0; i < num_to_gen; ++i) {
-			tile_t *tile(to_gen_zvals[i].second);
-			if (i >= gen_this_frame) {delete tile; continue;} // delete these tiles - they will be created in a later frame
-			tile->create_zvals(height_gens[0], 0); // generate these tiles
-			insert_tile(tile);
+		for (unsigned i = gen_this_frame; i < num_to_gen; ++i) {free_tile(to_gen_zvals[i].second);} // delete these tiles - they will be created in a later frame
+
+		if (cpu_gen && gen_this_frame > 1) { // generate tiles in parallel, one per thread, in priority order if sorted
+			if (cpu_height_gens.size() < num_threads) {cpu_height_gens.resize(num_threads);}
+#pragma omp parallel for schedule(dynamic,1) num_threads(num_threads)
+			for (int i = 0; i < (int)gen_this_frame; ++i) {
+				tile_t *tile(to_gen_zvals[i].second);
+				tile->create_zvals(cpu_height_gens[omp_get_thread_num()], 0);
+				if (enable_tiled_mesh_ao && !tile->has_ao_lighting()) {tile->calc_mesh_ao_lighting();} // CPU-only, so do it here rather than serially in pre_draw()
+			}
+		}
+		else {
+			for (unsigned i = 0; i < gen_this_frame; ++i) {to_gen_zvals[i].second->create_zvals(height_gens[0], 0);}
 		}
+		for (unsigned i = 0; i < gen_this_frame; ++i) {insert_tile(to_gen_zvals[i].second);}
 		to_gen_zvals.clear();
 		mesh_gen_mode = prev_mesh_gen_mode;
 	}
@@ -2083,7 +2761,15 @@ float tile_draw_t::update(float &min_camera_dist) { // view-independent updates;
 	bool const sun_change (sun_pos  != last_sun  && light_factor >= 0.4);
 	bool const moon_change(moon_pos != last_moon && light_factor <= 0.6);
 
-	if (mesh_shadows_enabled() && (sun_change || moon_change)) { // light source change
+	if (mesh_shadows_enabled() && USE_HORIZON_SHADOWS) {
+		if (sun_pos != last_sun || moon_pos != last_moon) { // light source change: cheap per-texel update from the horizon maps of tiles that have shadows
+#pragma omp parallel for schedule(dynamic,1)
+			for (int i = 0; i < (int)tiles.size(); ++i) {(tiles.begin() + i)->second->update_horizon_shadows();}
+			last_sun  = sun_pos;
+			last_moon = moon_pos;
+		}
+	}
+	else if (mesh_shadows_enabled() && (sun_change || moon_change)) { // light source change
 		if (auto_time_adv) {
 			int const skip_factor = 8;
 
@@ -2381,7 +3067,12 @@ void tile_draw_t::pre_draw(bool reflection_pass) { // view-dependent updates/GPU
 	//if (!to_gen_trees.empty()) {PRINT_TIME("Gen Trees2");}
 	assert(!height_gens.empty());
 	
+	double new_tile_time(0.0);
+	unsigned num_new_tiles(0);
+	
 	for (vector<tile_t *>::iterator i = to_update.begin(); i != to_update.end(); ++i) {
+		bool const is_new(!(*i)->textures_uploaded());
+		double const start_time(is_new ? omp_get_wtime() : 0.0);
 		(*i)->pre_draw(height_gens[0]);
 
 		if ((*i)->can_have_trees()) {
@@ -2389,7 +3080,9 @@ void tile_draw_t::pre_draw(bool reflection_pass) { // view-dependent updates/GPU
 			(*i)->update_decid_trees();
 		}
 		(*i)->update_scenery();
+		if (is_new) {new_tile_time += omp_get_wtime() - start_time; ++num_new_tiles;}
 	}
+	if (num_new_tiles > 0) {new_tile_upload_ms = 0.75*new_tile_upload_ms + 0.25*1000.0*new_tile_time/num_new_tiles;} // used to limit tiles inserted per frame
 	for (vector<tile_t *>::iterator i = to_update.begin(); i != to_update.end(); ++i) { // after everything has been setup
 		(*i)->setup_shadow_maps(smap_manager);
 	}
@@ -2498,7 +3191,8 @@ void tile_draw_t::draw(bool reflection_pass) {
 		unsigned const dtree_mem(tree_data_manager.get_gpu_mem()), ptree_mem(get_tree_inst_gpu_mem()), grass_mem(grass_tile_manager.get_gpu_mem());
 		cout << "tiles drawn: " << to_draw.size() << " of " << tiles.size()
 			 << ", trees drawn: " << num_trees << ", gpu mem: " << in_mb(mem + tree_mem + dtree_mem + ptree_mem + grass_mem)
-			 << ", tree mem: " << in_mb(tree_mem) << ", decid tree mem: " << in_mb(dtree_mem) << ", grass mem: " << in_mb(grass_mem) << endl;
+			 << ", tree mem: " << in_mb(tree_mem) << ", decid tree mem: " << in_mb(dtree_mem) << ", decid archetype cpu mem: " << in_mb(tree_data_manager.get_cpu_mem())
+			 << ", grass mem: " << in_mb(grass_mem) << endl;
 	}
 	if (pine_trees_enabled ()) {draw_pine_trees (reflection_pass);}
 	if (decid_trees_enabled()) {draw_decid_trees(reflection_pass);}
@@ -2849,6 +3543,7 @@ void tile_draw_t::draw_decid_trees(bool reflection_pass, bool shadow_pass) {
 		if (enable_billboards) {lod_renderer.branch_opacity_loc = bs.get_uniform_loc("opacity");}
 		draw_decid_tree_bl(bs, lod_renderer, 1, 0, reflection_pass, shadow_pass, enable_shadow_maps);
 		bs.add_uniform_vector3d("world_space_offset", zero_vector); // reset
+		bs.add_uniform_vector3d("instance_rot_scale", vector3d(1.0, 0.0, 1.0)); // reset
 		bs.end_shader();
 	}
 	lod_renderer.finalize();
@@ -3069,8 +3764,7 @@ void tile_draw_t::clear_flowers() {
 
 
 tile_t *tile_draw_t::get_tile_from_xy(tile_xy_pair const &tp) const {
-	tile_map::const_iterator it(tiles.find(tp));
-	return ((it != tiles.end()) ? it->second.get() : nullptr);
+	return tiles.get(tp);
 }
 tile_t *tile_draw_t::get_tile_containing_point(point const &pos) const {
 	return get_tile_from_xy(tile_xy_pair(round_fp(0.5*(pos.x - (xoff - xoff2)*DX_VAL)/X_SCENE_SIZE), round_fp(0.5*(pos.y - (yoff - yoff2)*DY_VAL)/Y_SCENE_SIZE)));
@@ -3108,24 +3802,41 @@ int tile_draw_t::get_tid_under_point(point const &pos) const {
 
 bool tile_draw_t::line_intersect_mesh(point const &v1, point const &v2, float &t, tile_t *&intersected_tile, int &xpos, int &ypos) const {
 
-	t = 2.0; // > 1.0
+	t = 1.0; // max value to consider
 	intersected_tile = nullptr;
+	if (tiles.empty()) return 0;
+	// walk the tiles along the line in xy using DDA; tile {x,y} spans [x, x+1] in units of tiles, offset by half a tile
+	float const tile_sz[2] = {2.0f*X_SCENE_SIZE, 2.0f*Y_SCENE_SIZE}, off[2] = {(xoff - xoff2)*DX_VAL, (yoff - yoff2)*DY_VAL};
+	int cur[2], step[2], num_steps(1);
+	float tnext[2], tdelta[2];
 
-	// Note: could start with get_tile_containing_point(v1) and walk the line to v2 using DDA, etc.
-	for (tile_map::const_iterator i = tiles.begin(); i != tiles.end(); ++i) {
-		float tn(1.0);
-		int new_xpos(0), new_ypos(0);
-
-		// Note: could make this faster by passing tmin, tmax into line_intersect_mesh() here and using for early termination,
-		// but this code is plenty fast enough to do a single query each frame as it is
-		if (i->second->line_intersect_mesh(v1, v2, tn, new_xpos, new_ypos) && tn < t) {
-			t = tn; xpos = new_xpos; ypos = new_ypos;
-			intersected_tile = i->second.get(); // constness?
+	for (unsigned d = 0; d < 2; ++d) {
+		float const p1((v1[d] - off[d])/tile_sz[d] + 0.5), p2((v2[d] - off[d])/tile_sz[d] + 0.5), delta(p2 - p1);
+		cur [d] = (int)floor(p1);
+		step[d] = ((delta < 0.0) ? -1 : 1);
+		num_steps += abs((int)floor(p2) - cur[d]);
+		if (delta == 0.0) {tnext[d] = tdelta[d] = FAR_DISTANCE; continue;}
+		tdelta[d] = fabs(1.0/delta);
+		tnext [d] = ((delta > 0.0) ? (cur[d] + 1 - p1) : (p1 - cur[d]))*tdelta[d];
+	}
+	if ((unsigned)num_steps > 4*tiles.size()) { // line is much longer than the area covered by tiles; test each tile instead
+		for (tile_map::const_iterator i = tiles.begin(); i != tiles.end(); ++i) {
+			if (i->second->line_intersect_mesh(v1, v2, t, xpos, ypos)) {intersected_tile = i->second.get();} // t is decreased on each hit
 		}
+		return (intersected_tile != nullptr);
 	}
-	if (intersected_tile != nullptr) {
-		assert(t >= 0 && t <= 1.0); // okay even with fp error?
-		return 1;
+	for (int n = 0; n < num_steps; ++n) {
+		tile_map::const_iterator const it(tiles.find(tile_xy_pair(cur[0], cur[1])));
+
+		if (it != tiles.end() && it->second->line_intersect_mesh(v1, v2, t, xpos, ypos)) { // tiles are visited in order, so the first hit is the closest
+			assert(t >= 0 && t <= 1.0);
+			intersected_tile = it->second.get(); // constness?
+			return 1;
+		}
+		unsigned const d((tnext[0] < tnext[1]) ? 0 : 1);
+		if (tnext[d] > 1.0) break; // reached the end of the line
+		cur  [d] += step[d];
+		tnext[d] += tdelta[d];
 	}
 	return 0;
 }
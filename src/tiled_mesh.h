@@ -15,6 +15,7 @@
 #include "tree_3dw.h"
 #include "shadow_map.h"
 #include "animals.h"
+#include <atomic>
 
 
 bool const ENABLE_TREE_LOD    = 1; // faster but has popping artifacts
@@ -67,6 +68,24 @@ public:
 };
 
 
+struct tile_height_pyramid_t { // min/max mesh heights over square blocks of quads for hierarchical line queries; level 0 is the finest
+	static unsigned const BLOCK_SZ = 4; // quads per side of a level 0 block
+
+	struct level_t {
+		unsigned nx; // blocks per side
+		vector<pair<float, float> > zr; // {zmin, zmax}
+		level_t(unsigned nx_=0) : nx(nx_), zr(nx*nx) {}
+	};
+	vector<level_t> levels; // the last level is a single block covering the entire tile
+
+	void build(vector<float> const &zvals, unsigned zvsize, unsigned size);
+	void clear() {levels.clear();}
+	bool empty() const {return levels.empty();}
+};
+
+struct mesh_line_query_t;
+
+
 class tile_t;
 
 struct tile_smap_data_t : public smap_data_t {
@@ -101,6 +120,7 @@ struct tile_xy_pair {
 	int x, y;
 	tile_xy_pair(int x_=0, int y_=0) : x(x_), y(y_) {}
 	bool operator<(tile_xy_pair const &t) const {return ((y == t.y) ? (x < t.x) : (y < t.y));}
+	bool operator==(tile_xy_pair const &t) const {return (x == t.x && y == t.y);}
 	void operator+=(tile_xy_pair const &tp) {x += tp.x; y += tp.y;}
 	void operator-=(tile_xy_pair const &tp) {x -= tp.x; y -= tp.y;}
 	tile_xy_pair operator+(tile_xy_pair const &tp) const {return tile_xy_pair(x+tp.x, y+tp.y);}
@@ -163,10 +183,10 @@ public:
 private:
 	int x1, y1, x2, y2, wx1, wy1, wx2, wy2, last_occluded_frame;
 	unsigned weight_tid, height_tid, normal_tid, shadow_tid;
-	unsigned size, stride, zvsize, base_tsize, gen_tsize;
+	unsigned size, stride, zvsize, base_tsize, gen_tsize, cache_key, horizon_adj_mask;
 	float radius, mzmin, mzmax, ptzmax, dtzmax, trmax, xstart, ystart, min_normal_z, deltax, deltay;
 	bool shadows_invalid, recalc_tree_grass_weights, mesh_height_invalid, in_queue, last_occluded, has_any_grass;
-	bool is_distant, no_trees, just_cleared, has_disabled_area;
+	bool is_distant, no_trees, just_cleared, has_disabled_area, mesh_weights_valid, cache_valid;
 	colorRGB avg_mesh_tex_color;
 	tile_offset_t mesh_off, ptree_off, dtree_off, scenery_off;
 	float sub_zmin[4][4], sub_zmax[4][4];
@@ -174,6 +194,7 @@ private:
 	vector<tree_map_val> tree_map;
 	vector<unsigned char> mesh_weight_data, weight_data, ao_lighting;
 	vector<unsigned char> smask[NUM_LIGHT_SRC];
+	vector<unsigned char> horizon; // max terrain elevation angle for each azimuth direction, one plane of zvals per direction
 	vector<float> sh_out[NUM_LIGHT_SRC][2];
 	vect_smap_t<tile_smap_data_t> smap_data;
 	small_tree_group pine_trees;
@@ -183,6 +204,8 @@ private:
 	tile_cloud_manager_t clouds;
 	vect_fish_t fish;
 	vect_bird_t birds;
+	vector<pair<tile_xy_pair, fish_t>> fish_to_move; // {dest tile offset, animal}, filled by update_animals() and applied by move_animals_to_neighbor_tiles()
+	vector<pair<tile_xy_pair, bird_t>> birds_to_move;
 
 	struct grass_block_t {
 		unsigned ix; // 0 is unused
@@ -191,6 +214,7 @@ private:
 	};
 
 	vector<grass_block_t> grass_blocks;
+	tile_height_pyramid_t hpyramid;
 
 	struct terrain_params_t { // settings for different biomes
 		float hoff, hscale, veg, grass, dirt;
@@ -220,12 +244,16 @@ public:
 	bool pine_trees_generated() const {return pine_trees.generated;}
 	bool has_pine_trees() const {return (pine_trees_generated() && !pine_trees.empty());}
 	bool has_valid_shadow_map() const {return !smap_data.empty();}
+	bool textures_uploaded() const {return (weight_tid != 0);}
+	bool has_ao_lighting() const {return !ao_lighting.empty();}
+	bool has_mesh_weights() const {return mesh_weights_valid;}
+	void set_cache_key(unsigned key) {cache_key = key;}
 	void invalidate_mesh_height() {mesh_height_invalid = 1;}
 	float get_avg_veg() const {return 0.25*(params[0][0].veg + params[0][1].veg + params[1][0].veg + params[1][1].veg);}
 	void set_last_occluded(bool val) {last_occluded = val; last_occluded_frame = frame_counter;}
 	bool was_last_occluded  () const {return (last_occluded_frame == frame_counter &&  last_occluded);}
 	bool was_last_unoccluded() const {return (last_occluded_frame == frame_counter && !last_occluded);}
-	vect_bird_t &get_birds() {return birds;} // for flocking
+	vect_bird_t const &get_birds() const {return birds;} // for flocking
 
 	// all of these are in the current camera's local coordinate space (based on xoff/yoff/xoff2/yoff2)
 	point get_center() const {
@@ -272,6 +300,7 @@ public:
 		return (pine_trees.capacity()*sizeof(small_tree) + decid_trees.capacity()*sizeof(tree) + pine_trees.palm_vbo_mem);
 	}
 	void clear();
+	void recycle_buffers_from(tile_t &tile);
 	void clear_flowers() {flowers.clear();}
 	void clear_shadows();
 	void clear_shadow_map(tile_shadow_map_manager *smap_manager);
@@ -279,6 +308,7 @@ public:
 	void clear_pine_tree_vbos() {pine_trees.clear_vbos();}
 	void invalidate_shadows() {shadows_invalid = 1;}
 	bool create_zvals(mesh_xy_grid_cache_t &height_gen, bool no_wait);
+	void calc_zval_bounds();
 	float get_zval_at(float x, float y, bool in_global_space) const;
 
 	vector3d get_norm_not_normalized(unsigned ix) const {
@@ -292,6 +322,11 @@ public:
 	void calc_shadows_for_light(unsigned l);
 	static void proc_tile_queue(tile_t *init_tile, unsigned l);
 	void calc_shadows(bool calc_sun, bool calc_moon, bool no_push=0);
+	static unsigned get_adj_bit(int dx, int dy) {return (3*(dy+1) + (dx+1));}
+	void calc_horizon_map();
+	bool calc_horizon_shadows(unsigned l);
+	void update_horizon_shadows();
+	void adj_tile_changed(int dx, int dy, bool added);
 
 	tile_xy_pair get_tile_xy_pair(int dx=0, int dy=0) const {
 		return tile_xy_pair((x1/(int)size)+dx, (y1/(int)size)+dy);
@@ -319,6 +354,10 @@ public:
 	// *** mesh creation ***
 	void ensure_height_tid();
 	unsigned get_grass_block_dim() const {return (1+(size-1)/GRASS_BLOCK_SZ);} // ceil
+	void calc_mesh_weights(mesh_xy_grid_cache_t &height_gen);
+	string get_cache_filename() const;
+	bool read_from_cache();
+	void write_to_cache();
 	void create_texture(mesh_xy_grid_cache_t &height_gen);
 	void add_grass_block_at(unsigned x, unsigned y, float mhmin, float mhmax, unsigned grass_block_dim);
 	void create_or_update_weight_tex();
@@ -379,9 +418,13 @@ public:
 	// *** animals ***
 	void add_animal(fish_t const &f) {fish.push_back (f);}
 	void add_animal(bird_t const &b) {birds.push_back(b);}
-	template<typename A> void propagate_animals_to_neighbor_tiles(animal_group_t<A> &animals);
-	void update_animals();
+	template<typename A> void collect_animals_leaving_tile(animal_group_t<A> &animals, vector<pair<tile_xy_pair, A>> &to_move);
+	template<typename A> void move_animals_to_neighbor_tiles(vector<pair<tile_xy_pair, A>> &to_move);
+	void build_flock_grid() {birds.build_flock_grid(this);}
+	void update_animals(unsigned num_birds, bool gen_birds); // thread safe with respect to other tiles, once all flock grids are built; num_birds is used for initial generation
+	void move_animals_to_neighbor_tiles(); // must be called serially
 	void clear_animals() {fish.clear(); birds.clear();}
+	unsigned get_num_birds() const {return birds.size();}
 	void draw_birds(shader_t &s, bool reflection_pass) const {birds.draw_animals(s);}
 	void draw_fish (shader_t &s, bool reflection_pass) const {if (!reflection_pass) {fish.draw_animals(s);}}
 
@@ -400,12 +443,58 @@ public:
 	bool check_sphere_collision(point &pos, float sradius) const;
 	int get_tid_under_point(point const &pos) const;
 	bool line_intersect_mesh(point const &v1, point const &v2, float &t, int &xpos, int &ypos) const;
+	bool line_intersect_node(mesh_line_query_t &q, unsigned level, unsigned bx, unsigned by) const;
+	bool line_intersect_quad(mesh_line_query_t &q, unsigned qx, unsigned qy) const;
 }; // tile_t
 
 
+// tiles stored in a dense vector for iteration, indexed by a toroidal grid of tile {x,y} for O(1) lookup;
+// tiles near the camera never share a grid cell as long as the grid is larger than the tile window, but collisions are chained for correctness
+class tile_grid_t {
+public:
+	typedef pair<tile_xy_pair, std::unique_ptr<tile_t> > value_type;
+	typedef vector<value_type>::iterator iterator;
+	typedef vector<value_type>::const_iterator const_iterator;
+
+private:
+	static unsigned const NO_ENTRY = (unsigned)-1;
+	vector<value_type> entries; // unordered
+	vector<unsigned> next; // next entry in the same grid cell, parallel to entries
+	vector<unsigned> grid; // first entry in each cell
+	unsigned grid_bits; // grid is (1 << grid_bits) on each side
+
+	unsigned get_cell(tile_xy_pair const &tp) const {
+		unsigned const mask((1U << grid_bits) - 1);
+		return (((unsigned(tp.y) & mask) << grid_bits) + (unsigned(tp.x) & mask));
+	}
+	void link(unsigned ix) {unsigned &head(grid[get_cell(entries[ix].first)]); next[ix] = head; head = ix;}
+	void unlink(unsigned ix);
+	void rebuild(unsigned new_grid_bits);
+	unsigned find_ix(tile_xy_pair const &tp) const {
+		if (grid.empty()) return NO_ENTRY;
+		for (unsigned ix = grid[get_cell(tp)]; ix != NO_ENTRY; ix = next[ix]) {if (entries[ix].first == tp) return ix;}
+		return NO_ENTRY;
+	}
+public:
+	tile_grid_t() : grid_bits(0) {}
+	iterator       begin()       {return entries.begin();}
+	iterator       end  ()       {return entries.end  ();}
+	const_iterator begin() const {return entries.begin();}
+	const_iterator end  () const {return entries.end  ();}
+	size_t size () const {return entries.size ();}
+	bool   empty() const {return entries.empty();}
+	void clear() {entries.clear(); next.clear(); grid.clear(); grid_bits = 0;}
+	iterator       find(tile_xy_pair const &tp)       {unsigned const ix(find_ix(tp)); return ((ix == NO_ENTRY) ? end() : (begin() + ix));}
+	const_iterator find(tile_xy_pair const &tp) const {unsigned const ix(find_ix(tp)); return ((ix == NO_ENTRY) ? end() : (begin() + ix));}
+	tile_t *get(tile_xy_pair const &tp) const {unsigned const ix(find_ix(tp)); return ((ix == NO_ENTRY) ? nullptr : entries[ix].second.get());}
+	bool insert(tile_xy_pair const &tp, tile_t *tile); // takes ownership of tile; returns false if tp is already present
+	iterator erase(iterator i); // the last entry is moved into the erased position, which is returned
+}; // tile_grid_t
+
+
 class tile_draw_t : public indexed_vbo_manager_t {
 
-	typedef map<tile_xy_pair, std::unique_ptr<tile_t> > tile_map;
+	typedef tile_grid_t tile_map;
 	typedef set<tile_xy_pair> tile_set_t;
 	typedef vector<pair<float, tile_t *> > draw_vect_t;
 
@@ -413,6 +502,8 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	bool buildings_valid;
 	unsigned ivbo_ixs[NUM_LODS+1];
 	unsigned tiles_gen_prev_frame;
+	unsigned bench_num_tiles, bench_stable_frames; // for BIRD_BENCHMARK_NUM
+	bool bench_birds_placed;
 	float terrain_zmin;
 	draw_vect_t to_draw;
 	vector<tile_t *> occluded_tiles;
@@ -420,6 +511,24 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	vector<pair<float, tile_t *>> to_gen_zvals;
 	cloud_draw_list_t to_draw_clouds;
 	vector<mesh_xy_grid_cache_t> height_gens;
+	vector<mesh_xy_grid_cache_t> cpu_height_gens; // one per OpenMP thread for parallel CPU tile generation
+
+	struct tile_gen_job_t { // heights, AO, and texture weights of one new tile, generated on a worker thread
+		std::unique_ptr<tile_t> tile; // owned by the job until it's inserted into tiles
+		point center; // in camera offset independent space, so that the main thread doesn't need to read the tile while it's being generated
+		float radius, priority;
+		bool calc_weights;
+		std::atomic<bool> done, cancel;
+
+		tile_gen_job_t(tile_t *tile_, point const &center_, float radius_, float priority_, bool calc_weights_) :
+			tile(tile_), center(center_), radius(radius_), priority(priority_), calc_weights(calc_weights_), done(0), cancel(0) {}
+	};
+	typedef std::shared_ptr<tile_gen_job_t> p_tile_gen_job;
+	map<tile_xy_pair, p_tile_gen_job> tile_jobs; // pending and completed jobs; main thread only
+	vector<std::unique_ptr<tile_t> > tile_pool; // deleted tiles whose vector memory is reused by new tiles
+	point last_camera_global;
+	vector3d camera_vel; // smoothed per-frame camera motion in global space
+	float new_tile_upload_ms; // smoothed main thread pre_draw() time per newly inserted tile
 	lightning_strike_t lightning_strike;
 	tree_lod_render_t lod_renderer;
 	crack_ibuf_t crack_ibuf;
@@ -432,6 +541,13 @@ class tile_draw_t : public indexed_vbo_manager_t {
 	vector<tile_t *> occluders; // reused across draw calls
 	vector<cube_t> test_cubes; // reused across draw calls
 	void insert_tile(tile_t *tile);
+	void update_adj_tile_horizons(tile_xy_pair const &tp, bool added);
+	tile_t *alloc_tile(tile_t const &tile);
+	void free_tile(tile_t *tile);
+	float get_gen_priority(tile_t const &tile) const;
+	void add_tile_gen_job(tile_t *tile, float priority);
+	void insert_completed_tiles(bool wait);
+	void cancel_tile_gen_jobs();
 
 public:
 	tile_draw_t();
@@ -440,6 +556,7 @@ public:
 	void free_compute_shader();
 	float update(float &min_camera_dist);
 private:
+	void update_animals();
 	static void setup_terrain_textures(shader_t &s, unsigned start_tu_id);
 	static void add_texture_colors(shader_t &s, unsigned start_tu_id);
 	static void shared_shader_lighting_setup(shader_t &s, unsigned lighting_shader);
@@ -18,6 +18,8 @@ struct tree_type;
 class tree_data_t;
 class cobj_bvh_tree;
 class tree;
+struct binary_file_reader;
+struct binary_file_writer;
 
 // small tree classes
 enum {TREE_CLASS_NONE=0, TREE_CLASS_PINE, TREE_CLASS_DECID, TREE_CLASS_PALM, TREE_CLASS_DETAILED, NUM_TREE_CLASSES};
@@ -28,10 +30,11 @@ class tree_lod_render_t {
 	struct entry_t {
 		tree_data_t const *td;
 		point pos;
+		float scale;
 		color_wrapper cw;
 
-		entry_t() : td(NULL) {}
-		entry_t(tree_data_t const *td_, point const &pos_, colorRGBA const &color) : td(td_), pos(pos_) {assert(td); cw.set_c4(color);}
+		entry_t() : td(NULL), scale(1.0) {}
+		entry_t(tree_data_t const *td_, point const &pos_, colorRGBA const &color, float scale_) : td(td_), pos(pos_), scale(scale_) {assert(td); cw.set_c4(color);}
 		bool operator<(entry_t const &e) const {return (td < e.td);} // compare tree data pointer values
 	};
 
@@ -50,11 +53,11 @@ public:
 	void clear()       {leaf_vect.clear(); branch_vect.clear();}
 	void resize_zero() {leaf_vect.resize(0); branch_vect.resize(0);}
 
-	void add_leaves(tree_data_t const *td, point const &pos, float opacity) {
-		leaf_vect.emplace_back(td, pos, colorRGBA(1, 1, 1, opacity));
+	void add_leaves(tree_data_t const *td, point const &pos, float opacity, float scale=1.0) {
+		leaf_vect.emplace_back(td, pos, colorRGBA(1, 1, 1, opacity), scale);
 	}
-	void add_branches(tree_data_t const *td, point const &pos, float opacity, colorRGBA const &bcolor) {
-		branch_vect.emplace_back(td, pos, colorRGBA(bcolor, opacity));
+	void add_branches(tree_data_t const *td, point const &pos, float opacity, colorRGBA const &bcolor, float scale=1.0) {
+		branch_vect.emplace_back(td, pos, colorRGBA(bcolor, opacity), scale);
 	}
 	void finalize();
 	void render_billboards(shader_t &s, bool render_branches) const;
@@ -131,11 +134,18 @@ struct tree_xform_t {
 };
 
 
+struct tree_builder_arena_t { // scratch memory for tree_builder_t, reused across trees
+	vector<tree_cylin >   cylin_cache;
+	vector<tree_branch>   branch_cache;
+	vector<tree_branch *> branch_ptr_cache;
+};
+
+
 class tree_builder_t : public tree_xform_t {
 
-	static vector<tree_cylin >   cylin_cache;
-	static vector<tree_branch>   branch_cache;
-	static vector<tree_branch *> branch_ptr_cache;
+	vector<tree_cylin >   &cylin_cache; // these reference the arena of the calling thread, so that trees can be built in parallel
+	vector<tree_branch>   &branch_cache;
+	vector<tree_branch *> &branch_ptr_cache;
 
 	tree_branch base, roots, *branches_34[2], **branches;
 	int base_num_cylins, root_num_cylins, ncib, num_1_branches, num_big_branches_min, num_big_branches_max;
@@ -161,9 +171,12 @@ class tree_builder_t : public tree_xform_t {
 	void generate_4th_order_branch(tree_branch &src_branch, int j, float rotate_start, float temp_deg, int branch_num);
 	int generate_next_cylin(int cylin_num, int ncib, bool branch_just_created, bool &branch_deflected);
 	void add_leaves_to_cylin(unsigned cylin_ix, int tree_type, float rel_leaf_size, float deadness, vector<tree_leaf> &leaves);
+	static tree_builder_arena_t &get_thread_arena();
 
 public:
-	tree_builder_t(cube_t const *clip_cube_, rand_gen_t &rgen_) : branches(NULL), clip_cube(clip_cube_), rgen(rgen_) {branches_34[0] = branches_34[1] = NULL;}
+	tree_builder_t(cube_t const *clip_cube_, rand_gen_t &rgen_, tree_builder_arena_t &arena=get_thread_arena()) :
+		cylin_cache(arena.cylin_cache), branch_cache(arena.branch_cache), branch_ptr_cache(arena.branch_ptr_cache), branches(NULL), clip_cube(clip_cube_), rgen(rgen_)
+	{branches_34[0] = branches_34[1] = NULL;}
 	float create_tree_branches(int tree_type, int size, float tree_depth, colorRGBA &base_color,
 		float height_scale, float br_scale, float nl_scale, float bbo_scale, bool has_4th_branches, bool create_bush);
 	void create_all_cylins_and_leaves(vector<draw_cylin> &all_cylins, vector<tree_leaf> &leaves,
@@ -248,6 +261,10 @@ public:
 	void clear_context();
 	void on_leaf_color_change();
 	unsigned get_leaf_data_mem() const {return leaf_data.size()*sizeof(leaf_vert_type_t);}
+	unsigned get_leaf_mem  () const {return (leaves.size()*sizeof(tree_leaf) + get_leaf_data_mem());} // CPU side
+	unsigned get_branch_mem() const {return all_cylins.size()*sizeof(draw_cylin);} // CPU side
+	bool read (binary_file_reader &reader);
+	bool write(binary_file_writer &writer) const;
 	unsigned get_gpu_mem() const;
 	int get_tree_type() const {return tree_type;}
 	point get_center() const {return point(0.0, 0.0, sphere_center_zoff);}
@@ -306,6 +323,7 @@ class tree {
 	bool no_delete, not_visible, leaf_orients_valid, enable_leaf_wind, use_clip_cube;
 	point tree_center;
 	float damage, damage_scale, last_size_scale, tree_nl_scale;
+	float inst_angle, inst_scale; // per-instance rotation about z (in degrees) and scale of shared tree data
 	colorRGBA tree_color;
 	vector<int> branch_cobjs, leaf_cobjs;
 	cube_t clip_cube;
@@ -330,26 +348,32 @@ class tree {
 
 public:
 	tree(bool en_lw=1) : tree_data(NULL), type(-1), created(0), leaf_burn_ix(0), no_delete(0), not_visible(0), leaf_orients_valid(0),
-		enable_leaf_wind(en_lw), use_clip_cube(0), damage(0.0), damage_scale(0.0), last_size_scale(0.0), tree_nl_scale(1.0) {}
+		enable_leaf_wind(en_lw), use_clip_cube(0), damage(0.0), damage_scale(0.0), last_size_scale(0.0), tree_nl_scale(1.0), inst_angle(0.0), inst_scale(1.0) {}
 	void enable_clip_cube(cube_t const &cc) {clip_cube = cc; use_clip_cube = 1;}
 	void bind_to_td(tree_data_t *td);
+	tree_data_t const *get_shared_tdata() const {return tree_data;} // NULL if private
 	void gen_tree(point const &pos, int size, int ttype, int calc_z, bool add_cobjs, bool user_placed, rand_gen_t &rgen,
 		float height_scale=1.0, float br_scale_mult=1.0, float nl_scale=1.0, bool has_4th_branches=0, bool allow_bushes=1);
 	void add_tree_collision_objects();
 	void remove_collision_objects();
+	unsigned get_gen_hash() const;
 	bool check_sphere_coll(point &center, float radius) const;
 	float calc_size_scale(point const &draw_pos) const;
 	void update_leaf_orients_wind();
-	void draw_branches_top(shader_t &s, tree_lod_render_t &lod_renderer, bool shadow_only, bool reflection_pass, vector3d const &xlate, int wsoff_loc);
+	bool has_inst_xform() const {return (inst_angle != 0.0 || inst_scale != 1.0);}
+	cube_t get_inst_bcube(cube_t const &c) const;
+	void apply_inst_xform() const;
+	void set_inst_xform_uniform(int inst_loc) const;
+	void draw_branches_top(shader_t &s, tree_lod_render_t &lod_renderer, bool shadow_only, bool reflection_pass, vector3d const &xlate, int wsoff_loc, int inst_loc);
 	void draw_leaves_top(shader_t &s, tree_lod_render_t &lod_renderer, bool shadow_only, bool reflection_pass, vector3d const &xlate,
-		int wsoff_loc, int tex0_loc, vector<tree *> &to_update_leaves);
+		int wsoff_loc, int inst_loc, int tex0_loc, vector<tree *> &to_update_leaves);
 	void shift_tree(vector3d const &vd);
 	void add_bounds_to_bcube(cube_t &bcube) const;
 	void clear_context();
 	int delete_tree();
 	int get_type()            const {return type;}
-	float get_radius()        const {return tdata().sphere_radius;}
-	point sphere_center()     const {return (tree_center + tdata().get_center());}
+	float get_radius()        const {return inst_scale*tdata().sphere_radius;}
+	point sphere_center()     const {return (tree_center + inst_scale*tdata().get_center());}
 	point const &get_center() const {return tree_center;}
 	unsigned get_gpu_mem()    const {return (td_is_private() ? tdata().get_gpu_mem() : 0);}
 	bool get_no_delete()      const {return no_delete;}
@@ -369,17 +393,26 @@ public:
 };
 
 
-class tree_data_manager_t : public vector<tree_data_t> {
+class tree_data_manager_t : public vector<tree_data_t> { // fixed pool of tree archetypes shared by all trees, with per-instance variation
 
 	float last_tree_scale;
 	int last_rgi;
 
+	unsigned get_params_hash() const;
+	std::string get_cache_filename() const;
+	void gen_archetype(unsigned ix);
+	void gen_archetypes();
+	bool read_archetypes (std::string const &fn);
+	void write_archetypes(std::string const &fn) const;
+
 public:
 	tree_data_manager_t() : last_tree_scale(1.0), last_rgi(0) {}
+	unsigned get_num_per_type() const;
 	void ensure_init();
 	void clear_context();
 	void on_leaf_color_change();
 	unsigned get_gpu_mem() const;
+	unsigned get_cpu_mem() const;
 };
 
 
@@ -391,6 +424,15 @@ class tree_cont_t : public vector<tree> {
 	cube_t all_bcube;
 	bool generated;
 
+	struct pending_tree_t { // placed but not yet generated tree, with the rgen state it's generated from
+		unsigned ix;
+		int ttype;
+		point pos;
+		rand_gen_t rgen;
+		pending_tree_t(unsigned ix_, int ttype_, point const &pos_, rand_gen_t const &rgen_) : ix(ix_), ttype(ttype_), pos(pos_), rgen(rgen_) {}
+	};
+	void gen_pending_trees(vector<pending_tree_t> &to_gen);
+
 public:
 	tree_cont_t(tree_data_manager_t &tds) : shared_tree_data(tds), generated(0) {all_bcube.set_to_zeros();}
 	bool was_generated() const {return generated;}
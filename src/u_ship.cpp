@@ -2630,7 +2630,6 @@ void u_ship::detonate_weapons() {
 void u_ship::fragment(vector3d const &edir, float num, bool outside_cr) const { // send off ship parts
 
 	if (!GEN_FRAGMENTS || (flags & OBJ_FLAGS_DIST)) return;
-	static free_obj_allocator<uparticle> allocator;
 	unsigned const etype(specs().exp_type);
 	float const nscale((etype == ETYPE_NONE) ? 1.5 : 1.0), pscale(0.25*radius), psize(min(pscale, MAX_PARTICLE_SIZE*nscale));
 	float const mvscale(max(0.5f, (2.0f*pscale/MAX_PARTICLE_SIZE)));
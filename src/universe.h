@@ -9,8 +9,10 @@
 #include "upsurface.h"
 #include "draw_utils.h"
 #include "gl_ext_arb.h"
+#include "cobj_bsp_tree.h"
 #include <map>
 #include <sstream>
+#include <atomic>
 
 using std::string;
 using std::ostringstream;
@@ -201,11 +203,32 @@ struct rotated_obj { // size = 48
 };
 
 
-class urev_body : public uobj_solid, public color_gen_class, public rotated_obj { // size = 360
+struct surface_color_gen_t : public color_gen_class { // snapshot of a body's surface color params, safe to use from a worker thread
 
-	// for textures/colors
 	unsigned char a[3], b[3];
-	
+	float temp, water, lava, atmos, snow_thresh, wr_scale;
+
+	void get_surface_color(unsigned char *data, float val, float phi) const;
+};
+
+
+struct planet_tex_gen_job_t { // rocky planet/moon texture + heightmap generated on a worker thread
+
+	unsigned size;
+	surface_color_gen_t cgen; // color params the texture was generated with
+	vector<unsigned char> data; // RGB
+	vector<float> heightmap;
+	std::atomic<bool> done, cancel;
+
+	planet_tex_gen_job_t(unsigned size_, surface_color_gen_t const &cgen_) : size(size_), cgen(cgen_), done(0), cancel(0) {}
+	bool is_valid() const {return (done && !cancel);}
+};
+
+typedef std::shared_ptr<planet_tex_gen_job_t> p_tex_gen_job;
+
+
+class urev_body : public uobj_solid, public rotated_obj { // size = 360
+
 protected:
 	void calc_snow_thresh();
 
@@ -216,6 +239,7 @@ public:
 	float orbit, rot_rate, rev_rate, atmos, water, lava, resources, cloud_density, cloud_scale, wr_scale, snow_thresh, population, prev_pop;
 	vector3d rev_axis, v_orbit, orbit_scale;
 	std::shared_ptr<upsurface> surface;
+	p_tex_gen_job tex_job; // pending or completed full resolution texture
 	string comment;
 
 	urev_body(char type_) : uobj_solid(type_), gas_giant(0), owner(NO_OWNER), orbiting_refs(0), tid(0), tsize(0), orbit(0.0), rot_rate(0.0), rev_rate(0.0), atmos(0.0),
@@ -227,8 +251,11 @@ public:
 	void gen_surface();
 	void check_gen_texture(unsigned size);
 	void create_rocky_texture(unsigned size);
+	void upload_rocky_texture(vector<unsigned char> const &data, vector<float> const &heightmap, unsigned size);
+	bool check_tex_job_complete();
+	void cancel_tex_job();
 	void create_gas_giant_texture();
-	void gen_texture_data_and_heightmap(unsigned char *data, unsigned size);
+	surface_color_gen_t get_surface_color_gen() const;
 	bool has_heightmap() const {return (surface != nullptr && surface->has_heightmap() && !use_procedural_shader());}
 	bool surface_test(float rad, point const &p, float &coll_r, bool simple) const;
 	float get_radius_at(point const &p, bool exact=0) const;
@@ -253,7 +280,6 @@ public:
 	bool use_procedural_shader() const;
 	bool use_vert_shader_offset() const;
 	void upload_colors_to_shader(shader_t &s) const;
-	void get_surface_color(unsigned char *data, float val, float phi) const;
 	bool draw(point_d pos_, ushader_group &usg, pt_line_drawer planet_plds[2], shadow_vars_t const &svars, bool use_light2, bool enable_text_tag);
 	void draw_surface(point_d const &pos_, float size, int ndiv);
 	void show_colonizable_liveable(point const &pos_, float radius0, ushader_group &usg) const;
@@ -416,8 +442,11 @@ class ugalaxy : public uobj_rgen, public named_obj, public ellipsoid_t { // size
 	mutable float lrq_rad;
 	mutable point lrq_pos;
 
+	cobj_tree_sphere_t system_bvh; // system centers; systems don't move, so this is only built when the galaxy is generated
+
 	void apply_scale_transform(point &pos_) const;
 	point gen_valid_system_pos() const;
+	void build_system_bvh();
 
 public:
 	struct system_cluster {
@@ -448,6 +477,8 @@ public:
 	bool gen_system_loc(vector<point> const &placed);
 	void clear_systems();
 	void free_uobj();
+	void get_systems_near_pt(point const &pos, float expand, float r_add, vector<unsigned> &ids) const;
+	void get_systems_near_line(point const &start, vector3d const &dir, float dist, float line_radius, vector<unsigned> &ids) const;
 	string get_name() const {return "Galaxy " + getname();}
 };
 
@@ -556,6 +587,7 @@ struct coll_test { // size = 16
 
 struct line_query_state {
 	vector<coll_test> gv, sv, pv, av;
+	vector<unsigned> sys_ids;
 };
 
 
@@ -127,19 +127,25 @@ void upsurface::gen(float mag, float freq, unsigned ntests, float mm_scale) {
 }
 
 
-void upsurface::setup(unsigned size, float mcut, bool alloc_hmap) {
+unsigned noise_gen_3d::get_num_sines_for_size(unsigned size) {
 
-	ssize      = size;
-	min_cutoff = mcut;
-	if (alloc_hmap) heightmap.resize(ssize*ssize);
 	unsigned max_freq(MAX_FREQ_BINS - 4);
 
 	for (unsigned i = 8; i <= MAX_TEXTURE_SIZE; i <<= 1) {
-		if (ssize <= i) break;
+		if (size <= i) break;
 		++max_freq;
 	}
-	max_freq  = max(1u, min(MAX_FREQ_BINS, max_freq));
-	num_sines = max_freq*SINES_PER_FREQ;
+	max_freq = max(1u, min(MAX_FREQ_BINS, max_freq));
+	return max_freq*SINES_PER_FREQ;
+}
+
+
+void upsurface::setup(unsigned size, float mcut, bool alloc_hmap) {
+
+	ssize      = size;
+	min_cutoff = mcut;
+	if (alloc_hmap) heightmap.resize(ssize*ssize);
+	num_sines  = get_num_sines_for_size(ssize);
 }
 
 
@@ -193,29 +199,28 @@ void urev_body::gen_surface() {
 // Note: many planet/sphere renderers use a texture with width = 2*height, which yields square regions at the equator
 // here we use a square texture for simplicity, so that this code can be shared with (and be similar to)
 // the rest of the 3DWorld sphere generation and drawing code; it also produces more uniform regions near the poles
-void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned size) {
-
+// Note: only reads the sine params and writes to data and hmap, so it can be called on a copy from a worker thread;
+// if cancel is set during generation, remaining rows are skipped and the output is incomplete
+void noise_gen_3d::gen_texture_data_and_heightmap(color_gen_class const &cgen, unsigned char *data, float *hmap, unsigned size, float max_mag,
+	std::atomic<bool> const *cancel) const
+{
 	//RESET_TIME;
-	get_colors(a, b);
 	unsigned size_p2(0);
 	for (unsigned sz = size; sz > 1; sz >>= 1, ++size_p2);
 	assert((1U<<size_p2) == size); // size must be a power of 2
-	assert(surface != nullptr);
+	assert(size <= MAX_TEXTURE_SIZE);
 	unsigned const table_size(MAX_TEXTURE_SIZE << 1); // larger is more accurate
-	static float xtable[TOT_NUM_SINES*table_size], ytable[TOT_NUM_SINES*table_size];
-	surface->setup(size, max(water, lava), 1); // use_heightmap=1
-	unsigned const num_sines(surface->num_sines);
-	float const *const rdata(surface->rdata);
-	float const mt2(0.5*(table_size-1)), scale(1.5/surface->max_mag);
+	unsigned const nsines(get_num_sines_for_size(size));
+	vector<float> xtable(nsines*table_size), ytable(nsines*table_size); // per-call rather than static so that multiple textures can be generated concurrently
+	float const mt2(0.5*(table_size-1)), scale(1.5/max_mag);
 	float const delta(TWO_PI/size), sin_ds(sin(delta)), cos_ds(cos(delta));
 	unsigned const pole_thresh(size>>3);
-	wr_scale = 1.0/max(0.01, (1.0 - water));
 
 	for (unsigned i = 0; i < table_size; ++i) { // build sin table
-		unsigned const offset(i*num_sines);
+		unsigned const offset(i*nsines);
 		float const sarg(i/mt2 - 1.0);
 
-		for (unsigned k = 0; k < num_sines; ++k) { // create x and y tables
+		for (unsigned k = 0; k < nsines; ++k) { // create x and y tables
 			unsigned const index2(NUM_SINE_PARAMS*k);
 			xtable[offset+k] = SINF(rdata[index2+1]*sarg + rdata[index2+2]);
 			ytable[offset+k] = SINF(rdata[index2+3]*sarg + rdata[index2+4]);
@@ -224,36 +229,42 @@ void urev_body::gen_texture_data_and_heightmap(unsigned char *data, unsigned siz
 
 	#pragma omp parallel for schedule(dynamic,1)
 	for (int i = 0; i < (int)size; ++i) { // phi values
+		if (cancel && *cancel) continue; // can't break out of an omp loop
 		unsigned const hmoff(i*size), ti(size-i-1), texoff(ti*size);
 		float const phi((float(i)/(size-1))*PI);
 		float const sin_phi((i == int(size-1)) ? 0.0 : sinf(phi)), zval((i == int(size-1)) ? -1.0 : cosf(phi));
+		bool const near_pole(i <= (int)pole_thresh || i >= int(size-pole_thresh-1));
 		float sin_s(0.0), cos_s(1.0);
-		float ztable[TOT_NUM_SINES];
+		float ztable[TOT_NUM_SINES], xytable[TOT_NUM_SINES];
 
-		for (unsigned k = 0; k < num_sines; ++k) { // create z table
+		for (unsigned k = 0; k < nsines; ++k) { // create z table
 			unsigned const index2(NUM_SINE_PARAMS*k);
 			ztable[k] = rdata[index2]*SINF(rdata[index2+5]*zval + rdata[index2+6]);
 		}
 		for (unsigned j = 0; j < size; ++j) { // theta values, Note: x and y are swapped because theta is out of phase by 90 degrees to match tex coords
 			float const s(sin_s), c(cos_s), xval(sin_phi*s), yval(sin_phi*c);
 			unsigned const tj(size-j-1), index(3*(texoff + tj));
-			unsigned const ox1((unsigned((xval+1.0)*mt2))*num_sines), oy1((unsigned((yval+1.0)*mt2))*num_sines);
 			float val(0.0);
 
-			if (i <= (int)pole_thresh || i >= int(size-pole_thresh-1)) { // slower version near the poles
-				for (unsigned k = 0; k < num_sines; ++k) {
+			if (near_pole) { // slower version near the poles
+				// table lookups can't be vectorized, so fill a temp array and do the sum below as a separate SIMD loop
+				for (unsigned k = 0; k < nsines; ++k) {
 					unsigned const index2(NUM_SINE_PARAMS*k);
-					val += ztable[k]*SINF(rdata[index2+1]*xval + rdata[index2+2])*SINF(rdata[index2+3]*yval + rdata[index2+4]);
+					xytable[k] = SINF(rdata[index2+1]*xval + rdata[index2+2])*SINF(rdata[index2+3]*yval + rdata[index2+4]);
 				}
+				#pragma omp simd reduction(+:val)
+				for (unsigned k = 0; k < nsines; ++k) {val += ztable[k]*xytable[k];}
 			}
 			else {
 				// Note: chooses the closest precomputed grid point for efficiency -
 				// no interpolation, so has artifacts closer to the poles
-				for (unsigned k = 0; k < num_sines; ++k) {val += ztable[k]*xtable[ox1+k]*ytable[oy1+k];}
+				float const *const xt(&xtable[(unsigned((xval+1.0)*mt2))*nsines]), *const yt(&ytable[(unsigned((yval+1.0)*mt2))*nsines]);
+				#pragma omp simd reduction(+:val)
+				for (unsigned k = 0; k < nsines; ++k) {val += ztable[k]*xt[k]*yt[k];} // performance critical
 			}
 			val = 0.5*(max(-1.0f, min(1.0f, scale*val)) + 1.0);
-			surface->heightmap[hmoff + j] = val;
-			get_surface_color((data + index), val, phi);
+			hmap[hmoff + j] = val;
+			cgen.get_surface_color((data + index), val, phi);
 			sin_s = s*cos_ds + c*sin_ds;
 			cos_s = c*cos_ds - s*sin_ds;
 		} // for j
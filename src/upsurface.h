@@ -7,6 +7,7 @@
 
 #include "3DWorld.h"
 #include "subdiv.h"
+#include <atomic>
 
 
 unsigned const MAX_TEXTURE_SIZE  = 256; // must be a power of 2
@@ -51,6 +52,9 @@ public:
 	void gen_xyz_vals(point const &start, vector3d const &step, unsigned const xyz_num[3], vector<float> xyz_vals[3]);
 	float get_val(unsigned x, unsigned y, unsigned z, vector<float> const xyz_vals[3]) const;
 	float get_val(point const &pt) const;
+	static unsigned get_num_sines_for_size(unsigned size);
+	void gen_texture_data_and_heightmap(color_gen_class const &cgen, unsigned char *data, float *hmap, unsigned size, float max_mag,
+		std::atomic<bool> const *cancel=nullptr) const;
 };
 
 
@@ -23,7 +23,7 @@ waypoint_vector waypoints;
 
 extern bool use_waypoints;
 extern int DISABLE_WATER, camera_change, frame_counter, num_smileys, num_groups, display_mode;
-extern float temperature, zmin, water_plane_z, waypoint_sz_thresh, CAMERA_RADIUS;
+extern float temperature, zmin, tstep, water_plane_z, waypoint_sz_thresh, CAMERA_RADIUS;
 extern double tfticks;
 extern int coll_id[];
 extern obj_group obj_groups[];
@@ -514,7 +514,7 @@ public:
 		dwobject obj(def_objects[WAYPOINT]); // create a temporary object
 		obj.pos     = pos;
 		obj.coll_id = coll_id; // ignore collisions with the current object
-		bool const ret(!obj.check_vert_collision(0, 0, 0, NULL, all_zeros, 1, 0, -1, 1)); // return true if no collision (skip dynamic and movable objects)
+		bool const ret(!obj.check_vert_collision(0, 0, 0, tstep, NULL, all_zeros, 1, 0, -1, 1)); // return true if no collision (skip dynamic and movable objects)
 		pos = obj.pos;
 		return ret;
 	}
@@ -0,0 +1,79 @@
+// 3D World - Simple Worker Thread Pool for Background Jobs
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <omp.h>
+
+
+// a fixed set of worker threads pulling jobs from a FIFO queue; threads are started on the first add_job() call
+// and joined in the destructor; jobs must not touch OpenGL state - results are handed back to the main thread by the caller
+class worker_pool_t {
+
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_condv;
+	unsigned num_threads, num_running;
+	bool exiting;
+
+	void worker_loop() {
+		omp_set_num_threads(1); // OpenMP loops inside jobs run serially on this thread rather than each starting a full team (only affects this thread)
+
+		while (1) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> mlock(m_mutex);
+				while (jobs.empty() && !exiting) {m_condv.wait(mlock);}
+				if (jobs.empty()) return; // exiting
+				job = jobs.front();
+				jobs.pop_front();
+				++num_running;
+			}
+			job();
+			std::unique_lock<std::mutex> mlock(m_mutex);
+			--num_running;
+		}
+	}
+	void start_threads() { // Note: m_mutex must be held by the caller
+		if (!threads.empty()) return; // already started
+		for (unsigned i = 0; i < num_threads; ++i) {threads.push_back(std::thread(&worker_pool_t::worker_loop, this));}
+	}
+
+public:
+	worker_pool_t(unsigned num_threads_=0) : num_threads(num_threads_), num_running(0), exiting(0) {
+		if (num_threads == 0) {num_threads = std::max(1U, std::thread::hardware_concurrency()/2);} // leave half the cores for the main thread's OpenMP loops
+	}
+	~worker_pool_t() {
+		{
+			std::unique_lock<std::mutex> mlock(m_mutex);
+			exiting = 1;
+			jobs.clear(); // drop any jobs that haven't been started
+		}
+		m_condv.notify_all();
+		for (auto i = threads.begin(); i != threads.end(); ++i) {i->join();}
+	}
+	void add_job(std::function<void()> const &job) {
+		{
+			std::unique_lock<std::mutex> mlock(m_mutex);
+			start_threads();
+			jobs.push_back(job);
+		}
+		m_condv.notify_one();
+	}
+	size_t num_pending_jobs() { // queued + running
+		std::unique_lock<std::mutex> mlock(m_mutex);
+		return (jobs.size() + num_running);
+	}
+	unsigned get_num_threads() const {return num_threads;}
+};
+
+
+#endif // _WORKER_POOL_H_
+